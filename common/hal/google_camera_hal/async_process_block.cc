@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_AsyncProcessBlock"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <cutils/native_handle.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include "async_process_block.h"
+#include "result_processor.h"
+
+namespace android {
+namespace google_camera_hal {
+
+namespace {
+// Copy the request without cloning the acquire fences of the buffers.
+void CopyCaptureRequest(const CaptureRequest& request, CaptureRequest* copy) {
+  copy->frame_number = request.frame_number;
+  if (request.settings != nullptr) {
+    copy->settings = HalCameraMetadata::Clone(request.settings.get());
+  }
+
+  for (auto& metadata : request.input_buffer_metadata) {
+    copy->input_buffer_metadata.push_back(
+        HalCameraMetadata::Clone(metadata.get()));
+  }
+
+  for (auto& [camera_id, physical_settings] :
+       request.physical_camera_settings) {
+    copy->physical_camera_settings[camera_id] =
+        HalCameraMetadata::Clone(physical_settings.get());
+  }
+
+  copy->input_buffers = request.input_buffers;
+  copy->output_buffers = request.output_buffers;
+}
+}  // namespace
+
+AsyncProcessBlock::QueuedRequests::~QueuedRequests() {
+  for (auto buffers : GetBufferLists()) {
+    for (auto& buffer : *buffers) {
+      if (buffer.acquire_fence != nullptr) {
+        auto fence = const_cast<native_handle_t*>(buffer.acquire_fence);
+        native_handle_close(fence);
+        native_handle_delete(fence);
+        buffer.acquire_fence = nullptr;
+      }
+    }
+  }
+}
+
+status_t AsyncProcessBlock::QueuedRequests::CloneAcquireFences() {
+  status_t res = OK;
+  for (auto buffers : GetBufferLists()) {
+    for (auto& buffer : *buffers) {
+      if (buffer.acquire_fence == nullptr) {
+        continue;
+      }
+
+      // After a failure, the remaining fences are not cloned and must not be
+      // closed with the clones.
+      buffer.acquire_fence =
+          res == OK ? native_handle_clone(buffer.acquire_fence) : nullptr;
+      if (res == OK && buffer.acquire_fence == nullptr) {
+        ALOGE("%s: Cloning the acquire fence of stream %d failed.",
+              __FUNCTION__, buffer.stream_id);
+        res = NO_MEMORY;
+      }
+    }
+  }
+
+  return res;
+}
+
+std::vector<std::vector<StreamBuffer>*>
+AsyncProcessBlock::QueuedRequests::GetBufferLists() {
+  std::vector<std::vector<StreamBuffer>*> buffer_lists;
+  for (auto& block_request : process_block_requests) {
+    buffer_lists.push_back(&block_request.request.input_buffers);
+    buffer_lists.push_back(&block_request.request.output_buffers);
+  }
+  buffer_lists.push_back(&remaining_session_request.input_buffers);
+  buffer_lists.push_back(&remaining_session_request.output_buffers);
+  return buffer_lists;
+}
+
+std::unique_ptr<AsyncProcessBlock> AsyncProcessBlock::Create(
+    std::unique_ptr<ProcessBlock> process_block, const std::string& name,
+    uint32_t max_queue_depth) {
+  ATRACE_CALL();
+  if (process_block == nullptr) {
+    ALOGE("%s: process_block is nullptr.", __FUNCTION__);
+    return nullptr;
+  }
+
+  auto boundary = AsyncStageBoundary::Create(name, max_queue_depth);
+  if (boundary == nullptr) {
+    ALOGE("%s: Creating AsyncStageBoundary failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  auto block = std::unique_ptr<AsyncProcessBlock>(
+      new AsyncProcessBlock(std::move(process_block), std::move(boundary)));
+  if (block == nullptr) {
+    ALOGE("%s: Creating AsyncProcessBlock failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  return block;
+}
+
+AsyncProcessBlock::AsyncProcessBlock(
+    std::unique_ptr<ProcessBlock> process_block,
+    std::unique_ptr<AsyncStageBoundary> boundary)
+    : process_block_(std::move(process_block)), boundary_(std::move(boundary)) {
+}
+
+status_t AsyncProcessBlock::ConfigureStreams(
+    const StreamConfiguration& stream_config,
+    const StreamConfiguration& overall_config) {
+  return process_block_->ConfigureStreams(stream_config, overall_config);
+}
+
+status_t AsyncProcessBlock::SetResultProcessor(
+    std::unique_ptr<ResultProcessor> result_processor) {
+  ResultProcessor* processor = result_processor.get();
+  status_t res =
+      process_block_->SetResultProcessor(std::move(result_processor));
+  if (res != OK) {
+    return res;
+  }
+
+  std::lock_guard<std::mutex> lock(result_processor_lock_);
+  result_processor_ = processor;
+  return OK;
+}
+
+status_t AsyncProcessBlock::GetConfiguredHalStreams(
+    std::vector<HalStream>* hal_streams) const {
+  return process_block_->GetConfiguredHalStreams(hal_streams);
+}
+
+status_t AsyncProcessBlock::ProcessRequests(
+    const std::vector<ProcessBlockRequest>& process_block_requests,
+    const CaptureRequest& remaining_session_request) {
+  ATRACE_CALL();
+  std::vector<ProcessBlockRequest> copies(process_block_requests.size());
+  for (uint32_t i = 0; i < process_block_requests.size(); i++) {
+    auto& block_request = process_block_requests[i];
+    copies[i].request_id = block_request.request_id;
+    copies[i].shared_settings = block_request.shared_settings;
+    copies[i].shared_input_buffer_metadata =
+        block_request.shared_input_buffer_metadata;
+    CopyCaptureRequest(block_request.request, &copies[i].request);
+  }
+
+  CaptureRequest remaining_copy;
+  CopyCaptureRequest(remaining_session_request, &remaining_copy);
+  return ProcessOwnedRequests(std::move(copies), std::move(remaining_copy));
+}
+
+status_t AsyncProcessBlock::ProcessOwnedRequests(
+    std::vector<ProcessBlockRequest> process_block_requests,
+    CaptureRequest remaining_session_request) {
+  ATRACE_CALL();
+  // std::function must be copyable, so the requests are held by a
+  // shared_ptr.
+  auto queued_requests = std::make_shared<QueuedRequests>();
+  queued_requests->process_block_requests = std::move(process_block_requests);
+  queued_requests->remaining_session_request =
+      std::move(remaining_session_request);
+  status_t res = queued_requests->CloneAcquireFences();
+  if (res != OK) {
+    ALOGE("%s: Cloning the acquire fences of frame %u failed.", __FUNCTION__,
+          queued_requests->remaining_session_request.frame_number);
+    return res;
+  }
+
+  return boundary_->Enqueue([this, queued_requests]() {
+    status_t res = process_block_->ProcessRequests(
+        queued_requests->process_block_requests,
+        queued_requests->remaining_session_request);
+    if (res != OK) {
+      ALOGE("%s: %s: Processing requests for frame %u failed: %s(%d)",
+            __FUNCTION__, boundary_->GetName().c_str(),
+            queued_requests->remaining_session_request.frame_number,
+            strerror(-res), res);
+      ReturnRequestsWithError(*queued_requests);
+    }
+  });
+}
+
+void AsyncProcessBlock::ReturnRequestsWithError(
+    const QueuedRequests& queued_requests) {
+  ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(result_processor_lock_);
+  if (result_processor_ == nullptr) {
+    ALOGE("%s: result processor was not set.", __FUNCTION__);
+    return;
+  }
+
+  for (auto& block_request : queued_requests.process_block_requests) {
+    auto& request = block_request.request;
+    // Notify the buffer errors before the buffers are returned.
+    for (auto& buffer : request.output_buffers) {
+      const NotifyMessage message = {
+          .type = MessageType::kError,
+          .message.error = {.frame_number = request.frame_number,
+                            .error_stream_id = buffer.stream_id,
+                            .error_code = ErrorCode::kErrorBuffer}};
+      result_processor_->Notify(
+          {.request_id = block_request.request_id, .message = message});
+    }
+
+    // The acquire fences are closed with the queued requests.
+    auto result = std::make_unique<CaptureResult>();
+    result->frame_number = request.frame_number;
+    result->output_buffers = request.output_buffers;
+    for (auto& buffer : result->output_buffers) {
+      buffer.status = BufferStatus::kError;
+      buffer.acquire_fence = nullptr;
+      buffer.release_fence = nullptr;
+    }
+
+    result->input_buffers = request.input_buffers;
+    for (auto& buffer : result->input_buffers) {
+      buffer.acquire_fence = nullptr;
+      buffer.release_fence = nullptr;
+    }
+
+    result_processor_->ProcessResult(
+        {.request_id = block_request.request_id, .result = std::move(result)});
+  }
+}
+
+status_t AsyncProcessBlock::Flush() {
+  ATRACE_CALL();
+  boundary_->Drain();
+  return process_block_->Flush();
+}
+
+AsyncStageBoundary::Stats AsyncProcessBlock::GetStageStats() {
+  return boundary_->GetStats();
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_ASYNC_PROCESS_BLOCK_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_ASYNC_PROCESS_BLOCK_H_
+
+#include <mutex>
+
+#include "async_stage_boundary.h"
+#include "process_block.h"
+
+namespace android {
+namespace google_camera_hal {
+
+// AsyncProcessBlock implements a ProcessBlock that inserts an
+// AsyncStageBoundary in front of another process block. ProcessRequests()
+// returns once the requests are queued. The wrapped process block processes
+// them on the boundary's worker thread. If it fails, the buffers of the
+// requests are returned to the result processor with ERROR_BUFFER notifies.
+class AsyncProcessBlock : public ProcessBlock {
+ public:
+  // Create an AsyncProcessBlock that forwards requests to process_block
+  // through a boundary with up to max_queue_depth queued requests.
+  static std::unique_ptr<AsyncProcessBlock> Create(
+      std::unique_ptr<ProcessBlock> process_block, const std::string& name,
+      uint32_t max_queue_depth);
+
+  virtual ~AsyncProcessBlock() = default;
+
+  // Override functions of ProcessBlock start.
+  status_t ConfigureStreams(const StreamConfiguration& stream_config,
+                            const StreamConfiguration& overall_config) override;
+
+  status_t SetResultProcessor(
+      std::unique_ptr<ResultProcessor> result_processor) override;
+
+  status_t GetConfiguredHalStreams(
+      std::vector<HalStream>* hal_streams) const override;
+
+  // Copy the requests and queue them with ProcessOwnedRequests().
+  status_t ProcessRequests(
+      const std::vector<ProcessBlockRequest>& process_block_requests,
+      const CaptureRequest& remaining_session_request) override;
+
+  // Queue the requests for the wrapped process block. The acquire fences of
+  // the buffers are cloned, so the caller keeps ownership of its fences.
+  status_t ProcessOwnedRequests(
+      std::vector<ProcessBlockRequest> process_block_requests,
+      CaptureRequest remaining_session_request) override;
+
+  // Wait for the queued requests to reach the wrapped process block and then
+  // flush it.
+  status_t Flush() override;
+  // Override functions of ProcessBlock end.
+
+  // Return the queue statistics of the boundary.
+  AsyncStageBoundary::Stats GetStageStats();
+
+ protected:
+  AsyncProcessBlock(std::unique_ptr<ProcessBlock> process_block,
+                    std::unique_ptr<AsyncStageBoundary> boundary);
+
+ private:
+  // Requests queued for the worker thread. The acquire fences are clones
+  // owned by QueuedRequests.
+  struct QueuedRequests {
+    std::vector<ProcessBlockRequest> process_block_requests;
+    CaptureRequest remaining_session_request;
+
+    ~QueuedRequests();
+
+    // Replace the acquire fences with clones.
+    status_t CloneAcquireFences();
+
+    // Return all buffer lists of the requests.
+    std::vector<std::vector<StreamBuffer>*> GetBufferLists();
+  };
+
+  // Notify ERROR_BUFFER for the output buffers of the requests and return
+  // their buffers to the result processor.
+  void ReturnRequestsWithError(const QueuedRequests& queued_requests);
+
+  std::unique_ptr<ProcessBlock> process_block_;
+
+  std::mutex result_processor_lock_;
+
+  // Owned by process_block_. Protected by result_processor_lock_.
+  ResultProcessor* result_processor_ = nullptr;
+
+  // Declared after process_block_ so the queued requests are processed
+  // before process_block_ is destroyed.
+  std::unique_ptr<AsyncStageBoundary> boundary_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_ASYNC_PROCESS_BLOCK_H_
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_AsyncStageBoundary"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <inttypes.h>
+
+#include <algorithm>
+
+#include "async_stage_boundary.h"
+
+namespace android {
+namespace google_camera_hal {
+
+std::unique_ptr<AsyncStageBoundary> AsyncStageBoundary::Create(
+    const std::string& name, uint32_t max_queue_depth) {
+  ATRACE_CALL();
+  if (max_queue_depth == 0) {
+    ALOGE("%s: %s: max_queue_depth must be at least 1.", __FUNCTION__,
+          name.c_str());
+    return nullptr;
+  }
+
+  auto boundary = std::unique_ptr<AsyncStageBoundary>(
+      new AsyncStageBoundary(name, max_queue_depth));
+  if (boundary == nullptr) {
+    ALOGE("%s: Creating AsyncStageBoundary failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  return boundary;
+}
+
+AsyncStageBoundary::AsyncStageBoundary(const std::string& name,
+                                       uint32_t max_queue_depth)
+    : kName(name),
+      kMaxQueueDepth(max_queue_depth),
+      kQueueDepthCounterName(name + " queue depth"),
+      queue_(max_queue_depth) {
+  worker_thread_ = std::thread([this] { WorkerThreadLoop(); });
+}
+
+AsyncStageBoundary::~AsyncStageBoundary() {
+  ATRACE_CALL();
+  {
+    std::lock_guard<std::mutex> lock(queue_lock_);
+    worker_thread_exiting_ = true;
+  }
+  task_enqueued_condition_.notify_one();
+  worker_thread_.join();
+
+  Stats stats = GetStats();
+  if (stats.completed_tasks > 0) {
+    nsecs_t completed_tasks = stats.completed_tasks;
+    ALOGI("%s: %s: %" PRIu64 " tasks completed. Max queue depth %u, average "
+          "wait %" PRId64 " us (max %" PRId64 " us), average run time %" PRId64
+          " us, blocked %" PRId64 " us in total.",
+          __FUNCTION__, kName.c_str(), stats.completed_tasks,
+          stats.max_queue_depth,
+          ns2us(stats.total_wait_latency / completed_tasks),
+          ns2us(stats.max_wait_latency),
+          ns2us(stats.total_run_time / completed_tasks),
+          ns2us(stats.total_blocked_time));
+  }
+}
+
+status_t AsyncStageBoundary::Enqueue(Task task) {
+  ATRACE_CALL();
+  if (task == nullptr) {
+    ALOGE("%s: %s: task is nullptr.", __FUNCTION__, kName.c_str());
+    return BAD_VALUE;
+  }
+
+  std::unique_lock<std::mutex> lock(queue_lock_);
+  if (queue_size_ == kMaxQueueDepth) {
+    nsecs_t blocked_time = systemTime();
+    task_dequeued_condition_.wait(lock, [this] {
+      return queue_size_ < kMaxQueueDepth || worker_thread_exiting_;
+    });
+    stats_.total_blocked_time += systemTime() - blocked_time;
+  }
+
+  if (worker_thread_exiting_) {
+    ALOGE("%s: %s: The worker thread is exiting.", __FUNCTION__,
+          kName.c_str());
+    return DEAD_OBJECT;
+  }
+
+  queue_[(queue_head_ + queue_size_) % kMaxQueueDepth] = {
+      .task = std::move(task), .enqueue_time = systemTime()};
+  queue_size_++;
+  stats_.queue_depth = queue_size_;
+  stats_.max_queue_depth = std::max(stats_.max_queue_depth, stats_.queue_depth);
+  ATRACE_INT(kQueueDepthCounterName.c_str(), queue_size_);
+  task_enqueued_condition_.notify_one();
+  return OK;
+}
+
+void AsyncStageBoundary::Drain() {
+  ATRACE_CALL();
+  std::unique_lock<std::mutex> lock(queue_lock_);
+  task_dequeued_condition_.wait(
+      lock, [this] { return queue_size_ == 0 && !task_running_; });
+}
+
+AsyncStageBoundary::Stats AsyncStageBoundary::GetStats() {
+  std::lock_guard<std::mutex> lock(queue_lock_);
+  return stats_;
+}
+
+const std::string& AsyncStageBoundary::GetName() const {
+  return kName;
+}
+
+void AsyncStageBoundary::WorkerThreadLoop() {
+  std::unique_lock<std::mutex> lock(queue_lock_);
+  while (true) {
+    task_enqueued_condition_.wait(
+        lock, [this] { return queue_size_ > 0 || worker_thread_exiting_; });
+    if (queue_size_ == 0) {
+      // Exit once all enqueued tasks have run.
+      return;
+    }
+
+    QueuedTask queued_task = std::move(queue_[queue_head_]);
+    queue_[queue_head_] = {};
+    queue_head_ = (queue_head_ + 1) % kMaxQueueDepth;
+    queue_size_--;
+    task_running_ = true;
+
+    nsecs_t start_time = systemTime();
+    nsecs_t wait_latency = start_time - queued_task.enqueue_time;
+    stats_.queue_depth = queue_size_;
+    stats_.total_wait_latency += wait_latency;
+    stats_.max_wait_latency = std::max(stats_.max_wait_latency, wait_latency);
+    ATRACE_INT(kQueueDepthCounterName.c_str(), queue_size_);
+    lock.unlock();
+    task_dequeued_condition_.notify_all();
+
+    queued_task.task();
+    nsecs_t run_time = systemTime() - start_time;
+    // Release what the task holds before taking the lock.
+    queued_task = {};
+
+    lock.lock();
+    task_running_ = false;
+    stats_.completed_tasks++;
+    stats_.total_run_time += run_time;
+    task_dequeued_condition_.notify_all();
+  }
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
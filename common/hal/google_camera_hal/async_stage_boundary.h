@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_ASYNC_STAGE_BOUNDARY_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_ASYNC_STAGE_BOUNDARY_H_
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+// AsyncStageBoundary runs the work of a process chain stage on its own worker
+// thread, so the preceding stage doesn't wait for it. Tasks run in the order
+// they are enqueued. The queue is bounded: Enqueue() blocks while the queue is
+// full, which slows down the preceding stage instead of letting the queue grow
+// without bound.
+class AsyncStageBoundary {
+ public:
+  using Task = std::function<void()>;
+
+  struct Stats {
+    // Number of tasks waiting in the queue.
+    uint32_t queue_depth = 0;
+    uint32_t max_queue_depth = 0;
+    // Number of tasks that have run.
+    uint64_t completed_tasks = 0;
+    // Time from enqueuing a task to starting it.
+    nsecs_t total_wait_latency = 0;
+    nsecs_t max_wait_latency = 0;
+    // Time spent running tasks.
+    nsecs_t total_run_time = 0;
+    // Time Enqueue() was blocked by a full queue.
+    nsecs_t total_blocked_time = 0;
+  };
+
+  // Create an AsyncStageBoundary. name identifies the stage in logs and
+  // traces. max_queue_depth is the maximum number of tasks waiting to run.
+  static std::unique_ptr<AsyncStageBoundary> Create(const std::string& name,
+                                                    uint32_t max_queue_depth);
+
+  // Run the remaining tasks and stop the worker thread.
+  virtual ~AsyncStageBoundary();
+
+  // Enqueue a task to run on the worker thread. Blocks while the queue is
+  // full. Must not be called from a task of the same boundary.
+  status_t Enqueue(Task task);
+
+  // Wait until all enqueued tasks have run. Must not be called from a task of
+  // the same boundary.
+  void Drain();
+
+  Stats GetStats();
+
+  const std::string& GetName() const;
+
+ protected:
+  AsyncStageBoundary(const std::string& name, uint32_t max_queue_depth);
+
+ private:
+  struct QueuedTask {
+    Task task;
+    nsecs_t enqueue_time = 0;
+  };
+
+  // Run the enqueued tasks until the boundary is destroyed.
+  void WorkerThreadLoop();
+
+  const std::string kName;
+  const uint32_t kMaxQueueDepth;
+  // Name of the trace counter of the queue depth.
+  const std::string kQueueDepthCounterName;
+
+  std::mutex queue_lock_;
+
+  // Notified when a task is enqueued or the boundary is destroyed.
+  std::condition_variable task_enqueued_condition_;
+
+  // Notified when a task is dequeued or has run.
+  std::condition_variable task_dequeued_condition_;
+
+  // Ring buffer of kMaxQueueDepth tasks. queue_head_ is the index of the
+  // oldest task. Producers are serialized by queue_lock_ since chain stages
+  // may be called from more than one thread. Must be protected by
+  // queue_lock_.
+  std::vector<QueuedTask> queue_;
+  size_t queue_head_ = 0;
+  size_t queue_size_ = 0;
+
+  // Whether the worker thread is running a task. Must be protected by
+  // queue_lock_.
+  bool task_running_ = false;
+
+  // Whether the worker thread should exit once the queue is empty. Must be
+  // protected by queue_lock_.
+  bool worker_thread_exiting_ = false;
+
+  // Must be protected by queue_lock_.
+  Stats stats_;
+
+  std::thread worker_thread_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_ASYNC_STAGE_BOUNDARY_H_
@@ -24,6 +24,7 @@
 #include <utils/Trace.h>
 
 #include "basic_capture_session.h"
+#include "cached_buffer_allocator.h"
 #include "dual_ir_capture_session.h"
 #include "hal_utils.h"
 #include "hdrplus_capture_session.h"
@@ -51,6 +52,8 @@ std::vector<CaptureSessionEntryFuncs>
              BasicCaptureSession::IsStreamConfigurationSupported,
          .CreateSession = BasicCaptureSession::Create}};
 
+std::atomic<uint32_t> CameraDeviceSession::num_sessions_ = 0;
+
 std::unique_ptr<CameraDeviceSession> CameraDeviceSession::Create(
     std::unique_ptr<CameraDeviceSessionHwl> device_session_hwl,
     std::vector<GetCaptureSessionFactoryFunc> external_session_factory_entries,
@@ -71,6 +74,7 @@ std::unique_ptr<CameraDeviceSession> CameraDeviceSession::Create(
     ALOGE("%s: Creating CameraDeviceSession failed.", __FUNCTION__);
     return nullptr;
   }
+  num_sessions_++;
 
   status_t res =
       session->Initialize(std::move(device_session_hwl), camera_allocator_hwl,
@@ -504,6 +508,12 @@ CameraDeviceSession::~CameraDeviceSession() {
     FreeImportedBufferHandles<android::hardware::graphics::mapper::V2_0::IMapper>(
         buffer_mapper_v2_);
   }
+
+  // Release the buffers cached for stream configurations once no session is
+  // left to reuse them.
+  if (--num_sessions_ == 0) {
+    CachedBufferAllocator::ClearProcessInstances();
+  }
 }
 
 void CameraDeviceSession::UnregisterThermalCallback() {
@@ -726,8 +736,85 @@ status_t CameraDeviceSession::ConfigureStreams(
   return OK;
 }
 
-status_t CameraDeviceSession::UpdateBufferHandlesLocked(
-    std::vector<StreamBuffer>* buffers) {
+buffer_handle_t CameraDeviceSession::GetImportedBufferHandle(
+    const ImportedBufferTable& table, int32_t stream_id, uint64_t buffer_id) {
+  auto stream_it = table.find(stream_id);
+  if (stream_it == table.end()) {
+    return nullptr;
+  }
+
+  const ImportedStreamBuffers& stream_buffers = stream_it->second;
+  if (buffer_id >= stream_buffers.base_buffer_id &&
+      buffer_id - stream_buffers.base_buffer_id < kMaxDenseBufferHandles) {
+    uint64_t index = buffer_id - stream_buffers.base_buffer_id;
+    return index < stream_buffers.dense_handles.size()
+               ? stream_buffers.dense_handles[index]
+               : nullptr;
+  }
+
+  auto buffer_it = stream_buffers.sparse_handles.find(buffer_id);
+  if (buffer_it == stream_buffers.sparse_handles.end()) {
+    return nullptr;
+  }
+
+  return buffer_it->second;
+}
+
+void CameraDeviceSession::SetImportedBufferHandle(
+    ImportedBufferTable* table, int32_t stream_id, uint64_t buffer_id,
+    buffer_handle_t buffer_handle) {
+  auto stream_it = table->find(stream_id);
+  if (stream_it == table->end()) {
+    if (buffer_handle == nullptr) {
+      return;
+    }
+
+    // The first imported buffer of a stream decides the dense range.
+    stream_it = table->emplace(stream_id, ImportedStreamBuffers{}).first;
+    stream_it->second.base_buffer_id = buffer_id;
+  }
+
+  ImportedStreamBuffers& stream_buffers = stream_it->second;
+  if (buffer_id >= stream_buffers.base_buffer_id &&
+      buffer_id - stream_buffers.base_buffer_id < kMaxDenseBufferHandles) {
+    uint64_t index = buffer_id - stream_buffers.base_buffer_id;
+    if (index >= stream_buffers.dense_handles.size()) {
+      if (buffer_handle == nullptr) {
+        return;
+      }
+      stream_buffers.dense_handles.resize(index + 1, nullptr);
+    }
+    stream_buffers.dense_handles[index] = buffer_handle;
+
+    while (!stream_buffers.dense_handles.empty() &&
+           stream_buffers.dense_handles.back() == nullptr) {
+      stream_buffers.dense_handles.pop_back();
+    }
+  } else if (buffer_handle != nullptr) {
+    stream_buffers.sparse_handles[buffer_id] = buffer_handle;
+  } else {
+    stream_buffers.sparse_handles.erase(buffer_id);
+  }
+
+  if (stream_buffers.dense_handles.empty() &&
+      stream_buffers.sparse_handles.empty()) {
+    table->erase(stream_it);
+  }
+}
+
+std::shared_ptr<const CameraDeviceSession::ImportedBufferTable>
+CameraDeviceSession::GetImportedBufferTable() const {
+  return std::atomic_load(&imported_buffer_table_);
+}
+
+void CameraDeviceSession::PublishImportedBufferTableLocked(
+    ImportedBufferTable table) {
+  auto new_table = std::make_shared<const ImportedBufferTable>(std::move(table));
+  std::atomic_store(&imported_buffer_table_, std::move(new_table));
+}
+
+status_t CameraDeviceSession::UpdateBufferHandles(
+    const ImportedBufferTable& table, std::vector<StreamBuffer>* buffers) {
   ATRACE_CALL();
   if (buffers == nullptr) {
     ALOGE("%s: buffers cannot be nullptr", __FUNCTION__);
@@ -735,16 +822,16 @@ status_t CameraDeviceSession::UpdateBufferHandlesLocked(
   }
 
   for (auto& buffer : *buffers) {
-    // Get the buffer handle from buffer handle map.
-    BufferCache buffer_cache = {buffer.stream_id, buffer.buffer_id};
-    auto buffer_handle_it = imported_buffer_handle_map_.find(buffer_cache);
-    if (buffer_handle_it == imported_buffer_handle_map_.end()) {
+    // Get the buffer handle from the imported buffer table.
+    buffer_handle_t buffer_handle =
+        GetImportedBufferHandle(table, buffer.stream_id, buffer.buffer_id);
+    if (buffer_handle == nullptr) {
       ALOGE("%s: Cannot find buffer handle for stream %u, buffer %" PRIu64,
             __FUNCTION__, buffer.stream_id, buffer.buffer_id);
       return NAME_NOT_FOUND;
     }
 
-    buffer.buffer = buffer_handle_it->second;
+    buffer.buffer = buffer_handle;
   }
 
   return OK;
@@ -794,16 +881,17 @@ status_t CameraDeviceSession::CreateCaptureRequestLocked(
   // If buffer management API is supported, buffers will be requested via
   // RequestStreamBuffersFunc.
   if (!buffer_management_supported_) {
-    std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
+    std::shared_ptr<const ImportedBufferTable> table = GetImportedBufferTable();
 
-    status_t res = UpdateBufferHandlesLocked(&updated_request->input_buffers);
+    status_t res =
+        UpdateBufferHandles(*table, &updated_request->input_buffers);
     if (res != OK) {
       ALOGE("%s: Updating input buffer handles failed: %s(%d)", __FUNCTION__,
             strerror(-res), res);
       return res;
     }
 
-    res = UpdateBufferHandlesLocked(&updated_request->output_buffers);
+    res = UpdateBufferHandles(*table, &updated_request->output_buffers);
     if (res != OK) {
       ALOGE("%s: Updating output buffer handles failed: %s(%d)", __FUNCTION__,
             strerror(-res), res);
@@ -818,7 +906,8 @@ status_t CameraDeviceSession::CreateCaptureRequestLocked(
 
 template <class T, class U>
 status_t CameraDeviceSession::ImportBufferHandleLocked(
-    const sp<T> buffer_mapper, const StreamBuffer& buffer) {
+    const sp<T> buffer_mapper, const StreamBuffer& buffer,
+    ImportedBufferTable* table) {
   ATRACE_CALL();
   U mapper_error;
   buffer_handle_t imported_buffer_handle;
@@ -836,45 +925,68 @@ status_t CameraDeviceSession::ImportBufferHandleLocked(
   }
 
   BufferCache buffer_cache = {buffer.stream_id, buffer.buffer_id};
-  return AddImportedBufferHandlesLocked(buffer_cache, imported_buffer_handle);
+  return AddImportedBufferHandlesLocked(buffer_cache, imported_buffer_handle,
+                                        table);
 }
 
 status_t CameraDeviceSession::ImportBufferHandles(
     const std::vector<StreamBuffer>& buffers) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
+
+  // Most requests only contain buffers that have been imported. Check them
+  // without taking imported_buffer_handles_lock_.
+  bool all_imported = true;
+  for (auto& buffer : buffers) {
+    if (!IsBufferImported(buffer.stream_id, buffer.buffer_id)) {
+      all_imported = false;
+      break;
+    }
+  }
+
+  if (all_imported) {
+    return OK;
+  }
+
+  std::lock_guard<std::mutex> lock(imported_buffer_handles_lock_);
+  ImportedBufferTable table = *GetImportedBufferTable();
 
   // Import buffers that are new to HAL.
+  status_t res = OK;
   for (auto& buffer : buffers) {
-    if (!IsBufferImportedLocked(buffer.stream_id, buffer.buffer_id)) {
-      status_t res = OK;
-      if (buffer_mapper_v4_ != nullptr) {
-        res = ImportBufferHandleLocked<
-            android::hardware::graphics::mapper::V4_0::IMapper,
-            android::hardware::graphics::mapper::V4_0::Error>(buffer_mapper_v4_,
-                                                              buffer);
-      } else if (buffer_mapper_v3_ != nullptr) {
-        res = ImportBufferHandleLocked<
-            android::hardware::graphics::mapper::V3_0::IMapper,
-            android::hardware::graphics::mapper::V3_0::Error>(buffer_mapper_v3_,
-                                                              buffer);
-      } else {
-        res = ImportBufferHandleLocked<
-            android::hardware::graphics::mapper::V2_0::IMapper,
-            android::hardware::graphics::mapper::V2_0::Error>(buffer_mapper_v2_,
-                                                              buffer);
-      }
+    if (GetImportedBufferHandle(table, buffer.stream_id, buffer.buffer_id) !=
+        nullptr) {
+      continue;
+    }
 
-      if (res != OK) {
-        ALOGE("%s: Importing buffer %" PRIu64 " from stream %d failed: %s(%d)",
-              __FUNCTION__, buffer.buffer_id, buffer.stream_id, strerror(-res),
-              res);
-        return res;
-      }
+    if (buffer_mapper_v4_ != nullptr) {
+      res = ImportBufferHandleLocked<
+          android::hardware::graphics::mapper::V4_0::IMapper,
+          android::hardware::graphics::mapper::V4_0::Error>(buffer_mapper_v4_,
+                                                            buffer, &table);
+    } else if (buffer_mapper_v3_ != nullptr) {
+      res = ImportBufferHandleLocked<
+          android::hardware::graphics::mapper::V3_0::IMapper,
+          android::hardware::graphics::mapper::V3_0::Error>(buffer_mapper_v3_,
+                                                            buffer, &table);
+    } else {
+      res = ImportBufferHandleLocked<
+          android::hardware::graphics::mapper::V2_0::IMapper,
+          android::hardware::graphics::mapper::V2_0::Error>(buffer_mapper_v2_,
+                                                            buffer, &table);
+    }
+
+    if (res != OK) {
+      ALOGE("%s: Importing buffer %" PRIu64 " from stream %d failed: %s(%d)",
+            __FUNCTION__, buffer.buffer_id, buffer.stream_id, strerror(-res),
+            res);
+      break;
     }
   }
 
-  return OK;
+  // Publish the buffers imported so far even if importing failed so they can
+  // be freed later.
+  PublishImportedBufferTableLocked(std::move(table));
+  return res;
 }
 
 status_t CameraDeviceSession::ImportRequestBufferHandles(
@@ -1268,25 +1380,27 @@ status_t CameraDeviceSession::ProcessCaptureRequest(
   return OK;
 }
 
-bool CameraDeviceSession::IsBufferImportedLocked(int32_t stream_id,
-                                                 uint32_t buffer_id) {
-  BufferCache buffer_cache = {stream_id, buffer_id};
-  return imported_buffer_handle_map_.find(buffer_cache) !=
-         imported_buffer_handle_map_.end();
+bool CameraDeviceSession::IsBufferImported(int32_t stream_id,
+                                           uint64_t buffer_id) const {
+  std::shared_ptr<const ImportedBufferTable> table = GetImportedBufferTable();
+  return GetImportedBufferHandle(*table, stream_id, buffer_id) != nullptr;
 }
 
 status_t CameraDeviceSession::AddImportedBufferHandlesLocked(
-    const BufferCache& buffer_cache, buffer_handle_t buffer_handle) {
+    const BufferCache& buffer_cache, buffer_handle_t buffer_handle,
+    ImportedBufferTable* table) {
   ATRACE_CALL();
-  auto buffer_handle_it = imported_buffer_handle_map_.find(buffer_cache);
-  if (buffer_handle_it == imported_buffer_handle_map_.end()) {
+  buffer_handle_t imported_buffer_handle = GetImportedBufferHandle(
+      *table, buffer_cache.stream_id, buffer_cache.buffer_id);
+  if (imported_buffer_handle == nullptr) {
     // Add a new buffer cache if it doesn't exist.
-    imported_buffer_handle_map_.emplace(buffer_cache, buffer_handle);
-  } else if (buffer_handle_it->second != buffer_handle) {
+    SetImportedBufferHandle(table, buffer_cache.stream_id,
+                            buffer_cache.buffer_id, buffer_handle);
+  } else if (imported_buffer_handle != buffer_handle) {
     ALOGE(
         "%s: Cached buffer handle %p doesn't match %p for stream %u buffer "
         "%" PRIu64,
-        __FUNCTION__, buffer_handle_it->second, buffer_handle,
+        __FUNCTION__, imported_buffer_handle, buffer_handle,
         buffer_cache.stream_id, buffer_cache.buffer_id);
     return BAD_VALUE;
   }
@@ -1297,19 +1411,21 @@ status_t CameraDeviceSession::AddImportedBufferHandlesLocked(
 void CameraDeviceSession::RemoveBufferCache(
     const std::vector<BufferCache>& buffer_caches) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
+  std::lock_guard<std::mutex> lock(imported_buffer_handles_lock_);
+  ImportedBufferTable table = *GetImportedBufferTable();
 
   for (auto& buffer_cache : buffer_caches) {
-    auto buffer_handle_it = imported_buffer_handle_map_.find(buffer_cache);
-    if (buffer_handle_it == imported_buffer_handle_map_.end()) {
+    buffer_handle_t buffer_handle = GetImportedBufferHandle(
+        table, buffer_cache.stream_id, buffer_cache.buffer_id);
+    if (buffer_handle == nullptr) {
       ALOGW("%s: Could not find buffer cache for stream %u buffer %" PRIu64,
             __FUNCTION__, buffer_cache.stream_id, buffer_cache.buffer_id);
       continue;
     }
 
-    auto free_buffer_mapper = [&buffer_handle_it](auto buffer_mapper) {
+    auto free_buffer_mapper = [buffer_handle](auto buffer_mapper) {
       auto hidl_res = buffer_mapper->freeBuffer(
-          const_cast<native_handle_t*>(buffer_handle_it->second));
+          const_cast<native_handle_t*>(buffer_handle));
       if (!hidl_res.isOk()) {
         ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
               hidl_res.description().c_str());
@@ -1322,51 +1438,68 @@ void CameraDeviceSession::RemoveBufferCache(
       free_buffer_mapper(buffer_mapper_v3_);
     } else {
       free_buffer_mapper(buffer_mapper_v2_);
-      ;
     }
 
-    imported_buffer_handle_map_.erase(buffer_handle_it);
+    SetImportedBufferHandle(&table, buffer_cache.stream_id,
+                            buffer_cache.buffer_id, /*buffer_handle=*/nullptr);
   }
+
+  PublishImportedBufferTableLocked(std::move(table));
 }
 
 template <class T>
 void CameraDeviceSession::FreeBufferHandlesLocked(const sp<T> buffer_mapper,
-                                                  int32_t stream_id) {
-  for (auto buffer_handle_it = imported_buffer_handle_map_.begin();
-       buffer_handle_it != imported_buffer_handle_map_.end();) {
-    if (buffer_handle_it->first.stream_id == stream_id) {
-      auto hidl_res = buffer_mapper->freeBuffer(
-          const_cast<native_handle_t*>(buffer_handle_it->second));
-      if (!hidl_res.isOk()) {
-        ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
-              hidl_res.description().c_str());
-      }
-      buffer_handle_it = imported_buffer_handle_map_.erase(buffer_handle_it);
-    } else {
-      buffer_handle_it++;
+                                                  int32_t stream_id,
+                                                  ImportedBufferTable* table) {
+  auto stream_it = table->find(stream_id);
+  if (stream_it == table->end()) {
+    return;
+  }
+
+  auto free_buffer_handle = [&buffer_mapper](buffer_handle_t buffer_handle) {
+    if (buffer_handle == nullptr) {
+      return;
     }
+
+    auto hidl_res =
+        buffer_mapper->freeBuffer(const_cast<native_handle_t*>(buffer_handle));
+    if (!hidl_res.isOk()) {
+      ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
+            hidl_res.description().c_str());
+    }
+  };
+
+  for (buffer_handle_t buffer_handle : stream_it->second.dense_handles) {
+    free_buffer_handle(buffer_handle);
   }
+
+  for (auto& [buffer_id, buffer_handle] : stream_it->second.sparse_handles) {
+    free_buffer_handle(buffer_handle);
+  }
+
+  table->erase(stream_it);
 }
 
 template <class T>
 void CameraDeviceSession::FreeImportedBufferHandles(const sp<T> buffer_mapper) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
+  std::lock_guard<std::mutex> lock(imported_buffer_handles_lock_);
 
   if (buffer_mapper == nullptr) {
     return;
   }
 
-  for (auto buffer_handle_it : imported_buffer_handle_map_) {
-    auto hidl_res = buffer_mapper->freeBuffer(
-        const_cast<native_handle_t*>(buffer_handle_it.second));
-    if (!hidl_res.isOk()) {
-      ALOGE("%s: Freeing imported buffer failed: %s", __FUNCTION__,
-            hidl_res.description().c_str());
-    }
+  ImportedBufferTable table = *GetImportedBufferTable();
+  std::vector<int32_t> stream_ids;
+  for (auto& [stream_id, stream_buffers] : table) {
+    stream_ids.push_back(stream_id);
   }
 
-  imported_buffer_handle_map_.clear();
+  for (int32_t stream_id : stream_ids) {
+    FreeBufferHandlesLocked(buffer_mapper, stream_id, &table);
+  }
+
+  PublishImportedBufferTableLocked(std::move(table));
 }
 
 void CameraDeviceSession::CleanupStaleStreamsLocked(
@@ -1382,18 +1515,20 @@ void CameraDeviceSession::CleanupStaleStreamsLocked(
       }
     }
     if (!found) {
-      std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
+      std::lock_guard<std::mutex> lock(imported_buffer_handles_lock_);
       stream_it = configured_streams_map_.erase(stream_it);
+      ImportedBufferTable table = *GetImportedBufferTable();
       if (buffer_mapper_v4_ != nullptr) {
         FreeBufferHandlesLocked<android::hardware::graphics::mapper::V4_0::IMapper>(
-            buffer_mapper_v4_, stream_id);
+            buffer_mapper_v4_, stream_id, &table);
       } else if (buffer_mapper_v3_ != nullptr) {
         FreeBufferHandlesLocked<android::hardware::graphics::mapper::V3_0::IMapper>(
-            buffer_mapper_v3_, stream_id);
+            buffer_mapper_v3_, stream_id, &table);
       } else {
         FreeBufferHandlesLocked<android::hardware::graphics::mapper::V2_0::IMapper>(
-            buffer_mapper_v2_, stream_id);
+            buffer_mapper_v2_, stream_id, &table);
       }
+      PublishImportedBufferTableLocked(std::move(table));
     } else {
       stream_it++;
     }
@@ -1491,24 +1626,45 @@ status_t CameraDeviceSession::UpdateRequestedBufferHandles(
     return BAD_VALUE;
   }
 
-  std::lock_guard<std::mutex> lock(imported_buffer_handle_map_lock_);
+  std::shared_ptr<const ImportedBufferTable> table = GetImportedBufferTable();
 
-  status_t res;
+  // If buffer handle is not nullptr, we need to add the new buffer handle
+  // to buffer cache.
+  bool has_new_buffers = false;
   for (auto& buffer : *buffers) {
-    // If buffer handle is not nullptr, we need to add the new buffer handle
-    // to buffer cache.
-    if (buffer.buffer != nullptr) {
-      BufferCache buffer_cache = {buffer.stream_id, buffer.buffer_id};
-      res = AddImportedBufferHandlesLocked(buffer_cache, buffer.buffer);
-      if (res != OK) {
-        ALOGE("%s: Adding imported buffer handle failed: %s(%d)", __FUNCTION__,
-              strerror(-res), res);
-        return res;
+    if (buffer.buffer != nullptr &&
+        GetImportedBufferHandle(*table, buffer.stream_id, buffer.buffer_id) !=
+            buffer.buffer) {
+      has_new_buffers = true;
+      break;
+    }
+  }
+
+  status_t res = OK;
+  if (has_new_buffers) {
+    std::lock_guard<std::mutex> lock(imported_buffer_handles_lock_);
+    ImportedBufferTable new_table = *GetImportedBufferTable();
+    for (auto& buffer : *buffers) {
+      if (buffer.buffer != nullptr) {
+        BufferCache buffer_cache = {buffer.stream_id, buffer.buffer_id};
+        res = AddImportedBufferHandlesLocked(buffer_cache, buffer.buffer,
+                                             &new_table);
+        if (res != OK) {
+          ALOGE("%s: Adding imported buffer handle failed: %s(%d)",
+                __FUNCTION__, strerror(-res), res);
+          break;
+        }
       }
     }
+
+    PublishImportedBufferTableLocked(std::move(new_table));
+    if (res != OK) {
+      return res;
+    }
+    table = GetImportedBufferTable();
   }
 
-  res = UpdateBufferHandlesLocked(buffers);
+  res = UpdateBufferHandles(*table, buffers);
   if (res != OK) {
     ALOGE("%s: Updating output buffer handles failed: %s(%d)", __FUNCTION__,
           strerror(-res), res);
@@ -20,9 +20,12 @@
 #include <android/hardware/graphics/mapper/2.0/IMapper.h>
 #include <android/hardware/graphics/mapper/3.0/IMapper.h>
 #include <android/hardware/graphics/mapper/4.0/IMapper.h>
+#include <atomic>
 #include <memory>
 #include <set>
 #include <shared_mutex>
+#include <unordered_map>
+#include <vector>
 
 #include "camera_buffer_allocator_hwl.h"
 #include "camera_device_session_hwl.h"
@@ -145,15 +148,9 @@ class CameraDeviceSession {
   CameraDeviceSession() = default;
 
  private:
-  // Define buffer cache hashing in order to use BufferCache as a key of an
-  // unordered map.
-  struct BufferCacheHashing {
-    unsigned long operator()(const BufferCache& buffer_cache) const {
-      std::string s = "s" + std::to_string(buffer_cache.stream_id) + "b" +
-                      std::to_string(buffer_cache.buffer_id);
-      return std::hash<std::string>{}(s);
-    }
-  };
+  // Maximum number of buffer handles per stream kept in the dense array of
+  // ImportedStreamBuffers.
+  static constexpr uint64_t kMaxDenseBufferHandles = 256;
 
   status_t Initialize(
       std::unique_ptr<CameraDeviceSessionHwl> device_session_hwl,
@@ -169,9 +166,43 @@ class CameraDeviceSession {
   // Initialize buffer management support.
   status_t InitializeBufferManagement(HalCameraMetadata* characteristics);
 
-  // Update all buffer handles in buffers with the imported buffer handles.
-  // Must be protected by imported_buffer_handle_map_lock_.
-  status_t UpdateBufferHandlesLocked(std::vector<StreamBuffer>* buffers);
+  // Imported buffer handles of a stream. The framework assigns buffer IDs
+  // monotonically, so most buffers are stored in dense_handles indexed by
+  // (buffer_id - base_buffer_id). Buffers that fall outside the dense range
+  // are stored in sparse_handles.
+  struct ImportedStreamBuffers {
+    uint64_t base_buffer_id = 0;
+    std::vector<buffer_handle_t> dense_handles;
+    std::unordered_map<uint64_t, buffer_handle_t> sparse_handles;
+  };
+
+  // Map from a stream ID to the imported buffer handles of the stream.
+  using ImportedBufferTable =
+      std::unordered_map<int32_t, ImportedStreamBuffers>;
+
+  // Return the imported buffer handle of a buffer in table, or nullptr if the
+  // buffer has not been imported.
+  static buffer_handle_t GetImportedBufferHandle(
+      const ImportedBufferTable& table, int32_t stream_id, uint64_t buffer_id);
+
+  // Set the imported buffer handle of a buffer in table. If buffer_handle is
+  // nullptr, the buffer is removed from table.
+  static void SetImportedBufferHandle(ImportedBufferTable* table,
+                                      int32_t stream_id, uint64_t buffer_id,
+                                      buffer_handle_t buffer_handle);
+
+  // Return the current imported buffer table. The returned table is immutable
+  // and can be read without holding imported_buffer_handles_lock_.
+  std::shared_ptr<const ImportedBufferTable> GetImportedBufferTable() const;
+
+  // Publish a new imported buffer table.
+  // Must be protected by imported_buffer_handles_lock_.
+  void PublishImportedBufferTableLocked(ImportedBufferTable table);
+
+  // Update all buffer handles in buffers with the imported buffer handles in
+  // table.
+  status_t UpdateBufferHandles(const ImportedBufferTable& table,
+                               std::vector<StreamBuffer>* buffers);
 
   // Import the buffer handles in the request.
   status_t ImportRequestBufferHandles(const CaptureRequest& request);
@@ -179,32 +210,33 @@ class CameraDeviceSession {
   // Import the buffer handles of buffers.
   status_t ImportBufferHandles(const std::vector<StreamBuffer>& buffers);
 
-  // Import the buffer handle of a buffer.
-  // Must be protected by imported_buffer_handle_map_lock_.
+  // Import the buffer handle of a buffer and add it to table.
+  // Must be protected by imported_buffer_handles_lock_.
   template <class T, class U>
   status_t ImportBufferHandleLocked(const sp<T> buffer_mapper,
-                                    const StreamBuffer& buffer);
+                                    const StreamBuffer& buffer,
+                                    ImportedBufferTable* table);
 
   // Create a request with updated buffer handles and modified settings.
   // Must be protected by session_lock_.
   status_t CreateCaptureRequestLocked(const CaptureRequest& request,
                                       CaptureRequest* updated_request);
 
-  // Add a buffer handle to the imported buffer handle map. If the buffer cache
-  // is already in the map but the buffer handle doesn't match, it will
-  // return BAD_VALUE.
-  // Must be protected by imported_buffer_handle_map_lock_.
+  // Add a buffer handle to table. If the buffer cache is already in table
+  // but the buffer handle doesn't match, it will return BAD_VALUE.
+  // Must be protected by imported_buffer_handles_lock_.
   status_t AddImportedBufferHandlesLocked(const BufferCache& buffer_cache,
-                                          buffer_handle_t buffer_handle);
+                                          buffer_handle_t buffer_handle,
+                                          ImportedBufferTable* table);
 
   // Return if the buffer handle for a certain buffer ID is imported.
-  // Must be protected by imported_buffer_handle_map_lock_.
-  bool IsBufferImportedLocked(int32_t stream_id, uint32_t buffer_id);
+  bool IsBufferImported(int32_t stream_id, uint64_t buffer_id) const;
 
-  // Free all imported buffer handles belonging to the stream id.
-  // Must be protected by imported_buffer_handle_map_lock_.
+  // Free all imported buffer handles belonging to the stream id in table.
+  // Must be protected by imported_buffer_handles_lock_.
   template <class T>
-  void FreeBufferHandlesLocked(const sp<T> buffer_mapper, int32_t stream_id);
+  void FreeBufferHandlesLocked(const sp<T> buffer_mapper, int32_t stream_id,
+                               ImportedBufferTable* table);
 
   template <class T>
   void FreeImportedBufferHandles(const sp<T> buffer_mapper);
@@ -320,13 +352,16 @@ class CameraDeviceSession {
   // Session callback from HWL session. Protected by session_callback_lock_
   HwlSessionCallback hwl_session_callback_;
 
-  // imported_buffer_handle_map_lock_ protects the following variables as noted.
-  std::mutex imported_buffer_handle_map_lock_;
+  // imported_buffer_handles_lock_ serializes updates to
+  // imported_buffer_table_. Readers load imported_buffer_table_ atomically
+  // without holding the lock.
+  std::mutex imported_buffer_handles_lock_;
 
-  // Store the imported buffer handles from camera framework. Protected by
-  // imported_buffer_handle_map_lock.
-  std::unordered_map<BufferCache, buffer_handle_t, BufferCacheHashing>
-      imported_buffer_handle_map_;
+  // Store the imported buffer handles from camera framework. The table is
+  // replaced, never modified in place, and must be accessed with
+  // std::atomic_load and std::atomic_store.
+  std::shared_ptr<const ImportedBufferTable> imported_buffer_table_ =
+      std::make_shared<const ImportedBufferTable>();
 
   // session_lock_ protects the following variables as noted.
   std::mutex session_lock_;
@@ -356,6 +391,10 @@ class CameraDeviceSession {
   // Predefined capture session entry points
   static std::vector<CaptureSessionEntryFuncs> kCaptureSessionEntries;
 
+  // Number of CameraDeviceSessions in the process. The process-wide buffer
+  // caches are cleared when the last session is destroyed.
+  static std::atomic<uint32_t> num_sessions_;
+
   // External capture session entry points
   std::vector<ExternalCaptureSessionFactory*> external_capture_session_entries_;
 
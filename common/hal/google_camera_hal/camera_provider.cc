@@ -23,6 +23,7 @@
 #include <dlfcn.h>
 
 #include "camera_provider.h"
+#include "hwl_buffer_allocator.h"
 #include "vendor_tag_defs.h"
 #include "vendor_tag_utils.h"
 
@@ -37,6 +38,8 @@ namespace android {
 namespace google_camera_hal {
 
 CameraProvider::~CameraProvider() {
+  CachedBufferAllocator::SetHwlInstance(nullptr);
+  cached_allocator_hwl_ = nullptr;
   VendorTagManager::GetInstance().Reset();
   if (hwl_lib_handle_ != nullptr) {
     dlclose(hwl_lib_handle_);
@@ -96,6 +99,16 @@ status_t CameraProvider::Initialize(
     return NO_INIT;
   }
 
+  if (camera_allocator_hwl_ != nullptr) {
+    cached_allocator_hwl_ = CachedBufferAllocator::Create(
+        HwlBufferAllocator::Create(camera_allocator_hwl_.get()),
+        CachedBufferAllocator::GetProcessCacheBytes());
+    if (cached_allocator_hwl_ == nullptr) {
+      ALOGW("%s: Creating a cache for HWL buffers failed.", __FUNCTION__);
+    }
+    CachedBufferAllocator::SetHwlInstance(cached_allocator_hwl_.get());
+  }
+
   camera_provider_hwl_ = std::move(camera_provider_hwl);
   res = InitializeVendorTags();
   if (res != OK) {
@@ -20,6 +20,7 @@
 #include <utils/Errors.h>
 #include <memory>
 
+#include "cached_buffer_allocator.h"
 #include "camera_buffer_allocator_hwl.h"
 #include "camera_device.h"
 #include "camera_provider_callback.h"
@@ -88,6 +89,11 @@ class CameraProvider {
   HwlCameraProviderCallback hwl_provider_callback_;
 
   std::unique_ptr<CameraBufferAllocatorHwl> camera_allocator_hwl_;
+
+  // Caches the buffers allocated by camera_allocator_hwl_. Set as the
+  // process-wide CachedBufferAllocator::GetHwlInstance().
+  std::unique_ptr<CachedBufferAllocator> cached_allocator_hwl_;
+
   // Combined list of vendor tags from HAL and HWL
   std::vector<VendorTagSection> vendor_tag_sections_;
 };
@@ -19,10 +19,14 @@
 #define ATRACE_TAG ATRACE_TAG_CAMERA
 #include <cutils/properties.h>
 #include <hardware/gralloc1.h>
+#include <inttypes.h>
 #include <log/log.h>
+#include <sync/sync.h>
 #include <sys/mman.h>
+#include <utils/Timers.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
 #include <dlfcn.h>
 
 #include "depth_process_block.h"
@@ -33,14 +37,21 @@
 namespace android {
 namespace google_camera_hal {
 
-static std::string kDepthGeneratorLib = "/vendor/lib64/libdepthgenerator.so";
+// Depth generator libraries are only loaded from the vendor library dir.
+#if defined(_LP64)
+constexpr char kDepthGeneratorLibDir[] = "/vendor/lib64/";
+#else  // defined(_LP64)
+constexpr char kDepthGeneratorLibDir[] = "/vendor/lib/";
+#endif
+static std::string kDepthGeneratorLib = "libdepthgenerator.so";
 using android::depth_generator::CreateDepthGenerator_t;
 const float kSmallOffset = 0.01f;
 
 std::unique_ptr<DepthProcessBlock> DepthProcessBlock::Create(
     CameraDeviceSessionHwl* device_session_hwl,
     HwlRequestBuffersFunc request_stream_buffers,
-    const DepthProcessBlockCreateData& create_data) {
+    const DepthProcessBlockCreateData& create_data,
+    std::unique_ptr<DepthGenerator> depth_generator) {
   ATRACE_CALL();
   if (device_session_hwl == nullptr) {
     ALOGE("%s: device_session_hwl is nullptr", __FUNCTION__);
@@ -86,6 +97,36 @@ std::unique_ptr<DepthProcessBlock> DepthProcessBlock::Create(
   block->rgb_ir_auto_cal_enabled_ =
       property_get_bool("vendor.camera.frontdepth.enableautocal", true);
 
+  int32_t max_in_flight_requests =
+      property_get_int32("persist.camera.frontdepth.max_inflight",
+                         block->max_in_flight_requests_);
+  if (max_in_flight_requests > 0) {
+    block->max_in_flight_requests_ = max_in_flight_requests;
+  } else {
+    ALOGW("%s: Ignoring invalid max in-flight depth requests %d", __FUNCTION__,
+          max_in_flight_requests);
+  }
+
+  char backpressure_policy[PROPERTY_VALUE_MAX];
+  property_get("persist.camera.frontdepth.backpressure", backpressure_policy,
+               "");
+  if (strcmp(backpressure_policy, "block") == 0) {
+    block->backpressure_policy_ = BackpressurePolicy::kBlock;
+  } else if (strcmp(backpressure_policy, "drop_oldest") == 0) {
+    block->backpressure_policy_ = BackpressurePolicy::kDropOldest;
+  } else if (strcmp(backpressure_policy, "skip_to_latest") == 0) {
+    block->backpressure_policy_ = BackpressurePolicy::kSkipToLatest;
+  } else if (strlen(backpressure_policy) > 0) {
+    ALOGW("%s: Ignoring unknown depth backpressure policy %s", __FUNCTION__,
+          backpressure_policy);
+  }
+
+  ALOGI("%s: Max in-flight depth requests %u, backpressure policy %d",
+        __FUNCTION__, block->max_in_flight_requests_,
+        static_cast<int32_t>(block->backpressure_policy_));
+
+  block->depth_generator_ = std::move(depth_generator);
+
   return block;
 }
 
@@ -118,13 +159,47 @@ DepthProcessBlock::DepthProcessBlock(
     : request_stream_buffers_(request_stream_buffers),
       rgb_internal_yuv_stream_id_(create_data.rgb_internal_yuv_stream_id),
       ir1_internal_raw_stream_id_(create_data.ir1_internal_raw_stream_id),
-      ir2_internal_raw_stream_id_(create_data.ir2_internal_raw_stream_id) {
+      ir2_internal_raw_stream_id_(create_data.ir2_internal_raw_stream_id),
+      max_in_flight_requests_(create_data.max_in_flight_requests),
+      backpressure_policy_(create_data.backpressure_policy) {
 }
 
 DepthProcessBlock::~DepthProcessBlock() {
   ATRACE_CALL();
+  if (depth_refill_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(depth_window_lock_);
+      depth_refill_thread_exiting_ = true;
+    }
+    depth_refill_condition_.notify_one();
+    depth_refill_thread_.join();
+  }
+
   depth_generator_ = nullptr;
 
+  DepthPipelineStats stats = GetDepthPipelineStats();
+  if (stats.completed_requests > 0) {
+    nsecs_t completed_requests = stats.completed_requests;
+    ALOGI("%s: %" PRIu64 " depth requests completed, %" PRIu64
+          " dropped. Average queue latency %" PRId64 " us (max %" PRId64
+          " us), average compute latency %" PRId64 " us (max %" PRId64
+          " us), average cloned metadata %" PRIu64 " bytes.",
+          __FUNCTION__, stats.completed_requests, stats.dropped_requests,
+          ns2us(stats.total_queue_latency / completed_requests),
+          ns2us(stats.max_queue_latency),
+          ns2us(stats.total_compute_latency / completed_requests),
+          ns2us(stats.max_compute_latency),
+          stats.cloned_metadata_bytes / stats.completed_requests);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(buffer_mappings_lock_);
+    for (auto& it : buffer_mappings_) {
+      munmap(it.second.addr, it.second.size);
+    }
+    buffer_mappings_.clear();
+  }
+
   if (depth_generator_lib_handle_ != nullptr) {
     dlclose(depth_generator_lib_handle_);
     depth_generator_lib_handle_ = nullptr;
@@ -230,23 +305,20 @@ status_t DepthProcessBlock::ConfigureStreams(
       ALOGE("%s: Creating DepthGenerator failed.", __FUNCTION__);
       return NO_INIT;
     }
+  }
 
-    if (pipelined_depth_engine_enabled_ == true) {
-      auto depth_result_callback =
-          android::depth_generator::DepthResultCallbackFunction(
-              [this](DepthResultStatus result_status, uint32_t frame_number) {
-                status_t res = ProcessDepthResult(result_status, frame_number);
-                if (res != OK) {
-                  ALOGE("%s: Failed to process the depth result for frame %d.",
-                        __FUNCTION__, frame_number);
-                }
-              });
-      ALOGI("%s: Async depth api is used. Callback func is set.", __FUNCTION__);
-      depth_generator_->SetResultCallback(depth_result_callback);
-    } else {
-      ALOGI("%s: Blocking depth api is used.", __FUNCTION__);
-      depth_generator_->SetResultCallback(nullptr);
-    }
+  if (pipelined_depth_engine_enabled_ == true) {
+    auto depth_result_callback =
+        android::depth_generator::DepthResultCallbackFunction(
+            [this](DepthResultStatus result_status, uint32_t frame_number) {
+              ProcessAsyncDepthResult(result_status, frame_number);
+            });
+    ALOGI("%s: Async depth api is used. Callback func is set.", __FUNCTION__);
+    depth_generator_->SetResultCallback(depth_result_callback);
+    depth_refill_thread_ = std::thread([this] { DepthRefillThreadLoop(); });
+  } else {
+    ALOGI("%s: Blocking depth api is used.", __FUNCTION__);
+    depth_generator_->SetResultCallback(nullptr);
   }
 
   is_configured_ = true;
@@ -272,12 +344,36 @@ status_t DepthProcessBlock::GetConfiguredHalStreams(
   return OK;
 }
 
+status_t DepthProcessBlock::MarkDepthRequestSubmitted(
+    uint32_t frame_number, DepthRequestInfo* request_info) {
+  std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+  auto pending_request = pending_depth_requests_.find(frame_number);
+  if (pending_request == pending_depth_requests_.end()) {
+    ALOGE("%s: Frame %u does not exist in pending requests list.",
+          __FUNCTION__, frame_number);
+    return BAD_VALUE;
+  }
+
+  pending_request->second.submit_time = systemTime();
+  if (request_info != nullptr) {
+    *request_info = pending_request->second.depth_request;
+  }
+
+  return OK;
+}
+
 status_t DepthProcessBlock::SubmitBlockingDepthRequest(
     const DepthRequestInfo& request_info) {
   ALOGV("%s: [ud] ExecuteProcessRequest for frame %d", __FUNCTION__,
         request_info.frame_number);
 
-  status_t res = depth_generator_->ExecuteProcessRequest(request_info);
+  status_t res = MarkDepthRequestSubmitted(request_info.frame_number,
+                                           /*request_info=*/nullptr);
+  if (res != OK) {
+    return res;
+  }
+
+  res = depth_generator_->ExecuteProcessRequest(request_info);
   if (res != OK) {
     ALOGE("%s: Depth generator fails to process frame %d.", __FUNCTION__,
           request_info.frame_number);
@@ -293,20 +389,142 @@ status_t DepthProcessBlock::SubmitBlockingDepthRequest(
   return OK;
 }
 
-status_t DepthProcessBlock::SubmitAsyncDepthRequest(
-    const DepthRequestInfo& request_info) {
-  std::unique_lock<std::mutex> lock(depth_generator_api_lock_);
-  ALOGV("%s: [ud] ExecuteProcessRequest for frame %d", __FUNCTION__,
-        request_info.frame_number);
-  status_t res = depth_generator_->EnqueueProcessRequest(request_info);
+status_t DepthProcessBlock::SubmitAsyncDepthRequest(uint32_t frame_number) {
+  DepthRequestInfo request_info;
+  status_t res = MarkDepthRequestSubmitted(frame_number, &request_info);
+  if (res == OK) {
+    std::unique_lock<std::mutex> lock(depth_generator_api_lock_);
+    ALOGV("%s: [ud] ExecuteProcessRequest for frame %d", __FUNCTION__,
+          request_info.frame_number);
+    res = depth_generator_->EnqueueProcessRequest(request_info);
+  }
+
   if (res != OK) {
-    ALOGE("%s: Failed to enqueue depth request.", __FUNCTION__);
+    ALOGE("%s: Failed to enqueue depth request for frame %u.", __FUNCTION__,
+          frame_number);
+    // Return the depth buffer with an error and release the in-flight slot.
+    ProcessAsyncDepthResult(DepthResultStatus::kError, frame_number);
     return res;
   }
 
   return OK;
 }
 
+status_t DepthProcessBlock::EnqueueAsyncDepthRequest(uint32_t frame_number) {
+  ATRACE_CALL();
+  bool submit = false;
+  std::vector<uint32_t> dropped_frames;
+  {
+    std::unique_lock<std::mutex> lock(depth_window_lock_);
+    if (backpressure_policy_ == BackpressurePolicy::kBlock) {
+      depth_window_condition_.wait(lock, [this] {
+        return in_flight_depth_requests_ < max_in_flight_requests_;
+      });
+      submit = true;
+    } else if (queued_depth_frames_.empty() &&
+               in_flight_depth_requests_ < max_in_flight_requests_) {
+      submit = true;
+    } else {
+      if (backpressure_policy_ == BackpressurePolicy::kSkipToLatest) {
+        dropped_frames.assign(queued_depth_frames_.begin(),
+                              queued_depth_frames_.end());
+        queued_depth_frames_.clear();
+      } else if (queued_depth_frames_.size() >= kMaxQueuedDepthRequests) {
+        dropped_frames.push_back(queued_depth_frames_.front());
+        queued_depth_frames_.pop_front();
+      }
+      queued_depth_frames_.push_back(frame_number);
+    }
+
+    if (submit) {
+      in_flight_depth_requests_++;
+    }
+  }
+
+  for (auto& dropped_frame : dropped_frames) {
+    ALOGW("%s: Depth generator falls behind, dropping frame %u.", __FUNCTION__,
+          dropped_frame);
+    status_t res = ProcessDepthResult(DepthResultStatus::kError, dropped_frame);
+    if (res != OK) {
+      ALOGE("%s: Failed to drop frame %u.", __FUNCTION__, dropped_frame);
+    }
+  }
+
+  if (submit) {
+    return SubmitAsyncDepthRequest(frame_number);
+  }
+
+  // A slot may have been released after the refill thread last checked.
+  depth_refill_condition_.notify_one();
+  return OK;
+}
+
+void DepthProcessBlock::ProcessAsyncDepthResult(DepthResultStatus result_status,
+                                                uint32_t frame_number) {
+  status_t res = ProcessDepthResult(result_status, frame_number);
+  if (res != OK) {
+    ALOGE("%s: Failed to process the depth result for frame %d.", __FUNCTION__,
+          frame_number);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(depth_window_lock_);
+    if (in_flight_depth_requests_ > 0) {
+      in_flight_depth_requests_--;
+    }
+  }
+
+  // The next queued request is submitted by the refill thread so the depth
+  // generator is not called back from its result callback.
+  depth_window_condition_.notify_one();
+  depth_refill_condition_.notify_one();
+}
+
+void DepthProcessBlock::DepthRefillThreadLoop() {
+  while (true) {
+    uint32_t frame_number = 0;
+    {
+      std::unique_lock<std::mutex> lock(depth_window_lock_);
+      depth_refill_condition_.wait(lock, [this] {
+        return depth_refill_thread_exiting_ ||
+               (!queued_depth_frames_.empty() &&
+                in_flight_depth_requests_ < max_in_flight_requests_);
+      });
+      if (depth_refill_thread_exiting_) {
+        ALOGV("%s: Depth refill thread exiting.", __FUNCTION__);
+        return;
+      }
+
+      frame_number = queued_depth_frames_.front();
+      queued_depth_frames_.pop_front();
+      in_flight_depth_requests_++;
+    }
+
+    SubmitAsyncDepthRequest(frame_number);
+  }
+}
+
+void DepthProcessBlock::DropQueuedDepthRequests() {
+  std::deque<uint32_t> dropped_frames;
+  {
+    std::lock_guard<std::mutex> lock(depth_window_lock_);
+    dropped_frames.swap(queued_depth_frames_);
+  }
+
+  for (auto& dropped_frame : dropped_frames) {
+    status_t res = ProcessDepthResult(DepthResultStatus::kError, dropped_frame);
+    if (res != OK) {
+      ALOGE("%s: Failed to drop frame %u.", __FUNCTION__, dropped_frame);
+    }
+  }
+}
+
+DepthProcessBlock::DepthPipelineStats
+DepthProcessBlock::GetDepthPipelineStats() {
+  std::lock_guard<std::mutex> lock(stats_lock_);
+  return stats_;
+}
+
 status_t DepthProcessBlock::ProcessDepthResult(DepthResultStatus result_status,
                                                uint32_t frame_number) {
   std::unique_lock<std::mutex> lock(depth_generator_api_lock_);
@@ -326,6 +544,9 @@ status_t DepthProcessBlock::ProcessDepthResult(DepthResultStatus result_status,
   }
 
   CaptureRequest request;
+  nsecs_t receive_time = 0;
+  nsecs_t submit_time = 0;
+  bool has_error_buffer = false;
   {
     std::lock_guard<std::mutex> pending_request_lock(pending_requests_mutex_);
     if (pending_depth_requests_.find(frame_number) ==
@@ -333,6 +554,8 @@ status_t DepthProcessBlock::ProcessDepthResult(DepthResultStatus result_status,
       ALOGE("%s: Frame %u does not exist in pending requests list.",
             __FUNCTION__, frame_number);
     } else {
+      receive_time = pending_depth_requests_[frame_number].receive_time;
+      submit_time = pending_depth_requests_[frame_number].submit_time;
       auto& request = pending_depth_requests_[frame_number].request;
       capture_result->frame_number = frame_number;
       capture_result->output_buffers = request.output_buffers;
@@ -343,6 +566,7 @@ status_t DepthProcessBlock::ProcessDepthResult(DepthResultStatus result_status,
         for (auto& stream_buffer : capture_result->output_buffers) {
           if (stream_buffer.stream_id == depth_stream_.id) {
             stream_buffer.status = BufferStatus::kError;
+            has_error_buffer = true;
           }
         }
       }
@@ -352,10 +576,40 @@ status_t DepthProcessBlock::ProcessDepthResult(DepthResultStatus result_status,
     }
   }
 
+  {
+    std::lock_guard<std::mutex> stats_lock(stats_lock_);
+    if (submit_time == 0) {
+      stats_.dropped_requests++;
+    } else {
+      nsecs_t queue_latency = submit_time - receive_time;
+      nsecs_t compute_latency = systemTime() - submit_time;
+      ALOGV("%s: Frame %u queue latency %" PRId64
+            " us, compute latency %" PRId64 " us",
+            __FUNCTION__, frame_number, ns2us(queue_latency),
+            ns2us(compute_latency));
+      stats_.completed_requests++;
+      stats_.total_queue_latency += queue_latency;
+      stats_.max_queue_latency =
+          std::max(stats_.max_queue_latency, queue_latency);
+      stats_.total_compute_latency += compute_latency;
+      stats_.max_compute_latency =
+          std::max(stats_.max_compute_latency, compute_latency);
+    }
+  }
+
   ProcessBlockResult block_result = {.request_id = 0,
                                      .result = std::move(capture_result)};
   {
     std::lock_guard<std::mutex> lock(result_processor_lock_);
+    // Notify the buffer error before the depth buffer is returned.
+    if (has_error_buffer) {
+      const NotifyMessage message = {
+          .type = MessageType::kError,
+          .message.error = {.frame_number = frame_number,
+                            .error_stream_id = depth_stream_.id,
+                            .error_code = ErrorCode::kErrorBuffer}};
+      result_processor_->Notify({.request_id = 0, .message = message});
+    }
     result_processor_->ProcessResult(std::move(block_result));
   }
 
@@ -366,6 +620,7 @@ status_t DepthProcessBlock::ProcessRequests(
     const std::vector<ProcessBlockRequest>& process_block_requests,
     const CaptureRequest& remaining_session_request) {
   ATRACE_CALL();
+  nsecs_t receive_time = systemTime();
   // TODO(b/128633958): remove this after FLL syncing is verified
   if (force_internal_stream_) {
     // Nothing to configure if this is force internal mode
@@ -402,33 +657,60 @@ status_t DepthProcessBlock::ProcessRequests(
     }
   }
 
-  auto& request = process_block_requests[0].request;
+  auto& block_request = process_block_requests[0];
+  auto& request = block_request.request;
   DepthRequestInfo request_info;
   request_info.frame_number = request.frame_number;
-  std::unique_ptr<HalCameraMetadata> metadata = nullptr;
-  if (request.settings != nullptr) {
-    metadata = HalCameraMetadata::Clone(request.settings.get());
-  }
+  const HalCameraMetadata* settings = block_request.shared_settings != nullptr
+                                          ? block_request.shared_settings.get()
+                                          : request.settings.get();
+
+  // The color metadata is the last valid input buffer metadata. Shared
+  // metadata is referenced instead of cloned.
+  std::shared_ptr<const HalCameraMetadata> color_metadata;
+  if (!block_request.shared_input_buffer_metadata.empty()) {
+    for (auto& metadata : block_request.shared_input_buffer_metadata) {
+      if (metadata != nullptr) {
+        color_metadata = metadata;
+      }
+    }
+  } else {
+    const HalCameraMetadata* last_metadata = nullptr;
+    for (auto& metadata : request.input_buffer_metadata) {
+      if (metadata != nullptr) {
+        last_metadata = metadata.get();
+      }
+    }
 
-  std::unique_ptr<HalCameraMetadata> color_metadata = nullptr;
-  for (auto& metadata : request.input_buffer_metadata) {
-    if (metadata != nullptr) {
-      color_metadata = HalCameraMetadata::Clone(metadata.get());
+    if (last_metadata != nullptr) {
+      color_metadata = CloneMetadata(last_metadata);
     }
   }
 
   ALOGV("%s: [ud] Prepare depth request info for frame %u .", __FUNCTION__,
         request.frame_number);
 
-  status_t res = PrepareDepthRequestInfo(request, &request_info, metadata.get(),
-                                         color_metadata.get());
+  std::unique_ptr<HalCameraMetadata> depth_settings;
+  status_t res = PrepareDepthRequestInfo(request, settings,
+                                         color_metadata.get(), &request_info,
+                                         &depth_settings);
   if (res != OK) {
     ALOGE("%s: Failed to perpare the depth request info.", __FUNCTION__);
     return res;
   }
 
+  {
+    // The depth request info references the metadata, which must stay valid
+    // until the depth generator is done with the request.
+    std::lock_guard<std::mutex> lock(pending_requests_mutex_);
+    auto& pending_request = pending_depth_requests_[request.frame_number];
+    pending_request.settings = std::move(depth_settings);
+    pending_request.color_metadata = std::move(color_metadata);
+    pending_request.receive_time = receive_time;
+  }
+
   if (pipelined_depth_engine_enabled_ == true) {
-    res = SubmitAsyncDepthRequest(request_info);
+    res = EnqueueAsyncDepthRequest(request_info.frame_number);
     if (res != OK) {
       ALOGE("%s: Failed to submit asynchronized depth request.", __FUNCTION__);
     }
@@ -449,6 +731,12 @@ status_t DepthProcessBlock::Flush() {
     return OK;
   }
 
+  // Requests still waiting for the depth generator are not processed.
+  DropQueuedDepthRequests();
+
+  // Buffers may be freed after a flush, drop their mappings.
+  InvalidateBufferMappings();
+
   // TODO(b/127322570): Implement this method.
   return OK;
 }
@@ -458,18 +746,33 @@ status_t DepthProcessBlock::LoadDepthGenerator(
   ATRACE_CALL();
   CreateDepthGenerator_t create_depth_generator;
 
-  ALOGI("%s: Loading library: %s", __FUNCTION__, kDepthGeneratorLib.c_str());
+  // Allow loading another vendor depth generator by library name, e.g. the
+  // reference CPU one.
+  char depth_generator_name[PROPERTY_VALUE_MAX];
+  property_get("persist.camera.frontdepth.generator_lib", depth_generator_name,
+               kDepthGeneratorLib.c_str());
+  std::string depth_generator_name_str(depth_generator_name);
+  if (depth_generator_name_str.empty() ||
+      depth_generator_name_str.find('/') != std::string::npos) {
+    ALOGE("%s: Depth generator \"%s\" is not a library name.", __FUNCTION__,
+          depth_generator_name);
+    return BAD_VALUE;
+  }
+
+  std::string depth_generator_lib =
+      kDepthGeneratorLibDir + depth_generator_name_str;
+  ALOGI("%s: Loading library: %s", __FUNCTION__, depth_generator_lib.c_str());
   depth_generator_lib_handle_ =
-      dlopen(kDepthGeneratorLib.c_str(), RTLD_NOW | RTLD_NODELETE);
+      dlopen(depth_generator_lib.c_str(), RTLD_NOW | RTLD_NODELETE);
   if (depth_generator_lib_handle_ == nullptr) {
-    ALOGE("Depth generator loading %s failed.", kDepthGeneratorLib.c_str());
+    ALOGE("Depth generator loading %s failed.", depth_generator_lib.c_str());
     return NO_INIT;
   }
 
   create_depth_generator = (CreateDepthGenerator_t)dlsym(
       depth_generator_lib_handle_, "CreateDepthGenerator");
   if (create_depth_generator == nullptr) {
-    ALOGE("%s: dlsym failed (%s).", __FUNCTION__, kDepthGeneratorLib.c_str());
+    ALOGE("%s: dlsym failed (%s).", __FUNCTION__, depth_generator_lib.c_str());
     dlclose(depth_generator_lib_handle_);
     depth_generator_lib_handle_ = nullptr;
     return NO_INIT;
@@ -496,13 +799,44 @@ status_t DepthProcessBlock::MapBuffersForDepthGenerator(
     return UNKNOWN_ERROR;
   }
 
-  void* virtual_addr =
-      mmap(NULL, stream_buffer_sizes_[stream_id], (PROT_READ | PROT_WRITE),
-           MAP_SHARED, buffer_handle->data[0], 0);
+  uint8_t* virtual_addr = nullptr;
+  if (!IsBufferMappingCacheable(stream_id)) {
+    void* addr = mmap(NULL, stream_buffer_sizes_[stream_id],
+                      (PROT_READ | PROT_WRITE), MAP_SHARED,
+                      buffer_handle->data[0], 0);
+    if (addr == nullptr || addr == reinterpret_cast<void*>(-1)) {
+      ALOGE("%s: Failed to map the stream buffer to virtual addr.",
+            __FUNCTION__);
+      return UNKNOWN_ERROR;
+    }
+    virtual_addr = reinterpret_cast<uint8_t*>(addr);
+  } else {
+    std::lock_guard<std::mutex> lock(buffer_mappings_lock_);
+    BufferMappingKey key(buffer_handle, buffer_handle->data[0]);
+    auto mapping = buffer_mappings_.find(key);
+    if (mapping != buffer_mappings_.end()) {
+      if (mapping->second.stale) {
+        ALOGE("%s: Stream buffer of stream id:%d is still in flight.",
+              __FUNCTION__, stream_id);
+        return UNKNOWN_ERROR;
+      }
+    } else {
+      uint32_t size = stream_buffer_sizes_[stream_id];
+      void* addr = mmap(NULL, size, (PROT_READ | PROT_WRITE), MAP_SHARED,
+                        buffer_handle->data[0], 0);
+      if (addr == nullptr || addr == reinterpret_cast<void*>(-1)) {
+        ALOGE("%s: Failed to map the stream buffer to virtual addr.",
+              __FUNCTION__);
+        return UNKNOWN_ERROR;
+      }
 
-  if (virtual_addr == nullptr || virtual_addr == reinterpret_cast<void*>(-1)) {
-    ALOGE("%s: Failed to map the stream buffer to virtual addr.", __FUNCTION__);
-    return UNKNOWN_ERROR;
+      BufferMapping new_mapping = {.addr = reinterpret_cast<uint8_t*>(addr),
+                                   .size = size};
+      mapping = buffer_mappings_.emplace(key, new_mapping).first;
+    }
+
+    mapping->second.in_flight++;
+    virtual_addr = mapping->second.addr;
   }
 
   auto& stream = depth_io_streams_[stream_id];
@@ -510,7 +844,7 @@ status_t DepthProcessBlock::MapBuffersForDepthGenerator(
   buffer->width = stream.width;
   buffer->height = stream.height;
   depth_generator::BufferPlane buffer_plane = {};
-  buffer_plane.addr = reinterpret_cast<uint8_t*>(virtual_addr);
+  buffer_plane.addr = virtual_addr;
   // TODO(b/130764929): Use actual gralloc buffer stride instead of stream dim
   buffer_plane.stride = stream.width;
   buffer_plane.scanline = stream.height;
@@ -534,10 +868,54 @@ status_t DepthProcessBlock::UnmapBuffersForDepthGenerator(
     return UNKNOWN_ERROR;
   }
 
-  munmap(addr, stream_buffer_sizes_[stream_id]);
+  if (!IsBufferMappingCacheable(stream_id)) {
+    munmap(addr, stream_buffer_sizes_[stream_id]);
+    return OK;
+  }
+
+  std::lock_guard<std::mutex> lock(buffer_mappings_lock_);
+  auto mapping = buffer_mappings_.find(
+      BufferMappingKey(stream_buffer.buffer, stream_buffer.buffer->data[0]));
+  if (mapping == buffer_mappings_.end() || mapping->second.addr != addr ||
+      mapping->second.in_flight == 0) {
+    ALOGE("%s: Stream buffer of stream id:%d is not mapped.", __FUNCTION__,
+          stream_id);
+    return BAD_VALUE;
+  }
+
+  // Keep the mapping for the next request using the same buffer unless the
+  // cache was invalidated or outgrew its limit.
+  mapping->second.in_flight--;
+  if (mapping->second.in_flight == 0 &&
+      (mapping->second.stale ||
+       buffer_mappings_.size() > kMaxBufferMappings)) {
+    munmap(mapping->second.addr, mapping->second.size);
+    buffer_mappings_.erase(mapping);
+  }
+
   return OK;
 }
 
+bool DepthProcessBlock::IsBufferMappingCacheable(int32_t stream_id) const {
+  return stream_id == rgb_internal_yuv_stream_id_ ||
+         stream_id == ir1_internal_raw_stream_id_ ||
+         stream_id == ir2_internal_raw_stream_id_;
+}
+
+void DepthProcessBlock::InvalidateBufferMappings() {
+  ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(buffer_mappings_lock_);
+  for (auto it = buffer_mappings_.begin(); it != buffer_mappings_.end();) {
+    if (it->second.in_flight > 0) {
+      it->second.stale = true;
+      it++;
+    } else {
+      munmap(it->second.addr, it->second.size);
+      it = buffer_mappings_.erase(it);
+    }
+  }
+}
+
 status_t DepthProcessBlock::RequestDepthStreamBuffer(
     StreamBuffer* incomplete_buffer, uint32_t frame_number) {
   if (!buffer_management_supported_) {
@@ -565,13 +943,13 @@ status_t DepthProcessBlock::RequestDepthStreamBuffer(
   return OK;
 }
 
-status_t DepthProcessBlock::UpdateCropRegion(const CaptureRequest& request,
-                                             DepthRequestInfo* depth_request_info,
-                                             HalCameraMetadata* metadata) {
-  if (request.settings != nullptr && metadata != nullptr) {
+status_t DepthProcessBlock::UpdateCropRegion(
+    const HalCameraMetadata* settings, DepthRequestInfo* depth_request_info,
+    std::unique_ptr<HalCameraMetadata>* depth_settings) {
+  if (settings != nullptr && depth_settings != nullptr) {
     camera_metadata_ro_entry_t entry_crop_region_user = {};
-    if (request.settings->Get(ANDROID_SCALER_CROP_REGION,
-                              &entry_crop_region_user) == OK) {
+    if (settings->Get(ANDROID_SCALER_CROP_REGION, &entry_crop_region_user) ==
+        OK) {
       const int32_t* crop_region = entry_crop_region_user.data.i32;
       ALOGV("%s: Depth PB crop region[%d %d %d %d]", __FUNCTION__,
             crop_region[0], crop_region[1], crop_region[2], crop_region[3]);
@@ -599,10 +977,18 @@ status_t DepthProcessBlock::UpdateCropRegion(const CaptureRequest& request,
       if (resized_crop_region[3] > ir_active_array_width_) {
         resized_crop_region[3] = ir_active_array_width_;
       }
-      metadata->Set(ANDROID_SCALER_CROP_REGION, resized_crop_region,
-                    sizeof(resized_crop_region) / sizeof(int32_t));
+      // Shared settings are read-only, so the IR crop region goes to a copy.
+      *depth_settings = CloneMetadata(settings);
+      if (*depth_settings == nullptr) {
+        ALOGE("%s: Cloning the settings failed.", __FUNCTION__);
+        return NO_MEMORY;
+      }
+
+      (*depth_settings)
+          ->Set(ANDROID_SCALER_CROP_REGION, resized_crop_region,
+                sizeof(resized_crop_region) / sizeof(int32_t));
 
-      depth_request_info->settings = metadata->GetRawCameraMetadata();
+      depth_request_info->settings = (*depth_settings)->GetRawCameraMetadata();
     }
   }
   return OK;
@@ -653,9 +1039,41 @@ status_t DepthProcessBlock::MapDepthRequestBuffers(
   return OK;
 }
 
+status_t DepthProcessBlock::WaitForAcquireFences(
+    const CaptureRequest& request) {
+  ATRACE_CALL();
+  for (auto& buffer : request.output_buffers) {
+    if (buffer.acquire_fence == nullptr || buffer.acquire_fence->numFds != 1) {
+      continue;
+    }
+
+    int res = sync_wait(buffer.acquire_fence->data[0], kSyncWaitTimeMs);
+    if (res != 0) {
+      ALOGE("%s: Waiting for the acquire fence of stream %d failed: %d",
+            __FUNCTION__, buffer.stream_id, res);
+      return TIMED_OUT;
+    }
+  }
+
+  return OK;
+}
+
+std::unique_ptr<HalCameraMetadata> DepthProcessBlock::CloneMetadata(
+    const HalCameraMetadata* metadata) {
+  auto clone = HalCameraMetadata::Clone(metadata);
+  if (clone != nullptr) {
+    std::lock_guard<std::mutex> lock(stats_lock_);
+    stats_.cloned_metadata_bytes += clone->GetCameraMetadataSize();
+  }
+
+  return clone;
+}
+
 status_t DepthProcessBlock::PrepareDepthRequestInfo(
-    const CaptureRequest& request, DepthRequestInfo* depth_request_info,
-    HalCameraMetadata* metadata, const HalCameraMetadata* color_metadata) {
+    const CaptureRequest& request, const HalCameraMetadata* settings,
+    const HalCameraMetadata* color_metadata,
+    DepthRequestInfo* depth_request_info,
+    std::unique_ptr<HalCameraMetadata>* depth_settings) {
   ATRACE_CALL();
 
   if (depth_request_info == nullptr) {
@@ -663,7 +1081,7 @@ status_t DepthProcessBlock::PrepareDepthRequestInfo(
     return BAD_VALUE;
   }
 
-  status_t res = UpdateCropRegion(request, depth_request_info, metadata);
+  status_t res = UpdateCropRegion(settings, depth_request_info, depth_settings);
   if (res != OK) {
     ALOGE("%s: Failed to update crop region.", __FUNCTION__);
     return UNKNOWN_ERROR;
@@ -694,6 +1112,12 @@ status_t DepthProcessBlock::PrepareDepthRequestInfo(
     }
   }
 
+  res = WaitForAcquireFences(request);
+  if (res != OK) {
+    ALOGE("%s: Waiting for the acquire fences failed.", __FUNCTION__);
+    return UNKNOWN_ERROR;
+  }
+
   res = MapDepthRequestBuffers(request, depth_request_info);
   if (res != OK) {
     ALOGE("%s: Failed to map buffers for depth request.", __FUNCTION__);
@@ -714,6 +1138,10 @@ status_t DepthProcessBlock::PrepareDepthRequestInfo(
       pending_request.frame_number = frame_number;
       pending_request.input_buffers = request.input_buffers;
       pending_request.output_buffers = request.output_buffers;
+      // The fences are signaled and owned by the caller.
+      for (auto& buffer : pending_request.output_buffers) {
+        buffer.acquire_fence = nullptr;
+      }
       auto& pending_depth_request =
           pending_depth_requests_[frame_number].depth_request;
       pending_depth_request = *depth_request_info;
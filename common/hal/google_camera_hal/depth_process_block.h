@@ -17,7 +17,10 @@
 #ifndef HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_DEPTH_PROCESS_BLOCK_H_
 #define HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_DEPTH_PROCESS_BLOCK_H_
 
+#include <condition_variable>
+#include <deque>
 #include <map>
+#include <thread>
 
 #include "depth_generator.h"
 #include "hwl_types.h"
@@ -34,6 +37,19 @@ namespace google_camera_hal {
 // for a logical camera consisting of one RGB and two IR camera sensors.
 class DepthProcessBlock : public ProcessBlock {
  public:
+  // Policy applied in async mode when the depth generator has the maximum
+  // number of requests in flight and a new request arrives.
+  enum class BackpressurePolicy {
+    // Block the request until a depth request completes.
+    kBlock,
+    // Queue the request. Once the queue is full, the oldest queued request is
+    // dropped and its depth buffer is returned with an error.
+    kDropOldest,
+    // Queue the request and drop all older queued requests, so the depth
+    // generator always continues with the latest request.
+    kSkipToLatest,
+  };
+
   struct DepthProcessBlockCreateData {
     // stream id of the internal yuv stream from RGB sensor
     int32_t rgb_internal_yuv_stream_id = -1;
@@ -41,12 +57,36 @@ class DepthProcessBlock : public ProcessBlock {
     int32_t ir1_internal_raw_stream_id = -1;
     // stream id of the internal raw stream from IR 2
     int32_t ir2_internal_raw_stream_id = -1;
+    // Maximum number of requests submitted to the depth generator at a time
+    // in async mode.
+    uint32_t max_in_flight_requests = 2;
+    // Policy applied when the depth generator falls behind in async mode.
+    BackpressurePolicy backpressure_policy = BackpressurePolicy::kBlock;
+  };
+
+  // Latency statistics of the depth requests processed so far.
+  struct DepthPipelineStats {
+    // Number of depth requests processed by the depth generator.
+    uint64_t completed_requests = 0;
+    // Number of depth requests dropped before reaching the depth generator.
+    uint64_t dropped_requests = 0;
+    // Time from receiving a request to submitting it to the depth generator.
+    nsecs_t total_queue_latency = 0;
+    nsecs_t max_queue_latency = 0;
+    // Time from submitting a request to receiving its depth result.
+    nsecs_t total_compute_latency = 0;
+    nsecs_t max_compute_latency = 0;
+    // Bytes of metadata cloned to build depth requests.
+    uint64_t cloned_metadata_bytes = 0;
   };
-  // Create a DepthProcessBlock.
+
+  // Create a DepthProcessBlock. If depth_generator is not nullptr, it will be
+  // used instead of loading the depth generator library.
   static std::unique_ptr<DepthProcessBlock> Create(
       CameraDeviceSessionHwl* device_session_hwl,
       HwlRequestBuffersFunc request_stream_buffers,
-      const DepthProcessBlockCreateData& create_data);
+      const DepthProcessBlockCreateData& create_data,
+      std::unique_ptr<DepthGenerator> depth_generator = nullptr);
 
   virtual ~DepthProcessBlock();
 
@@ -67,6 +107,9 @@ class DepthProcessBlock : public ProcessBlock {
   status_t Flush() override;
   // Override functions of ProcessBlock end.
 
+  // Return the latency statistics of the depth requests processed so far.
+  DepthPipelineStats GetDepthPipelineStats();
+
  protected:
   DepthProcessBlock(HwlRequestBuffersFunc request_stream_buffers_,
                     const DepthProcessBlockCreateData& create_data);
@@ -75,10 +118,43 @@ class DepthProcessBlock : public ProcessBlock {
   struct PendingDepthRequestInfo {
     CaptureRequest request;
     DepthRequestInfo depth_request;
+    // Metadata referenced by depth_request, which must outlive the request
+    // in the depth generator. settings holds the crop region in the IR
+    // sensor coordinates. color_metadata may be shared with other stages.
+    std::unique_ptr<HalCameraMetadata> settings;
+    std::shared_ptr<const HalCameraMetadata> color_metadata;
+    // Time the request was received by the process block.
+    nsecs_t receive_time = 0;
+    // Time the request was submitted to the depth generator. 0 if the request
+    // has not been submitted.
+    nsecs_t submit_time = 0;
+  };
+
+  // CPU mapping of a stream buffer. Mappings of internal stream buffers are
+  // cached across depth requests since the buffers are recycled from fixed
+  // pools owned by the HAL. Framework buffers can be freed and their handles
+  // reused at any time, so they are mapped for each request.
+  struct BufferMapping {
+    uint8_t* addr = nullptr;
+    uint32_t size = 0;
+    // Number of pending depth requests using this mapping.
+    uint32_t in_flight = 0;
+    // Whether to unmap the buffer once it is no longer in flight.
+    bool stale = false;
   };
 
+  // Buffers are identified by their buffer handle and fd.
+  using BufferMappingKey = std::pair<buffer_handle_t, int>;
+
   static constexpr int32_t kInvalidStreamId = -1;
   const uint32_t kDepthStreamMaxBuffers = 8;
+  // Maximum number of idle buffer mappings kept in the cache.
+  const uint32_t kMaxBufferMappings = 32;
+  // Maximum number of requests waiting for the depth generator with
+  // BackpressurePolicy::kDropOldest.
+  const uint32_t kMaxQueuedDepthRequests = 2;
+  // Time to wait for the acquire fence of an output buffer.
+  const int32_t kSyncWaitTimeMs = 5000;
 
   // Callback function to request stream buffer from camera device session
   const HwlRequestBuffersFunc request_stream_buffers_;
@@ -97,11 +173,21 @@ class DepthProcessBlock : public ProcessBlock {
   status_t UnmapBuffersForDepthGenerator(const StreamBuffer& stream_buffer,
                                          uint8_t* addr);
 
-  // Prepare a depth request info for the depth generator
-  status_t PrepareDepthRequestInfo(const CaptureRequest& request,
-                                   DepthRequestInfo* depth_request_info,
-                                   HalCameraMetadata* metadata,
-                                   const HalCameraMetadata* color_metadata);
+  // Return whether buffer mappings of stream_id can be cached, i.e. the
+  // stream is an internal stream whose buffers are owned by the HAL.
+  bool IsBufferMappingCacheable(int32_t stream_id) const;
+
+  // Unmap all cached buffers that are not in flight. Buffers still used by
+  // pending depth requests are unmapped once their requests complete.
+  void InvalidateBufferMappings();
+
+  // Prepare a depth request info for the depth generator. depth_settings is
+  // set to the settings passed to the depth generator, if any.
+  status_t PrepareDepthRequestInfo(
+      const CaptureRequest& request, const HalCameraMetadata* settings,
+      const HalCameraMetadata* color_metadata,
+      DepthRequestInfo* depth_request_info,
+      std::unique_ptr<HalCameraMetadata>* depth_settings);
 
   // Clean up a depth request info by unmapping the buffers
   status_t UnmapDepthRequestBuffers(uint32_t frame_number);
@@ -112,10 +198,20 @@ class DepthProcessBlock : public ProcessBlock {
       CameraDeviceSessionHwl* device_session_hwl);
 
   // Calculate the crop region info from the RGB sensor framework to the IR
-  // sensor framework. Update the depth_request_info with the updated result.
-  status_t UpdateCropRegion(const CaptureRequest& request,
+  // sensor framework. If settings has a crop region, depth_settings is set to
+  // a copy of settings with the updated crop region, and depth_request_info
+  // references it.
+  status_t UpdateCropRegion(const HalCameraMetadata* settings,
                             DepthRequestInfo* depth_request_info,
-                            HalCameraMetadata* metadata);
+                            std::unique_ptr<HalCameraMetadata>* depth_settings);
+
+  // Wait until the acquire fences of the output buffers are signaled. The
+  // fences are not closed since they are owned by the caller.
+  status_t WaitForAcquireFences(const CaptureRequest& request);
+
+  // Clone metadata and count the cloned bytes in the statistics.
+  std::unique_ptr<HalCameraMetadata> CloneMetadata(
+      const HalCameraMetadata* metadata);
 
   // Request the stream buffer for depth stream. incomplete_buffer is the
   // StreamBuffer that does not have a valid buffer handle and needs to be
@@ -130,13 +226,36 @@ class DepthProcessBlock : public ProcessBlock {
   // Submit a depth request through the blocking depth generator API
   status_t SubmitBlockingDepthRequest(const DepthRequestInfo& request_info);
 
-  // Submit a detph request through the asynchronized depth generator API
-  status_t SubmitAsyncDepthRequest(const DepthRequestInfo& request_info);
+  // Submit the pending depth request of frame frame_number through the
+  // asynchronized depth generator API. The request must own an in-flight slot.
+  status_t SubmitAsyncDepthRequest(uint32_t frame_number);
+
+  // Submit the pending depth request of frame frame_number if there is a free
+  // in-flight slot, otherwise apply the backpressure policy.
+  status_t EnqueueAsyncDepthRequest(uint32_t frame_number);
+
+  // Process an asynchronized depth result and release its in-flight slot.
+  // Called from the depth generator's result callback.
+  void ProcessAsyncDepthResult(DepthResultStatus result_status,
+                               uint32_t frame_number);
 
-  // Process the depth result of frame frame_number
+  // Submit the queued depth requests as in-flight slots are released. Runs on
+  // depth_refill_thread_.
+  void DepthRefillThreadLoop();
+
+  // Record the submit time of the pending depth request of frame frame_number
+  // and return its depth request info.
+  status_t MarkDepthRequestSubmitted(uint32_t frame_number,
+                                     DepthRequestInfo* request_info);
+
+  // Process the depth result of frame frame_number. Requests that were not
+  // submitted to the depth generator are counted as dropped.
   status_t ProcessDepthResult(DepthResultStatus result_status,
                               uint32_t frame_number);
 
+  // Return the depth buffers of the queued depth requests with an error.
+  void DropQueuedDepthRequests();
+
   // Map all buffers needed by a depth request from request
   status_t MapDepthRequestBuffers(const CaptureRequest& request,
                                   DepthRequestInfo* depth_request_info);
@@ -201,6 +320,44 @@ class DepthProcessBlock : public ProcessBlock {
 
   // Guarding async depth generator API calls and the result processing calls
   std::mutex depth_generator_api_lock_;
+
+  std::mutex buffer_mappings_lock_;
+  // Cached buffer mappings. Must be protected by buffer_mappings_lock_.
+  std::map<BufferMappingKey, BufferMapping> buffer_mappings_;
+
+  // Maximum number of requests submitted to the depth generator at a time
+  uint32_t max_in_flight_requests_ = 2;
+
+  // Policy applied when the depth generator falls behind
+  BackpressurePolicy backpressure_policy_ = BackpressurePolicy::kBlock;
+
+  std::mutex depth_window_lock_;
+
+  // Notified when an in-flight slot is released.
+  std::condition_variable depth_window_condition_;
+
+  // Number of requests submitted to the depth generator. Must be protected by
+  // depth_window_lock_.
+  uint32_t in_flight_depth_requests_ = 0;
+
+  // Frame numbers of the requests waiting for an in-flight slot, oldest
+  // first. Must be protected by depth_window_lock_.
+  std::deque<uint32_t> queued_depth_frames_;
+
+  // Notified when a request is queued or an in-flight slot is released.
+  std::condition_variable depth_refill_condition_;
+
+  // Whether depth_refill_thread_ should exit. Must be protected by
+  // depth_window_lock_.
+  bool depth_refill_thread_exiting_ = false;
+
+  // Thread submitting the queued depth requests in async mode.
+  std::thread depth_refill_thread_;
+
+  std::mutex stats_lock_;
+
+  // Depth request statistics. Must be protected by stats_lock_.
+  DepthPipelineStats stats_;
 };
 
 }  // namespace google_camera_hal
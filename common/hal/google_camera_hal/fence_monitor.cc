@@ -0,0 +1,337 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_FenceMonitor"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "fence_monitor.h"
+
+namespace android {
+namespace google_camera_hal {
+
+namespace {
+// Maximum number of events handled by one epoll_wait().
+constexpr int kMaxEpollEvents = 16;
+}  // namespace
+
+std::unique_ptr<FenceMonitor> FenceMonitor::Create(int32_t timeout_ms) {
+  ATRACE_CALL();
+  if (timeout_ms < 0) {
+    ALOGE("%s: Invalid timeout_ms %d.", __FUNCTION__, timeout_ms);
+    return nullptr;
+  }
+
+  auto monitor = std::unique_ptr<FenceMonitor>(new FenceMonitor(timeout_ms));
+  if (monitor == nullptr) {
+    ALOGE("%s: Creating FenceMonitor failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  status_t res = monitor->Initialize();
+  if (res != OK) {
+    ALOGE("%s: Initializing FenceMonitor failed: %s(%d)", __FUNCTION__,
+          strerror(-res), res);
+    return nullptr;
+  }
+
+  return monitor;
+}
+
+FenceMonitor::FenceMonitor(int32_t timeout_ms) : kTimeoutMs(timeout_ms) {
+}
+
+FenceMonitor::~FenceMonitor() {
+  ATRACE_CALL();
+  if (monitor_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(fence_lock_);
+      monitor_thread_exiting_ = true;
+    }
+    WakeUpMonitorThread();
+    monitor_thread_.join();
+  }
+
+  if (wake_up_fd_ >= 0) {
+    close(wake_up_fd_);
+  }
+
+  if (epoll_fd_ >= 0) {
+    close(epoll_fd_);
+  }
+}
+
+status_t FenceMonitor::Initialize() {
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    status_t res = -errno;
+    ALOGE("%s: Creating an epoll instance failed: %s", __FUNCTION__,
+          strerror(-res));
+    return res;
+  }
+
+  wake_up_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_up_fd_ < 0) {
+    status_t res = -errno;
+    ALOGE("%s: Creating the wake-up event failed: %s", __FUNCTION__,
+          strerror(-res));
+    return res;
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wake_up_fd_;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_up_fd_, &event) != 0) {
+    status_t res = -errno;
+    ALOGE("%s: Monitoring the wake-up event failed: %s", __FUNCTION__,
+          strerror(-res));
+    return res;
+  }
+
+  monitor_thread_ = std::thread([this] { MonitorThreadLoop(); });
+  return OK;
+}
+
+status_t FenceMonitor::WaitForFences(
+    const std::vector<const native_handle_t*>& fences, FenceCallback callback) {
+  ATRACE_CALL();
+  if (callback == nullptr) {
+    ALOGE("%s: callback is nullptr.", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  FenceGroup group;
+  for (auto& fence : fences) {
+    if (fence == nullptr) {
+      continue;
+    }
+
+    for (int i = 0; i < fence->numFds; i++) {
+      int fd = fcntl(fence->data[i], F_DUPFD_CLOEXEC, 0);
+      if (fd < 0) {
+        status_t res = -errno;
+        ALOGE("%s: Duplicating fence fd %d failed: %s", __FUNCTION__,
+              fence->data[i], strerror(-res));
+        for (auto& group_fd : group.fds) {
+          close(group_fd);
+        }
+        return res;
+      }
+      group.fds.push_back(fd);
+    }
+  }
+
+  if (group.fds.empty()) {
+    callback(OK);
+    return OK;
+  }
+
+  std::lock_guard<std::mutex> lock(fence_lock_);
+  if (monitor_thread_exiting_) {
+    ALOGE("%s: The monitor thread is exiting.", __FUNCTION__);
+    RemoveGroupFdsLocked(&group);
+    return DEAD_OBJECT;
+  }
+
+  uint64_t group_id = next_group_id_++;
+  for (auto& fd : group.fds) {
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+      status_t res = -errno;
+      ALOGE("%s: Monitoring fence fd %d failed: %s", __FUNCTION__, fd,
+            strerror(-res));
+      RemoveGroupFdsLocked(&group);
+      return res;
+    }
+    fd_groups_[fd] = group_id;
+  }
+
+  // Every group gets the same timeout, so a new group never has the earliest
+  // deadline unless it's the only one.
+  bool need_wake_up = fence_groups_.empty();
+  group.deadline = systemTime() + ms2ns(kTimeoutMs);
+  group.callback = std::move(callback);
+  fence_groups_.emplace(group_id, std::move(group));
+  if (need_wake_up) {
+    WakeUpMonitorThread();
+  }
+
+  return OK;
+}
+
+void FenceMonitor::WakeUpMonitorThread() {
+  uint64_t value = 1;
+  if (write(wake_up_fd_, &value, sizeof(value)) != sizeof(value)) {
+    ALOGE("%s: Waking up the monitor thread failed: %s", __FUNCTION__,
+          strerror(errno));
+  }
+}
+
+int FenceMonitor::GetEpollTimeoutMsLocked(nsecs_t now) const {
+  if (fence_groups_.empty()) {
+    return -1;
+  }
+
+  nsecs_t deadline = fence_groups_.begin()->second.deadline;
+  for (auto& [group_id, group] : fence_groups_) {
+    deadline = std::min(deadline, group.deadline);
+  }
+
+  // Round up so the monitor thread doesn't wake up just before the deadline.
+  nsecs_t timeout = std::max(deadline - now, static_cast<nsecs_t>(0));
+  return static_cast<int>(ns2ms(timeout + ms2ns(1) - 1));
+}
+
+void FenceMonitor::RemoveGroupFdsLocked(FenceGroup* group) {
+  for (auto& fd : group->fds) {
+    if (fd_groups_.erase(fd) > 0) {
+      epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+    close(fd);
+  }
+  group->fds.clear();
+}
+
+void FenceMonitor::HandleFenceEventLocked(
+    int fd, bool has_error,
+    std::vector<std::pair<FenceGroup, status_t>>* completed_groups) {
+  auto fd_iter = fd_groups_.find(fd);
+  if (fd_iter == fd_groups_.end()) {
+    // The group of fd was completed earlier in the same epoll_wait().
+    return;
+  }
+
+  auto group_iter = fence_groups_.find(fd_iter->second);
+  fd_groups_.erase(fd_iter);
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  if (group_iter == fence_groups_.end()) {
+    ALOGE("%s: Cannot find the group of fence fd %d.", __FUNCTION__, fd);
+    return;
+  }
+
+  FenceGroup& group = group_iter->second;
+  group.fds.erase(std::remove(group.fds.begin(), group.fds.end(), fd),
+                  group.fds.end());
+  if (has_error) {
+    ALOGE("%s: Waiting for fence fd %d failed.", __FUNCTION__, fd);
+    RemoveGroupFdsLocked(&group);
+    completed_groups->emplace_back(std::move(group), UNKNOWN_ERROR);
+    fence_groups_.erase(group_iter);
+  } else if (group.fds.empty()) {
+    completed_groups->emplace_back(std::move(group), OK);
+    fence_groups_.erase(group_iter);
+  }
+}
+
+void FenceMonitor::RemoveExpiredGroupsLocked(
+    nsecs_t now,
+    std::vector<std::pair<FenceGroup, status_t>>* completed_groups) {
+  for (auto iter = fence_groups_.begin(); iter != fence_groups_.end();) {
+    if (iter->second.deadline > now) {
+      iter++;
+      continue;
+    }
+
+    ALOGE("%s: %zu fences are not signaled after %d ms.", __FUNCTION__,
+          iter->second.fds.size(), kTimeoutMs);
+    RemoveGroupFdsLocked(&iter->second);
+    completed_groups->emplace_back(std::move(iter->second), TIMED_OUT);
+    iter = fence_groups_.erase(iter);
+  }
+}
+
+void FenceMonitor::MonitorThreadLoop() {
+  epoll_event events[kMaxEpollEvents];
+  std::vector<std::pair<FenceGroup, status_t>> completed_groups;
+  while (true) {
+    int timeout_ms;
+    {
+      std::lock_guard<std::mutex> lock(fence_lock_);
+      if (monitor_thread_exiting_) {
+        break;
+      }
+      timeout_ms = GetEpollTimeoutMsLocked(systemTime());
+    }
+
+    int num_events = epoll_wait(epoll_fd_, events, kMaxEpollEvents, timeout_ms);
+    if (num_events < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ALOGE("%s: epoll_wait failed: %s", __FUNCTION__, strerror(errno));
+      break;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(fence_lock_);
+      for (int i = 0; i < num_events; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wake_up_fd_) {
+          uint64_t value;
+          if (read(wake_up_fd_, &value, sizeof(value)) != sizeof(value)) {
+            ALOGW("%s: Reading the wake-up event failed: %s", __FUNCTION__,
+                  strerror(errno));
+          }
+          continue;
+        }
+
+        bool has_error = (events[i].events & EPOLLIN) == 0;
+        HandleFenceEventLocked(fd, has_error, &completed_groups);
+      }
+
+      RemoveExpiredGroupsLocked(systemTime(), &completed_groups);
+    }
+
+    // Callbacks may register new fences, so they are invoked without
+    // fence_lock_.
+    for (auto& [group, res] : completed_groups) {
+      ATRACE_NAME("FenceMonitor callback");
+      group.callback(res);
+    }
+    completed_groups.clear();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(fence_lock_);
+    monitor_thread_exiting_ = true;
+    for (auto& [group_id, group] : fence_groups_) {
+      RemoveGroupFdsLocked(&group);
+      completed_groups.emplace_back(std::move(group), DEAD_OBJECT);
+    }
+    fence_groups_.clear();
+  }
+
+  for (auto& [group, res] : completed_groups) {
+    group.callback(res);
+  }
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_FENCE_MONITOR_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_FENCE_MONITOR_H_
+
+#include <cutils/native_handle.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace google_camera_hal {
+
+// FenceMonitor waits for groups of sync fences on a single thread with one
+// epoll instance. A callback is invoked once all fences of its group are
+// signaled, so the threads registering fences never sleep on them.
+class FenceMonitor {
+ public:
+  // Invoked with OK when all fences of a group are signaled, TIMED_OUT if they
+  // are not signaled in time, or another error if waiting for them failed.
+  using FenceCallback = std::function<void(status_t res)>;
+
+  // Create a FenceMonitor that gives up on a group of fences after
+  // timeout_ms milliseconds.
+  static std::unique_ptr<FenceMonitor> Create(int32_t timeout_ms);
+
+  // Invoke the callbacks of the pending groups with DEAD_OBJECT and stop the
+  // monitor thread.
+  virtual ~FenceMonitor();
+
+  // Wait for fences to be signaled and then invoke callback on the monitor
+  // thread. The fences are duplicated, so the caller keeps ownership of them.
+  // nullptr fences and fences without a file descriptor are treated as
+  // signaled. If no fence needs to be waited for, callback is invoked on the
+  // calling thread before WaitForFences returns.
+  status_t WaitForFences(const std::vector<const native_handle_t*>& fences,
+                         FenceCallback callback);
+
+ protected:
+  explicit FenceMonitor(int32_t timeout_ms);
+
+ private:
+  // A group of fences registered by one WaitForFences() call.
+  struct FenceGroup {
+    // File descriptors that are not signaled yet.
+    std::vector<int> fds;
+    nsecs_t deadline = 0;
+    FenceCallback callback;
+  };
+
+  // Create the epoll instance and the wake-up event, and start the monitor
+  // thread.
+  status_t Initialize();
+
+  // Wake up the monitor thread to re-evaluate the deadlines or exit.
+  void WakeUpMonitorThread();
+
+  void MonitorThreadLoop();
+
+  // Return the epoll timeout until the earliest deadline.
+  // Must be protected by fence_lock_.
+  int GetEpollTimeoutMsLocked(nsecs_t now) const;
+
+  // Handle an event on fd. Completed groups are moved to completed_groups.
+  // Must be protected by fence_lock_.
+  void HandleFenceEventLocked(
+      int fd, bool has_error,
+      std::vector<std::pair<FenceGroup, status_t>>* completed_groups);
+
+  // Move the groups whose deadline passed to completed_groups.
+  // Must be protected by fence_lock_.
+  void RemoveExpiredGroupsLocked(
+      nsecs_t now,
+      std::vector<std::pair<FenceGroup, status_t>>* completed_groups);
+
+  // Stop monitoring and close the remaining fds of a group.
+  // Must be protected by fence_lock_.
+  void RemoveGroupFdsLocked(FenceGroup* group);
+
+  const int32_t kTimeoutMs;
+
+  int epoll_fd_ = -1;
+
+  // Event used to wake up the monitor thread.
+  int wake_up_fd_ = -1;
+
+  std::thread monitor_thread_;
+
+  std::mutex fence_lock_;
+
+  // Map from group ID to the group. Must be protected by fence_lock_.
+  std::unordered_map<uint64_t, FenceGroup> fence_groups_;
+
+  // Map from a monitored fd to the ID of its group. Must be protected by
+  // fence_lock_.
+  std::unordered_map<int, uint64_t> fd_groups_;
+
+  // ID of the next group. Must be protected by fence_lock_.
+  uint64_t next_group_id_ = 0;
+
+  // Must be protected by fence_lock_.
+  bool monitor_thread_exiting_ = false;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_FENCE_MONITOR_H_
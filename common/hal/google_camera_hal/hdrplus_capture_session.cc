@@ -425,6 +425,13 @@ status_t HdrplusCaptureSession::SetupHdrplusProcessChain(
     return UNKNOWN_ERROR;
   }
   result_processor->SetResultCallback(process_capture_result, notify);
+  // The request processor owns the process block that owns the result
+  // processor, so it outlives the callback.
+  result_processor->SetZslBuffersReturnedCallback(
+      [request_processor = static_cast<HdrplusRequestProcessor*>(
+           hdrplus_request_processor_.get())](uint32_t frame_number) {
+        request_processor->NotifyZslBuffersReturned(frame_number);
+      });
 
   status_t res = ConfigureHdrplusStreams(
       stream_config, hdrplus_request_processor_.get(), process_block.get());
@@ -17,9 +17,14 @@
 //#define LOG_NDEBUG 0
 #define LOG_TAG "GCH_HdrplusRequestProcessor"
 #define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <cutils/properties.h>
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include <inttypes.h>
+
+#include <algorithm>
+
 #include "hdrplus_request_processor.h"
 #include "vendor_tag_defs.h"
 
@@ -54,6 +59,41 @@ std::unique_ptr<HdrplusRequestProcessor> HdrplusRequestProcessor::Create(
   return request_processor;
 }
 
+HdrplusRequestProcessor::~HdrplusRequestProcessor() {
+  // Destroy the process block first so no raw buffers are returned after the
+  // admission states are destroyed.
+  {
+    std::lock_guard<std::mutex> lock(process_block_lock_);
+    process_block_ = nullptr;
+  }
+
+  Stats stats = GetStats();
+  uint64_t total_requests = stats.hdrplus_requests + stats.fallback_requests;
+  if (total_requests == 0) {
+    return;
+  }
+
+  ALOGI("%s: %" PRIu64 " HDR+ requests (%" PRIu64 " queued), %" PRIu64
+        " fell back to realtime (%.1f%%).",
+        __FUNCTION__, stats.hdrplus_requests, stats.queued_requests,
+        stats.fallback_requests,
+        100.0 * stats.fallback_requests / total_requests);
+  if (stats.completed_requests > 0) {
+    ALOGI("%s: HDR+ latency avg %" PRId64 " ms, max %" PRId64 " ms.",
+          __FUNCTION__,
+          ns2ms(stats.total_latency_ns /
+                static_cast<nsecs_t>(stats.completed_requests)),
+          ns2ms(stats.max_latency_ns));
+  }
+  if (stats.shot_to_shot_count > 0) {
+    ALOGI("%s: HDR+ shot-to-shot avg %" PRId64 " ms, max %" PRId64 " ms.",
+          __FUNCTION__,
+          ns2ms(stats.total_shot_to_shot_ns /
+                static_cast<nsecs_t>(stats.shot_to_shot_count)),
+          ns2ms(stats.max_shot_to_shot_ns));
+  }
+}
+
 status_t HdrplusRequestProcessor::Initialize(
     CameraDeviceSessionHwl* device_session_hwl, int32_t raw_stream_id) {
   ATRACE_CALL();
@@ -100,6 +140,17 @@ status_t HdrplusRequestProcessor::Initialize(
   ALOGI("%s: HDR+ payload_frames_: %d", __FUNCTION__, payload_frames_);
   raw_stream_id_ = raw_stream_id;
 
+  int32_t max_in_flight_requests = property_get_int32(
+      "persist.camera.hdrplus.max_inflight", kDefaultMaxInFlightRequests);
+  if (max_in_flight_requests > 0) {
+    max_in_flight_requests_ = max_in_flight_requests;
+  } else {
+    ALOGW("%s: Ignoring invalid max in-flight HDR+ requests %d", __FUNCTION__,
+          max_in_flight_requests);
+  }
+  ALOGI("%s: Max in-flight HDR+ requests %u", __FUNCTION__,
+        max_in_flight_requests_);
+
   return OK;
 }
 
@@ -160,18 +211,82 @@ status_t HdrplusRequestProcessor::SetProcessBlock(
   return OK;
 }
 
-bool HdrplusRequestProcessor::IsReadyForNextRequest() {
+bool HdrplusRequestProcessor::AdmitRequest(uint32_t frame_number) {
   ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(admission_lock_);
   if (internal_stream_manager_ == nullptr) {
     ALOGW("%s: internal_stream_manager_ nullptr", __FUNCTION__);
+    stats_.fallback_requests++;
     return false;
   }
-  if (internal_stream_manager_->IsPendingBufferEmpty(raw_stream_id_) == false) {
+
+  if (in_flight_requests_.size() >= max_in_flight_requests_) {
+    ALOGD("%s: frame %u: %zu HDR+ requests are in flight.", __FUNCTION__,
+          frame_number, in_flight_requests_.size());
+    stats_.fallback_requests++;
     return false;
   }
+
+  InFlightRequest in_flight_request = {
+      .admitted_time = systemTime(),
+      .queued = !in_flight_requests_.empty(),
+  };
+  in_flight_requests_[frame_number] = in_flight_request;
   return true;
 }
 
+void HdrplusRequestProcessor::RecordProcessedRequest(uint32_t frame_number) {
+  std::lock_guard<std::mutex> lock(admission_lock_);
+  stats_.hdrplus_requests++;
+  auto request_iter = in_flight_requests_.find(frame_number);
+  if (request_iter != in_flight_requests_.end() &&
+      request_iter->second.queued) {
+    stats_.queued_requests++;
+  }
+}
+
+void HdrplusRequestProcessor::RejectAdmittedRequest(uint32_t frame_number) {
+  std::lock_guard<std::mutex> lock(admission_lock_);
+  auto request_iter = in_flight_requests_.find(frame_number);
+  if (request_iter != in_flight_requests_.end()) {
+    in_flight_requests_.erase(request_iter);
+  }
+  stats_.fallback_requests++;
+}
+
+void HdrplusRequestProcessor::NotifyZslBuffersReturned(uint32_t frame_number) {
+  ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(admission_lock_);
+  auto request_iter = in_flight_requests_.find(frame_number);
+  if (request_iter == in_flight_requests_.end()) {
+    ALOGW("%s: frame %u is not an in-flight HDR+ request.", __FUNCTION__,
+          frame_number);
+    return;
+  }
+
+  nsecs_t now = systemTime();
+  nsecs_t latency = now - request_iter->second.admitted_time;
+  stats_.completed_requests++;
+  stats_.total_latency_ns += latency;
+  stats_.max_latency_ns = std::max(stats_.max_latency_ns, latency);
+
+  if (request_iter->second.queued && last_completed_time_ > 0) {
+    nsecs_t shot_to_shot = now - last_completed_time_;
+    stats_.shot_to_shot_count++;
+    stats_.total_shot_to_shot_ns += shot_to_shot;
+    stats_.max_shot_to_shot_ns =
+        std::max(stats_.max_shot_to_shot_ns, shot_to_shot);
+  }
+
+  last_completed_time_ = now;
+  in_flight_requests_.erase(request_iter);
+}
+
+HdrplusRequestProcessor::Stats HdrplusRequestProcessor::GetStats() {
+  std::lock_guard<std::mutex> lock(admission_lock_);
+  return stats_;
+}
+
 void HdrplusRequestProcessor::RemoveJpegMetadata(
     std::vector<std::unique_ptr<HalCameraMetadata>>* metadata) {
   const uint32_t tags[] = {
@@ -207,7 +322,7 @@ status_t HdrplusRequestProcessor::ProcessRequest(const CaptureRequest& request)
     return NO_INIT;
   }
 
-  if (IsReadyForNextRequest() == false) {
+  if (!AdmitRequest(request.frame_number)) {
     return BAD_VALUE;
   }
 
@@ -220,13 +335,15 @@ status_t HdrplusRequestProcessor::ProcessRequest(const CaptureRequest& request)
         HalCameraMetadata::Clone(physical_metadata.get());
   }
 
-  // Get multiple raw buffer and metadata from internal stream as input
+  // Reserve multiple raw buffers and metadata from internal stream as input
+  // until the result of this request returns them.
   status_t result = internal_stream_manager_->GetMostRecentStreamBuffer(
-      raw_stream_id_, &(block_request.input_buffers),
+      raw_stream_id_, request.frame_number, &(block_request.input_buffers),
       &(block_request.input_buffer_metadata), payload_frames_);
   if (result != OK) {
     ALOGE("%s: frame:%d GetStreamBuffer failed.", __FUNCTION__,
           request.frame_number);
+    RejectAdmittedRequest(request.frame_number);
     return UNKNOWN_ERROR;
   }
 
@@ -236,7 +353,18 @@ status_t HdrplusRequestProcessor::ProcessRequest(const CaptureRequest& request)
   ALOGD("%s: frame number %u is an HDR+ request.", __FUNCTION__,
         request.frame_number);
 
-  return process_block_->ProcessRequests(block_requests, request);
+  result = process_block_->ProcessRequests(block_requests, request);
+  if (result != OK) {
+    ALOGE("%s: frame:%u Processing the HDR+ request failed: %s(%d)",
+          __FUNCTION__, request.frame_number, strerror(-result), result);
+    internal_stream_manager_->ReturnZslStreamBuffers(request.frame_number,
+                                                     raw_stream_id_);
+    RejectAdmittedRequest(request.frame_number);
+    return result;
+  }
+
+  RecordProcessedRequest(request.frame_number);
+  return OK;
 }
 
 status_t HdrplusRequestProcessor::Flush() {
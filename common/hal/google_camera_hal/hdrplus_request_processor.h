@@ -17,6 +17,10 @@
 #ifndef HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_HDRPLUS_REQUEST_PROCESSOR_H_
 #define HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_HDRPLUS_REQUEST_PROCESSOR_H_
 
+#include <utils/Timers.h>
+
+#include <map>
+
 #include "process_block.h"
 #include "request_processor.h"
 
@@ -26,15 +30,41 @@ namespace google_camera_hal {
 // HdrplusRequestProcessor implements a RequestProcessor that adds
 // internal raw stream as input stream to request and forwards the request to
 // its ProcessBlock.
+// Several HDR+ requests can be in flight at the same time. Each of them
+// reserves its raw buffers when it's processed, so later requests cannot take
+// them, and the process block processes the requests in order. An HDR+ request
+// is rejected, and falls back to the realtime path, if too many HDR+ requests
+// are in flight or there are not enough raw buffers.
 class HdrplusRequestProcessor : public RequestProcessor {
  public:
+  struct Stats {
+    // Number of HDR+ requests processed.
+    uint64_t hdrplus_requests = 0;
+    // Number of HDR+ requests processed while other HDR+ requests were in
+    // flight.
+    uint64_t queued_requests = 0;
+    // Number of HDR+ requests rejected, which fall back to the realtime path.
+    uint64_t fallback_requests = 0;
+    // Number of HDR+ requests whose raw buffers were returned, and their
+    // total and maximum latency from being admitted to returning the raw
+    // buffers.
+    uint64_t completed_requests = 0;
+    nsecs_t total_latency_ns = 0;
+    nsecs_t max_latency_ns = 0;
+    // Number of queued HDR+ requests completed after the previous HDR+
+    // request, and the total and maximum time between the two completions.
+    uint64_t shot_to_shot_count = 0;
+    nsecs_t total_shot_to_shot_ns = 0;
+    nsecs_t max_shot_to_shot_ns = 0;
+  };
+
   // device_session_hwl is owned by the caller and must be valid during the
   // lifetime of this HdrplusRequestProcessor.
   static std::unique_ptr<HdrplusRequestProcessor> Create(
       CameraDeviceSessionHwl* device_session_hwl, int32_t raw_stream_id,
       uint32_t physical_camera_id);
 
-  virtual ~HdrplusRequestProcessor() = default;
+  virtual ~HdrplusRequestProcessor();
 
   // Override functions of RequestProcessor start.
   status_t ConfigureStreams(
@@ -51,6 +81,12 @@ class HdrplusRequestProcessor : public RequestProcessor {
   status_t Flush() override;
   // Override functions of RequestProcessor end.
 
+  // Notify that the raw buffers of the HDR+ request of frame_number were
+  // returned, which completes the HDR+ request and admits a new one.
+  void NotifyZslBuffersReturned(uint32_t frame_number);
+
+  Stats GetStats();
+
  protected:
   HdrplusRequestProcessor(uint32_t physical_camera_id)
       : kCameraId(physical_camera_id){};
@@ -59,9 +95,32 @@ class HdrplusRequestProcessor : public RequestProcessor {
   // Physical camera ID of request processor.
   const uint32_t kCameraId;
 
+  // Default maximum number of HDR+ requests in flight.
+  static constexpr uint32_t kDefaultMaxInFlightRequests = 2;
+
+  struct InFlightRequest {
+    // Time when the request was admitted.
+    nsecs_t admitted_time = 0;
+    // Whether other HDR+ requests were in flight when the request was
+    // admitted.
+    bool queued = false;
+  };
+
   status_t Initialize(CameraDeviceSessionHwl* device_session_hwl,
                       int32_t raw_stream_id);
-  bool IsReadyForNextRequest();
+
+  // Admit the HDR+ request of frame_number if fewer than
+  // max_in_flight_requests_ HDR+ requests are in flight. Count a fallback
+  // request if it's not admitted.
+  bool AdmitRequest(uint32_t frame_number);
+
+  // Remove an admitted HDR+ request that failed to be processed and count it
+  // as a fallback request.
+  void RejectAdmittedRequest(uint32_t frame_number);
+
+  // Count an admitted HDR+ request that was sent to the process block.
+  void RecordProcessedRequest(uint32_t frame_number);
+
   // For CTS (android.hardware.camera2.cts.StillCaptureTest#testJpegExif)
   // Remove JPEG metadata (THUMBNAIL_SIZE, ORIENTATION...) from internal raw
   // buffer in order to get these metadata from HDR+ capture request directly
@@ -78,6 +137,22 @@ class HdrplusRequestProcessor : public RequestProcessor {
   uint32_t active_array_height_ = 0;
   // The number of HDR+ input buffers
   uint32_t payload_frames_ = 0;
+
+  // Maximum number of HDR+ requests in flight.
+  uint32_t max_in_flight_requests_ = kDefaultMaxInFlightRequests;
+
+  std::mutex admission_lock_;
+
+  // Map from frame number to HDR+ requests that hold raw buffers. Protected by
+  // admission_lock_.
+  std::map<uint32_t, InFlightRequest> in_flight_requests_;
+
+  // Time when the raw buffers of the last HDR+ request were returned.
+  // Protected by admission_lock_.
+  nsecs_t last_completed_time_ = 0;
+
+  // Protected by admission_lock_.
+  Stats stats_;
 };
 
 }  // namespace google_camera_hal
@@ -59,6 +59,13 @@ void HdrplusResultProcessor::SetResultCallback(
   notify_ = notify;
 }
 
+void HdrplusResultProcessor::SetZslBuffersReturnedCallback(
+    ZslBuffersReturnedFunc zsl_buffers_returned) {
+  ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(callback_lock_);
+  zsl_buffers_returned_ = zsl_buffers_returned;
+}
+
 status_t HdrplusResultProcessor::AddPendingRequests(
     const std::vector<ProcessBlockRequest>& process_block_requests,
     const CaptureRequest& remaining_session_request) {
@@ -90,21 +97,25 @@ void HdrplusResultProcessor::ProcessResult(ProcessBlockResult block_result) {
     return;
   }
 
-  // Return raw buffer to internal stream manager and remove it from result
+  // Return raw buffer to internal stream manager and remove it from result.
+  // Only the first result with output buffers returns the raw buffers of a
+  // frame.
   status_t res;
-  if (result->output_buffers.size() != 0 &&
-      internal_stream_manager_->IsPendingBufferEmpty(raw_stream_id_) == false) {
+  if (result->output_buffers.size() != 0) {
     res = internal_stream_manager_->ReturnZslStreamBuffers(result->frame_number,
                                                            raw_stream_id_);
-    if (res != OK) {
+    if (res == OK) {
+      ALOGI("%s: (%d)ReturnZslStreamBuffers ok", __FUNCTION__,
+            result->frame_number);
+      result->input_buffers.clear();
+      if (zsl_buffers_returned_ != nullptr) {
+        zsl_buffers_returned_(result->frame_number);
+      }
+    } else if (res != NAME_NOT_FOUND) {
       ALOGE("%s: (%d)ReturnZslStreamBuffers fail", __FUNCTION__,
             result->frame_number);
       return;
-    } else {
-      ALOGI("%s: (%d)ReturnZslStreamBuffers ok", __FUNCTION__,
-            result->frame_number);
     }
-    result->input_buffers.clear();
   }
 
   if (result->result_metadata) {
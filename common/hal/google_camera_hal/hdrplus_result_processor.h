@@ -28,6 +28,10 @@ namespace google_camera_hal {
 // raw buffer to its callback functions.
 class HdrplusResultProcessor : public ResultProcessor {
  public:
+  // Invoked after the raw buffers of the HDR+ request of frame_number are
+  // returned to the internal stream manager.
+  using ZslBuffersReturnedFunc = std::function<void(uint32_t frame_number)>;
+
   static std::unique_ptr<HdrplusResultProcessor> Create(
       InternalStreamManager* internal_stream_manager, int32_t raw_stream_id);
 
@@ -50,6 +54,11 @@ class HdrplusResultProcessor : public ResultProcessor {
   status_t FlushPendingRequests() override;
   // Override functions of ResultProcessor end.
 
+  // Set the callback to invoke after the raw buffers of an HDR+ request are
+  // returned to the internal stream manager.
+  void SetZslBuffersReturnedCallback(
+      ZslBuffersReturnedFunc zsl_buffers_returned);
+
  protected:
   HdrplusResultProcessor(InternalStreamManager* internal_stream_manager,
                          int32_t raw_stream_id);
@@ -60,6 +69,7 @@ class HdrplusResultProcessor : public ResultProcessor {
   // The following callbacks must be protected by callback_lock_.
   ProcessCaptureResultFunc process_capture_result_;
   NotifyFunc notify_;
+  ZslBuffersReturnedFunc zsl_buffers_returned_;
 
   InternalStreamManager* internal_stream_manager_;
   int32_t raw_stream_id_ = -1;
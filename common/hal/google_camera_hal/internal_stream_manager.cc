@@ -20,6 +20,7 @@
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include "cached_buffer_allocator.h"
 #include "hal_utils.h"
 #include "internal_stream_manager.h"
 
@@ -42,6 +43,11 @@ std::unique_ptr<InternalStreamManager> InternalStreamManager::Create(
 }
 
 void InternalStreamManager::Initialize(IHalBufferAllocator* buffer_allocator) {
+  // Fall back to the shared cache of HWL buffers so vendor buffers freed by a
+  // previous stream configuration can be reused.
+  if (buffer_allocator == nullptr) {
+    buffer_allocator = CachedBufferAllocator::GetHwlInstance();
+  }
   hwl_buffer_allocator_ = buffer_allocator;
 }
 
@@ -71,6 +77,35 @@ int32_t InternalStreamManager::GetBufferManagerOwnerIdLocked(int32_t stream_id)
   return owner_stream_id;
 }
 
+void InternalStreamManager::UpdateRoutingTableLocked() {
+  auto routing_table = std::make_shared<BufferManagerRoutingTable>();
+  for (auto& [stream_id, buffer_manager] : buffer_managers_) {
+    routing_table->emplace(stream_id, buffer_manager);
+  }
+
+  for (auto& [stream_id, owner_stream_id] : shared_stream_owner_ids_) {
+    auto buffer_manager_it = buffer_managers_.find(owner_stream_id);
+    if (buffer_manager_it != buffer_managers_.end()) {
+      routing_table->emplace(stream_id, buffer_manager_it->second);
+    }
+  }
+
+  std::shared_ptr<const BufferManagerRoutingTable> published_table =
+      std::move(routing_table);
+  std::atomic_store(&routing_table_, std::move(published_table));
+}
+
+std::shared_ptr<ZslBufferManager> InternalStreamManager::GetBufferManager(
+    int32_t stream_id) const {
+  auto routing_table = std::atomic_load(&routing_table_);
+  auto buffer_manager_it = routing_table->find(stream_id);
+  if (buffer_manager_it == routing_table->end()) {
+    return nullptr;
+  }
+
+  return buffer_manager_it->second;
+}
+
 status_t InternalStreamManager::RegisterNewInternalStream(const Stream& stream,
                                                           int32_t* stream_id) {
   ATRACE_CALL();
@@ -129,8 +164,13 @@ status_t InternalStreamManager::AllocateBuffers(const HalStream& hal_stream,
                                                 bool need_vendor_buffer) {
   ATRACE_CALL();
   std::lock_guard<std::mutex> lock(stream_mutex_);
-  return AllocateBuffersLocked(hal_stream, additional_num_buffers,
-                               need_vendor_buffer);
+  status_t res = AllocateBuffersLocked(hal_stream, additional_num_buffers,
+                                       need_vendor_buffer);
+  if (res == OK) {
+    UpdateRoutingTableLocked();
+  }
+
+  return res;
 }
 
 status_t InternalStreamManager::AllocateBuffersLocked(
@@ -158,7 +198,7 @@ status_t InternalStreamManager::AllocateBuffersLocked(
     return res;
   }
 
-  auto buffer_manager = std::make_unique<ZslBufferManager>(
+  auto buffer_manager = std::make_shared<ZslBufferManager>(
       need_vendor_buffer ? hwl_buffer_allocator_ : nullptr);
   if (buffer_manager == nullptr) {
     ALOGE("%s: Failed to create a buffer manager for stream %d", __FUNCTION__,
@@ -287,6 +327,7 @@ status_t InternalStreamManager::AllocateSharedBuffers(
     shared_stream_owner_ids_[hal_streams[i].id] = hal_streams[0].id;
   }
 
+  UpdateRoutingTableLocked();
   return OK;
 }
 
@@ -355,14 +396,15 @@ void InternalStreamManager::FreeStream(int32_t stream_id) {
     // shared_stream_owner_ids_.
     shared_stream_owner_ids_.erase(stream_id);
   }
+
+  UpdateRoutingTableLocked();
 }
 
 status_t InternalStreamManager::GetStreamBuffer(int32_t stream_id,
                                                 StreamBuffer* buffer) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(stream_mutex_);
-
-  if (!IsStreamAllocatedLocked(stream_id)) {
+  auto buffer_manager = GetBufferManager(stream_id);
+  if (buffer_manager == nullptr) {
     ALOGE("%s: Stream %d was not allocated.", __FUNCTION__, stream_id);
     return ALREADY_EXISTS;
   }
@@ -372,17 +414,10 @@ status_t InternalStreamManager::GetStreamBuffer(int32_t stream_id,
     return BAD_VALUE;
   }
 
-  int32_t owner_stream_id = GetBufferManagerOwnerIdLocked(stream_id);
-  if (owner_stream_id == kInvalidStreamId) {
-    ALOGE("%s: Cannot find a owner stream ID for stream %d", __FUNCTION__,
-          stream_id);
-    return BAD_VALUE;
-  }
-
-  buffer->buffer = buffer_managers_[owner_stream_id]->GetEmptyBuffer();
+  buffer->buffer = buffer_manager->GetEmptyBuffer();
   if (buffer->buffer == kInvalidBufferHandle) {
-    ALOGE("%s: Failed to get an empty buffer for stream %d (owner %d)",
-          __FUNCTION__, stream_id, owner_stream_id);
+    ALOGE("%s: Failed to get an empty buffer for stream %d", __FUNCTION__,
+          stream_id);
     return UNKNOWN_ERROR;
   }
 
@@ -396,50 +431,37 @@ status_t InternalStreamManager::GetStreamBuffer(int32_t stream_id,
 
 bool InternalStreamManager::IsPendingBufferEmpty(int32_t stream_id) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(stream_mutex_);
-  if (!IsStreamAllocatedLocked(stream_id)) {
+  auto buffer_manager = GetBufferManager(stream_id);
+  if (buffer_manager == nullptr) {
     ALOGE("%s: Stream %d was not allocated.", __FUNCTION__, stream_id);
     return false;
   }
 
-  int32_t owner_stream_id = GetBufferManagerOwnerIdLocked(stream_id);
-  if (owner_stream_id == kInvalidStreamId) {
-    ALOGE("%s: Cannot find a owner stream ID for stream %d", __FUNCTION__,
-          stream_id);
-    return false;
-  }
-
-  return buffer_managers_[owner_stream_id]->IsPendingBufferEmpty();
+  return buffer_manager->IsPendingBufferEmpty();
 }
 
 status_t InternalStreamManager::GetMostRecentStreamBuffer(
-    int32_t stream_id, std::vector<StreamBuffer>* input_buffers,
+    int32_t stream_id, uint32_t frame_number,
+    std::vector<StreamBuffer>* input_buffers,
     std::vector<std::unique_ptr<HalCameraMetadata>>* input_buffer_metadata,
     uint32_t payload_frames) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(stream_mutex_);
-
-  if (!IsStreamAllocatedLocked(stream_id)) {
+  auto buffer_manager = GetBufferManager(stream_id);
+  if (buffer_manager == nullptr) {
     ALOGE("%s: Stream %d was not allocated.", __FUNCTION__, stream_id);
     return BAD_VALUE;
   }
 
-  int32_t owner_stream_id = GetBufferManagerOwnerIdLocked(stream_id);
-  if (owner_stream_id == kInvalidStreamId) {
-    ALOGE("%s: Cannot find a owner stream ID for stream %d", __FUNCTION__,
-          stream_id);
-    return BAD_VALUE;
-  }
-
   if (input_buffers == nullptr || input_buffer_metadata == nullptr) {
     ALOGE("%s: input_buffers (%p) or input_buffer_metadata (%p) is nullptr",
           __FUNCTION__, input_buffers, input_buffer_metadata);
     return BAD_VALUE;
   }
 
+  std::lock_guard<std::mutex> lock(zsl_buffer_mutex_);
   std::vector<ZslBufferManager::ZslBuffer> filled_buffers;
-  buffer_managers_[owner_stream_id]->GetMostRecentZslBuffers(
-      &filled_buffers, payload_frames, kMinFilledBuffers);
+  buffer_manager->GetMostRecentZslBuffers(&filled_buffers, payload_frames,
+                                          kMinFilledBuffers);
 
   if (filled_buffers.size() == 0) {
     ALOGE("%s: There is no input buffers.", __FUNCTION__);
@@ -448,7 +470,7 @@ status_t InternalStreamManager::GetMostRecentStreamBuffer(
 
   // TODO(b/138592133): Remove AddPendingBuffers because internal stream manager
   // should not be responsible for saving the pending buffers' metadata.
-  buffer_managers_[owner_stream_id]->AddPendingBuffers(filled_buffers);
+  buffer_manager->AddPendingBuffers(frame_number, filled_buffers);
 
   for (uint32_t i = 0; i < filled_buffers.size(); i++) {
     StreamBuffer buffer = {};
@@ -461,8 +483,8 @@ status_t InternalStreamManager::GetMostRecentStreamBuffer(
     input_buffers->push_back(buffer);
     if (filled_buffers[i].metadata == nullptr) {
       std::vector<ZslBufferManager::ZslBuffer> buffers;
-      buffer_managers_[owner_stream_id]->CleanPendingBuffers(&buffers);
-      buffer_managers_[owner_stream_id]->ReturnZslBuffers(std::move(buffers));
+      buffer_manager->CleanPendingBuffers(frame_number, &buffers);
+      buffer_manager->ReturnZslBuffers(std::move(buffers));
       return INVALID_OPERATION;
     }
     input_buffer_metadata->push_back(std::move(filled_buffers[i].metadata));
@@ -474,95 +496,62 @@ status_t InternalStreamManager::GetMostRecentStreamBuffer(
 status_t InternalStreamManager::ReturnZslStreamBuffers(uint32_t frame_number,
                                                        int32_t stream_id) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(stream_mutex_);
-
-  if (!IsStreamAllocatedLocked(stream_id)) {
+  auto buffer_manager = GetBufferManager(stream_id);
+  if (buffer_manager == nullptr) {
     ALOGE("%s: Unknown stream ID %d.", __FUNCTION__, stream_id);
     return BAD_VALUE;
   }
 
-  int32_t owner_stream_id = GetBufferManagerOwnerIdLocked(stream_id);
-  if (owner_stream_id == kInvalidStreamId) {
-    ALOGE("%s: Cannot find a owner stream ID for stream %d", __FUNCTION__,
-          stream_id);
-    return BAD_VALUE;
-  }
-
+  std::lock_guard<std::mutex> lock(zsl_buffer_mutex_);
   std::vector<ZslBufferManager::ZslBuffer> zsl_buffers;
   status_t res =
-      buffer_managers_[owner_stream_id]->CleanPendingBuffers(&zsl_buffers);
-  if (res != OK) {
+      buffer_manager->CleanPendingBuffers(frame_number, &zsl_buffers);
+  if (res == NAME_NOT_FOUND) {
+    return res;
+  } else if (res != OK) {
     ALOGE("%s: frame (%d)fail to return zsl stream buffers", __FUNCTION__,
           frame_number);
     return res;
   }
-  buffer_managers_[owner_stream_id]->ReturnZslBuffers(std::move(zsl_buffers));
+  buffer_manager->ReturnZslBuffers(std::move(zsl_buffers));
 
   return OK;
 }
 
 status_t InternalStreamManager::ReturnStreamBuffer(const StreamBuffer& buffer) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(stream_mutex_);
-  int32_t stream_id = buffer.stream_id;
-
-  if (!IsStreamAllocatedLocked(stream_id)) {
-    ALOGE("%s: Unknown stream ID %d.", __FUNCTION__, stream_id);
-    return BAD_VALUE;
-  }
-
-  int32_t owner_stream_id = GetBufferManagerOwnerIdLocked(stream_id);
-  if (owner_stream_id == kInvalidStreamId) {
-    ALOGE("%s: Cannot find a owner stream ID for stream %d", __FUNCTION__,
-          stream_id);
+  auto buffer_manager = GetBufferManager(buffer.stream_id);
+  if (buffer_manager == nullptr) {
+    ALOGE("%s: Unknown stream ID %d.", __FUNCTION__, buffer.stream_id);
     return BAD_VALUE;
   }
 
-  return buffer_managers_[owner_stream_id]->ReturnEmptyBuffer(buffer.buffer);
+  return buffer_manager->ReturnEmptyBuffer(buffer.buffer);
 }
 
 status_t InternalStreamManager::ReturnFilledBuffer(uint32_t frame_number,
                                                    const StreamBuffer& buffer) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(stream_mutex_);
-  int32_t stream_id = buffer.stream_id;
-
-  if (!IsStreamAllocatedLocked(stream_id)) {
-    ALOGE("%s: Unknown stream ID %d.", __FUNCTION__, stream_id);
-    return BAD_VALUE;
-  }
-
-  int32_t owner_stream_id = GetBufferManagerOwnerIdLocked(stream_id);
-  if (owner_stream_id == kInvalidStreamId) {
-    ALOGE("%s: Cannot find a owner stream ID for stream %d", __FUNCTION__,
-          stream_id);
+  auto buffer_manager = GetBufferManager(buffer.stream_id);
+  if (buffer_manager == nullptr) {
+    ALOGE("%s: Unknown stream ID %d.", __FUNCTION__, buffer.stream_id);
     return BAD_VALUE;
   }
 
-  return buffer_managers_[owner_stream_id]->ReturnFilledBuffer(frame_number,
-                                                               buffer);
+  return buffer_manager->ReturnFilledBuffer(frame_number, buffer);
 }
 
 status_t InternalStreamManager::ReturnMetadata(
     int32_t stream_id, uint32_t frame_number,
     const HalCameraMetadata* metadata) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(stream_mutex_);
-
-  if (!IsStreamAllocatedLocked(stream_id)) {
+  auto buffer_manager = GetBufferManager(stream_id);
+  if (buffer_manager == nullptr) {
     ALOGE("%s: Unknown stream ID %d.", __FUNCTION__, stream_id);
     return BAD_VALUE;
   }
 
-  int32_t owner_stream_id = GetBufferManagerOwnerIdLocked(stream_id);
-  if (owner_stream_id == kInvalidStreamId) {
-    ALOGE("%s: Cannot find a owner stream ID for stream %d", __FUNCTION__,
-          stream_id);
-    return BAD_VALUE;
-  }
-
-  return buffer_managers_[owner_stream_id]->ReturnMetadata(frame_number,
-                                                           metadata);
+  return buffer_manager->ReturnMetadata(frame_number, metadata);
 }
 
 }  // namespace google_camera_hal
@@ -19,6 +19,8 @@
 
 #include <hardware/gralloc.h>
 #include <utils/Errors.h>
+#include <memory>
+#include <mutex>
 #include <unordered_map>
 
 #include "camera_buffer_allocator_hwl.h"
@@ -48,8 +50,9 @@ class InternalStreamManager {
   // stream information (set via RegisterNewInternalStream) to allocate buffers.
   // This method will allocate hal_stream.max_buffers immediately and at most
   // (hal_stream.max_buffers + additional_num_buffers) buffers.
-  // If need_vendor_buffer is true, the external buffer allocator must be passed
-  // in when create the internal stream manager in create() function.
+  // If need_vendor_buffer is true, the buffers are allocated by the external
+  // buffer allocator passed in Create(), or by the HWL buffer allocator if
+  // none was passed.
   status_t AllocateBuffers(const HalStream& hal_stream,
                            uint32_t additional_num_buffers = 0,
                            bool need_vendor_buffer = false);
@@ -60,8 +63,9 @@ class InternalStreamManager {
   // This method will allocate the maximum of all hal_stream.max_buffers
   // immediately and at most (total of hal_stream.max_buffers +
   // additional_num_buffers).
-  // If need_vendor_buffer is true, the external buffer allocator must be passed
-  // in when create the internal stream manager in create() function.
+  // If need_vendor_buffer is true, the buffers are allocated by the external
+  // buffer allocator passed in Create(), or by the HWL buffer allocator if
+  // none was passed.
   status_t AllocateSharedBuffers(const std::vector<HalStream>& hal_streams,
                                  uint32_t additional_num_buffers = 0,
                                  bool need_vendor_buffer = false);
@@ -82,13 +86,18 @@ class InternalStreamManager {
   status_t ReturnMetadata(int32_t stream_id, uint32_t frame_number,
                           const HalCameraMetadata* metadata);
 
-  // Get the most recent buffer and metadata.
+  // Get the most recent buffer and metadata. The buffers are held by the
+  // request of frame_number until ReturnZslStreamBuffers is called with the
+  // same frame_number, so they are not given to any other request.
   status_t GetMostRecentStreamBuffer(
-      int32_t stream_id, std::vector<StreamBuffer>* input_buffers,
+      int32_t stream_id, uint32_t frame_number,
+      std::vector<StreamBuffer>* input_buffers,
       std::vector<std::unique_ptr<HalCameraMetadata>>* input_buffer_metadata,
       uint32_t payload_frames);
 
-  // Return the buffer from GetMostRecentStreamBuffer
+  // Return the buffers that GetMostRecentStreamBuffer got for the request of
+  // frame_number. Returns NAME_NOT_FOUND if the request doesn't hold any
+  // buffers.
   status_t ReturnZslStreamBuffers(uint32_t frame_number, int32_t stream_id);
 
   // Check the pending buffer is empty or not
@@ -101,6 +110,11 @@ class InternalStreamManager {
       kImplementationDefinedInternalStreamStart;
   static constexpr int32_t kInvalidStreamId = -1;
 
+  // Map from stream ID to the buffer manager that serves the stream. Streams
+  // sharing buffers map to the same buffer manager.
+  using BufferManagerRoutingTable =
+      std::unordered_map<int32_t, std::shared_ptr<ZslBufferManager>>;
+
   // Initialize internal stream manager
   void Initialize(IHalBufferAllocator* buffer_allocator);
 
@@ -140,8 +154,24 @@ class InternalStreamManager {
                                  uint32_t additional_num_buffers,
                                  bool need_vendor_buffer);
 
+  // Rebuild the routing table from buffer_managers_ and
+  // shared_stream_owner_ids_ and publish it. Must be called with stream_mutex_
+  // locked whenever either of them changes.
+  void UpdateRoutingTableLocked();
+
+  // Get the buffer manager serving stream_id from the published routing table
+  // without locking stream_mutex_. Returns nullptr if the stream is not
+  // allocated. The returned buffer manager stays valid even if the stream is
+  // freed concurrently.
+  std::shared_ptr<ZslBufferManager> GetBufferManager(int32_t stream_id) const;
+
   std::mutex stream_mutex_;
 
+  // Serializes the multi-step ZSL buffer operations in
+  // GetMostRecentStreamBuffer and ReturnZslStreamBuffers. Per-frame buffer and
+  // metadata returns do not take this lock.
+  std::mutex zsl_buffer_mutex_;
+
   // Next available stream ID. Protected by stream_mutex_.
   int32_t next_available_stream_id_ = kStreamIdStart;
 
@@ -156,7 +186,14 @@ class InternalStreamManager {
   // Map from stream ID to ZSL buffer manager it owns. If a stream doesn't own
   // a buffer manager, the owner stream can be looked up with
   // shared_stream_owner_ids_. Protected by stream_mutex_.
-  std::unordered_map<int32_t, std::unique_ptr<ZslBufferManager>> buffer_managers_;
+  std::unordered_map<int32_t, std::shared_ptr<ZslBufferManager>> buffer_managers_;
+
+  // Immutable routing table built whenever streams are allocated or freed.
+  // Per-frame calls read it with std::atomic_load instead of locking
+  // stream_mutex_. Only replaced with std::atomic_store while holding
+  // stream_mutex_.
+  std::shared_ptr<const BufferManagerRoutingTable> routing_table_ =
+      std::make_shared<const BufferManagerRoutingTable>();
 
   // external buffer allocator
   IHalBufferAllocator* hwl_buffer_allocator_ = nullptr;
@@ -97,6 +97,8 @@ status_t MultiCameraRtProcessBlock::SetResultProcessor(
   }
 
   result_processor_ = std::move(result_processor);
+  hwl_result_processor_.store(result_processor_.get(),
+                              std::memory_order_release);
   return OK;
 }
 
@@ -169,8 +171,9 @@ status_t MultiCameraRtProcessBlock::ConfigureStreams(
 
     camera_pipeline_ids_[camera_id] = pipeline_id;
     for (auto& stream : config.streams) {
-      configured_streams_[stream.id].pipeline_id = pipeline_id;
-      configured_streams_[stream.id].stream = stream;
+      configured_streams_[stream.id] = {.camera_id = camera_id,
+                                        .pipeline_id = pipeline_id,
+                                        .stream = stream};
     }
   }
 
@@ -210,64 +213,21 @@ status_t MultiCameraRtProcessBlock::GetConfiguredHalStreams(
   return OK;
 }
 
-status_t MultiCameraRtProcessBlock::GetBufferPhysicalCameraIdLocked(
-    const StreamBuffer& buffer, uint32_t* camera_id) const {
-  if (camera_id == nullptr) {
-    ALOGE("%s: camera_id is nullptr", __FUNCTION__);
-    return BAD_VALUE;
-  }
-
-  int32_t stream_id = buffer.stream_id;
-  auto configured_stream_iter = configured_streams_.find(stream_id);
-  if (configured_stream_iter == configured_streams_.end()) {
-    ALOGE("%s: Stream %d was not configured.", __FUNCTION__, stream_id);
-    return BAD_VALUE;
-  }
-
-  const ConfiguredStream& configure_stream = configured_stream_iter->second;
-  if (!configure_stream.stream.is_physical_camera_stream) {
-    ALOGE("%s: Stream %d is not a physical stream.", __FUNCTION__, stream_id);
-    return BAD_VALUE;
-  }
-
-  *camera_id = configure_stream.stream.physical_camera_id;
-  return OK;
-}
-
-status_t MultiCameraRtProcessBlock::GetOutputBufferPipelineIdLocked(
-    const StreamBuffer& buffer, uint32_t* pipeline_id) const {
-  if (pipeline_id == nullptr) {
-    ALOGE("%s: pipeline_id is nullptr", __FUNCTION__);
-    return BAD_VALUE;
-  }
-
-  uint32_t camera_id;
-  status_t res = GetBufferPhysicalCameraIdLocked(buffer, &camera_id);
-  if (res != OK) {
-    ALOGE("%s: Getting buffer's physical camera ID failed: %s(%d)",
-          __FUNCTION__, strerror(-res), res);
-    return res;
-  }
-
-  auto camera_pipeline_id_iter = camera_pipeline_ids_.find(camera_id);
-  if (camera_pipeline_id_iter == camera_pipeline_ids_.end()) {
-    ALOGE("%s: Cannot find the pipeline ID for camera %u", __FUNCTION__,
-          camera_id);
-    return BAD_VALUE;
-  }
-
-  *pipeline_id = camera_pipeline_id_iter->second;
-  return OK;
-}
-
 bool MultiCameraRtProcessBlock::AreRequestsValidLocked(
-    const std::vector<ProcessBlockRequest>& block_requests) const {
+    const std::vector<ProcessBlockRequest>& block_requests,
+    std::vector<uint32_t>* pipeline_ids) const {
   ATRACE_CALL();
+  if (pipeline_ids == nullptr) {
+    ALOGE("%s: pipeline_ids is nullptr.", __FUNCTION__);
+    return false;
+  }
+
   if (block_requests.empty()) {
     ALOGE("%s: requests is empty.", __FUNCTION__);
     return false;
   }
 
+  pipeline_ids->clear();
   std::unordered_set<int32_t> request_camera_ids;
   uint32_t frame_number = block_requests[0].request.frame_number;
   for (auto& block_request : block_requests) {
@@ -289,20 +249,22 @@ bool MultiCameraRtProcessBlock::AreRequestsValidLocked(
     }
 
     // Check all output buffers will be captured from the same physical camera.
-    uint32_t physical_camera_id;
+    uint32_t physical_camera_id = 0;
+    uint32_t pipeline_id = 0;
     for (uint32_t i = 0; i < block_request.request.output_buffers.size(); i++) {
-      uint32_t buffer_camera_id;
-      status_t res = GetBufferPhysicalCameraIdLocked(
-          block_request.request.output_buffers[0], &buffer_camera_id);
-      if (res != OK) {
-        ALOGE("%s: Getting buffer's physical camera ID failed: %s(%d)",
-              __FUNCTION__, strerror(-res), res);
+      int32_t stream_id = block_request.request.output_buffers[i].stream_id;
+      auto configured_stream_iter = configured_streams_.find(stream_id);
+      if (configured_stream_iter == configured_streams_.end()) {
+        ALOGE("%s: Stream %d was not configured.", __FUNCTION__, stream_id);
         return false;
       }
 
+      const ConfiguredStream& configured_stream =
+          configured_stream_iter->second;
       if (i == 0) {
-        physical_camera_id = buffer_camera_id;
-      } else if (buffer_camera_id != physical_camera_id) {
+        physical_camera_id = configured_stream.camera_id;
+        pipeline_id = configured_stream.pipeline_id;
+      } else if (configured_stream.camera_id != physical_camera_id) {
         ALOGE("%s: Buffers should belong to the same camera ID in a request.",
               __FUNCTION__);
         return false;
@@ -318,6 +280,7 @@ bool MultiCameraRtProcessBlock::AreRequestsValidLocked(
     }
 
     request_camera_ids.insert(physical_camera_id);
+    pipeline_ids->push_back(pipeline_id);
   }
 
   return true;
@@ -352,7 +315,9 @@ status_t MultiCameraRtProcessBlock::ProcessRequests(
     return NO_INIT;
   }
 
-  if (!AreRequestsValidLocked(process_block_requests)) {
+  // Get pipeline ID for each request while validating the requests.
+  std::vector<uint32_t> pipeline_ids;
+  if (!AreRequestsValidLocked(process_block_requests, &pipeline_ids)) {
     ALOGE("%s: Requests are not supported.", __FUNCTION__);
     return BAD_VALUE;
   }
@@ -365,22 +330,9 @@ status_t MultiCameraRtProcessBlock::ProcessRequests(
     return res;
   }
 
-  // Get pipeline ID for each request.
-  std::vector<uint32_t> pipeline_ids;
-  for (auto& block_request : process_block_requests) {
-    uint32_t pipeline_id;
-
-    // Get the camera ID of the request's first output buffer. All output
-    // buffers should belong to the same pipeline ID, which is checked in
-    // AreRequestsSupportedLocked.
-    res = GetOutputBufferPipelineIdLocked(
-        block_request.request.output_buffers[0], &pipeline_id);
-    if (res != OK) {
-      ALOGE("%s: Getting buffer's pipeline ID failed: %s(%d)", __FUNCTION__,
-            strerror(-res), res);
-      return res;
-    }
-
+  for (uint32_t i = 0; i < process_block_requests.size(); i++) {
+    auto& block_request = process_block_requests[i];
+    uint32_t pipeline_id = pipeline_ids[i];
     res = request_id_manager_->SetPipelineRequestId(
         block_request.request_id, block_request.request.frame_number,
         pipeline_id);
@@ -390,7 +342,6 @@ status_t MultiCameraRtProcessBlock::ProcessRequests(
       return res;
     }
 
-    pipeline_ids.push_back(pipeline_id);
     ALOGV("%s: frame_number %u pipeline_id %u request_id %u", __FUNCTION__,
           block_request.request.frame_number, pipeline_id,
           block_request.request_id);
@@ -433,8 +384,9 @@ status_t MultiCameraRtProcessBlock::Flush() {
 void MultiCameraRtProcessBlock::NotifyHwlPipelineResult(
     std::unique_ptr<HwlPipelineResult> hwl_result) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(result_processor_mutex_);
-  if (result_processor_ == nullptr) {
+  ResultProcessor* result_processor =
+      hwl_result_processor_.load(std::memory_order_acquire);
+  if (result_processor == nullptr) {
     ALOGE("%s: result processor is nullptr. Dropping a result", __FUNCTION__);
     return;
   }
@@ -473,14 +425,15 @@ void MultiCameraRtProcessBlock::NotifyHwlPipelineResult(
 
   ProcessBlockResult block_result = {.request_id = request_id,
                                      .result = std::move(capture_result)};
-  result_processor_->ProcessResult(std::move(block_result));
+  result_processor->ProcessResult(std::move(block_result));
 }
 
 void MultiCameraRtProcessBlock::NotifyHwlPipelineMessage(
     uint32_t pipeline_id, const NotifyMessage& message) {
   ATRACE_CALL();
-  std::lock_guard<std::mutex> lock(result_processor_mutex_);
-  if (result_processor_ == nullptr) {
+  ResultProcessor* result_processor =
+      hwl_result_processor_.load(std::memory_order_acquire);
+  if (result_processor == nullptr) {
     ALOGE("%s: result processor is nullptr. Dropping a message", __FUNCTION__);
     return;
   }
@@ -499,7 +452,7 @@ void MultiCameraRtProcessBlock::NotifyHwlPipelineMessage(
   }
   ProcessBlockNotifyMessage block_message = {.request_id = request_id,
                                              .message = message};
-  result_processor_->Notify(std::move(block_message));
+  result_processor->Notify(std::move(block_message));
 }
 
 }  // namespace google_camera_hal
@@ -17,6 +17,7 @@
 #ifndef HARDWARE_GOOGLE_CAMERA_HAL_MULTICAM_REALTIME_PROCESS_BLOCK_H_
 #define HARDWARE_GOOGLE_CAMERA_HAL_MULTICAM_REALTIME_PROCESS_BLOCK_H_
 
+#include <atomic>
 #include <map>
 #include <shared_mutex>
 
@@ -69,8 +70,11 @@ class MultiCameraRtProcessBlock : public ProcessBlock {
   // Camera ID of this process block.
   const uint32_t kCameraId;
 
-  // Define a configured stream.
+  // Define a configured stream. The physical camera and the pipeline that
+  // capture the stream are resolved at configuration time, so a buffer needs a
+  // single lookup per request.
   struct ConfiguredStream {
+    uint32_t camera_id = 0;
     uint32_t pipeline_id = 0;
     Stream stream;
   };
@@ -94,19 +98,11 @@ class MultiCameraRtProcessBlock : public ProcessBlock {
       const StreamConfiguration& stream_config,
       CameraStreamConfigurationMap* camera_stream_config_map) const;
 
-  // Get the camera ID that a buffer will be captured from. Must be called with
+  // Return if requests are valid. If they are, pipeline_ids will be filled
+  // with the pipeline ID of each request. Must be called with
   // configure_shared_mutex_ locked.
-  status_t GetBufferPhysicalCameraIdLocked(const StreamBuffer& buffer,
-                                           uint32_t* camera_id) const;
-
-  // Get the pipeline ID that a buffer will be captured from. Must be called
-  // with configure_shared_mutex_ locked.
-  status_t GetOutputBufferPipelineIdLocked(const StreamBuffer& buffer,
-                                           uint32_t* pipeline_id) const;
-
-  // Return if requests are valid. Must be called with configure_shared_mutex_ locked.
-  bool AreRequestsValidLocked(
-      const std::vector<ProcessBlockRequest>& requests) const;
+  bool AreRequestsValidLocked(const std::vector<ProcessBlockRequest>& requests,
+                              std::vector<uint32_t>* pipeline_ids) const;
 
   // Forward the pending requests to result processor.
   status_t ForwardPendingRequests(
@@ -133,6 +129,12 @@ class MultiCameraRtProcessBlock : public ProcessBlock {
   // Result processor. Must be protected by result_processor_mutex_.
   std::unique_ptr<ResultProcessor> result_processor_ = nullptr;
 
+  // Same as result_processor_.get(), published once result_processor_ is set.
+  // result_processor_ is never replaced, so HWL results and messages from
+  // different pipelines are passed to it in parallel without
+  // result_processor_mutex_.
+  std::atomic<ResultProcessor*> hwl_result_processor_ = nullptr;
+
   // Pipeline request id manager
   std::unique_ptr<PipelineRequestIdManager> request_id_manager_ = nullptr;
 };
@@ -20,6 +20,9 @@
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
+#include <map>
+
 #include "pending_requests_tracker.h"
 
 namespace android {
@@ -44,6 +47,56 @@ std::unique_ptr<PendingRequestsTracker> PendingRequestsTracker::Create(
   return tracker;
 }
 
+PendingRequestsTracker::BufferCredits::BufferCredits(uint32_t max_credits)
+    : max_credits_(max_credits), available_credits_(max_credits) {
+}
+
+bool PendingRequestsTracker::BufferCredits::TryAcquire(uint32_t num_credits) {
+  uint32_t available_credits = available_credits_.load();
+  while (available_credits >= num_credits) {
+    if (available_credits_.compare_exchange_weak(
+            available_credits, available_credits - num_credits)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool PendingRequestsTracker::BufferCredits::Acquire(
+    uint32_t num_credits, std::chrono::milliseconds timeout) {
+  if (TryAcquire(num_credits)) {
+    return true;
+  }
+
+  std::unique_lock<std::mutex> lock(wait_mutex_);
+  num_waiters_++;
+  bool acquired = credits_condition_.wait_for(
+      lock, timeout, [this, num_credits] { return TryAcquire(num_credits); });
+  num_waiters_--;
+
+  return acquired;
+}
+
+bool PendingRequestsTracker::BufferCredits::Release(uint32_t num_credits) {
+  uint32_t available_credits = available_credits_.load();
+  do {
+    if (available_credits + num_credits > max_credits_) {
+      return false;
+    }
+  } while (!available_credits_.compare_exchange_weak(
+      available_credits, available_credits + num_credits));
+
+  if (num_waiters_.load() > 0) {
+    // Lock wait_mutex_ so a waiter cannot miss the notification between
+    // checking the credits and waiting.
+    { std::lock_guard<std::mutex> lock(wait_mutex_); }
+    credits_condition_.notify_all();
+  }
+
+  return true;
+}
+
 status_t PendingRequestsTracker::Initialize(
     const std::vector<HalStream>& hal_configured_streams) {
   for (auto& hal_stream : hal_configured_streams) {
@@ -55,8 +108,10 @@ status_t PendingRequestsTracker::Initialize(
       return BAD_VALUE;
     }
 
-    stream_pending_buffers_.emplace(hal_stream.id, /*pending_buffers=*/0);
-    stream_acquired_buffers_.emplace(hal_stream.id, /*pending_buffers=*/0);
+    stream_request_credits_.emplace(
+        hal_stream.id, std::make_unique<BufferCredits>(hal_stream.max_buffers));
+    stream_acquisition_credits_.emplace(
+        hal_stream.id, std::make_unique<BufferCredits>(hal_stream.max_buffers));
   }
 
   return OK;
@@ -66,115 +121,77 @@ bool PendingRequestsTracker::IsStreamConfigured(int32_t stream_id) const {
   return stream_max_buffers_.find(stream_id) != stream_max_buffers_.end();
 }
 
-void PendingRequestsTracker::TrackRequestBuffersLocked(
-    const std::vector<StreamBuffer>& requested_buffers) {
-  ATRACE_CALL();
-
-  for (auto& buffer : requested_buffers) {
-    int32_t stream_id = buffer.stream_id;
-    if (!IsStreamConfigured(stream_id)) {
-      ALOGW("%s: stream %d was not configured.", __FUNCTION__, stream_id);
-      // Continue to track other buffers.
-      continue;
+status_t PendingRequestsTracker::AcquireCredits(
+    const std::unordered_map<int32_t, std::unique_ptr<BufferCredits>>&
+        credits_map,
+    const std::vector<StreamBuffer>& buffers,
+    std::chrono::milliseconds timeout) {
+  // Map from stream ID to the number of credits to take, sorted by stream ID.
+  std::map<int32_t, uint32_t> stream_num_credits;
+  for (auto& buffer : buffers) {
+    if (!IsStreamConfigured(buffer.stream_id)) {
+      ALOGE("%s: stream %d was not configured.", __FUNCTION__,
+            buffer.stream_id);
+      return BAD_VALUE;
     }
 
-    stream_pending_buffers_[stream_id]++;
-  }
-}
-
-status_t PendingRequestsTracker::TrackReturnedResultBuffers(
-    const std::vector<StreamBuffer>& returned_buffers) {
-  ATRACE_CALL();
-
-  {
-    std::lock_guard<std::mutex> lock(pending_requests_mutex_);
-    for (auto& buffer : returned_buffers) {
-      int32_t stream_id = buffer.stream_id;
-      if (!IsStreamConfigured(stream_id)) {
-        ALOGW("%s: stream %d was not configured.", __FUNCTION__, stream_id);
-        // Continue to track other buffers.
-        continue;
-      }
-
-      if (stream_pending_buffers_[stream_id] == 0) {
-        ALOGE("%s: stream %d should not have any pending quota buffers.",
-              __FUNCTION__, stream_id);
-        // Continue to track other buffers.
-        continue;
-      }
-
-      stream_pending_buffers_[stream_id]--;
-    }
+    stream_num_credits[buffer.stream_id]++;
   }
 
-  tracker_request_condition_.notify_one();
-  return OK;
-}
-
-status_t PendingRequestsTracker::TrackReturnedAcquiredBuffers(
-    const std::vector<StreamBuffer>& returned_buffers) {
-  ATRACE_CALL();
-
-  {
-    std::lock_guard<std::mutex> lock(pending_acquisition_mutex_);
-    for (auto& buffer : returned_buffers) {
-      int32_t stream_id = buffer.stream_id;
-      if (!IsStreamConfigured(stream_id)) {
-        ALOGW("%s: stream %d was not configured.", __FUNCTION__, stream_id);
-        // Continue to track other buffers.
-        continue;
-      }
-
-      if (stream_acquired_buffers_[stream_id] == 0) {
-        ALOGE("%s: stream %d should not have any pending acquired buffers.",
-              __FUNCTION__, stream_id);
-        // Continue to track other buffers.
-        continue;
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  for (auto it = stream_num_credits.begin(); it != stream_num_credits.end();
+       it++) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+        deadline - std::chrono::steady_clock::now());
+    if (!credits_map.at(it->first)->Acquire(
+            it->second, std::max(remaining, std::chrono::milliseconds(0)))) {
+      ALOGV("%s: stream %d is not ready. max_buffers=%u", __FUNCTION__,
+            it->first, stream_max_buffers_.at(it->first));
+      // Return the credits taken so far.
+      for (auto taken_it = stream_num_credits.begin(); taken_it != it;
+           taken_it++) {
+        credits_map.at(taken_it->first)->Release(taken_it->second);
       }
-
-      stream_acquired_buffers_[stream_id]--;
+      return TIMED_OUT;
     }
   }
 
-  tracker_acquisition_condition_.notify_one();
   return OK;
 }
 
-bool PendingRequestsTracker::DoStreamsHaveEnoughBuffersLocked(
-    const std::vector<StreamBuffer>& buffers) const {
+void PendingRequestsTracker::ReleaseCredits(
+    const std::unordered_map<int32_t, std::unique_ptr<BufferCredits>>&
+        credits_map,
+    const std::vector<StreamBuffer>& buffers, const char* credit_type) {
   for (auto& buffer : buffers) {
     int32_t stream_id = buffer.stream_id;
     if (!IsStreamConfigured(stream_id)) {
-      ALOGE("%s: stream %d was not configured.", __FUNCTION__, stream_id);
-      return false;
+      ALOGW("%s: stream %d was not configured.", __FUNCTION__, stream_id);
+      // Continue to track other buffers.
+      continue;
     }
 
-    if (stream_pending_buffers_.at(stream_id) >=
-        stream_max_buffers_.at(stream_id)) {
-      ALOGV("%s: stream %d is not ready. max_buffers=%u", __FUNCTION__,
-            stream_id, stream_max_buffers_.at(stream_id));
-      return false;
+    if (!credits_map.at(stream_id)->Release(/*num_credits=*/1)) {
+      ALOGE("%s: stream %d should not have any pending %s buffers.",
+            __FUNCTION__, stream_id, credit_type);
+      // Continue to track other buffers.
+      continue;
     }
   }
-
-  return true;
 }
 
-bool PendingRequestsTracker::DoesStreamHaveEnoughBuffersToAcquireLocked(
-    int32_t stream_id, uint32_t num_buffers) const {
-  if (!IsStreamConfigured(stream_id)) {
-    ALOGE("%s: stream %d was not configured.", __FUNCTION__, stream_id);
-    return false;
-  }
-
-  if (stream_acquired_buffers_.at(stream_id) + num_buffers >
-      stream_max_buffers_.at(stream_id)) {
-    ALOGV("%s: stream %d is not ready. max_buffers=%u", __FUNCTION__, stream_id,
-          stream_max_buffers_.at(stream_id));
-    return false;
-  }
+status_t PendingRequestsTracker::TrackReturnedResultBuffers(
+    const std::vector<StreamBuffer>& returned_buffers) {
+  ATRACE_CALL();
+  ReleaseCredits(stream_request_credits_, returned_buffers, "quota");
+  return OK;
+}
 
-  return true;
+status_t PendingRequestsTracker::TrackReturnedAcquiredBuffers(
+    const std::vector<StreamBuffer>& returned_buffers) {
+  ATRACE_CALL();
+  ReleaseCredits(stream_acquisition_credits_, returned_buffers, "acquired");
+  return OK;
 }
 
 status_t PendingRequestsTracker::UpdateRequestedStreamIdsLocked(
@@ -207,22 +224,21 @@ status_t PendingRequestsTracker::WaitAndTrackRequestBuffers(
     return BAD_VALUE;
   }
 
-  std::unique_lock<std::mutex> lock(pending_requests_mutex_);
-  if (!tracker_request_condition_.wait_for(
-          lock, std::chrono::milliseconds(kTrackerTimeoutMs), [this, &request] {
-            return DoStreamsHaveEnoughBuffersLocked(request.output_buffers);
-          })) {
-    ALOGE("%s: Waiting for buffer ready timed out.", __FUNCTION__);
-    return TIMED_OUT;
+  status_t res =
+      AcquireCredits(stream_request_credits_, request.output_buffers,
+                     std::chrono::milliseconds(kTrackerTimeoutMs));
+  if (res != OK) {
+    ALOGE("%s: Waiting for buffer ready failed: %s(%d)", __FUNCTION__,
+          strerror(-res), res);
+    return res;
   }
 
   ALOGV("%s: all streams are ready", __FUNCTION__);
 
-  TrackRequestBuffersLocked(request.output_buffers);
-
+  std::lock_guard<std::mutex> lock(pending_requests_mutex_);
   first_requested_stream_ids->clear();
-  status_t res = UpdateRequestedStreamIdsLocked(request.output_buffers,
-                                                first_requested_stream_ids);
+  res = UpdateRequestedStreamIdsLocked(request.output_buffers,
+                                       first_requested_stream_ids);
   if (res != OK) {
     ALOGE("%s: Updating requested stream ID for output buffers failed: %s(%d)",
           __FUNCTION__, strerror(-res), res);
@@ -242,19 +258,12 @@ status_t PendingRequestsTracker::WaitAndTrackAcquiredBuffers(
     return BAD_VALUE;
   }
 
-  std::unique_lock<std::mutex> lock(pending_acquisition_mutex_);
-  if (!tracker_acquisition_condition_.wait_for(
-          lock, std::chrono::milliseconds(kAcquireBufferTimeoutMs),
-          [this, stream_id, num_buffers] {
-            return DoesStreamHaveEnoughBuffersToAcquireLocked(stream_id,
-                                                              num_buffers);
-          })) {
+  if (!stream_acquisition_credits_.at(stream_id)->Acquire(
+          num_buffers, std::chrono::milliseconds(kAcquireBufferTimeoutMs))) {
     ALOGW("%s: Waiting to acquire buffer timed out.", __FUNCTION__);
     return TIMED_OUT;
   }
 
-  stream_acquired_buffers_[stream_id] += num_buffers;
-
   return OK;
 }
 
@@ -266,8 +275,10 @@ void PendingRequestsTracker::TrackBufferAcquisitionFailure(int32_t stream_id,
     return;
   }
 
-  std::unique_lock<std::mutex> lock(pending_acquisition_mutex_);
-  stream_acquired_buffers_[stream_id] -= num_buffers;
+  if (!stream_acquisition_credits_.at(stream_id)->Release(num_buffers)) {
+    ALOGE("%s: stream %d does not have %u acquired buffers.", __FUNCTION__,
+          stream_id, num_buffers);
+  }
 }
 
 }  // namespace google_camera_hal
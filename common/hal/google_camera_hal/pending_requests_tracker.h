@@ -17,7 +17,11 @@
 #ifndef HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_PENDING_REQUESTS_TRACKER_H_
 #define HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_PENDING_REQUESTS_TRACKER_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -71,18 +75,59 @@ class PendingRequestsTracker {
   // Duration to wait for when requesting buffer
   static constexpr uint32_t kAcquireBufferTimeoutMs = 50;
 
+  // BufferCredits is a counting semaphore for one stream's buffers. Credits
+  // are taken and returned with atomic operations. A thread only blocks when
+  // the stream runs out of credits, and returning credits only wakes up the
+  // threads waiting on the same stream.
+  class BufferCredits {
+   public:
+    explicit BufferCredits(uint32_t max_credits);
+
+    // Take num_credits, waiting up to timeout for them to be returned.
+    // Return false if the credits could not be taken before timeout.
+    bool Acquire(uint32_t num_credits, std::chrono::milliseconds timeout);
+
+    // Return num_credits. Return false without returning any credits if it
+    // would exceed the max number of credits.
+    bool Release(uint32_t num_credits);
+
+   private:
+    // Take num_credits if they are available without waiting.
+    bool TryAcquire(uint32_t num_credits);
+
+    const uint32_t max_credits_;
+
+    // Number of credits that can be taken.
+    std::atomic<uint32_t> available_credits_;
+
+    // Number of threads waiting in Acquire(). Release() only locks
+    // wait_mutex_ to wake them up if it is not 0.
+    std::atomic<uint32_t> num_waiters_ = 0;
+
+    std::mutex wait_mutex_;
+
+    // Condition to signal when credits are returned.
+    std::condition_variable credits_condition_;
+  };
+
   // Initialize the tracker.
   status_t Initialize(const std::vector<HalStream>& hal_configured_streams);
 
-  // Return if all the buffers' streams have enough buffers to be requested.
-  // Must be protected with pending_requests_mutex_.
-  bool DoStreamsHaveEnoughBuffersLocked(
-      const std::vector<StreamBuffer>& buffers) const;
-
-  // Return if the stream with stream_id have enough buffers to be requested.
-  // Must be protected with pending_acquisition_mutex_.
-  bool DoesStreamHaveEnoughBuffersToAcquireLocked(int32_t stream_id,
-                                                  uint32_t num_buffers) const;
+  // Take the credits of all the buffers' streams from credits_map, waiting up
+  // to timeout. Credits are taken in stream ID order so concurrent callers
+  // cannot deadlock. If any stream times out, the credits already taken are
+  // returned.
+  status_t AcquireCredits(
+      const std::unordered_map<int32_t, std::unique_ptr<BufferCredits>>&
+          credits_map,
+      const std::vector<StreamBuffer>& buffers,
+      std::chrono::milliseconds timeout);
+
+  // Return one credit for each of the buffers to its stream in credits_map.
+  void ReleaseCredits(
+      const std::unordered_map<int32_t, std::unique_ptr<BufferCredits>>&
+          credits_map,
+      const std::vector<StreamBuffer>& buffers, const char* credit_type);
 
   // Update requested stream ID and return the stream IDs that have not been
   // requested previously in first_requested_stream_ids.
@@ -91,38 +136,29 @@ class PendingRequestsTracker {
       const std::vector<StreamBuffer>& requested_buffers,
       std::vector<int32_t>* first_requested_stream_ids);
 
-  // Track buffers in capture requests.
-  // Must be protected with pending_requests_mutex_.
-  void TrackRequestBuffersLocked(
-      const std::vector<StreamBuffer>& requested_buffers);
-
   // Return if a stream ID is configured when Create() was called.
   bool IsStreamConfigured(int32_t stream_id) const;
 
   // Map from stream ID to the stream's max number of buffers.
   std::unordered_map<int32_t, uint32_t> stream_max_buffers_;
 
-  // Condition to signal when a buffer is returned to the client.
-  std::condition_variable tracker_request_condition_;
+  // Map from stream ID to the credits of the stream's buffers that can still
+  // be requested. A credit is taken when a request arrives and returned when
+  // the buffer is returned in a result. Created in Initialize() and not
+  // modified afterwards, so it can be read without locking.
+  std::unordered_map<int32_t, std::unique_ptr<BufferCredits>>
+      stream_request_credits_;
+
+  // Map from stream ID to the credits of the stream's buffers that can still
+  // be acquired. A credit is taken when a buffer is acquired and returned when
+  // the buffer is returned to the client through process capture result or
+  // return stream buffer api. Created in Initialize() and not modified
+  // afterwards, so it can be read without locking.
+  std::unordered_map<int32_t, std::unique_ptr<BufferCredits>>
+      stream_acquisition_credits_;
 
   std::mutex pending_requests_mutex_;
 
-  // Map from stream ID to the stream's number of pending buffers.
-  // It must have an entry for keys present in stream_max_buffers_.
-  // Must be protected with pending_requests_mutex_.
-  std::unordered_map<int32_t, uint32_t> stream_pending_buffers_;
-
-  // Condition to signal when a buffer is returned to the client through process
-  // capture result or return stream buffer api.
-  std::condition_variable tracker_acquisition_condition_;
-
-  std::mutex pending_acquisition_mutex_;
-
-  // Map from stream ID to the stream's number of actually acquired buffers.
-  // It must have an entry for keys present in stream_max_buffers_.
-  // Must be protected with pending_acquisition_mutex_.
-  std::unordered_map<int32_t, uint32_t> stream_acquired_buffers_;
-
   // Contains the stream IDs that have been requested previously.
   // Must be protected with pending_requests_mutex_.
   std::unordered_set<int32_t> requested_stream_ids_;
@@ -31,6 +31,15 @@ class ResultProcessor;
 struct ProcessBlockRequest {
   uint32_t request_id = 0;  // A unique ID of this process block request.
   CaptureRequest request;
+
+  // Read-only metadata shared with the stage that created this request. If
+  // shared_settings is not nullptr, it is used instead of request.settings.
+  // If shared_input_buffer_metadata is not empty, it is used instead of
+  // request.input_buffer_metadata. A process block can keep a reference to
+  // shared metadata instead of cloning it.
+  std::shared_ptr<const HalCameraMetadata> shared_settings;
+  std::vector<std::shared_ptr<const HalCameraMetadata>>
+      shared_input_buffer_metadata;
 };
 
 // Define a process block result.
@@ -92,6 +101,15 @@ class ProcessBlock {
       const std::vector<ProcessBlockRequest>& process_block_requests,
       const CaptureRequest& remaining_session_request) = 0;
 
+  // Same as ProcessRequests() but the process block takes ownership of the
+  // requests, so it can keep them without copying. The caller still owns the
+  // fences of the buffers. The default implementation calls ProcessRequests().
+  virtual status_t ProcessOwnedRequests(
+      std::vector<ProcessBlockRequest> process_block_requests,
+      CaptureRequest remaining_session_request) {
+    return ProcessRequests(process_block_requests, remaining_session_request);
+  }
+
   // Flush pending requests.
   virtual status_t Flush() = 0;
 };
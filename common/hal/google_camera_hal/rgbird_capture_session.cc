@@ -24,6 +24,7 @@
 #include <inttypes.h>
 #include <set>
 
+#include "async_process_block.h"
 #include "basic_result_processor.h"
 #include "depth_process_block.h"
 #include "hal_utils.h"
@@ -653,6 +654,13 @@ status_t RgbirdCaptureSession::SetupHdrplusProcessChain(
     return UNKNOWN_ERROR;
   }
   result_processor->SetResultCallback(process_capture_result, notify);
+  // The request processor owns the process block that owns the result
+  // processor, so it outlives the callback.
+  result_processor->SetZslBuffersReturnedCallback(
+      [request_processor = static_cast<HdrplusRequestProcessor*>(
+           hdrplus_request_processor_.get())](uint32_t frame_number) {
+        request_processor->NotifyZslBuffersReturned(frame_number);
+      });
 
   StreamConfiguration process_block_stream_config;
   status_t res =
@@ -718,6 +726,19 @@ status_t RgbirdCaptureSession::CreateProcessChain(
   if (NeedDepthProcessBlock()) {
     depth_result_processor->SetResultCallback(process_capture_result, notify);
 
+    if (async_depth_stage_) {
+      // Waiting for depth buffer fences and submitting depth requests happen
+      // on the stage's own thread instead of the realtime result thread.
+      depth_process_block = AsyncProcessBlock::Create(
+          std::move(depth_process_block), "RgbirdDepthStage",
+          kAsyncDepthStageQueueDepth);
+      if (depth_process_block == nullptr) {
+        ALOGE("%s: Creating the asynchronous depth stage failed.",
+              __FUNCTION__);
+        return UNKNOWN_ERROR;
+      }
+    }
+
     res = ConnectProcessChain(realtime_result_processor.get(),
                               std::move(depth_process_block),
                               std::move(depth_result_processor));
@@ -959,6 +980,9 @@ status_t RgbirdCaptureSession::Initialize(
     ALOGI("%s: Force creating internal streams for IR pipelines", __FUNCTION__);
   }
 
+  async_depth_stage_ =
+      property_get_bool("persist.camera.rgbird.async_depth", false);
+
   device_session_hwl_ = device_session_hwl;
   internal_stream_manager_ = InternalStreamManager::Create();
   if (internal_stream_manager_ == nullptr) {
@@ -84,6 +84,9 @@ class RgbirdCaptureSession : public CaptureSession {
   static constexpr uint32_t kPartialResult = 1;
   static const android_pixel_format_t kHdrplusRawFormat = HAL_PIXEL_FORMAT_RAW10;
   static const uint32_t kDefaultInternalBufferCount = 8;
+  // Maximum number of depth requests queued in front of the depth process
+  // block when it runs asynchronously.
+  static constexpr uint32_t kAsyncDepthStageQueueDepth = 4;
 
   status_t Initialize(CameraDeviceSessionHwl* device_session_hwl,
                       const StreamConfiguration& stream_config,
@@ -243,6 +246,9 @@ class RgbirdCaptureSession : public CaptureSession {
 
   // TODO(b/128633958): remove this after FLL syncing is verified
   bool force_internal_stream_ = false;
+  // Whether depth requests are submitted to the depth process block on a
+  // separate thread, so they don't delay realtime results.
+  bool async_depth_stage_ = false;
   // Use this stream id to check the request is HDR+ compatible
   int32_t hal_preview_stream_id_ = -1;
 };
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_RgbirdInternalStreamScheduler"
+#include <log/log.h>
+
+#include <inttypes.h>
+
+#include "rgbird_internal_stream_scheduler.h"
+
+namespace android {
+namespace google_camera_hal {
+
+std::unique_ptr<RgbirdInternalStreamScheduler>
+RgbirdInternalStreamScheduler::Create(const Policy& policy) {
+  if (policy.thermal_interval_scale == 0) {
+    ALOGE("%s: thermal_interval_scale must be at least 1.", __FUNCTION__);
+    return nullptr;
+  }
+
+  auto scheduler = std::unique_ptr<RgbirdInternalStreamScheduler>(
+      new RgbirdInternalStreamScheduler(policy));
+  if (scheduler == nullptr) {
+    ALOGE("%s: Creating RgbirdInternalStreamScheduler failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  ALOGI("%s: Idle IR RAW interval %u, thermal interval scale %u", __FUNCTION__,
+        policy.idle_ir_raw_interval, policy.thermal_interval_scale);
+  return scheduler;
+}
+
+RgbirdInternalStreamScheduler::RgbirdInternalStreamScheduler(
+    const Policy& policy)
+    : kPolicy(policy) {
+}
+
+RgbirdInternalStreamScheduler::~RgbirdInternalStreamScheduler() {
+  if (stats_.skipped_ir_raw_frames > 0) {
+    ALOGI("%s: IR RAW outputs requested for %" PRIu64 " frames, skipped for %"
+          PRIu64 " frames.",
+          __FUNCTION__, stats_.ir_raw_frames, stats_.skipped_ir_raw_frames);
+  }
+}
+
+bool RgbirdInternalStreamScheduler::ShouldRequestIrRaw(bool depth_requested,
+                                                       bool thermal_throttled) {
+  bool request_ir_raw = false;
+  if (depth_requested) {
+    request_ir_raw = true;
+  } else if (kPolicy.idle_ir_raw_interval > 0) {
+    uint32_t interval = kPolicy.idle_ir_raw_interval;
+    if (thermal_throttled) {
+      interval *= kPolicy.thermal_interval_scale;
+    }
+    request_ir_raw = frames_since_ir_raw_ + 1 >= interval;
+  }
+
+  if (request_ir_raw) {
+    frames_since_ir_raw_ = 0;
+    stats_.ir_raw_frames++;
+  } else {
+    frames_since_ir_raw_++;
+    stats_.skipped_ir_raw_frames++;
+  }
+
+  return request_ir_raw;
+}
+
+RgbirdInternalStreamScheduler::Stats RgbirdInternalStreamScheduler::GetStats()
+    const {
+  return stats_;
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_RGBIRD_INTERNAL_STREAM_SCHEDULER_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_RGBIRD_INTERNAL_STREAM_SCHEDULER_H_
+
+#include <memory>
+
+namespace android {
+namespace google_camera_hal {
+
+// RgbirdInternalStreamScheduler decides for each frame of an RGB-IR session
+// whether the internal IR RAW outputs are requested. Frames that request a
+// depth buffer always get them. Other frames only keep the IR pipelines
+// streaming at a sub-sampled rate, which is lowered further while the device
+// is thermally throttled.
+// RgbirdInternalStreamScheduler is not thread-safe. The caller must serialize
+// the calls.
+class RgbirdInternalStreamScheduler {
+ public:
+  struct Policy {
+    // Request the IR RAW outputs on every idle_ir_raw_interval-th frame that
+    // doesn't request a depth buffer. 1 requests them on every frame. 0
+    // requests them only on frames that request a depth buffer.
+    uint32_t idle_ir_raw_interval = 1;
+
+    // idle_ir_raw_interval is multiplied by thermal_interval_scale while the
+    // device is thermally throttled.
+    uint32_t thermal_interval_scale = 2;
+  };
+
+  struct Stats {
+    // Number of frames the IR RAW outputs are requested for.
+    uint64_t ir_raw_frames = 0;
+    // Number of frames the IR RAW outputs are skipped for.
+    uint64_t skipped_ir_raw_frames = 0;
+  };
+
+  static std::unique_ptr<RgbirdInternalStreamScheduler> Create(
+      const Policy& policy);
+
+  virtual ~RgbirdInternalStreamScheduler();
+
+  // Return whether the IR RAW outputs should be requested for the next frame.
+  bool ShouldRequestIrRaw(bool depth_requested, bool thermal_throttled);
+
+  Stats GetStats() const;
+
+ protected:
+  explicit RgbirdInternalStreamScheduler(const Policy& policy);
+
+ private:
+  const Policy kPolicy;
+
+  // Number of frames since the IR RAW outputs were last requested.
+  uint32_t frames_since_ir_raw_ = 0;
+
+  Stats stats_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_GOOGLE_CAMERA_HAL_RGBIRD_INTERNAL_STREAM_SCHEDULER_H_
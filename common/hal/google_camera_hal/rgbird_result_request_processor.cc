@@ -19,7 +19,6 @@
 #define ATRACE_TAG ATRACE_TAG_CAMERA
 #include <cutils/properties.h>
 #include <log/log.h>
-#include <sync/sync.h>
 #include <utils/Trace.h>
 
 #include <cutils/native_handle.h>
@@ -41,6 +40,12 @@ std::unique_ptr<RgbirdResultRequestProcessor> RgbirdResultRequestProcessor::Crea
     return nullptr;
   }
 
+  result_processor->fence_monitor_ = FenceMonitor::Create(kSyncWaitTimeMs);
+  if (result_processor->fence_monitor_ == nullptr) {
+    ALOGE("%s: Creating FenceMonitor failed.", __FUNCTION__);
+    return nullptr;
+  }
+
   // TODO(b/128633958): remove this after FLL syncing is verified
   result_processor->force_internal_stream_ =
       property_get_bool("persist.camera.rgbird.forceinternal", false);
@@ -335,32 +340,16 @@ status_t RgbirdResultRequestProcessor::ReturnInternalStreams(
   return OK;
 }
 
-status_t RgbirdResultRequestProcessor::CheckFenceStatus(CaptureRequest* request) {
-  int fence_status = 0;
-
-  if (request == nullptr) {
-    ALOGE("%s: request is null.", __FUNCTION__);
-    return UNKNOWN_ERROR;
-  }
-
-  for (uint32_t i = 0; i < request->output_buffers.size(); i++) {
-    if (request->output_buffers[i].acquire_fence != nullptr) {
-      auto fence =
-          const_cast<native_handle_t*>(request->output_buffers[i].acquire_fence);
-      if (fence->numFds == 1) {
-        fence_status = sync_wait(fence->data[0], kSyncWaitTime);
-      }
-      if (0 != fence_status) {
-        ALOGE("%s: Fence check failed.", __FUNCTION__);
-        return UNKNOWN_ERROR;
-      }
+void RgbirdResultRequestProcessor::ReleaseAcquireFences(
+    CaptureRequest* request) {
+  for (auto& buffer : request->output_buffers) {
+    if (buffer.acquire_fence != nullptr) {
+      auto fence = const_cast<native_handle_t*>(buffer.acquire_fence);
       native_handle_close(fence);
       native_handle_delete(fence);
-      request->output_buffers[i].acquire_fence = nullptr;
+      buffer.acquire_fence = nullptr;
     }
   }
-
-  return OK;
 }
 
 bool RgbirdResultRequestProcessor::IsAutocalMetadataReadyLocked(
@@ -394,9 +383,9 @@ bool RgbirdResultRequestProcessor::IsAutocalMetadataReadyLocked(
   return true;
 }
 
-status_t RgbirdResultRequestProcessor::VerifyAndSubmitDepthRequest(
+status_t RgbirdResultRequestProcessor::VerifyAndSubmitDepthRequestLocked(
     uint32_t frame_number) {
-  std::lock_guard<std::mutex> lock(depth_requests_mutex_);
+  std::unique_lock<std::mutex> lock(depth_requests_mutex_);
   if (depth_requests_.find(frame_number) == depth_requests_.end()) {
     ALOGW("%s: Can not find depth request with frame number %u", __FUNCTION__,
           frame_number);
@@ -438,7 +427,6 @@ status_t RgbirdResultRequestProcessor::VerifyAndSubmitDepthRequest(
 
   // Check against all metadata needed before move on e.g. check against
   // cropping info, FD result for internal YUV stream
-  status_t res = OK;
   if (IsAutocalRequest(frame_number)) {
     bool is_ready = false;
     for (auto& metadata : depth_request->input_buffer_metadata) {
@@ -453,24 +441,146 @@ status_t RgbirdResultRequestProcessor::VerifyAndSubmitDepthRequest(
     }
   }
 
-  res = CheckFenceStatus(depth_request.get());
+  // The request is erased once submitted, so its metadata can be handed to
+  // the depth process block without cloning.
+  auto pending_request = std::make_shared<FencePendingDepthRequest>();
+  for (auto& metadata : depth_request->input_buffer_metadata) {
+    pending_request->input_buffer_metadata.push_back(std::move(metadata));
+  }
+  depth_request->input_buffer_metadata.clear();
+  pending_request->request = std::move(depth_request);
+  depth_requests_.erase(frame_number);
+  // Keep the request visible to FlushPendingRequests() while it waits for its
+  // fences.
+  fence_pending_depth_requests_[frame_number] = pending_request;
+
+  lock.unlock();
+  return SubmitDepthRequestWhenFencesSignaledLocked(std::move(pending_request));
+}
+
+status_t
+RgbirdResultRequestProcessor::SubmitDepthRequestWhenFencesSignaledLocked(
+    std::shared_ptr<FencePendingDepthRequest> pending_request) {
+  ATRACE_CALL();
+  std::vector<const native_handle_t*> fences;
+  bool has_fence_fds = false;
+  for (auto& buffer : pending_request->request->output_buffers) {
+    fences.push_back(buffer.acquire_fence);
+    if (buffer.acquire_fence != nullptr && buffer.acquire_fence->numFds > 0) {
+      has_fence_fds = true;
+    }
+  }
+
+  // fence_monitor_ invokes the callback on this thread if there is nothing to
+  // wait for, so handle that here where callback_lock_ is known to be held.
+  if (!has_fence_fds) {
+    OnDepthRequestFencesSignaled(OK, pending_request.get(),
+                                 /*callback_locked=*/true);
+    return OK;
+  }
+
+  // std::function must be copyable, so the request is held by a shared_ptr.
+  status_t res = fence_monitor_->WaitForFences(
+      fences, [this, pending_request](status_t res) {
+        OnDepthRequestFencesSignaled(res, pending_request.get(),
+                                     /*callback_locked=*/false);
+      });
   if (res != OK) {
-    ALOGE("%s:Fence status wait failed.", __FUNCTION__);
+    ALOGE("%s: Waiting for the fences of frame %u failed: %s(%d)",
+          __FUNCTION__, pending_request->request->frame_number, strerror(-res),
+          res);
+    OnDepthRequestFencesSignaled(res, pending_request.get(),
+                                 /*callback_locked=*/true);
     return UNKNOWN_ERROR;
   }
 
-  res = ProcessRequest(*depth_request.get());
-  if (res != OK) {
+  return OK;
+}
+
+void RgbirdResultRequestProcessor::OnDepthRequestFencesSignaled(
+    status_t res, FencePendingDepthRequest* pending_request,
+    bool callback_locked) {
+  ATRACE_CALL();
+  std::unique_ptr<CaptureRequest>& depth_request = pending_request->request;
+  uint32_t frame_number = depth_request->frame_number;
+  bool flushed = false;
+  {
+    std::lock_guard<std::mutex> lock(depth_requests_mutex_);
+    flushed = fence_pending_depth_requests_.erase(frame_number) == 0;
+  }
+
+  // The fences are signaled, or waiting for them has failed.
+  ReleaseAcquireFences(depth_request.get());
+  if (flushed) {
+    ALOGV("%s: Depth request %u was flushed.", __FUNCTION__, frame_number);
+    return;
+  }
+
+  if (res == OK) {
+    res = SubmitDepthRequest(*depth_request, std::move(depth_request->settings),
+                             std::move(pending_request->input_buffer_metadata));
+    if (res == OK) {
+      return;
+    }
     ALOGE("%s: Failed to submit process request to depth process block.",
           __FUNCTION__);
-    return UNKNOWN_ERROR;
+  } else {
+    ALOGE("%s: Acquire fences of frame %u are not signaled: %s(%d)",
+          __FUNCTION__, frame_number, strerror(-res), res);
   }
 
-  depth_requests_.erase(frame_number);
-  return OK;
+  if (callback_locked) {
+    ReturnDepthRequestWithErrorLocked(*depth_request);
+  } else {
+    std::lock_guard<std::mutex> lock(callback_lock_);
+    ReturnDepthRequestWithErrorLocked(*depth_request);
+  }
+}
+
+void RgbirdResultRequestProcessor::ReturnDepthRequestWithErrorLocked(
+    const CaptureRequest& request) {
+  if (notify_ == nullptr || process_capture_result_ == nullptr) {
+    ALOGE("%s: Callbacks are not set. Dropping depth request %u.",
+          __FUNCTION__, request.frame_number);
+    return;
+  }
+
+  // Returns all internal stream buffers
+  for (auto& input_buffer : request.input_buffers) {
+    if (input_buffer.stream_id != kInvalidStreamId) {
+      status_t res = internal_stream_manager_->ReturnStreamBuffer(input_buffer);
+      if (res != OK) {
+        ALOGW("%s: Failed to return internal buffer for depth request %d",
+              __FUNCTION__, request.frame_number);
+      }
+    }
+  }
+
+  // Notify buffer error for the depth stream output buffer
+  const NotifyMessage message = {
+      .type = MessageType::kError,
+      .message.error = {.frame_number = request.frame_number,
+                        .error_stream_id = depth_stream_id_,
+                        .error_code = ErrorCode::kErrorBuffer}};
+  notify_(message);
+
+  // Return output buffer for the depth stream
+  auto result = std::make_unique<CaptureResult>();
+  result->frame_number = request.frame_number;
+  for (auto& output_buffer : request.output_buffers) {
+    if (output_buffer.stream_id == depth_stream_id_) {
+      result->output_buffers.push_back(output_buffer);
+      auto& buffer = result->output_buffers.back();
+      buffer.status = BufferStatus::kError;
+      buffer.acquire_fence = nullptr;
+      buffer.release_fence = nullptr;
+      break;
+    }
+  }
+  process_capture_result_(std::move(result));
 }
 
-status_t RgbirdResultRequestProcessor::TrySubmitDepthProcessBlockRequest(
+status_t RgbirdResultRequestProcessor::TrySubmitDepthProcessBlockRequestLocked(
     const ProcessBlockResult& block_result) {
   ATRACE_CALL();
   uint32_t request_id = block_result.request_id;
@@ -596,7 +706,7 @@ status_t RgbirdResultRequestProcessor::TrySubmitDepthProcessBlockRequest(
   }
 
   if (pending_request_updated) {
-    status_t res = VerifyAndSubmitDepthRequest(frame_number);
+    status_t res = VerifyAndSubmitDepthRequestLocked(frame_number);
     if (res != OK) {
       ALOGE("%s: Failed to verify and submit depth request.", __FUNCTION__);
       return res;
@@ -659,7 +769,7 @@ void RgbirdResultRequestProcessor::ProcessResult(ProcessBlockResult block_result
   }
 
   // Save necessary data for depth process block request
-  res = TrySubmitDepthProcessBlockRequest(block_result);
+  res = TrySubmitDepthProcessBlockRequestLocked(block_result);
   if (res != OK) {
     ALOGE("%s: Failed to submit depth process block request.", __FUNCTION__);
     return;
@@ -779,6 +889,24 @@ status_t RgbirdResultRequestProcessor::SetProcessBlock(
 status_t RgbirdResultRequestProcessor::ProcessRequest(
     const CaptureRequest& request) {
   ATRACE_CALL();
+  // The caller keeps the request, so its metadata is cloned once and then
+  // shared with the depth process block.
+  std::vector<std::shared_ptr<const HalCameraMetadata>> input_buffer_metadata;
+  for (auto& metadata : request.input_buffer_metadata) {
+    input_buffer_metadata.push_back(HalCameraMetadata::Clone(metadata.get()));
+  }
+
+  return SubmitDepthRequest(request,
+                            HalCameraMetadata::Clone(request.settings.get()),
+                            std::move(input_buffer_metadata));
+}
+
+status_t RgbirdResultRequestProcessor::SubmitDepthRequest(
+    const CaptureRequest& request,
+    std::shared_ptr<const HalCameraMetadata> settings,
+    std::vector<std::shared_ptr<const HalCameraMetadata>>
+        input_buffer_metadata) {
+  ATRACE_CALL();
   std::lock_guard<std::mutex> lock(depth_process_block_lock_);
   if (depth_process_block_ == nullptr) {
     ALOGE("%s: depth_process_block_ is null.", __FUNCTION__);
@@ -789,17 +917,23 @@ status_t RgbirdResultRequestProcessor::ProcessRequest(
   std::vector<ProcessBlockRequest> process_block_requests(1);
   auto& block_request = process_block_requests[0];
   block_request.request_id = 0;
+  block_request.shared_settings = std::move(settings);
+  block_request.shared_input_buffer_metadata =
+      std::move(input_buffer_metadata);
   CaptureRequest& physical_request = block_request.request;
   physical_request.frame_number = request.frame_number;
-  physical_request.settings = HalCameraMetadata::Clone(request.settings.get());
-  for (auto& metadata : request.input_buffer_metadata) {
-    physical_request.input_buffer_metadata.emplace_back(
-        HalCameraMetadata::Clone(metadata.get()));
-  }
   physical_request.input_buffers = request.input_buffers;
   physical_request.output_buffers = request.output_buffers;
 
-  return depth_process_block_->ProcessRequests(process_block_requests, request);
+  // The settings and metadata are shared through the block request, so the
+  // remaining request only needs the buffers.
+  CaptureRequest remaining_session_request;
+  remaining_session_request.frame_number = request.frame_number;
+  remaining_session_request.input_buffers = request.input_buffers;
+  remaining_session_request.output_buffers = request.output_buffers;
+
+  return depth_process_block_->ProcessOwnedRequests(
+      std::move(process_block_requests), std::move(remaining_session_request));
 }
 
 status_t RgbirdResultRequestProcessor::Flush() {
@@ -831,42 +965,15 @@ status_t RgbirdResultRequestProcessor::FlushPendingRequests() {
 
   std::lock_guard<std::mutex> requests_lock(depth_requests_mutex_);
   for (auto& [frame_number, capture_request] : depth_requests_) {
-    // Returns all internal stream buffers
-    for (auto& input_buffer : capture_request->input_buffers) {
-      if (input_buffer.stream_id != kInvalidStreamId) {
-        status_t res =
-            internal_stream_manager_->ReturnStreamBuffer(input_buffer);
-        if (res != OK) {
-          ALOGW("%s: Failed to return internal buffer for depth request %d",
-                __FUNCTION__, frame_number);
-        }
-      }
-    }
-
-    // Notify buffer error for the depth stream output buffer
-    const NotifyMessage message = {
-        .type = MessageType::kError,
-        .message.error = {.frame_number = frame_number,
-                          .error_stream_id = depth_stream_id_,
-                          .error_code = ErrorCode::kErrorBuffer}};
-    notify_(message);
-
-    // Return output buffer for the depth stream
-    auto result = std::make_unique<CaptureResult>();
-    result->frame_number = frame_number;
-    for (auto& output_buffer : capture_request->output_buffers) {
-      if (output_buffer.stream_id == depth_stream_id_) {
-        result->output_buffers.push_back(output_buffer);
-        auto& buffer = result->output_buffers.back();
-        buffer.status = BufferStatus::kError;
-        buffer.acquire_fence = nullptr;
-        buffer.release_fence = nullptr;
-        break;
-      }
-    }
-    process_capture_result_(std::move(result));
+    ReturnDepthRequestWithErrorLocked(*capture_request);
   }
   depth_requests_.clear();
+
+  // The fence callbacks drop the requests that are no longer in the map.
+  for (auto& [frame_number, pending_request] : fence_pending_depth_requests_) {
+    ReturnDepthRequestWithErrorLocked(*pending_request->request);
+  }
+  fence_pending_depth_requests_.clear();
   ALOGI("%s: Flushing depth requests done. ", __FUNCTION__);
   return OK;
 }
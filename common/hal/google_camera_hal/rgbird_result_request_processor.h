@@ -19,6 +19,7 @@
 
 #include <set>
 
+#include "fence_monitor.h"
 #include "request_processor.h"
 #include "result_processor.h"
 #include "vendor_tag_defs.h"
@@ -91,7 +92,6 @@ class RgbirdResultRequestProcessor : public ResultProcessor,
   const uint32_t kRgbCameraId;
   const uint32_t kIr1CameraId;
   const uint32_t kIr2CameraId;
-  const int32_t kSyncWaitTime = 5000;  // milliseconds
 
   void ProcessResultForHdrplus(CaptureResult* result, bool* rgb_raw_output);
   // Return the RGB internal YUV stream buffer if there is any and depth is
@@ -113,15 +113,17 @@ class RgbirdResultRequestProcessor : public ResultProcessor,
   // Remove internal streams for depth lock
   status_t ReturnInternalStreams(CaptureResult* result);
 
-  // Check fence status if need
-  status_t CheckFenceStatus(CaptureRequest* request);
+  // Close the acquire fences of the output buffers cloned by
+  // AddPendingRequests().
+  void ReleaseAcquireFences(CaptureRequest* request);
 
   // Check all metadata exist for Autocal
   // Protected by depth_requests_mutex_
   bool IsAutocalMetadataReadyLocked(const HalCameraMetadata& metadata);
 
-  // Prepare Depth Process Block request and try to submit that
-  status_t TrySubmitDepthProcessBlockRequest(
+  // Prepare Depth Process Block request and try to submit that.
+  // Must be protected by callback_lock_.
+  status_t TrySubmitDepthProcessBlockRequestLocked(
       const ProcessBlockResult& block_result);
 
   // Whether the internal yuv stream buffer needs to be passed to the depth
@@ -130,7 +132,42 @@ class RgbirdResultRequestProcessor : public ResultProcessor,
 
   // Verify if all information is ready for a depth request for frame_number and
   // submit the request to the process block if so.
-  status_t VerifyAndSubmitDepthRequest(uint32_t frame_number);
+  // Must be protected by callback_lock_.
+  status_t VerifyAndSubmitDepthRequestLocked(uint32_t frame_number);
+
+  // A depth request that is ready except for the acquire fences of its output
+  // buffers.
+  struct FencePendingDepthRequest {
+    std::unique_ptr<CaptureRequest> request;
+    std::vector<std::shared_ptr<const HalCameraMetadata>> input_buffer_metadata;
+  };
+
+  // Submit a depth request once the acquire fences of its output buffers are
+  // signaled. The fences are waited for by fence_monitor_, so this returns
+  // without waiting. Must be protected by callback_lock_.
+  status_t SubmitDepthRequestWhenFencesSignaledLocked(
+      std::shared_ptr<FencePendingDepthRequest> pending_request);
+
+  // Invoked when the acquire fences of a depth request are signaled or
+  // waiting for them failed. The request is submitted, or returned with an
+  // error if it fails. A request that was flushed is dropped.
+  // callback_locked indicates whether the caller holds callback_lock_.
+  void OnDepthRequestFencesSignaled(status_t res,
+                                    FencePendingDepthRequest* pending_request,
+                                    bool callback_locked);
+
+  // Return the internal input buffers of a depth request and return its depth
+  // buffer with ERROR_BUFFER. Must be protected by callback_lock_.
+  void ReturnDepthRequestWithErrorLocked(const CaptureRequest& request);
+
+  // Submit a depth request to the depth process block. The settings and the
+  // input buffer metadata are shared with the depth process block instead of
+  // cloned.
+  status_t SubmitDepthRequest(
+      const CaptureRequest& request,
+      std::shared_ptr<const HalCameraMetadata> settings,
+      std::vector<std::shared_ptr<const HalCameraMetadata>>
+          input_buffer_metadata);
 
   std::mutex callback_lock_;
 
@@ -181,6 +218,12 @@ class RgbirdResultRequestProcessor : public ResultProcessor,
   // Protected by depth_requests_mutex_
   std::unordered_map<uint32_t, std::unique_ptr<CaptureRequest>> depth_requests_;
 
+  // Map from frame number to depth requests waiting for their acquire fences.
+  // A request is removed when its fences are signaled or it is flushed.
+  // Protected by depth_requests_mutex_
+  std::unordered_map<uint32_t, std::shared_ptr<FencePendingDepthRequest>>
+      fence_pending_depth_requests_;
+
   // Depth stream id if it is configured for the current session
   int32_t depth_stream_id_ = -1;
 
@@ -192,6 +235,13 @@ class RgbirdResultRequestProcessor : public ResultProcessor,
   // Whether RGB-IR auto-calibration is enabled. This affects how the internal
   // YUV stream results are handled.
   bool rgb_ir_auto_cal_enabled_ = false;
+
+  // Time to wait for the acquire fences of a depth request.
+  static constexpr int32_t kSyncWaitTimeMs = 5000;
+
+  // Waits for the acquire fences of depth requests. Declared last so it is
+  // destroyed first, while its callbacks can still access the other members.
+  std::unique_ptr<FenceMonitor> fence_monitor_;
 };
 
 }  // namespace google_camera_hal
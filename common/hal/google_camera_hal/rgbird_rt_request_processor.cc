@@ -91,6 +91,33 @@ std::unique_ptr<RgbirdRtRequestProcessor> RgbirdRtRequestProcessor::Create(
   request_processor->is_auto_cal_session_ =
       request_processor->IsAutocalSession();
 
+  RgbirdInternalStreamScheduler::Policy policy;
+  int32_t idle_ir_raw_interval = property_get_int32(
+      "persist.camera.rgbird.idle_ir_interval", policy.idle_ir_raw_interval);
+  if (idle_ir_raw_interval >= 0) {
+    policy.idle_ir_raw_interval = idle_ir_raw_interval;
+  } else {
+    ALOGW("%s: Ignoring invalid idle IR RAW interval %d", __FUNCTION__,
+          idle_ir_raw_interval);
+  }
+
+  int32_t thermal_interval_scale =
+      property_get_int32("persist.camera.rgbird.thermal_ir_scale",
+                         policy.thermal_interval_scale);
+  if (thermal_interval_scale > 0) {
+    policy.thermal_interval_scale = thermal_interval_scale;
+  } else {
+    ALOGW("%s: Ignoring invalid thermal IR RAW interval scale %d",
+          __FUNCTION__, thermal_interval_scale);
+  }
+
+  request_processor->internal_stream_scheduler_ =
+      RgbirdInternalStreamScheduler::Create(policy);
+  if (request_processor->internal_stream_scheduler_ == nullptr) {
+    ALOGE("%s: Creating RgbirdInternalStreamScheduler failed.", __FUNCTION__);
+    return nullptr;
+  }
+
   return request_processor;
 }
 
@@ -121,6 +148,40 @@ bool RgbirdRtRequestProcessor::IsAutocalRequest(uint32_t frame_number) {
   return true;
 }
 
+bool RgbirdRtRequestProcessor::HasDepthOutputBuffer(
+    const CaptureRequest& request) const {
+  for (auto& output_buffer : request.output_buffers) {
+    if (output_buffer.stream_id == depth_stream_id_) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void RgbirdRtRequestProcessor::UpdateThermalThrottlingLocked(
+    const CaptureRequest& request) {
+  // Settings are only sent when they change.
+  if (request.settings == nullptr) {
+    return;
+  }
+
+  camera_metadata_ro_entry entry = {};
+  status_t res = request.settings->Get(VendorTagIds::kThermalThrottling, &entry);
+  if (res != OK || entry.count != 1) {
+    ALOGV("%s: Getting thermal throttling entry failed: %s(%d)", __FUNCTION__,
+          strerror(-res), res);
+    return;
+  }
+
+  bool thermal_throttled = entry.data.u8[0] == true;
+  if (thermal_throttled != thermal_throttled_) {
+    ALOGI("%s: Thermal throttling %s at frame %u", __FUNCTION__,
+          thermal_throttled ? "started" : "stopped", request.frame_number);
+    thermal_throttled_ = thermal_throttled;
+  }
+}
+
 RgbirdRtRequestProcessor::RgbirdRtRequestProcessor(
     uint32_t rgb_camera_id, uint32_t ir1_camera_id, uint32_t ir2_camera_id,
     uint32_t active_array_width, uint32_t active_array_height,
@@ -570,18 +631,10 @@ status_t RgbirdRtRequestProcessor::TryAddRgbProcessBlockRequestLocked(
     }
   }
 
-  if (is_hdrplus_zsl_enabled_ && request.settings != nullptr) {
-    camera_metadata_ro_entry entry = {};
-    status_t res =
-        request.settings->Get(VendorTagIds::kThermalThrottling, &entry);
-    if (res != OK || entry.count != 1) {
-      ALOGW("%s: Getting thermal throttling entry failed: %s(%d)", __FUNCTION__,
-            strerror(-res), res);
-    } else if (entry.data.u8[0] == true) {
-      // Disable HDR+ once thermal throttles.
-      is_hdrplus_zsl_enabled_ = false;
-      ALOGI("%s: HDR+ ZSL disabled due to thermal throttling", __FUNCTION__);
-    }
+  if (is_hdrplus_zsl_enabled_ && thermal_throttled_) {
+    // Disable HDR+ once thermal throttles.
+    is_hdrplus_zsl_enabled_ = false;
+    ALOGI("%s: HDR+ ZSL disabled due to thermal throttling", __FUNCTION__);
   }
 
   // Disable HDR+ for thermal throttling.
@@ -698,6 +751,8 @@ status_t RgbirdRtRequestProcessor::ProcessRequest(const CaptureRequest& request)
   }
 
   {
+    UpdateThermalThrottlingLocked(request);
+
     std::vector<ProcessBlockRequest> block_requests;
     status_t res = TryAddRgbProcessBlockRequestLocked(&block_requests, request);
     if (res != OK) {
@@ -707,7 +762,15 @@ status_t RgbirdRtRequestProcessor::ProcessRequest(const CaptureRequest& request)
     }
 
     // TODO(b/128633958): Remove the force flag after FLL sync is verified
-    if (force_internal_stream_ || depth_stream_id_ != kStreamIdInvalid) {
+    bool request_ir_raw = force_internal_stream_;
+    if (!request_ir_raw && depth_stream_id_ != kStreamIdInvalid) {
+      // IR RAW outputs are only consumed by depth requests. Other frames
+      // request them at a lower rate to keep the IR pipelines streaming.
+      request_ir_raw = internal_stream_scheduler_->ShouldRequestIrRaw(
+          HasDepthOutputBuffer(request), thermal_throttled_);
+    }
+
+    if (request_ir_raw) {
       res = AddIrRawProcessBlockRequestLocked(&block_requests, request,
                                               kIr1CameraId);
       if (res != OK) {
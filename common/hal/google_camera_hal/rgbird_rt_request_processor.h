@@ -21,6 +21,7 @@
 
 #include "process_block.h"
 #include "request_processor.h"
+#include "rgbird_internal_stream_scheduler.h"
 
 namespace android {
 namespace google_camera_hal {
@@ -111,6 +112,13 @@ class RgbirdRtRequestProcessor : public RequestProcessor {
   // Whether the internal YUV stream result should be used for auto cal.
   bool IsAutocalRequest(uint32_t frame_number);
 
+  // Whether request has an output buffer for the depth stream.
+  bool HasDepthOutputBuffer(const CaptureRequest& request) const;
+
+  // Update thermal_throttled_ from the settings of request.
+  // Must lock process_block_lock_ before calling this function.
+  void UpdateThermalThrottlingLocked(const CaptureRequest& request);
+
   std::mutex process_block_lock_;
 
   // Protected by process_block_lock_.
@@ -139,6 +147,14 @@ class RgbirdRtRequestProcessor : public RequestProcessor {
   // rgb_ir_auto_cal_enabled_ is true).
   bool is_auto_cal_session_ = false;
   bool auto_cal_triggered_ = false;
+
+  // Whether the latest request settings indicate thermal throttling.
+  // Protected by process_block_lock_.
+  bool thermal_throttled_ = false;
+
+  // Decides which frames request the internal IR RAW outputs.
+  // Protected by process_block_lock_.
+  std::unique_ptr<RgbirdInternalStreamScheduler> internal_stream_scheduler_;
 };
 
 }  // namespace google_camera_hal
@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AsyncStageBoundaryTests"
+#include <log/log.h>
+
+#include <async_process_block.h>
+#include <async_stage_boundary.h>
+#include <gtest/gtest.h>
+#include <result_processor.h>
+
+#include <future>
+#include <thread>
+
+#include "mock_process_block.h"
+#include "mock_result_processor.h"
+
+using ::testing::_;
+using ::testing::Return;
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr uint32_t kMaxQueueDepth = 2;
+
+TEST(AsyncStageBoundaryTests, Create) {
+  EXPECT_NE(AsyncStageBoundary::Create("Test", kMaxQueueDepth), nullptr);
+  EXPECT_EQ(AsyncStageBoundary::Create("Test", /*max_queue_depth=*/0), nullptr)
+      << "Creating a boundary without queue slots should fail";
+}
+
+TEST(AsyncStageBoundaryTests, TasksRunInOrder) {
+  auto boundary = AsyncStageBoundary::Create("Test", kMaxQueueDepth);
+  ASSERT_NE(boundary, nullptr);
+  EXPECT_NE(boundary->Enqueue(nullptr), OK);
+
+  const uint32_t kNumTasks = 10;
+  std::vector<uint32_t> task_order;
+  for (uint32_t i = 0; i < kNumTasks; i++) {
+    ASSERT_EQ(
+        boundary->Enqueue([i, &task_order]() { task_order.push_back(i); }),
+        OK);
+  }
+
+  boundary->Drain();
+  ASSERT_EQ(task_order.size(), kNumTasks);
+  for (uint32_t i = 0; i < kNumTasks; i++) {
+    EXPECT_EQ(task_order[i], i);
+  }
+
+  AsyncStageBoundary::Stats stats = boundary->GetStats();
+  EXPECT_EQ(stats.completed_tasks, kNumTasks);
+  EXPECT_EQ(stats.queue_depth, 0u);
+  EXPECT_LE(stats.max_queue_depth, kMaxQueueDepth);
+}
+
+TEST(AsyncStageBoundaryTests, EnqueueBlocksWhenFull) {
+  auto boundary = AsyncStageBoundary::Create("Test", kMaxQueueDepth);
+  ASSERT_NE(boundary, nullptr);
+
+  // Hold the worker thread in the first task so the queue fills up.
+  std::promise<void> release_worker;
+  std::shared_future<void> worker_released = release_worker.get_future();
+  std::promise<void> worker_started;
+  auto blocking_task = [&worker_started, worker_released]() {
+    worker_started.set_value();
+    worker_released.wait();
+  };
+  ASSERT_EQ(boundary->Enqueue(blocking_task), OK);
+  worker_started.get_future().wait();
+
+  for (uint32_t i = 0; i < kMaxQueueDepth; i++) {
+    ASSERT_EQ(boundary->Enqueue([]() {}), OK);
+  }
+  EXPECT_EQ(boundary->GetStats().queue_depth, kMaxQueueDepth);
+
+  auto blocked_enqueue = std::async(std::launch::async, [&boundary]() {
+    return boundary->Enqueue([]() {});
+  });
+  EXPECT_EQ(blocked_enqueue.wait_for(std::chrono::milliseconds(100)),
+            std::future_status::timeout)
+      << "Enqueue should block while the queue is full";
+
+  release_worker.set_value();
+  EXPECT_EQ(blocked_enqueue.get(), OK);
+  boundary->Drain();
+
+  AsyncStageBoundary::Stats stats = boundary->GetStats();
+  EXPECT_EQ(stats.completed_tasks, kMaxQueueDepth + 2);
+  EXPECT_EQ(stats.max_queue_depth, kMaxQueueDepth);
+  EXPECT_GT(stats.total_blocked_time, 0);
+}
+
+TEST(AsyncStageBoundaryTests, DestructorRunsQueuedTasks) {
+  uint32_t num_completed_tasks = 0;
+  {
+    auto boundary = AsyncStageBoundary::Create("Test", kMaxQueueDepth);
+    ASSERT_NE(boundary, nullptr);
+    for (uint32_t i = 0; i < kMaxQueueDepth; i++) {
+      ASSERT_EQ(boundary->Enqueue(
+                    [&num_completed_tasks]() { num_completed_tasks++; }),
+                OK);
+    }
+  }
+  EXPECT_EQ(num_completed_tasks, kMaxQueueDepth);
+}
+
+TEST(AsyncStageBoundaryTests, AsyncProcessBlockForwardsRequests) {
+  EXPECT_EQ(AsyncProcessBlock::Create(nullptr, "Test", kMaxQueueDepth),
+            nullptr);
+
+  auto mock_block = std::make_unique<MockProcessBlock>();
+  MockProcessBlock* mock_block_ptr = mock_block.get();
+  auto block = AsyncProcessBlock::Create(std::move(mock_block), "Test",
+                                         kMaxQueueDepth);
+  ASSERT_NE(block, nullptr);
+
+  const uint32_t kFrameNumber = 5;
+  std::vector<ProcessBlockRequest> block_requests(1);
+  block_requests[0].request.frame_number = kFrameNumber;
+  block_requests[0].request.output_buffers.push_back({.stream_id = 1});
+
+  CaptureRequest remaining_session_request;
+  remaining_session_request.frame_number = kFrameNumber;
+
+  EXPECT_CALL(*mock_block_ptr, ProcessRequests(_, _))
+      .WillOnce([&](const std::vector<ProcessBlockRequest>& requests,
+                    const CaptureRequest& remaining_request) {
+        EXPECT_EQ(requests.size(), 1u);
+        EXPECT_EQ(requests[0].request.frame_number, kFrameNumber);
+        EXPECT_EQ(requests[0].request.output_buffers.size(), 1u);
+        EXPECT_EQ(remaining_request.frame_number, kFrameNumber);
+        return OK;
+      });
+  EXPECT_CALL(*mock_block_ptr, Flush()).WillOnce(Return(OK));
+
+  EXPECT_EQ(block->ProcessRequests(block_requests, remaining_session_request),
+            OK);
+
+  // Flush waits for the queued request to reach the mock process block.
+  EXPECT_EQ(block->Flush(), OK);
+  EXPECT_EQ(block->GetStageStats().completed_tasks, 1u);
+}
+
+TEST(AsyncStageBoundaryTests, AsyncProcessBlockReturnsFailedRequests) {
+  // Owns the result processor for the mock process block.
+  std::unique_ptr<ResultProcessor> owned_result_processor;
+  auto mock_block = std::make_unique<MockProcessBlock>();
+  MockProcessBlock* mock_block_ptr = mock_block.get();
+  auto block = AsyncProcessBlock::Create(std::move(mock_block), "Test",
+                                         kMaxQueueDepth);
+  ASSERT_NE(block, nullptr);
+
+  auto result_processor = std::make_unique<MockResultProcessor>();
+  MockResultProcessor* result_processor_ptr = result_processor.get();
+  EXPECT_CALL(*mock_block_ptr, SetResultProcessor(_))
+      .WillOnce([&](std::unique_ptr<ResultProcessor> processor) {
+        owned_result_processor = std::move(processor);
+        return OK;
+      });
+  ASSERT_EQ(block->SetResultProcessor(std::move(result_processor)), OK);
+
+  const uint32_t kFrameNumber = 7;
+  const int32_t kOutputStreamId = 1;
+  const int32_t kInputStreamId = 2;
+  std::vector<ProcessBlockRequest> block_requests(1);
+  block_requests[0].request.frame_number = kFrameNumber;
+  block_requests[0].request.output_buffers.push_back(
+      {.stream_id = kOutputStreamId});
+  block_requests[0].request.input_buffers.push_back(
+      {.stream_id = kInputStreamId});
+
+  CaptureRequest remaining_session_request;
+  remaining_session_request.frame_number = kFrameNumber;
+  remaining_session_request.output_buffers =
+      block_requests[0].request.output_buffers;
+
+  EXPECT_CALL(*mock_block_ptr, ProcessRequests(_, _))
+      .WillOnce(Return(UNKNOWN_ERROR));
+  EXPECT_CALL(*result_processor_ptr, Notify(_))
+      .WillOnce([&](const ProcessBlockNotifyMessage& message) {
+        EXPECT_EQ(message.message.type, MessageType::kError);
+        EXPECT_EQ(message.message.message.error.frame_number, kFrameNumber);
+        EXPECT_EQ(message.message.message.error.error_stream_id,
+                  kOutputStreamId);
+        EXPECT_EQ(message.message.message.error.error_code,
+                  ErrorCode::kErrorBuffer);
+      });
+  EXPECT_CALL(*result_processor_ptr, ProcessResult(_))
+      .WillOnce([&](ProcessBlockResult block_result) {
+        ASSERT_NE(block_result.result, nullptr);
+        EXPECT_EQ(block_result.result->frame_number, kFrameNumber);
+        ASSERT_EQ(block_result.result->output_buffers.size(), 1u);
+        EXPECT_EQ(block_result.result->output_buffers[0].status,
+                  BufferStatus::kError);
+        ASSERT_EQ(block_result.result->input_buffers.size(), 1u);
+        EXPECT_EQ(block_result.result->input_buffers[0].stream_id,
+                  kInputStreamId);
+      });
+  EXPECT_CALL(*mock_block_ptr, Flush()).WillOnce(Return(OK));
+
+  EXPECT_EQ(block->ProcessOwnedRequests(std::move(block_requests),
+                                        std::move(remaining_session_request)),
+            OK);
+
+  // Flush waits for the failed request to be returned.
+  EXPECT_EQ(block->Flush(), OK);
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CachedBufferAllocatorTests"
+#include <log/log.h>
+
+#include <algorithm>
+
+#include <cached_buffer_allocator.h>
+#include <gtest/gtest.h>
+
+namespace android {
+namespace google_camera_hal {
+
+static const uint32_t kBufferWidth = 1920;
+static const uint32_t kBufferHeight = 1080;
+static const uint32_t kNumBuffers = 4;
+// Estimated size of a kBufferWidth x kBufferHeight YCbCr_420_888 buffer.
+static const uint64_t kBufferBytes = kBufferWidth * kBufferHeight * 3 / 2;
+
+// FakeBufferAllocator hands out unique fake buffer handles and counts the
+// buffers it allocates and frees.
+class FakeBufferAllocator : public IHalBufferAllocator {
+ public:
+  FakeBufferAllocator(uint32_t* num_allocated, uint32_t* num_freed)
+      : num_allocated_(num_allocated), num_freed_(num_freed) {
+  }
+
+  status_t AllocateBuffers(const HalBufferDescriptor& buffer_descriptor,
+                           std::vector<buffer_handle_t>* buffers) override {
+    for (uint32_t i = 0; i < buffer_descriptor.immediate_num_buffers; i++) {
+      buffers->push_back(reinterpret_cast<buffer_handle_t>(++next_handle_));
+    }
+    *num_allocated_ += buffer_descriptor.immediate_num_buffers;
+    return OK;
+  }
+
+  void FreeBuffers(std::vector<buffer_handle_t>* buffers) override {
+    *num_freed_ += buffers->size();
+    buffers->clear();
+  }
+
+ private:
+  uint32_t* num_allocated_ = nullptr;
+  uint32_t* num_freed_ = nullptr;
+  uintptr_t next_handle_ = 0;
+};
+
+static HalBufferDescriptor GetBufferDescriptor(uint32_t width = kBufferWidth) {
+  HalBufferDescriptor buffer_descriptor = {};
+  buffer_descriptor.width = width;
+  buffer_descriptor.height = kBufferHeight;
+  buffer_descriptor.format = HAL_PIXEL_FORMAT_YCBCR_420_888;
+  buffer_descriptor.producer_flags = GRALLOC1_PRODUCER_USAGE_CAMERA;
+  buffer_descriptor.consumer_flags = GRALLOC1_CONSUMER_USAGE_CAMERA;
+  buffer_descriptor.immediate_num_buffers = kNumBuffers;
+  buffer_descriptor.max_num_buffers = kNumBuffers;
+  return buffer_descriptor;
+}
+
+TEST(CachedBufferAllocatorTests, Create) {
+  EXPECT_EQ(CachedBufferAllocator::Create(/*allocator=*/nullptr,
+                                          /*max_cached_bytes=*/0),
+            nullptr)
+      << "Creating without an allocator should fail";
+
+  uint32_t num_allocated = 0, num_freed = 0;
+  EXPECT_NE(CachedBufferAllocator::Create(
+                std::make_unique<FakeBufferAllocator>(&num_allocated,
+                                                      &num_freed),
+                /*max_cached_bytes=*/0),
+            nullptr);
+}
+
+TEST(CachedBufferAllocatorTests, ReuseFreedBuffers) {
+  uint32_t num_allocated = 0, num_freed = 0;
+  auto allocator = CachedBufferAllocator::Create(
+      std::make_unique<FakeBufferAllocator>(&num_allocated, &num_freed),
+      kNumBuffers * kBufferBytes);
+  ASSERT_NE(allocator, nullptr);
+
+  // Simulate reconfiguring the same internal stream several times.
+  std::vector<buffer_handle_t> buffers;
+  for (uint32_t i = 0; i < 3; i++) {
+    ASSERT_EQ(allocator->AllocateBuffers(GetBufferDescriptor(), &buffers), OK);
+    ASSERT_EQ(buffers.size(), kNumBuffers);
+    allocator->FreeBuffers(&buffers);
+    EXPECT_EQ(buffers.size(), 0u);
+  }
+
+  EXPECT_EQ(num_allocated, kNumBuffers) << "Only the first set is allocated";
+  EXPECT_EQ(num_freed, 0u) << "Buffers within the budget are kept";
+  EXPECT_EQ(allocator->GetCachedBytes(), kNumBuffers * kBufferBytes);
+
+  // A different descriptor cannot reuse the cached buffers.
+  ASSERT_EQ(allocator->AllocateBuffers(GetBufferDescriptor(kBufferWidth / 2),
+                                       &buffers),
+            OK);
+  EXPECT_EQ(num_allocated, 2 * kNumBuffers);
+  allocator->FreeBuffers(&buffers);
+
+  allocator->Clear();
+  EXPECT_EQ(allocator->GetCachedBytes(), 0u);
+  EXPECT_EQ(num_freed, num_allocated);
+}
+
+TEST(CachedBufferAllocatorTests, EvictLeastRecentlyFreed) {
+  uint32_t num_allocated = 0, num_freed = 0;
+  auto allocator = CachedBufferAllocator::Create(
+      std::make_unique<FakeBufferAllocator>(&num_allocated, &num_freed),
+      kNumBuffers * kBufferBytes);
+  ASSERT_NE(allocator, nullptr);
+
+  std::vector<buffer_handle_t> old_buffers;
+  std::vector<buffer_handle_t> new_buffers;
+  ASSERT_EQ(allocator->AllocateBuffers(GetBufferDescriptor(), &old_buffers),
+            OK);
+  ASSERT_EQ(allocator->AllocateBuffers(GetBufferDescriptor(), &new_buffers),
+            OK);
+  std::vector<buffer_handle_t> expected_buffers = new_buffers;
+
+  // Only one set fits in the budget, so the set freed first is released.
+  allocator->FreeBuffers(&old_buffers);
+  allocator->FreeBuffers(&new_buffers);
+  EXPECT_EQ(num_freed, kNumBuffers);
+  EXPECT_EQ(allocator->GetCachedBytes(), kNumBuffers * kBufferBytes);
+
+  std::vector<buffer_handle_t> buffers;
+  ASSERT_EQ(allocator->AllocateBuffers(GetBufferDescriptor(), &buffers), OK);
+  std::sort(buffers.begin(), buffers.end());
+  std::sort(expected_buffers.begin(), expected_buffers.end());
+  EXPECT_EQ(buffers, expected_buffers) << "The most recent set is reused";
+  EXPECT_EQ(num_allocated, 2 * kNumBuffers);
+  allocator->FreeBuffers(&buffers);
+}
+
+TEST(CachedBufferAllocatorTests, EvictAcrossDescriptors) {
+  uint32_t num_allocated = 0, num_freed = 0;
+  auto allocator = CachedBufferAllocator::Create(
+      std::make_unique<FakeBufferAllocator>(&num_allocated, &num_freed),
+      2 * kBufferBytes);
+  ASSERT_NE(allocator, nullptr);
+
+  // Two descriptors with the same buffer size but different cache keys.
+  HalBufferDescriptor descriptor_a = GetBufferDescriptor();
+  descriptor_a.immediate_num_buffers = 1;
+  HalBufferDescriptor descriptor_b = descriptor_a;
+  descriptor_b.consumer_flags |= GRALLOC1_CONSUMER_USAGE_CPU_READ;
+
+  std::vector<buffer_handle_t> a1, a2, b1;
+  ASSERT_EQ(allocator->AllocateBuffers(descriptor_a, &a1), OK);
+  ASSERT_EQ(allocator->AllocateBuffers(descriptor_a, &a2), OK);
+  ASSERT_EQ(allocator->AllocateBuffers(descriptor_b, &b1), OK);
+  buffer_handle_t expected_a = a2[0];
+  buffer_handle_t expected_b = b1[0];
+
+  // Freeing a1, b1 and a2 in turn exceeds the budget, so a1 is released.
+  allocator->FreeBuffers(&a1);
+  allocator->FreeBuffers(&b1);
+  allocator->FreeBuffers(&a2);
+  EXPECT_EQ(num_freed, 1u);
+
+  std::vector<buffer_handle_t> buffers;
+  ASSERT_EQ(allocator->AllocateBuffers(descriptor_a, &buffers), OK);
+  ASSERT_EQ(allocator->AllocateBuffers(descriptor_b, &buffers), OK);
+  ASSERT_EQ(buffers.size(), 2u);
+  EXPECT_EQ(buffers[0], expected_a);
+  EXPECT_EQ(buffers[1], expected_b);
+  EXPECT_EQ(num_allocated, 3u) << "Both cached buffers should be reused";
+  allocator->FreeBuffers(&buffers);
+}
+
+TEST(CachedBufferAllocatorTests, ZeroBudget) {
+  uint32_t num_allocated = 0, num_freed = 0;
+  auto allocator = CachedBufferAllocator::Create(
+      std::make_unique<FakeBufferAllocator>(&num_allocated, &num_freed),
+      /*max_cached_bytes=*/0);
+  ASSERT_NE(allocator, nullptr);
+
+  std::vector<buffer_handle_t> buffers;
+  ASSERT_EQ(allocator->AllocateBuffers(GetBufferDescriptor(), &buffers), OK);
+  allocator->FreeBuffers(&buffers);
+  EXPECT_EQ(num_freed, kNumBuffers) << "Buffers should be released right away";
+  EXPECT_EQ(allocator->GetCachedBytes(), 0u);
+}
+
+TEST(CachedBufferAllocatorTests, Prewarm) {
+  uint32_t num_allocated = 0, num_freed = 0;
+  auto allocator = CachedBufferAllocator::Create(
+      std::make_unique<FakeBufferAllocator>(&num_allocated, &num_freed),
+      kNumBuffers * kBufferBytes);
+  ASSERT_NE(allocator, nullptr);
+
+  ASSERT_EQ(allocator->Prewarm(GetBufferDescriptor()), OK);
+  EXPECT_EQ(num_allocated, kNumBuffers);
+
+  // Allocating more buffers than prewarmed only allocates the difference.
+  HalBufferDescriptor buffer_descriptor = GetBufferDescriptor();
+  buffer_descriptor.immediate_num_buffers = kNumBuffers + 1;
+  std::vector<buffer_handle_t> buffers;
+  ASSERT_EQ(allocator->AllocateBuffers(buffer_descriptor, &buffers), OK);
+  EXPECT_EQ(buffers.size(), kNumBuffers + 1);
+  EXPECT_EQ(num_allocated, kNumBuffers + 1);
+  allocator->FreeBuffers(&buffers);
+}
+
+TEST(CachedBufferAllocatorTests, PrewarmTopsUpToBudget) {
+  uint32_t num_allocated = 0, num_freed = 0;
+  auto allocator = CachedBufferAllocator::Create(
+      std::make_unique<FakeBufferAllocator>(&num_allocated, &num_freed),
+      kNumBuffers * kBufferBytes);
+  ASSERT_NE(allocator, nullptr);
+
+  HalBufferDescriptor buffer_descriptor = GetBufferDescriptor();
+  buffer_descriptor.immediate_num_buffers = 1;
+  ASSERT_EQ(allocator->Prewarm(buffer_descriptor), OK);
+  EXPECT_EQ(num_allocated, 1u);
+
+  // Prewarming again only allocates the buffers missing from the cache.
+  ASSERT_EQ(allocator->Prewarm(buffer_descriptor), OK);
+  EXPECT_EQ(num_allocated, 1u) << "Cached buffers should not be allocated";
+
+  // Prewarming more buffers than the budget stops at the budget.
+  buffer_descriptor.immediate_num_buffers = kNumBuffers * 2;
+  ASSERT_EQ(allocator->Prewarm(buffer_descriptor), OK);
+  EXPECT_EQ(num_allocated, kNumBuffers);
+  EXPECT_EQ(num_freed, 0u) << "Prewarming should not evict buffers";
+  EXPECT_EQ(allocator->GetCachedBytes(), kNumBuffers * kBufferBytes);
+}
+
+TEST(CachedBufferAllocatorTests, ClearProcessInstances) {
+  uint32_t num_allocated = 0, num_freed = 0;
+  auto allocator = CachedBufferAllocator::Create(
+      std::make_unique<FakeBufferAllocator>(&num_allocated, &num_freed),
+      kNumBuffers * kBufferBytes);
+  ASSERT_NE(allocator, nullptr);
+
+  CachedBufferAllocator::SetHwlInstance(allocator.get());
+  EXPECT_EQ(CachedBufferAllocator::GetHwlInstance(), allocator.get());
+
+  ASSERT_EQ(allocator->Prewarm(GetBufferDescriptor()), OK);
+  CachedBufferAllocator::ClearProcessInstances();
+  EXPECT_EQ(num_freed, kNumBuffers) << "Cached HWL buffers should be released";
+  EXPECT_EQ(allocator->GetCachedBytes(), 0u);
+
+  CachedBufferAllocator::SetHwlInstance(nullptr);
+  EXPECT_EQ(CachedBufferAllocator::GetHwlInstance(), nullptr);
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
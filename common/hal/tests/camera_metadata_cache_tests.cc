@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "CameraMetadataCacheTests"
+#include <log/log.h>
+
+#include <camera_metadata_cache.h>
+#include <gtest/gtest.h>
+#include <string.h>
+#include <system/camera_metadata.h>
+#include <unistd.h>
+
+#include <fstream>
+
+namespace android {
+namespace google_camera_hal {
+
+static std::string GetCachePath(const char* name) {
+  return ::testing::TempDir() + name;
+}
+
+static std::unique_ptr<HalCameraMetadata> CreateCharacteristics(
+    int32_t width, int32_t height, float focal_length) {
+  auto metadata = HalCameraMetadata::Create(/*entry_capacity=*/8,
+                                            /*data_capacity=*/128);
+  if (metadata == nullptr) {
+    return nullptr;
+  }
+
+  int32_t pixel_array_size[] = {width, height};
+  metadata->Set(ANDROID_SENSOR_INFO_PIXEL_ARRAY_SIZE, pixel_array_size, 2);
+  metadata->Set(ANDROID_LENS_INFO_AVAILABLE_FOCAL_LENGTHS, &focal_length, 1);
+  uint8_t pipeline_depth = 4;
+  metadata->Set(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &pipeline_depth, 1);
+  int64_t max_frame_duration = 33333333;
+  metadata->Set(ANDROID_SENSOR_INFO_MAX_FRAME_DURATION, &max_frame_duration, 1);
+  camera_metadata_rational_t color_transform[9];
+  for (size_t i = 0; i < 9; i++) {
+    color_transform[i] = {.numerator = (i % 4 == 0) ? 1 : 0,
+                          .denominator = 1};
+  }
+  metadata->Set(ANDROID_SENSOR_COLOR_TRANSFORM1, color_transform, 9);
+
+  return metadata;
+}
+
+// Verify that both metadata contain the same entries with the same values.
+static void ExpectSameMetadata(const HalCameraMetadata& expected,
+                               const HalCameraMetadata& actual) {
+  ASSERT_EQ(expected.GetEntryCount(), actual.GetEntryCount());
+  for (size_t i = 0; i < expected.GetEntryCount(); i++) {
+    camera_metadata_ro_entry_t expected_entry, actual_entry;
+    ASSERT_EQ(expected.GetByIndex(&expected_entry, i), OK);
+    ASSERT_EQ(actual.Get(expected_entry.tag, &actual_entry), OK)
+        << "Tag " << expected_entry.tag << " is missing";
+    ASSERT_EQ(expected_entry.type, actual_entry.type);
+    ASSERT_EQ(expected_entry.count, actual_entry.count);
+    size_t data_size =
+        camera_metadata_type_size[expected_entry.type] * expected_entry.count;
+    EXPECT_EQ(memcmp(expected_entry.data.u8, actual_entry.data.u8, data_size),
+              0)
+        << "Tag " << expected_entry.tag << " has different values";
+  }
+}
+
+TEST(CameraMetadataCacheTests, LoadMatchesStoredMetadata) {
+  std::string cache_path = GetCachePath("metadata_cache_load.bin");
+  std::vector<std::unique_ptr<HalCameraMetadata>> metadata;
+  metadata.push_back(CreateCharacteristics(4032, 3024, 4.38f));
+  metadata.push_back(CreateCharacteristics(1920, 1080, 2.2f));
+  ASSERT_NE(metadata[0], nullptr);
+  ASSERT_NE(metadata[1], nullptr);
+
+  uint64_t hash = CameraMetadataCache::GetContentHash("{\"config\": 1}");
+  ASSERT_EQ(CameraMetadataCache::Store(cache_path, hash, metadata), OK);
+
+  std::vector<std::unique_ptr<HalCameraMetadata>> cached_metadata;
+  ASSERT_EQ(CameraMetadataCache::Load(cache_path, hash, &cached_metadata), OK);
+  ASSERT_EQ(cached_metadata.size(), metadata.size());
+  for (size_t i = 0; i < metadata.size(); i++) {
+    ASSERT_NE(cached_metadata[i], nullptr);
+    ExpectSameMetadata(*metadata[i], *cached_metadata[i]);
+  }
+
+  unlink(cache_path.c_str());
+}
+
+TEST(CameraMetadataCacheTests, LoadRejectsChangedSource) {
+  std::string cache_path = GetCachePath("metadata_cache_hash.bin");
+  std::vector<std::unique_ptr<HalCameraMetadata>> metadata;
+  metadata.push_back(CreateCharacteristics(640, 480, 3.0f));
+
+  uint64_t hash = CameraMetadataCache::GetContentHash("{\"config\": 1}");
+  uint64_t new_hash = CameraMetadataCache::GetContentHash("{\"config\": 2}");
+  ASSERT_NE(hash, new_hash);
+  ASSERT_EQ(CameraMetadataCache::Store(cache_path, hash, metadata), OK);
+
+  std::vector<std::unique_ptr<HalCameraMetadata>> cached_metadata;
+  EXPECT_EQ(CameraMetadataCache::Load(cache_path, new_hash, &cached_metadata),
+            BAD_VALUE);
+  EXPECT_TRUE(cached_metadata.empty());
+
+  // Regenerating the cache makes it valid for the new source.
+  ASSERT_EQ(CameraMetadataCache::Store(cache_path, new_hash, metadata), OK);
+  EXPECT_EQ(CameraMetadataCache::Load(cache_path, new_hash, &cached_metadata),
+            OK);
+  EXPECT_EQ(cached_metadata.size(), metadata.size());
+
+  unlink(cache_path.c_str());
+}
+
+TEST(CameraMetadataCacheTests, SourceHashCoversParserVersion) {
+  const std::string source = "{\"config\": 1}";
+  EXPECT_EQ(CameraMetadataCache::GetSourceHash(source, /*parser_version=*/1),
+            CameraMetadataCache::GetSourceHash(source, /*parser_version=*/1));
+  EXPECT_NE(CameraMetadataCache::GetSourceHash(source, /*parser_version=*/1),
+            CameraMetadataCache::GetSourceHash(source, /*parser_version=*/2))
+      << "A new parser version should invalidate the cache";
+  EXPECT_NE(CameraMetadataCache::GetSourceHash(source, /*parser_version=*/1),
+            CameraMetadataCache::GetContentHash(source));
+}
+
+TEST(CameraMetadataCacheTests, LoadRejectsMissingOrCorruptedCache) {
+  std::string cache_path = GetCachePath("metadata_cache_corrupted.bin");
+  unlink(cache_path.c_str());
+  std::vector<std::unique_ptr<HalCameraMetadata>> cached_metadata;
+  EXPECT_EQ(CameraMetadataCache::Load(cache_path, 0, &cached_metadata),
+            NAME_NOT_FOUND);
+  EXPECT_EQ(CameraMetadataCache::Load(cache_path, 0, nullptr), BAD_VALUE);
+
+  std::vector<std::unique_ptr<HalCameraMetadata>> metadata;
+  metadata.push_back(CreateCharacteristics(640, 480, 3.0f));
+  ASSERT_EQ(CameraMetadataCache::Store(cache_path, 0, metadata), OK);
+
+  // Truncate the cache in the middle of the metadata.
+  ASSERT_EQ(truncate(cache_path.c_str(), 40), 0);
+  EXPECT_EQ(CameraMetadataCache::Load(cache_path, 0, &cached_metadata),
+            BAD_VALUE);
+
+  // Overwrite the cache with unrelated contents.
+  {
+    std::ofstream file(cache_path, std::ios::binary | std::ios::trunc);
+    file << "not a metadata cache file";
+  }
+  EXPECT_EQ(CameraMetadataCache::Load(cache_path, 0, &cached_metadata),
+            BAD_VALUE);
+  EXPECT_TRUE(cached_metadata.empty());
+
+  unlink(cache_path.c_str());
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DepthProcessBlockTest"
+#include <cutils/ashmem.h>
+#include <cutils/native_handle.h>
+#include <log/log.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include "depth_process_block.h"
+#include "fake_depth_generator.h"
+#include "mock_device_session_hwl.h"
+#include "mock_result_processor.h"
+
+using ::testing::_;
+using ::testing::Invoke;
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr uint32_t kLogicalCameraId = 3;
+static const std::vector<uint32_t> kPhysicalCameraIds = {0, 1, 2};
+static constexpr int32_t kDepthStreamId = 0;
+static constexpr int32_t kIr1StreamId = 1;
+static constexpr int32_t kIr2StreamId = 2;
+static constexpr uint32_t kStreamWidth = 64;
+static constexpr uint32_t kStreamHeight = 48;
+static constexpr int32_t kActiveArraySize[] = {0, 0, 640, 480};
+// Time to wait for all depth results of a test.
+static constexpr auto kResultTimeout = std::chrono::seconds(5);
+
+class DepthProcessBlockTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    session_hwl_ = std::make_unique<MockDeviceSessionHwl>(kLogicalCameraId,
+                                                          kPhysicalCameraIds);
+    ASSERT_NE(session_hwl_, nullptr);
+    session_hwl_->DelegateCallsToFakeSession();
+
+    // DepthProcessBlock needs the active array sizes and an IR camera.
+    ON_CALL(*session_hwl_, GetCameraCharacteristics(_))
+        .WillByDefault(
+            Invoke([](std::unique_ptr<HalCameraMetadata>* characteristics) {
+              *characteristics = CreateCharacteristics(/*is_ir=*/false);
+              return OK;
+            }));
+    ON_CALL(*session_hwl_, GetPhysicalCameraCharacteristics(_, _))
+        .WillByDefault(
+            Invoke([](uint32_t /*physical_camera_id*/,
+                      std::unique_ptr<HalCameraMetadata>* characteristics) {
+              *characteristics = CreateCharacteristics(/*is_ir=*/true);
+              return OK;
+            }));
+
+    stream_config_.operation_mode = StreamConfigurationMode::kNormal;
+    stream_config_.streams = {
+        CreateStream(kDepthStreamId, StreamType::kOutput,
+                     HAL_PIXEL_FORMAT_Y16, HAL_DATASPACE_DEPTH),
+        CreateStream(kIr1StreamId, StreamType::kInput, HAL_PIXEL_FORMAT_Y8,
+                     HAL_DATASPACE_UNKNOWN),
+        CreateStream(kIr2StreamId, StreamType::kInput, HAL_PIXEL_FORMAT_Y8,
+                     HAL_DATASPACE_UNKNOWN),
+    };
+  }
+
+  void TearDown() override {
+    // Buffers must stay valid until the block unmaps them.
+    block_ = nullptr;
+    for (auto& handle : buffer_handles_) {
+      native_handle_close(handle);
+      native_handle_delete(handle);
+    }
+    buffer_handles_.clear();
+  }
+
+  static std::unique_ptr<HalCameraMetadata> CreateCharacteristics(bool is_ir) {
+    auto characteristics = HalCameraMetadata::Create(/*num_entries=*/2,
+                                                     /*data_bytes=*/64);
+    characteristics->Set(ANDROID_SENSOR_INFO_PRE_CORRECTION_ACTIVE_ARRAY_SIZE,
+                         kActiveArraySize,
+                         sizeof(kActiveArraySize) / sizeof(int32_t));
+    if (is_ir) {
+      uint8_t cfa = ANDROID_SENSOR_INFO_COLOR_FILTER_ARRANGEMENT_NIR;
+      characteristics->Set(ANDROID_SENSOR_INFO_COLOR_FILTER_ARRANGEMENT, &cfa,
+                           /*entry_count=*/1);
+    }
+    return characteristics;
+  }
+
+  static Stream CreateStream(int32_t id, StreamType stream_type,
+                             android_pixel_format_t format,
+                             android_dataspace_t data_space) {
+    Stream stream;
+    stream.id = id;
+    stream.stream_type = stream_type;
+    stream.width = kStreamWidth;
+    stream.height = kStreamHeight;
+    stream.format = format;
+    stream.data_space = data_space;
+    return stream;
+  }
+
+  // Create a buffer backed by shared memory that DepthProcessBlock can map.
+  StreamBuffer CreateStreamBuffer(int32_t stream_id, size_t size) {
+    StreamBuffer stream_buffer = {.stream_id = stream_id};
+    int fd = ashmem_create_region("depth_process_block_test", size);
+    if (fd < 0) {
+      ALOGE("%s: Creating a shared memory region failed.", __FUNCTION__);
+      return stream_buffer;
+    }
+
+    native_handle_t* handle = native_handle_create(/*numFds=*/1,
+                                                   /*numInts=*/0);
+    handle->data[0] = fd;
+    buffer_handles_.push_back(handle);
+    stream_buffer.buffer_id = buffer_handles_.size();
+    stream_buffer.buffer = handle;
+    return stream_buffer;
+  }
+
+  // Create a DepthProcessBlock with a FakeDepthGenerator that takes latency
+  // to process each request.
+  void CreateDepthProcessBlock(
+      uint32_t max_in_flight_requests,
+      DepthProcessBlock::BackpressurePolicy backpressure_policy,
+      std::chrono::milliseconds latency) {
+    auto depth_generator = std::make_unique<FakeDepthGenerator>(latency);
+    ASSERT_NE(depth_generator, nullptr);
+    depth_generator_ = depth_generator.get();
+
+    DepthProcessBlock::DepthProcessBlockCreateData create_data = {
+        .ir1_internal_raw_stream_id = kIr1StreamId,
+        .ir2_internal_raw_stream_id = kIr2StreamId,
+        .max_in_flight_requests = max_in_flight_requests,
+        .backpressure_policy = backpressure_policy,
+    };
+    block_ = DepthProcessBlock::Create(session_hwl_.get(),
+                                       /*request_stream_buffers=*/nullptr,
+                                       create_data, std::move(depth_generator));
+    ASSERT_NE(block_, nullptr) << "Creating DepthProcessBlock failed";
+    ASSERT_EQ(block_->ConfigureStreams(stream_config_, stream_config_), OK);
+
+    auto result_processor = std::make_unique<MockResultProcessor>();
+    ASSERT_NE(result_processor, nullptr);
+    ON_CALL(*result_processor, ProcessResult(_))
+        .WillByDefault(Invoke([this](ProcessBlockResult block_result) {
+          std::lock_guard<std::mutex> lock(result_lock_);
+          uint32_t frame_number = block_result.result->frame_number;
+          for (auto& buffer : block_result.result->output_buffers) {
+            if (buffer.stream_id == kDepthStreamId) {
+              depth_buffer_status_[frame_number] = buffer.status;
+              if (buffer.status == BufferStatus::kError &&
+                  error_notified_frames_.count(frame_number) == 0) {
+                num_unnotified_error_buffers_++;
+              }
+            }
+          }
+          result_condition_.notify_one();
+        }));
+    ON_CALL(*result_processor, Notify(_))
+        .WillByDefault(Invoke([this](const ProcessBlockNotifyMessage& message) {
+          std::lock_guard<std::mutex> lock(result_lock_);
+          if (message.message.type == MessageType::kError &&
+              message.message.message.error.error_code ==
+                  ErrorCode::kErrorBuffer &&
+              message.message.message.error.error_stream_id ==
+                  kDepthStreamId) {
+            error_notified_frames_.insert(
+                message.message.message.error.frame_number);
+          }
+        }));
+    ASSERT_EQ(block_->SetResultProcessor(std::move(result_processor)), OK);
+  }
+
+  // Create a depth request with new buffers for frame_number.
+  ProcessBlockRequest CreateRequest(uint32_t frame_number) {
+    const size_t ir_buffer_size = kStreamWidth * kStreamHeight;
+    ProcessBlockRequest block_request;
+    block_request.request.frame_number = frame_number;
+    block_request.request.input_buffers = {
+        CreateStreamBuffer(kIr1StreamId, ir_buffer_size),
+        CreateStreamBuffer(kIr2StreamId, ir_buffer_size)};
+    block_request.request.output_buffers = {
+        CreateStreamBuffer(kDepthStreamId, ir_buffer_size * 2)};
+    return block_request;
+  }
+
+  void SubmitRequest(ProcessBlockRequest block_request) {
+    std::vector<ProcessBlockRequest> block_requests;
+    block_requests.push_back(std::move(block_request));
+    ASSERT_EQ(
+        block_->ProcessRequests(block_requests, block_requests[0].request), OK);
+  }
+
+  // Submit a depth request with new buffers for frame_number.
+  void SubmitRequest(uint32_t frame_number) {
+    SubmitRequest(CreateRequest(frame_number));
+  }
+
+  static std::unique_ptr<HalCameraMetadata> CreateSettings(bool has_crop) {
+    auto settings = HalCameraMetadata::Create(/*num_entries=*/2,
+                                              /*data_bytes=*/64);
+    uint8_t intent = ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW;
+    settings->Set(ANDROID_CONTROL_CAPTURE_INTENT, &intent, /*entry_count=*/1);
+    if (has_crop) {
+      settings->Set(ANDROID_SCALER_CROP_REGION, kActiveArraySize,
+                    sizeof(kActiveArraySize) / sizeof(int32_t));
+    }
+    return settings;
+  }
+
+  // Clones may be smaller than the original metadata.
+  static size_t GetClonedSize(const HalCameraMetadata* metadata) {
+    return HalCameraMetadata::Clone(metadata)->GetCameraMetadataSize();
+  }
+
+  // Wait until the depth results of num_frames frames are received.
+  bool WaitForResults(size_t num_frames) {
+    std::unique_lock<std::mutex> lock(result_lock_);
+    return result_condition_.wait_for(lock, kResultTimeout, [&] {
+      return depth_buffer_status_.size() == num_frames;
+    });
+  }
+
+  uint32_t GetNumErrorBuffers() {
+    std::lock_guard<std::mutex> lock(result_lock_);
+    uint32_t num_error_buffers = 0;
+    for (auto& status : depth_buffer_status_) {
+      if (status.second == BufferStatus::kError) {
+        num_error_buffers++;
+      }
+    }
+    return num_error_buffers;
+  }
+
+  uint32_t GetNumUnnotifiedErrorBuffers() {
+    std::lock_guard<std::mutex> lock(result_lock_);
+    return num_unnotified_error_buffers_;
+  }
+
+  std::unique_ptr<MockDeviceSessionHwl> session_hwl_;
+  StreamConfiguration stream_config_;
+  std::unique_ptr<DepthProcessBlock> block_;
+  // Owned by block_.
+  FakeDepthGenerator* depth_generator_ = nullptr;
+  std::vector<native_handle_t*> buffer_handles_;
+
+  std::mutex result_lock_;
+  std::condition_variable result_condition_;
+  // Map from frame number to the depth buffer status. Protected by
+  // result_lock_.
+  std::map<uint32_t, BufferStatus> depth_buffer_status_;
+  // Frames whose depth buffer error was notified. Protected by result_lock_.
+  std::set<uint32_t> error_notified_frames_;
+  // Number of error depth buffers returned before their error was notified.
+  // Protected by result_lock_.
+  uint32_t num_unnotified_error_buffers_ = 0;
+};
+
+TEST_F(DepthProcessBlockTest, BlockPolicyBoundsInFlightRequests) {
+  const uint32_t kNumFrames = 6;
+  CreateDepthProcessBlock(/*max_in_flight_requests=*/2,
+                          DepthProcessBlock::BackpressurePolicy::kBlock,
+                          std::chrono::milliseconds(10));
+
+  for (uint32_t frame = 0; frame < kNumFrames; frame++) {
+    SubmitRequest(frame);
+  }
+
+  ASSERT_TRUE(WaitForResults(kNumFrames));
+  EXPECT_EQ(GetNumErrorBuffers(), 0u);
+  EXPECT_LE(depth_generator_->GetMaxPendingRequests(), 2u);
+  EXPECT_EQ(depth_generator_->GetProcessedFrames(),
+            std::vector<uint32_t>({0, 1, 2, 3, 4, 5}));
+
+  auto stats = block_->GetDepthPipelineStats();
+  EXPECT_EQ(stats.completed_requests, kNumFrames);
+  EXPECT_EQ(stats.dropped_requests, 0u);
+  EXPECT_GE(stats.max_compute_latency, ms2ns(10));
+}
+
+TEST_F(DepthProcessBlockTest, DropOldestPolicyReturnsErrorBuffers) {
+  CreateDepthProcessBlock(/*max_in_flight_requests=*/1,
+                          DepthProcessBlock::BackpressurePolicy::kDropOldest,
+                          std::chrono::milliseconds(200));
+
+  // Frame 0 is in flight while frames 1 and 2 are queued. Frames 3 and 4 push
+  // out frames 1 and 2.
+  for (uint32_t frame = 0; frame < 5; frame++) {
+    SubmitRequest(frame);
+  }
+
+  ASSERT_TRUE(WaitForResults(5));
+  EXPECT_EQ(GetNumErrorBuffers(), 2u);
+  EXPECT_EQ(GetNumUnnotifiedErrorBuffers(), 0u)
+      << "Dropped frames should notify a buffer error first";
+  EXPECT_EQ(depth_generator_->GetProcessedFrames(),
+            std::vector<uint32_t>({0, 3, 4}));
+  EXPECT_EQ(depth_generator_->GetNumReentrantRequests(), 0u)
+      << "Queued requests should not be enqueued from the result callback";
+
+  auto stats = block_->GetDepthPipelineStats();
+  EXPECT_EQ(stats.completed_requests, 3u);
+  EXPECT_EQ(stats.dropped_requests, 2u);
+}
+
+TEST_F(DepthProcessBlockTest, SkipToLatestPolicyKeepsLatestRequest) {
+  CreateDepthProcessBlock(/*max_in_flight_requests=*/1,
+                          DepthProcessBlock::BackpressurePolicy::kSkipToLatest,
+                          std::chrono::milliseconds(200));
+
+  // Frame 0 is in flight and each new frame replaces the queued one.
+  for (uint32_t frame = 0; frame < 5; frame++) {
+    SubmitRequest(frame);
+  }
+
+  ASSERT_TRUE(WaitForResults(5));
+  EXPECT_EQ(GetNumErrorBuffers(), 3u);
+  EXPECT_EQ(GetNumUnnotifiedErrorBuffers(), 0u);
+  EXPECT_EQ(depth_generator_->GetProcessedFrames(),
+            std::vector<uint32_t>({0, 4}));
+
+  auto stats = block_->GetDepthPipelineStats();
+  EXPECT_EQ(stats.completed_requests, 2u);
+  EXPECT_EQ(stats.dropped_requests, 3u);
+}
+
+TEST_F(DepthProcessBlockTest, SharedMetadataIsNotCloned) {
+  CreateDepthProcessBlock(/*max_in_flight_requests=*/1,
+                          DepthProcessBlock::BackpressurePolicy::kBlock,
+                          std::chrono::milliseconds(0));
+
+  // Settings without a crop region are not passed to the depth generator.
+  ProcessBlockRequest block_request = CreateRequest(/*frame_number=*/0);
+  block_request.shared_settings = CreateSettings(/*has_crop=*/false);
+  block_request.shared_input_buffer_metadata = {
+      nullptr, nullptr, CreateSettings(/*has_crop=*/false)};
+  SubmitRequest(std::move(block_request));
+
+  ASSERT_TRUE(WaitForResults(1));
+  EXPECT_EQ(block_->GetDepthPipelineStats().cloned_metadata_bytes, 0u);
+}
+
+TEST_F(DepthProcessBlockTest, CropRegionIsUpdatedInACopy) {
+  CreateDepthProcessBlock(/*max_in_flight_requests=*/1,
+                          DepthProcessBlock::BackpressurePolicy::kBlock,
+                          std::chrono::milliseconds(0));
+
+  std::shared_ptr<const HalCameraMetadata> settings =
+      CreateSettings(/*has_crop=*/true);
+  ProcessBlockRequest block_request = CreateRequest(/*frame_number=*/0);
+  block_request.shared_settings = settings;
+  SubmitRequest(std::move(block_request));
+
+  ASSERT_TRUE(WaitForResults(1));
+  EXPECT_EQ(block_->GetDepthPipelineStats().cloned_metadata_bytes,
+            GetClonedSize(settings.get()));
+
+  // The shared settings keep the crop region of the logical camera.
+  camera_metadata_ro_entry entry = {};
+  ASSERT_EQ(settings->Get(ANDROID_SCALER_CROP_REGION, &entry), OK);
+  ASSERT_EQ(entry.count, 4u);
+  for (uint32_t i = 0; i < entry.count; i++) {
+    EXPECT_EQ(entry.data.i32[i], kActiveArraySize[i]);
+  }
+}
+
+TEST_F(DepthProcessBlockTest, UnsharedMetadataIsCloned) {
+  CreateDepthProcessBlock(/*max_in_flight_requests=*/1,
+                          DepthProcessBlock::BackpressurePolicy::kBlock,
+                          std::chrono::milliseconds(0));
+
+  ProcessBlockRequest block_request = CreateRequest(/*frame_number=*/0);
+  block_request.request.settings = CreateSettings(/*has_crop=*/true);
+  block_request.request.input_buffer_metadata.push_back(
+      CreateSettings(/*has_crop=*/false));
+  size_t metadata_size =
+      GetClonedSize(block_request.request.settings.get()) +
+      GetClonedSize(block_request.request.input_buffer_metadata[0].get());
+  SubmitRequest(std::move(block_request));
+
+  ASSERT_TRUE(WaitForResults(1));
+  EXPECT_EQ(block_->GetDepthPipelineStats().cloned_metadata_bytes,
+            metadata_size);
+}
+
+TEST_F(DepthProcessBlockTest, FlushDropsQueuedRequests) {
+  CreateDepthProcessBlock(/*max_in_flight_requests=*/1,
+                          DepthProcessBlock::BackpressurePolicy::kDropOldest,
+                          std::chrono::milliseconds(200));
+
+  for (uint32_t frame = 0; frame < 3; frame++) {
+    SubmitRequest(frame);
+  }
+  ASSERT_EQ(block_->Flush(), OK);
+
+  ASSERT_TRUE(WaitForResults(3));
+  EXPECT_EQ(GetNumErrorBuffers(), 2u);
+  EXPECT_EQ(GetNumUnnotifiedErrorBuffers(), 0u)
+      << "Flushed frames should notify a buffer error first";
+  EXPECT_EQ(depth_generator_->GetProcessedFrames(), std::vector<uint32_t>({0}));
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
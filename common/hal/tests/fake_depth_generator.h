@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_TESTS_FAKE_DEPTH_GENERATOR_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_TESTS_FAKE_DEPTH_GENERATOR_H_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "depth_generator.h"
+
+namespace android {
+namespace google_camera_hal {
+
+using android::depth_generator::DepthGenerator;
+using android::depth_generator::DepthRequestInfo;
+using android::depth_generator::DepthResultCallbackFunction;
+using android::depth_generator::DepthResultStatus;
+
+// FakeDepthGenerator processes depth requests one at a time after a tunable
+// latency. Asynchronous results are returned from a worker thread.
+class FakeDepthGenerator : public DepthGenerator {
+ public:
+  explicit FakeDepthGenerator(std::chrono::milliseconds latency)
+      : latency_(latency) {
+    worker_thread_ = std::thread([this] { WorkerThreadLoop(); });
+  }
+
+  virtual ~FakeDepthGenerator() {
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      exiting_ = true;
+    }
+    condition_.notify_one();
+    worker_thread_.join();
+  }
+
+  status_t EnqueueProcessRequest(const DepthRequestInfo& info) override {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (result_callback_ == nullptr) {
+      return NO_INIT;
+    }
+
+    if (std::this_thread::get_id() == worker_thread_.get_id()) {
+      num_reentrant_requests_++;
+    }
+
+    pending_frames_.push_back(info.frame_number);
+    max_pending_requests_ =
+        std::max(max_pending_requests_, pending_frames_.size());
+    condition_.notify_one();
+    return OK;
+  }
+
+  status_t ExecuteProcessRequest(const DepthRequestInfo& info) override {
+    std::this_thread::sleep_for(latency_);
+    std::lock_guard<std::mutex> lock(lock_);
+    processed_frames_.push_back(info.frame_number);
+    return OK;
+  }
+
+  void SetResultCallback(DepthResultCallbackFunction callback) override {
+    std::lock_guard<std::mutex> lock(lock_);
+    result_callback_ = callback;
+  }
+
+  // Return the frame numbers processed so far in processing order.
+  std::vector<uint32_t> GetProcessedFrames() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return processed_frames_;
+  }
+
+  // Return the maximum number of requests enqueued and not yet processed.
+  size_t GetMaxPendingRequests() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return max_pending_requests_;
+  }
+
+  // Return the number of requests enqueued from the result callback.
+  uint32_t GetNumReentrantRequests() {
+    std::lock_guard<std::mutex> lock(lock_);
+    return num_reentrant_requests_;
+  }
+
+ private:
+  void WorkerThreadLoop() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+      condition_.wait(
+          lock, [this] { return exiting_ || !pending_frames_.empty(); });
+      if (exiting_) {
+        return;
+      }
+
+      uint32_t frame_number = pending_frames_.front();
+      lock.unlock();
+      std::this_thread::sleep_for(latency_);
+      lock.lock();
+
+      pending_frames_.pop_front();
+      processed_frames_.push_back(frame_number);
+      auto callback = result_callback_;
+      lock.unlock();
+      callback(DepthResultStatus::kOk, frame_number);
+      lock.lock();
+    }
+  }
+
+  const std::chrono::milliseconds latency_;
+
+  std::mutex lock_;
+  std::condition_variable condition_;
+  std::thread worker_thread_;
+
+  // The following members must be protected by lock_.
+  bool exiting_ = false;
+  DepthResultCallbackFunction result_callback_;
+  std::deque<uint32_t> pending_frames_;
+  size_t max_pending_requests_ = 0;
+  uint32_t num_reentrant_requests_ = 0;
+  std::vector<uint32_t> processed_frames_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_TESTS_FAKE_DEPTH_GENERATOR_H_
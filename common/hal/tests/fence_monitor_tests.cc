@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FenceMonitorTests"
+#include <log/log.h>
+
+#include <fence_monitor.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <future>
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr int32_t kTimeoutMs = 500;
+
+// A pipe stands in for a sync fence: its read end becomes readable, like a
+// signaled fence, once the write end is written.
+class TestFence {
+ public:
+  TestFence() {
+    EXPECT_EQ(pipe(fds_), 0);
+    handle_ = native_handle_create(/*numFds=*/1, /*numInts=*/0);
+    handle_->data[0] = fds_[0];
+  }
+
+  ~TestFence() {
+    native_handle_close(handle_);
+    native_handle_delete(handle_);
+    close(fds_[1]);
+  }
+
+  void Signal() {
+    char value = 0;
+    EXPECT_EQ(write(fds_[1], &value, sizeof(value)),
+              static_cast<ssize_t>(sizeof(value)));
+  }
+
+  const native_handle_t* GetHandle() const {
+    return handle_;
+  }
+
+ private:
+  int fds_[2] = {-1, -1};
+  native_handle_t* handle_ = nullptr;
+};
+
+TEST(FenceMonitorTests, Create) {
+  EXPECT_NE(FenceMonitor::Create(kTimeoutMs), nullptr);
+  EXPECT_EQ(FenceMonitor::Create(/*timeout_ms=*/-1), nullptr)
+      << "Creating a monitor with a negative timeout should fail";
+}
+
+TEST(FenceMonitorTests, NoFences) {
+  auto monitor = FenceMonitor::Create(kTimeoutMs);
+  ASSERT_NE(monitor, nullptr);
+  EXPECT_NE(monitor->WaitForFences({}, nullptr), OK);
+
+  status_t callback_res = UNKNOWN_ERROR;
+  std::thread::id callback_thread;
+  ASSERT_EQ(monitor->WaitForFences({nullptr},
+                                   [&](status_t res) {
+                                     callback_res = res;
+                                     callback_thread =
+                                         std::this_thread::get_id();
+                                   }),
+            OK);
+  EXPECT_EQ(callback_res, OK);
+  EXPECT_EQ(callback_thread, std::this_thread::get_id())
+      << "Callback without fences should be invoked on the calling thread";
+}
+
+TEST(FenceMonitorTests, CallbackAfterAllFencesSignaled) {
+  auto monitor = FenceMonitor::Create(kTimeoutMs);
+  ASSERT_NE(monitor, nullptr);
+
+  TestFence first_fence;
+  TestFence second_fence;
+  std::promise<status_t> callback_res;
+  auto callback_done = callback_res.get_future();
+  ASSERT_EQ(monitor->WaitForFences(
+                {first_fence.GetHandle(), second_fence.GetHandle()},
+                [&callback_res](status_t res) { callback_res.set_value(res); }),
+            OK);
+
+  first_fence.Signal();
+  EXPECT_EQ(callback_done.wait_for(std::chrono::milliseconds(50)),
+            std::future_status::timeout)
+      << "Callback should wait for all fences";
+
+  second_fence.Signal();
+  ASSERT_EQ(callback_done.wait_for(std::chrono::milliseconds(kTimeoutMs)),
+            std::future_status::ready);
+  EXPECT_EQ(callback_done.get(), OK);
+}
+
+TEST(FenceMonitorTests, Timeout) {
+  auto monitor = FenceMonitor::Create(kTimeoutMs);
+  ASSERT_NE(monitor, nullptr);
+
+  TestFence fence;
+  std::promise<status_t> callback_res;
+  auto callback_done = callback_res.get_future();
+  ASSERT_EQ(monitor->WaitForFences({fence.GetHandle()},
+                                   [&callback_res](status_t res) {
+                                     callback_res.set_value(res);
+                                   }),
+            OK);
+
+  ASSERT_EQ(callback_done.wait_for(std::chrono::milliseconds(kTimeoutMs * 4)),
+            std::future_status::ready);
+  EXPECT_EQ(callback_done.get(), TIMED_OUT);
+}
+
+TEST(FenceMonitorTests, DestroyWithPendingFences) {
+  auto monitor = FenceMonitor::Create(kTimeoutMs);
+  ASSERT_NE(monitor, nullptr);
+
+  TestFence fence;
+  status_t callback_res = OK;
+  ASSERT_EQ(monitor->WaitForFences(
+                {fence.GetHandle()},
+                [&callback_res](status_t res) { callback_res = res; }),
+            OK);
+
+  monitor = nullptr;
+  EXPECT_EQ(callback_res, DEAD_OBJECT);
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
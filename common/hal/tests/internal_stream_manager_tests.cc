@@ -22,6 +22,8 @@
 #include <hardware/gralloc.h>
 #include <internal_stream_manager.h>
 
+#include <thread>
+
 namespace android {
 namespace google_camera_hal {
 
@@ -309,7 +311,7 @@ TEST(InternalStreamManagerTests, GetMostRecentStreamBuffer) {
   std::vector<StreamBuffer> input_buffers;
   std::vector<std::unique_ptr<HalCameraMetadata>> input_buffer_metadata;
   res = stream_manager->GetMostRecentStreamBuffer(
-      raw_hal_stream.id, &input_buffers, &input_buffer_metadata,
+      raw_hal_stream.id, frame_index, &input_buffers, &input_buffer_metadata,
       /*payload_frames*/ 1);
   ASSERT_EQ(res, OK) << "GetMostRecentZslBuffers failed.";
 
@@ -325,5 +327,64 @@ TEST(InternalStreamManagerTests, GetMostRecentStreamBuffer) {
   ASSERT_EQ(empty, true) << "Pending buffer is not empty";
 }
 
+TEST(InternalStreamManagerTests, SharedBuffersAfterFreeingOwner) {
+  auto stream_manager = InternalStreamManager::Create();
+  ASSERT_NE(stream_manager, nullptr);
+
+  std::vector<HalStream> hal_streams = {kPreviewHalStreamTemplate,
+                                        kPreviewHalStreamTemplate};
+  for (auto& hal_stream : hal_streams) {
+    ASSERT_EQ(stream_manager->RegisterNewInternalStream(kPreviewStreamTemplate,
+                                                        &hal_stream.id),
+              OK);
+  }
+  ASSERT_EQ(stream_manager->AllocateSharedBuffers(hal_streams), OK);
+
+  // Free the owner. The remaining stream must still be routed to the shared
+  // buffer manager.
+  stream_manager->FreeStream(hal_streams[0].id);
+
+  StreamBuffer buffer;
+  EXPECT_NE(stream_manager->GetStreamBuffer(hal_streams[0].id, &buffer), OK)
+      << "Getting a buffer from a freed stream should fail";
+  ASSERT_EQ(stream_manager->GetStreamBuffer(hal_streams[1].id, &buffer), OK);
+  EXPECT_EQ(stream_manager->ReturnStreamBuffer(buffer), OK);
+
+  stream_manager->FreeStream(hal_streams[1].id);
+  EXPECT_NE(stream_manager->GetStreamBuffer(hal_streams[1].id, &buffer), OK)
+      << "Getting a buffer from a freed stream should fail";
+}
+
+TEST(InternalStreamManagerTests, ConcurrentGetAndReturnStreamBuffers) {
+  static constexpr uint32_t kNumIterations = 100;
+  auto stream_manager = InternalStreamManager::Create();
+  ASSERT_NE(stream_manager, nullptr);
+
+  HalStream preview_hal_stream = kPreviewHalStreamTemplate;
+  HalStream raw_hal_stream = kRawHalStreamTemplate;
+  ASSERT_EQ(stream_manager->RegisterNewInternalStream(kPreviewStreamTemplate,
+                                                      &preview_hal_stream.id),
+            OK);
+  ASSERT_EQ(stream_manager->AllocateBuffers(preview_hal_stream), OK);
+  ASSERT_EQ(stream_manager->RegisterNewInternalStream(kRawStreamTemplate,
+                                                      &raw_hal_stream.id),
+            OK);
+  ASSERT_EQ(stream_manager->AllocateBuffers(raw_hal_stream), OK);
+
+  // Each thread works on its own stream so buffers never run out.
+  auto get_and_return = [&](int32_t stream_id) {
+    for (uint32_t i = 0; i < kNumIterations; i++) {
+      StreamBuffer buffer;
+      EXPECT_EQ(stream_manager->GetStreamBuffer(stream_id, &buffer), OK);
+      EXPECT_EQ(stream_manager->ReturnStreamBuffer(buffer), OK);
+    }
+  };
+
+  std::thread preview_thread(get_and_return, preview_hal_stream.id);
+  std::thread raw_thread(get_and_return, raw_hal_stream.id);
+  preview_thread.join();
+  raw_thread.join();
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "PendingRequestsTrackerTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <hal_types.h>
+#include <pending_requests_tracker.h>
+
+#include <thread>
+
+namespace android {
+namespace google_camera_hal {
+
+static constexpr int32_t kPreviewStreamId = 0;
+static constexpr int32_t kVideoStreamId = 1;
+static constexpr uint32_t kMaxBuffers = 2;
+
+static std::vector<HalStream> GetHalStreams() {
+  return {
+      {.id = kPreviewStreamId, .max_buffers = kMaxBuffers},
+      {.id = kVideoStreamId, .max_buffers = kMaxBuffers},
+  };
+}
+
+static CaptureRequest GetRequest(const std::vector<int32_t>& stream_ids) {
+  CaptureRequest request;
+  for (auto stream_id : stream_ids) {
+    request.output_buffers.push_back({.stream_id = stream_id});
+  }
+  return request;
+}
+
+TEST(PendingRequestsTrackerTests, Create) {
+  EXPECT_NE(PendingRequestsTracker::Create(GetHalStreams()), nullptr);
+
+  std::vector<HalStream> duplicated_streams = GetHalStreams();
+  duplicated_streams.push_back(duplicated_streams[0]);
+  EXPECT_EQ(PendingRequestsTracker::Create(duplicated_streams), nullptr)
+      << "Creating a tracker with duplicated streams should fail";
+}
+
+TEST(PendingRequestsTrackerTests, WaitAndTrackRequestBuffers) {
+  auto tracker = PendingRequestsTracker::Create(GetHalStreams());
+  ASSERT_NE(tracker, nullptr);
+
+  std::vector<int32_t> first_requested_stream_ids;
+  EXPECT_NE(tracker->WaitAndTrackRequestBuffers(GetRequest({kPreviewStreamId}),
+                                                nullptr),
+            OK)
+      << "Passing a nullptr first_requested_stream_ids should fail";
+  EXPECT_NE(tracker->WaitAndTrackRequestBuffers(GetRequest({/*stream_id=*/-1}),
+                                                &first_requested_stream_ids),
+            OK)
+      << "Requesting an unconfigured stream should fail";
+
+  ASSERT_EQ(tracker->WaitAndTrackRequestBuffers(GetRequest({kPreviewStreamId}),
+                                                &first_requested_stream_ids),
+            OK);
+  EXPECT_EQ(first_requested_stream_ids,
+            std::vector<int32_t>({kPreviewStreamId}));
+
+  ASSERT_EQ(tracker->WaitAndTrackRequestBuffers(
+                GetRequest({kPreviewStreamId, kVideoStreamId}),
+                &first_requested_stream_ids),
+            OK);
+  EXPECT_EQ(first_requested_stream_ids, std::vector<int32_t>({kVideoStreamId}));
+
+  // Preview has run out of buffers. A request waiting on preview must be woken
+  // up when a preview buffer is returned.
+  std::thread preview_thread([&tracker] {
+    std::vector<int32_t> stream_ids;
+    EXPECT_EQ(tracker->WaitAndTrackRequestBuffers(
+                  GetRequest({kPreviewStreamId}), &stream_ids),
+              OK);
+  });
+
+  // Video still has a buffer even though preview has run out.
+  EXPECT_EQ(tracker->WaitAndTrackRequestBuffers(GetRequest({kVideoStreamId}),
+                                                &first_requested_stream_ids),
+            OK);
+
+  EXPECT_EQ(tracker->TrackReturnedResultBuffers(
+                GetRequest({kPreviewStreamId}).output_buffers),
+            OK);
+  preview_thread.join();
+}
+
+TEST(PendingRequestsTrackerTests, WaitAndTrackAcquiredBuffers) {
+  auto tracker = PendingRequestsTracker::Create(GetHalStreams());
+  ASSERT_NE(tracker, nullptr);
+
+  EXPECT_NE(tracker->WaitAndTrackAcquiredBuffers(/*stream_id=*/-1,
+                                                 /*num_buffers=*/1),
+            OK)
+      << "Acquiring buffers for an unconfigured stream should fail";
+
+  ASSERT_EQ(tracker->WaitAndTrackAcquiredBuffers(kPreviewStreamId, kMaxBuffers),
+            OK);
+  EXPECT_EQ(
+      tracker->WaitAndTrackAcquiredBuffers(kPreviewStreamId, /*num_buffers=*/1),
+      TIMED_OUT)
+      << "Acquiring more than max buffers should time out";
+
+  // Buffers that failed to be acquired can be acquired again.
+  tracker->TrackBufferAcquisitionFailure(kPreviewStreamId, /*num_buffers=*/1);
+  ASSERT_EQ(
+      tracker->WaitAndTrackAcquiredBuffers(kPreviewStreamId, /*num_buffers=*/1),
+      OK);
+
+  // Returned buffers can be acquired again.
+  EXPECT_EQ(tracker->TrackReturnedAcquiredBuffers(
+                GetRequest({kPreviewStreamId}).output_buffers),
+            OK);
+  EXPECT_EQ(
+      tracker->WaitAndTrackAcquiredBuffers(kPreviewStreamId, /*num_buffers=*/1),
+      OK);
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -257,5 +257,36 @@ TEST_F(ProcessBlockTest, MultiCameraRtProcessBlockRequest) {
             OK);
 }
 
+TEST_F(ProcessBlockTest, MultiCameraRtProcessBlockMixedCameraRequest) {
+  ProcessBlockTestSetup& setup = multi_camera_process_block_setup_;
+  InitializeProcessBlockTest(setup);
+
+  EXPECT_CALL(*session_hwl_, SubmitRequests(_, _)).Times(0);
+
+  auto result_processor = std::make_unique<MockResultProcessor>();
+  ASSERT_NE(result_processor, nullptr) << "Cannot create a MockResultProcessor";
+  EXPECT_CALL(*result_processor, AddPendingRequests(_, _)).Times(0);
+
+  auto block = setup.process_block_create_func();
+  ASSERT_NE(block, nullptr) << "Creating MultiCameraRtProcessBlock failed";
+  ASSERT_EQ(block->ConfigureStreams(test_config_, test_config_), OK);
+  ASSERT_EQ(session_hwl_->BuildPipelines(), OK);
+  ASSERT_EQ(block->SetResultProcessor(std::move(result_processor)), OK);
+
+  // Put buffers from all physical cameras in one request.
+  std::vector<ProcessBlockRequest> block_requests(1);
+  CaptureRequest remaining_session_request;
+  for (auto& stream : test_config_.streams) {
+    StreamBuffer buffer;
+    buffer.stream_id = stream.id;
+    block_requests[0].request.output_buffers.push_back(buffer);
+    remaining_session_request.output_buffers.push_back(buffer);
+  }
+
+  EXPECT_NE(block->ProcessRequests(block_requests, remaining_session_request),
+            OK)
+      << "Buffers from different physical cameras in a request should fail";
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "RgbirdInternalStreamSchedulerTests"
+#include <log/log.h>
+
+#include <gtest/gtest.h>
+#include <rgbird_internal_stream_scheduler.h>
+
+namespace android {
+namespace google_camera_hal {
+
+// Return the frames among the first num_frames that request the IR RAW
+// outputs when no frame requests a depth buffer.
+static std::vector<uint32_t> GetIrRawFrames(
+    RgbirdInternalStreamScheduler* scheduler, uint32_t num_frames,
+    bool thermal_throttled) {
+  std::vector<uint32_t> ir_raw_frames;
+  for (uint32_t i = 0; i < num_frames; i++) {
+    if (scheduler->ShouldRequestIrRaw(/*depth_requested=*/false,
+                                      thermal_throttled)) {
+      ir_raw_frames.push_back(i);
+    }
+  }
+  return ir_raw_frames;
+}
+
+TEST(RgbirdInternalStreamSchedulerTests, Create) {
+  RgbirdInternalStreamScheduler::Policy policy;
+  EXPECT_NE(RgbirdInternalStreamScheduler::Create(policy), nullptr);
+
+  policy.thermal_interval_scale = 0;
+  EXPECT_EQ(RgbirdInternalStreamScheduler::Create(policy), nullptr)
+      << "Creating a scheduler with a zero thermal scale should fail";
+}
+
+TEST(RgbirdInternalStreamSchedulerTests, DefaultPolicyRequestsEveryFrame) {
+  auto scheduler = RgbirdInternalStreamScheduler::Create({});
+  ASSERT_NE(scheduler, nullptr);
+
+  EXPECT_EQ(GetIrRawFrames(scheduler.get(), /*num_frames=*/4,
+                           /*thermal_throttled=*/false),
+            std::vector<uint32_t>({0, 1, 2, 3}));
+  EXPECT_EQ(GetIrRawFrames(scheduler.get(), /*num_frames=*/4,
+                           /*thermal_throttled=*/true),
+            std::vector<uint32_t>({1, 3}));
+}
+
+TEST(RgbirdInternalStreamSchedulerTests, SubsampleIdleFrames) {
+  auto scheduler = RgbirdInternalStreamScheduler::Create(
+      {.idle_ir_raw_interval = 3, .thermal_interval_scale = 2});
+  ASSERT_NE(scheduler, nullptr);
+
+  EXPECT_EQ(GetIrRawFrames(scheduler.get(), /*num_frames=*/9,
+                           /*thermal_throttled=*/false),
+            std::vector<uint32_t>({2, 5, 8}));
+
+  // A depth frame always requests the IR RAW outputs and restarts the idle
+  // interval.
+  EXPECT_TRUE(scheduler->ShouldRequestIrRaw(/*depth_requested=*/true,
+                                            /*thermal_throttled=*/true));
+  EXPECT_EQ(GetIrRawFrames(scheduler.get(), /*num_frames=*/12,
+                           /*thermal_throttled=*/true),
+            std::vector<uint32_t>({5, 11}));
+
+  RgbirdInternalStreamScheduler::Stats stats = scheduler->GetStats();
+  EXPECT_EQ(stats.ir_raw_frames, 6u);
+  EXPECT_EQ(stats.skipped_ir_raw_frames, 16u);
+}
+
+TEST(RgbirdInternalStreamSchedulerTests, DepthFramesOnly) {
+  auto scheduler = RgbirdInternalStreamScheduler::Create(
+      {.idle_ir_raw_interval = 0, .thermal_interval_scale = 2});
+  ASSERT_NE(scheduler, nullptr);
+
+  EXPECT_TRUE(GetIrRawFrames(scheduler.get(), /*num_frames=*/10,
+                             /*thermal_throttled=*/false)
+                  .empty());
+  EXPECT_TRUE(scheduler->ShouldRequestIrRaw(/*depth_requested=*/true,
+                                            /*thermal_throttled=*/false));
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
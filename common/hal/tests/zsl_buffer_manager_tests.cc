@@ -193,13 +193,14 @@ TEST(ZslBufferManagerTests, PendingBuffer) {
   std::vector<ZslBufferManager::ZslBuffer> filled_buffers;
   ZslBufferManager::ZslBuffer zsl_buffer;
   filled_buffers.push_back(std::move(zsl_buffer));
-  manager->AddPendingBuffers(filled_buffers);
+  manager->AddPendingBuffers(/*frame_number=*/0, filled_buffers);
 
   // Pending buffer is not empty after call AddPendingBuffers.
   empty = manager->IsPendingBufferEmpty();
   ASSERT_EQ(empty, false) << "Pending buffer is empty after AddPendingBuffers.";
 
-  status_t res = manager->CleanPendingBuffers(&filled_buffers);
+  status_t res = manager->CleanPendingBuffers(/*frame_number=*/0,
+                                              &filled_buffers);
   ASSERT_EQ(res, OK) << "CleanPendingBuffers failed.";
 
   empty = manager->IsPendingBufferEmpty();
@@ -207,5 +208,36 @@ TEST(ZslBufferManagerTests, PendingBuffer) {
       << "Pending buffer is not empty after CleanPendingBuffers.";
 }
 
+TEST(ZslBufferManagerTests, PendingBuffersPerRequest) {
+  auto manager = std::make_unique<ZslBufferManager>();
+  ASSERT_NE(manager, nullptr) << "Creating ZslBufferManager failed.";
+
+  // Two requests hold their own pending buffers.
+  for (uint32_t frame_number = 0; frame_number < 2; frame_number++) {
+    std::vector<ZslBufferManager::ZslBuffer> filled_buffers(1);
+    filled_buffers[0].frame_number = frame_number;
+    manager->AddPendingBuffers(frame_number, filled_buffers);
+  }
+
+  std::vector<ZslBufferManager::ZslBuffer> pending_buffers;
+  EXPECT_EQ(manager->CleanPendingBuffers(/*frame_number=*/2, &pending_buffers),
+            NAME_NOT_FOUND)
+      << "Cleaning the buffers of a request without buffers should fail.";
+
+  ASSERT_EQ(manager->CleanPendingBuffers(/*frame_number=*/1, &pending_buffers),
+            OK);
+  ASSERT_EQ(pending_buffers.size(), 1u);
+  EXPECT_EQ(pending_buffers[0].frame_number, 1u);
+  EXPECT_FALSE(manager->IsPendingBufferEmpty())
+      << "Buffers of frame 0 should still be pending.";
+
+  pending_buffers.clear();
+  ASSERT_EQ(manager->CleanPendingBuffers(/*frame_number=*/0, &pending_buffers),
+            OK);
+  ASSERT_EQ(pending_buffers.size(), 1u);
+  EXPECT_EQ(pending_buffers[0].frame_number, 0u);
+  EXPECT_TRUE(manager->IsPendingBufferEmpty());
+}
+
 }  // namespace google_camera_hal
 }  // namespace android
@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_CachedBufferAllocator"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <cutils/properties.h>
+#include <inttypes.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include "cached_buffer_allocator.h"
+#include "gralloc_buffer_allocator.h"
+#include "utils.h"
+
+namespace android {
+namespace google_camera_hal {
+
+std::unique_ptr<CachedBufferAllocator> CachedBufferAllocator::Create(
+    std::unique_ptr<IHalBufferAllocator> allocator, uint64_t max_cached_bytes) {
+  ATRACE_CALL();
+  if (allocator == nullptr) {
+    ALOGE("%s: allocator is nullptr", __FUNCTION__);
+    return nullptr;
+  }
+
+  auto cached_allocator =
+      std::unique_ptr<CachedBufferAllocator>(new CachedBufferAllocator());
+  if (cached_allocator == nullptr) {
+    ALOGE("%s: Creating CachedBufferAllocator failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  cached_allocator->allocator_ = std::move(allocator);
+  cached_allocator->max_cached_bytes_ = max_cached_bytes;
+  return cached_allocator;
+}
+
+std::atomic<CachedBufferAllocator*> CachedBufferAllocator::hwl_instance_ =
+    nullptr;
+
+uint64_t CachedBufferAllocator::GetProcessCacheBytes() {
+  int32_t cache_mb = property_get_int32("persist.camera.hal.buffer_cache_mb",
+                                        kDefaultGrallocCacheMb);
+  return static_cast<uint64_t>(std::max(cache_mb, 0)) * 1024 * 1024;
+}
+
+CachedBufferAllocator* CachedBufferAllocator::GetGrallocInstance() {
+  // Intentionally leaked so it outlives any session destroyed at exit.
+  static CachedBufferAllocator* gralloc_instance =
+      Create(GrallocBufferAllocator::Create(), GetProcessCacheBytes())
+          .release();
+
+  return gralloc_instance;
+}
+
+void CachedBufferAllocator::SetHwlInstance(
+    CachedBufferAllocator* hwl_instance) {
+  hwl_instance_ = hwl_instance;
+}
+
+CachedBufferAllocator* CachedBufferAllocator::GetHwlInstance() {
+  return hwl_instance_;
+}
+
+void CachedBufferAllocator::ClearProcessInstances() {
+  ATRACE_CALL();
+  CachedBufferAllocator* gralloc_instance = GetGrallocInstance();
+  if (gralloc_instance != nullptr) {
+    gralloc_instance->Clear();
+  }
+
+  CachedBufferAllocator* hwl_instance = GetHwlInstance();
+  if (hwl_instance != nullptr) {
+    hwl_instance->Clear();
+  }
+}
+
+CachedBufferAllocator::~CachedBufferAllocator() {
+  Clear();
+  if (!allocated_buffers_.empty()) {
+    ALOGW("%s: %zu buffers were not freed.", __FUNCTION__,
+          allocated_buffers_.size());
+  }
+}
+
+CachedBufferAllocator::CacheKey CachedBufferAllocator::GetCacheKey(
+    const HalBufferDescriptor& buffer_descriptor) {
+  return std::make_tuple(buffer_descriptor.width, buffer_descriptor.height,
+                         static_cast<int32_t>(buffer_descriptor.format),
+                         buffer_descriptor.producer_flags,
+                         buffer_descriptor.consumer_flags,
+                         buffer_descriptor.allocator_id_);
+}
+
+uint64_t CachedBufferAllocator::GetBufferBytes(
+    const HalBufferDescriptor& buffer_descriptor) {
+  return utils::GetEstimatedBufferSize(buffer_descriptor.format,
+                                       buffer_descriptor.width,
+                                       buffer_descriptor.height);
+}
+
+status_t CachedBufferAllocator::AllocateBuffers(
+    const HalBufferDescriptor& buffer_descriptor,
+    std::vector<buffer_handle_t>* buffers) {
+  ATRACE_CALL();
+  if (buffers == nullptr) {
+    ALOGE("%s: buffers is nullptr", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  CacheKey key = GetCacheKey(buffer_descriptor);
+  uint64_t bytes = GetBufferBytes(buffer_descriptor);
+  uint32_t num_cached_buffers = 0;
+  {
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    auto cached_it = cached_buffers_.find(key);
+    while (cached_it != cached_buffers_.end() && !cached_it->second.empty() &&
+           num_cached_buffers < buffer_descriptor.immediate_num_buffers) {
+      auto lru_it = cached_it->second.back();
+      cached_it->second.pop_back();
+      buffers->push_back(lru_it->buffer);
+      allocated_buffers_[lru_it->buffer] = *lru_it;
+      cached_bytes_ -= lru_it->bytes;
+      lru_buffers_.erase(lru_it);
+      num_cached_buffers++;
+    }
+
+    if (cached_it != cached_buffers_.end() && cached_it->second.empty()) {
+      cached_buffers_.erase(cached_it);
+    }
+  }
+
+  if (num_cached_buffers == buffer_descriptor.immediate_num_buffers) {
+    ALOGV("%s: Reused %u cached buffers.", __FUNCTION__, num_cached_buffers);
+    return OK;
+  }
+
+  HalBufferDescriptor remaining_descriptor = buffer_descriptor;
+  remaining_descriptor.immediate_num_buffers -= num_cached_buffers;
+  std::vector<buffer_handle_t> new_buffers;
+  status_t res =
+      allocator_->AllocateBuffers(remaining_descriptor, &new_buffers);
+
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  if (res != OK) {
+    ALOGE("%s: Allocating %u buffers failed: %s(%d)", __FUNCTION__,
+          remaining_descriptor.immediate_num_buffers, strerror(-res), res);
+    // Put the reused buffers back to the cache.
+    for (uint32_t i = 0; i < num_cached_buffers; i++) {
+      buffer_handle_t buffer = buffers->back();
+      buffers->pop_back();
+      AddToCacheLocked(allocated_buffers_[buffer]);
+      allocated_buffers_.erase(buffer);
+    }
+    return res;
+  }
+
+  for (auto& buffer : new_buffers) {
+    allocated_buffers_[buffer] = {.key = key, .buffer = buffer, .bytes = bytes};
+    buffers->push_back(buffer);
+  }
+
+  ALOGV("%s: Reused %u cached buffers and allocated %zu buffers.", __FUNCTION__,
+        num_cached_buffers, new_buffers.size());
+  return OK;
+}
+
+void CachedBufferAllocator::AddToCacheLocked(
+    const CachedBuffer& cached_buffer) {
+  lru_buffers_.push_front(cached_buffer);
+  cached_buffers_[cached_buffer.key].push_back(lru_buffers_.begin());
+  cached_bytes_ += cached_buffer.bytes;
+}
+
+void CachedBufferAllocator::EvictLocked(uint64_t max_cached_bytes) {
+  std::vector<buffer_handle_t> evicted_buffers;
+  while (cached_bytes_ > max_cached_bytes && !lru_buffers_.empty()) {
+    auto lru_it = std::prev(lru_buffers_.end());
+    // The least recently freed buffer is also the least recently freed one
+    // with its key.
+    auto cached_it = cached_buffers_.find(lru_it->key);
+    cached_it->second.pop_front();
+    if (cached_it->second.empty()) {
+      cached_buffers_.erase(cached_it);
+    }
+
+    evicted_buffers.push_back(lru_it->buffer);
+    cached_bytes_ -= lru_it->bytes;
+    lru_buffers_.erase(lru_it);
+  }
+
+  if (!evicted_buffers.empty()) {
+    ALOGV("%s: Releasing %zu cached buffers.", __FUNCTION__,
+          evicted_buffers.size());
+    allocator_->FreeBuffers(&evicted_buffers);
+  }
+}
+
+void CachedBufferAllocator::FreeBuffers(std::vector<buffer_handle_t>* buffers) {
+  ATRACE_CALL();
+  if (buffers == nullptr) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  std::vector<buffer_handle_t> unknown_buffers;
+  for (auto& buffer : *buffers) {
+    auto allocated_it = allocated_buffers_.find(buffer);
+    if (allocated_it == allocated_buffers_.end()) {
+      ALOGW("%s: Buffer %p was not allocated by this allocator.", __FUNCTION__,
+            buffer);
+      unknown_buffers.push_back(buffer);
+      continue;
+    }
+
+    AddToCacheLocked(allocated_it->second);
+    allocated_buffers_.erase(allocated_it);
+  }
+  buffers->clear();
+
+  if (!unknown_buffers.empty()) {
+    allocator_->FreeBuffers(&unknown_buffers);
+  }
+
+  EvictLocked(max_cached_bytes_);
+}
+
+status_t CachedBufferAllocator::Prewarm(
+    const HalBufferDescriptor& buffer_descriptor) {
+  ATRACE_CALL();
+  CacheKey key = GetCacheKey(buffer_descriptor);
+  uint64_t bytes = GetBufferBytes(buffer_descriptor);
+  HalBufferDescriptor prewarm_descriptor = buffer_descriptor;
+  {
+    std::lock_guard<std::mutex> lock(cache_lock_);
+    auto cached_it = cached_buffers_.find(key);
+    uint32_t num_cached_buffers =
+        cached_it == cached_buffers_.end() ? 0 : cached_it->second.size();
+    uint64_t unused_bytes =
+        max_cached_bytes_ > cached_bytes_ ? max_cached_bytes_ - cached_bytes_
+                                          : 0;
+    uint64_t num_buffers =
+        buffer_descriptor.immediate_num_buffers > num_cached_buffers
+            ? buffer_descriptor.immediate_num_buffers - num_cached_buffers
+            : 0;
+    if (bytes > 0) {
+      num_buffers = std::min(num_buffers, unused_bytes / bytes);
+    }
+    prewarm_descriptor.immediate_num_buffers = num_buffers;
+  }
+
+  if (prewarm_descriptor.immediate_num_buffers == 0) {
+    return OK;
+  }
+
+  std::vector<buffer_handle_t> buffers;
+  status_t res = allocator_->AllocateBuffers(prewarm_descriptor, &buffers);
+  if (res != OK) {
+    ALOGE("%s: Allocating %u buffers failed: %s(%d)", __FUNCTION__,
+          prewarm_descriptor.immediate_num_buffers, strerror(-res), res);
+    return res;
+  }
+
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  for (auto& buffer : buffers) {
+    AddToCacheLocked({.key = key, .buffer = buffer, .bytes = bytes});
+  }
+
+  EvictLocked(max_cached_bytes_);
+  ALOGI("%s: Cached %zu buffers of %ux%u format %d, %" PRIu64 " bytes cached.",
+        __FUNCTION__, buffers.size(), buffer_descriptor.width,
+        buffer_descriptor.height, buffer_descriptor.format, cached_bytes_);
+  return OK;
+}
+
+void CachedBufferAllocator::Clear() {
+  ATRACE_CALL();
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  EvictLocked(/*max_cached_bytes=*/0);
+}
+
+uint64_t CachedBufferAllocator::GetCachedBytes() {
+  std::lock_guard<std::mutex> lock(cache_lock_);
+  return cached_bytes_;
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CACHED_BUFFER_ALLOCATOR_H
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CACHED_BUFFER_ALLOCATOR_H
+
+#include <utils/Errors.h>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "hal_buffer_allocator.h"
+
+namespace android {
+namespace google_camera_hal {
+
+// CachedBufferAllocator implements IHalBufferAllocator on top of another
+// IHalBufferAllocator. Freed buffers are kept in a cache keyed by their buffer
+// descriptor instead of being released, and are handed out again when buffers
+// with the same descriptor are allocated. The cache is bounded by a byte
+// budget and the least recently freed buffers are released first.
+class CachedBufferAllocator : public IHalBufferAllocator {
+ public:
+  // Create a CachedBufferAllocator that allocates buffers from allocator and
+  // caches up to max_cached_bytes of freed buffers. If max_cached_bytes is 0,
+  // freed buffers are released immediately.
+  static std::unique_ptr<CachedBufferAllocator> Create(
+      std::unique_ptr<IHalBufferAllocator> allocator,
+      uint64_t max_cached_bytes);
+
+  // Return a process-wide CachedBufferAllocator backed by gralloc. Its budget
+  // is read from persist.camera.hal.buffer_cache_mb. Returns nullptr if
+  // gralloc is not available.
+  static CachedBufferAllocator* GetGrallocInstance();
+
+  // Set the process-wide CachedBufferAllocator backed by the HWL buffer
+  // allocator. hwl_instance is owned by the caller, which must set nullptr
+  // before destroying it.
+  static void SetHwlInstance(CachedBufferAllocator* hwl_instance);
+
+  // Return the CachedBufferAllocator set by SetHwlInstance(), or nullptr if
+  // the HWL doesn't support vendor buffer allocation.
+  static CachedBufferAllocator* GetHwlInstance();
+
+  // Release the cached buffers of the process-wide allocators, e.g. when the
+  // last camera session is closed.
+  static void ClearProcessInstances();
+
+  // Return the cache budget of the process-wide allocators, read from
+  // persist.camera.hal.buffer_cache_mb.
+  static uint64_t GetProcessCacheBytes();
+
+  virtual ~CachedBufferAllocator();
+
+  // Allocate buffers and return buffer via buffers.
+  // The buffers is owned by caller. Cached buffers with the same descriptor
+  // are returned first.
+  status_t AllocateBuffers(const HalBufferDescriptor& buffer_descriptor,
+                           std::vector<buffer_handle_t>* buffers) override;
+
+  // Move the buffers to the cache. The least recently freed buffers are
+  // released if the cache exceeds its budget.
+  void FreeBuffers(std::vector<buffer_handle_t>* buffers) override;
+
+  // Allocate buffers into the cache until it holds
+  // buffer_descriptor.immediate_num_buffers buffers with the same descriptor,
+  // so later allocations with the descriptor don't wait for allocation. The
+  // number of buffers is limited by the unused cache budget.
+  status_t Prewarm(const HalBufferDescriptor& buffer_descriptor);
+
+  // Release all cached buffers. Buffers owned by callers are not affected.
+  void Clear();
+
+  // Return the number of bytes of buffers in the cache.
+  uint64_t GetCachedBytes();
+
+ protected:
+  CachedBufferAllocator() = default;
+
+ private:
+  // Fields of a buffer descriptor that decide if a buffer can be reused.
+  using CacheKey = std::tuple<uint32_t /*width*/, uint32_t /*height*/,
+                              int32_t /*format*/, uint64_t /*producer_flags*/,
+                              uint64_t /*consumer_flags*/,
+                              uint64_t /*allocator_id*/>;
+
+  struct CachedBuffer {
+    CacheKey key;
+    buffer_handle_t buffer = nullptr;
+    uint64_t bytes = 0;
+  };
+
+  // Default budget if persist.camera.hal.buffer_cache_mb is not set.
+  static constexpr int32_t kDefaultGrallocCacheMb = 128;
+
+  // Do not support the copy constructor or assignment operator
+  CachedBufferAllocator(const CachedBufferAllocator&) = delete;
+  CachedBufferAllocator& operator=(const CachedBufferAllocator&) = delete;
+
+  static CacheKey GetCacheKey(const HalBufferDescriptor& buffer_descriptor);
+
+  static uint64_t GetBufferBytes(const HalBufferDescriptor& buffer_descriptor);
+
+  // Move a buffer to the cache. Must be called with cache_lock_ locked.
+  void AddToCacheLocked(const CachedBuffer& cached_buffer);
+
+  // Release the least recently freed buffers until the cache is within
+  // max_cached_bytes. Must be called with cache_lock_ locked.
+  void EvictLocked(uint64_t max_cached_bytes);
+
+  // Allocator set by SetHwlInstance().
+  static std::atomic<CachedBufferAllocator*> hwl_instance_;
+
+  std::unique_ptr<IHalBufferAllocator> allocator_;
+  uint64_t max_cached_bytes_ = 0;
+
+  std::mutex cache_lock_;
+
+  // Cached buffers, most recently freed first. Protected by cache_lock_.
+  std::list<CachedBuffer> lru_buffers_;
+
+  // Map from cache key to the iterators of the cached buffers with that key in
+  // lru_buffers_, most recently freed last. Protected by cache_lock_.
+  std::map<CacheKey, std::deque<std::list<CachedBuffer>::iterator>>
+      cached_buffers_;
+
+  // Number of bytes in lru_buffers_. Protected by cache_lock_.
+  uint64_t cached_bytes_ = 0;
+
+  // Map from buffers owned by callers to how they were allocated, so they can
+  // be cached when freed. Protected by cache_lock_.
+  std::unordered_map<buffer_handle_t, CachedBuffer> allocated_buffers_;
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CACHED_BUFFER_ALLOCATOR_H
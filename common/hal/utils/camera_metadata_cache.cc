@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "GCH_CameraMetadataCache"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <cutils/properties.h>
+#include <fcntl.h>
+#include <log/log.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/Trace.h>
+
+#include "camera_metadata_cache.h"
+
+namespace android {
+namespace google_camera_hal {
+
+uint64_t CameraMetadataCache::GetContentHash(const std::string& source) {
+  // 64-bit FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : source) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+
+  return hash;
+}
+
+uint64_t CameraMetadataCache::GetSourceHash(const std::string& source,
+                                            uint32_t parser_version) {
+  char fingerprint[PROPERTY_VALUE_MAX];
+  property_get("ro.build.fingerprint", fingerprint, "");
+  return GetContentHash(source + '\0' + fingerprint + '\0' +
+                        std::to_string(parser_version));
+}
+
+status_t CameraMetadataCache::Load(
+    const std::string& cache_path, uint64_t source_hash,
+    std::vector<std::unique_ptr<HalCameraMetadata>>* metadata) {
+  ATRACE_CALL();
+  if (metadata == nullptr) {
+    ALOGE("%s: metadata is nullptr", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  int fd = open(cache_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NAME_NOT_FOUND;
+  }
+
+  struct stat file_stat;
+  if ((fstat(fd, &file_stat) != 0) ||
+      (static_cast<size_t>(file_stat.st_size) < sizeof(CacheHeader))) {
+    close(fd);
+    return BAD_VALUE;
+  }
+
+  size_t file_size = file_stat.st_size;
+  void* file_data = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file_data == MAP_FAILED) {
+    ALOGE("%s: Mapping %s failed: %s", __FUNCTION__, cache_path.c_str(),
+          strerror(errno));
+    return BAD_VALUE;
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(file_data);
+  const CacheHeader* header = reinterpret_cast<const CacheHeader*>(data);
+  if ((header->magic != kCacheMagic) || (header->version != kCacheVersion)) {
+    ALOGW("%s: %s is not a supported cache file", __FUNCTION__,
+          cache_path.c_str());
+    munmap(file_data, file_size);
+    return BAD_VALUE;
+  }
+
+  if (header->source_hash != source_hash) {
+    ALOGI("%s: %s is out of date", __FUNCTION__, cache_path.c_str());
+    munmap(file_data, file_size);
+    return BAD_VALUE;
+  }
+
+  status_t res = OK;
+  std::vector<std::unique_ptr<HalCameraMetadata>> cached_metadata;
+  size_t offset = sizeof(CacheHeader);
+  for (uint32_t i = 0; i < header->num_metadata; i++) {
+    uint64_t metadata_size = 0;
+    if (file_size - offset < sizeof(metadata_size)) {
+      res = BAD_VALUE;
+      break;
+    }
+    memcpy(&metadata_size, data + offset, sizeof(metadata_size));
+    offset += sizeof(metadata_size);
+
+    if ((metadata_size > file_size - offset) ||
+        (AlignSize(metadata_size) > file_size - offset)) {
+      res = BAD_VALUE;
+      break;
+    }
+
+    auto raw_metadata =
+        reinterpret_cast<const camera_metadata_t*>(data + offset);
+    size_t expected_size = metadata_size;
+    if (validate_camera_metadata_structure(raw_metadata, &expected_size) !=
+        OK) {
+      res = BAD_VALUE;
+      break;
+    }
+
+    auto hal_metadata = HalCameraMetadata::Clone(raw_metadata);
+    if (hal_metadata == nullptr) {
+      res = NO_MEMORY;
+      break;
+    }
+    cached_metadata.push_back(std::move(hal_metadata));
+    offset += AlignSize(metadata_size);
+  }
+
+  munmap(file_data, file_size);
+  if (res != OK) {
+    ALOGE("%s: %s is corrupted: %s(%d)", __FUNCTION__, cache_path.c_str(),
+          strerror(-res), res);
+    return res;
+  }
+
+  *metadata = std::move(cached_metadata);
+  return OK;
+}
+
+status_t CameraMetadataCache::Store(
+    const std::string& cache_path, uint64_t source_hash,
+    const std::vector<std::unique_ptr<HalCameraMetadata>>& metadata) {
+  ATRACE_CALL();
+  std::string contents;
+  CacheHeader header = {.magic = kCacheMagic,
+                        .version = kCacheVersion,
+                        .source_hash = source_hash,
+                        .num_metadata = static_cast<uint32_t>(metadata.size()),
+                        .reserved = 0};
+  contents.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  for (const auto& hal_metadata : metadata) {
+    if (hal_metadata == nullptr) {
+      ALOGE("%s: metadata is nullptr", __FUNCTION__);
+      return BAD_VALUE;
+    }
+
+    uint64_t metadata_size = hal_metadata->GetCameraMetadataSize();
+    contents.append(reinterpret_cast<const char*>(&metadata_size),
+                    sizeof(metadata_size));
+    contents.append(
+        reinterpret_cast<const char*>(hal_metadata->GetRawCameraMetadata()),
+        metadata_size);
+    contents.append(AlignSize(metadata_size) - metadata_size, '\0');
+  }
+
+  std::string temp_path = cache_path + ".tmp";
+  int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                S_IRUSR | S_IWUSR | S_IRGRP);
+  if (fd < 0) {
+    ALOGW("%s: Creating %s failed: %s", __FUNCTION__, temp_path.c_str(),
+          strerror(errno));
+    return UNKNOWN_ERROR;
+  }
+
+  size_t written = 0;
+  while (written < contents.size()) {
+    ssize_t res =
+        write(fd, contents.data() + written, contents.size() - written);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ALOGE("%s: Writing %s failed: %s", __FUNCTION__, temp_path.c_str(),
+            strerror(errno));
+      close(fd);
+      unlink(temp_path.c_str());
+      return UNKNOWN_ERROR;
+    }
+    written += res;
+  }
+  close(fd);
+
+  if (rename(temp_path.c_str(), cache_path.c_str()) != 0) {
+    ALOGE("%s: Renaming %s failed: %s", __FUNCTION__, temp_path.c_str(),
+          strerror(errno));
+    unlink(temp_path.c_str());
+    return UNKNOWN_ERROR;
+  }
+
+  return OK;
+}
+
+}  // namespace google_camera_hal
+}  // namespace android
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CAMERA_METADATA_CACHE_H_
+#define HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CAMERA_METADATA_CACHE_H_
+
+#include <utils/Errors.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hal_camera_metadata.h"
+
+namespace android {
+namespace google_camera_hal {
+
+// CameraMetadataCache stores a list of camera metadata in a binary file
+// together with a content hash of the source the metadata was generated from.
+// HWLs that generate static metadata from text configurations can use it to
+// skip the conversion when the configuration did not change.
+class CameraMetadataCache {
+ public:
+  // Return the content hash of a cache source.
+  static uint64_t GetContentHash(const std::string& source);
+
+  // Return the hash to key a cache generated from source. Besides the source
+  // it covers the build fingerprint and parser_version, so the cache is
+  // regenerated after a system update or when the code converting the source
+  // to metadata changes.
+  static uint64_t GetSourceHash(const std::string& source,
+                                uint32_t parser_version);
+
+  // Load the metadata from cache_path by mapping the file into memory.
+  // Returns NAME_NOT_FOUND if the cache file does not exist, and BAD_VALUE if
+  // it is corrupted or was generated from a source with a different hash.
+  static status_t Load(
+      const std::string& cache_path, uint64_t source_hash,
+      std::vector<std::unique_ptr<HalCameraMetadata>>* metadata /*out*/);
+
+  // Store the metadata in cache_path. The file is replaced atomically so
+  // readers never observe a partially written cache.
+  static status_t Store(
+      const std::string& cache_path, uint64_t source_hash,
+      const std::vector<std::unique_ptr<HalCameraMetadata>>& metadata);
+
+ private:
+  static constexpr uint32_t kCacheMagic = 0x434d4443;  // 'CDMC'
+  static constexpr uint32_t kCacheVersion = 1;
+
+  // Cache file layout: the header is followed by num_metadata records, each
+  // one a uint64_t size and a camera_metadata_t padded to kCacheAlignment.
+  struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t num_metadata;
+    uint32_t reserved;
+  };
+
+  static constexpr size_t kCacheAlignment = 8;
+
+  static size_t AlignSize(size_t size) {
+    return (size + kCacheAlignment - 1) & ~(kCacheAlignment - 1);
+  }
+};
+
+}  // namespace google_camera_hal
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_HAL_UTILS_CAMERA_METADATA_CACHE_H_
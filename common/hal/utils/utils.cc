@@ -117,6 +117,34 @@ bool IsYUVSnapshotStream(const Stream& stream) {
   return false;
 }
 
+uint64_t GetEstimatedBufferSize(android_pixel_format_t format, uint32_t width,
+                                uint32_t height) {
+  uint64_t bits_per_pixel = 32;
+  switch (format) {
+    case HAL_PIXEL_FORMAT_Y8:
+    case HAL_PIXEL_FORMAT_BLOB:
+      bits_per_pixel = 8;
+      break;
+    case HAL_PIXEL_FORMAT_RAW10:
+      bits_per_pixel = 10;
+      break;
+    case HAL_PIXEL_FORMAT_YCBCR_420_888:
+    case HAL_PIXEL_FORMAT_YCRCB_420_SP:
+    case HAL_PIXEL_FORMAT_YV12:
+    case HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED:
+      bits_per_pixel = 12;
+      break;
+    case HAL_PIXEL_FORMAT_Y16:
+    case HAL_PIXEL_FORMAT_RAW16:
+      bits_per_pixel = 16;
+      break;
+    default:
+      break;
+  }
+
+  return static_cast<uint64_t>(width) * height * bits_per_pixel / 8;
+}
+
 status_t GetSensorPhysicalSize(const HalCameraMetadata* characteristics,
                                float* width, float* height) {
   if (characteristics == nullptr || width == nullptr || height == nullptr) {
@@ -35,6 +35,11 @@ bool IsYUVSnapshotStream(const Stream& stream);
 bool IsDepthStream(const Stream& stream);
 bool IsOutputZslStream(const Stream& stream);
 
+// Return the estimated size in bytes of a buffer with the format and
+// dimension. Strides and alignment are not taken into account.
+uint64_t GetEstimatedBufferSize(android_pixel_format_t format, uint32_t width,
+                                uint32_t height);
+
 status_t GetSensorPhysicalSize(const HalCameraMetadata* characteristics,
                                float* width, float* height);
 
@@ -25,14 +25,10 @@
 namespace android {
 namespace google_camera_hal {
 
-int32_t kWeightedRectToConvert[] = {ANDROID_CONTROL_AE_REGIONS,
-                                    ANDROID_CONTROL_AF_REGIONS,
-                                    ANDROID_CONTROL_AWB_REGIONS};
-
-int32_t kRectToConvert[] = {ANDROID_SCALER_CROP_REGION};
-
-int32_t kResultPointsToConvert[] = {ANDROID_STATISTICS_FACE_LANDMARKS,
-                                    ANDROID_STATISTICS_FACE_RECTANGLES};
+namespace {
+// Maximum number of coordinate tags in a metadata that ApplyZoomRatio maps.
+constexpr size_t kMaxCoordinateTags = 6;
+}  // namespace
 
 void ZoomRatioMapper::Initialize(InitParams* params) {
   if (params == nullptr) {
@@ -116,6 +112,23 @@ void ZoomRatioMapper::UpdateCaptureResult(CaptureResult* result) {
   }
 }
 
+ZoomRatioMapper::CoordinateType ZoomRatioMapper::GetCoordinateType(
+    uint32_t tag_id, bool is_request) {
+  switch (tag_id) {
+    case ANDROID_SCALER_CROP_REGION:
+      return CoordinateType::kRect;
+    case ANDROID_CONTROL_AE_REGIONS:
+    case ANDROID_CONTROL_AF_REGIONS:
+    case ANDROID_CONTROL_AWB_REGIONS:
+      return CoordinateType::kWeightedRect;
+    case ANDROID_STATISTICS_FACE_LANDMARKS:
+    case ANDROID_STATISTICS_FACE_RECTANGLES:
+      return is_request ? CoordinateType::kNone : CoordinateType::kPoints;
+    default:
+      return CoordinateType::kNone;
+  }
+}
+
 void ZoomRatioMapper::ApplyZoomRatio(const Dimension& active_array_dimension,
                                      const bool is_request,
                                      HalCameraMetadata* metadata) {
@@ -124,13 +137,32 @@ void ZoomRatioMapper::ApplyZoomRatio(const Dimension& active_array_dimension,
     return;
   }
 
-  camera_metadata_ro_entry entry = {};
-  status_t res = metadata->Get(ANDROID_CONTROL_ZOOM_RATIO, &entry);
-  if (res != OK) {
+  // Find the zoom ratio and the coordinate tags in one pass instead of
+  // searching the metadata for each tag.
+  camera_metadata_ro_entry zoom_ratio_entry = {};
+  camera_metadata_ro_entry coordinate_entries[kMaxCoordinateTags] = {};
+  size_t num_coordinate_entries = 0;
+  size_t entry_count = metadata->GetEntryCount();
+  for (size_t i = 0; i < entry_count; i++) {
+    camera_metadata_ro_entry entry = {};
+    if (metadata->GetByIndex(&entry, i) != OK) {
+      continue;
+    }
+
+    if (entry.tag == ANDROID_CONTROL_ZOOM_RATIO) {
+      zoom_ratio_entry = entry;
+    } else if (entry.count > 0 && num_coordinate_entries < kMaxCoordinateTags &&
+               GetCoordinateType(entry.tag, is_request) !=
+                   CoordinateType::kNone) {
+      coordinate_entries[num_coordinate_entries++] = entry;
+    }
+  }
+
+  if (zoom_ratio_entry.count == 0) {
     ALOGE("%s: Failed to get the zoom ratio", __FUNCTION__);
     return;
   }
-  float zoom_ratio = entry.data.f[0];
+  float zoom_ratio = zoom_ratio_entry.data.f[0];
 
   if (zoom_ratio < zoom_ratio_range_.min) {
     ALOGE("%s, zoom_ratio(%f) is smaller than lower bound(%f)", __FUNCTION__,
@@ -146,40 +178,56 @@ void ZoomRatioMapper::ApplyZoomRatio(const Dimension& active_array_dimension,
     zoom_ratio_mapper_hwl_->LimitZoomRatioIfConcurrent(&zoom_ratio);
   }
 
-  if (fabs(zoom_ratio - entry.data.f[0]) > 1e-9) {
-    metadata->Set(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio, entry.count);
-  }
+  // Map all coordinates before updating the metadata, which may move the
+  // entry data. Only the tags whose coordinates change are updated, so an
+  // unzoomed frame within the active array isn't modified.
+  std::vector<std::pair<uint32_t, std::vector<int32_t>>> updated_tags;
+  for (size_t i = 0; i < num_coordinate_entries; i++) {
+    const camera_metadata_ro_entry& entry = coordinate_entries[i];
+    std::vector<int32_t> updated_data;
+    switch (GetCoordinateType(entry.tag, is_request)) {
+      case CoordinateType::kRect:
+        MapRect(zoom_ratio, active_array_dimension, is_request, entry,
+                &updated_data);
+        break;
+      case CoordinateType::kWeightedRect:
+        MapWeightedRects(zoom_ratio, active_array_dimension, is_request, entry,
+                         &updated_data);
+        break;
+      case CoordinateType::kPoints:
+        MapPoints(zoom_ratio, active_array_dimension, entry, &updated_data);
+        break;
+      case CoordinateType::kNone:
+        break;
+    }
 
-  for (auto tag_id : kRectToConvert) {
-    UpdateRects(zoom_ratio, tag_id, active_array_dimension, is_request,
-                metadata);
+    if (!updated_data.empty()) {
+      updated_tags.emplace_back(entry.tag, std::move(updated_data));
+    }
   }
 
-  for (auto tag_id : kWeightedRectToConvert) {
-    UpdateWeightedRects(zoom_ratio, tag_id, active_array_dimension, is_request,
-                        metadata);
+  if (fabs(zoom_ratio - zoom_ratio_entry.data.f[0]) > 1e-9) {
+    metadata->Set(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio,
+                  zoom_ratio_entry.count);
   }
 
-  if (!is_request) {
-    for (auto tag_id : kResultPointsToConvert) {
-      UpdatePoints(zoom_ratio, tag_id, active_array_dimension, metadata);
+  for (auto& [tag_id, data] : updated_tags) {
+    status_t res = metadata->Set(tag_id, data.data(), data.size());
+    if (res != OK) {
+      ALOGE("%s: Updating tag: %u failed: %s (%d)", __FUNCTION__, tag_id,
+            strerror(-res), res);
     }
   }
 }
 
-void ZoomRatioMapper::UpdateRects(const float zoom_ratio, const uint32_t tag_id,
-                                  const Dimension& active_array_dimension,
-                                  const bool is_request,
-                                  HalCameraMetadata* metadata) {
-  if (metadata == nullptr) {
-    ALOGE("%s: metadata is nullptr", __FUNCTION__);
-    return;
-  }
-  camera_metadata_ro_entry entry = {};
-  status_t res = metadata->Get(tag_id, &entry);
-  if (res != OK || entry.count == 0) {
-    ALOGE("%s: Failed to get the region: %d, res: %d", __FUNCTION__, tag_id,
-          res);
+void ZoomRatioMapper::MapRect(const float zoom_ratio,
+                              const Dimension& active_array_dimension,
+                              const bool is_request,
+                              const camera_metadata_ro_entry& entry,
+                              std::vector<int32_t>* updated_data) {
+  if (entry.count < 4) {
+    ALOGE("%s: Invalid region: %u, count: %zu", __FUNCTION__, entry.tag,
+          entry.count);
     return;
   }
   int32_t left = entry.data.i32[0];
@@ -187,119 +235,112 @@ void ZoomRatioMapper::UpdateRects(const float zoom_ratio, const uint32_t tag_id,
   int32_t width = entry.data.i32[2];
   int32_t height = entry.data.i32[3];
 
-  if (is_request) {
-    utils::ConvertZoomRatio(zoom_ratio, active_array_dimension, &left, &top,
-                            &width, &height);
-  } else {
-    utils::RevertZoomRatio(zoom_ratio, active_array_dimension, true, &left,
-                           &top, &width, &height);
+  MapRegion(zoom_ratio, active_array_dimension, is_request, &left, &top,
+            &width, &height);
+  if (left == entry.data.i32[0] && top == entry.data.i32[1] &&
+      width == entry.data.i32[2] && height == entry.data.i32[3]) {
+    return;
   }
-  int32_t rect[4] = {left, top, width, height};
 
   ALOGV(
       "%s: is request: %d, zoom ratio: %f, set rect: [%d, %d, %d, %d] -> [%d, "
       "%d, %d, %d]",
       __FUNCTION__, is_request, zoom_ratio, entry.data.i32[0], entry.data.i32[1],
-      entry.data.i32[2], entry.data.i32[3], rect[0], rect[1], rect[2], rect[3]);
-
-  res = metadata->Set(tag_id, rect, sizeof(rect) / sizeof(int32_t));
-  if (res != OK) {
-    ALOGE("%s: Updating region: %u failed: %s (%d)", __FUNCTION__, tag_id,
-          strerror(-res), res);
-  }
+      entry.data.i32[2], entry.data.i32[3], left, top, width, height);
+  *updated_data = {left, top, width, height};
 }
 
-void ZoomRatioMapper::UpdateWeightedRects(
-    const float zoom_ratio, const uint32_t tag_id,
-    const Dimension& active_array_dimension, const bool is_request,
-    HalCameraMetadata* metadata) {
-  if (metadata == nullptr) {
-    ALOGE("%s: metadata is nullptr", __FUNCTION__);
-    return;
-  }
-  camera_metadata_ro_entry entry = {};
-  status_t res = metadata->Get(tag_id, &entry);
-  if (res != OK || entry.count == 0) {
-    ALOGV("%s: Failed to get the region: %d, res: %d", __FUNCTION__, tag_id,
-          res);
-    return;
-  }
+void ZoomRatioMapper::MapWeightedRects(const float zoom_ratio,
+                                       const Dimension& active_array_dimension,
+                                       const bool is_request,
+                                       const camera_metadata_ro_entry& entry,
+                                       std::vector<int32_t>* updated_data) {
   const WeightedRect* regions =
       reinterpret_cast<const WeightedRect*>(entry.data.i32);
   const size_t kNumElementsInTuple = sizeof(WeightedRect) / sizeof(int32_t);
-  std::vector<WeightedRect> updated_regions(entry.count / kNumElementsInTuple);
+  const size_t num_regions = entry.count / kNumElementsInTuple;
 
-  for (size_t i = 0; i < updated_regions.size(); i++) {
+  for (size_t i = 0; i < num_regions; i++) {
     int32_t left = regions[i].left;
     int32_t top = regions[i].top;
     int32_t width = regions[i].right - regions[i].left + 1;
     int32_t height = regions[i].bottom - regions[i].top + 1;
 
-    if (is_request) {
-      utils::ConvertZoomRatio(zoom_ratio, active_array_dimension, &left, &top,
-                              &width, &height);
-    } else {
-      utils::RevertZoomRatio(zoom_ratio, active_array_dimension, true, &left,
-                             &top, &width, &height);
+    MapRegion(zoom_ratio, active_array_dimension, is_request, &left, &top,
+              &width, &height);
+
+    WeightedRect updated_region = {};
+    updated_region.left = left;
+    updated_region.top = top;
+    updated_region.right = left + width - 1;
+    updated_region.bottom = top + height - 1;
+    updated_region.weight = regions[i].weight;
+    if (updated_region.left == regions[i].left &&
+        updated_region.top == regions[i].top &&
+        updated_region.right == regions[i].right &&
+        updated_region.bottom == regions[i].bottom) {
+      continue;
     }
 
-    updated_regions[i].left = left;
-    updated_regions[i].top = top;
-    updated_regions[i].right = left + width - 1;
-    updated_regions[i].bottom = top + height - 1;
-    updated_regions[i].weight = regions[i].weight;
-
-    ALOGV("%s: set region(%d): [%d, %d, %d, %d, %d]", __FUNCTION__, tag_id,
-          updated_regions[i].left, updated_regions[i].top,
-          updated_regions[i].right, updated_regions[i].bottom,
-          updated_regions[i].weight);
-  }
-  res = metadata->Set(tag_id, reinterpret_cast<int32_t*>(updated_regions.data()),
-                      updated_regions.size() * kNumElementsInTuple);
-  if (res != OK) {
-    ALOGE("%s: Updating region(%d) failed: %s (%d)", __FUNCTION__, tag_id,
-          strerror(-res), res);
+    ALOGV("%s: set region(%d): [%d, %d, %d, %d, %d]", __FUNCTION__, entry.tag,
+          updated_region.left, updated_region.top, updated_region.right,
+          updated_region.bottom, updated_region.weight);
+    if (updated_data->empty()) {
+      updated_data->assign(entry.data.i32,
+                           entry.data.i32 + num_regions * kNumElementsInTuple);
+    }
+    reinterpret_cast<WeightedRect*>(updated_data->data())[i] = updated_region;
   }
 }
 
-void ZoomRatioMapper::UpdatePoints(const float zoom_ratio, const uint32_t tag_id,
-                                   const Dimension& active_array_dimension,
-                                   HalCameraMetadata* metadata) {
-  if (metadata == nullptr) {
-    ALOGE("%s: metadata is nullptr", __FUNCTION__);
-    return;
-  }
-  camera_metadata_ro_entry entry = {};
-  if (metadata->Get(tag_id, &entry) != OK) {
-    ALOGV("%s: tag: %u not published.", __FUNCTION__, tag_id);
-    return;
-  }
-
-  if (entry.count <= 0) {
-    ALOGV("%s: No data found, tag: %u", __FUNCTION__, tag_id);
-    return;
-  }
+void ZoomRatioMapper::MapPoints(const float zoom_ratio,
+                                const Dimension& active_array_dimension,
+                                const camera_metadata_ro_entry& entry,
+                                std::vector<int32_t>* updated_data) {
   // x, y
   const uint32_t kDataSizePerPoint = 2;
   const uint32_t point_num = entry.count / kDataSizePerPoint;
-  std::vector<PointI> points(point_num);
   uint32_t data_index = 0;
 
   for (uint32_t i = 0; i < point_num; i++) {
     data_index = i * kDataSizePerPoint;
-    PointI* transformed = &points.at(i);
-    transformed->x = entry.data.i32[data_index];
-    transformed->y = entry.data.i32[data_index + 1];
-    utils::RevertZoomRatio(zoom_ratio, active_array_dimension, true,
-                           &transformed->x, &transformed->y);
-  }
+    PointI transformed = {.x = entry.data.i32[data_index],
+                          .y = entry.data.i32[data_index + 1]};
+    if (zoom_ratio == 1.0f) {
+      utils::ClampBoundary(active_array_dimension, &transformed.x,
+                           &transformed.y);
+    } else {
+      utils::RevertZoomRatio(zoom_ratio, active_array_dimension, true,
+                             &transformed.x, &transformed.y);
+    }
 
-  status_t res = metadata->Set(
-      tag_id, reinterpret_cast<int32_t*>(points.data()), entry.count);
+    if (transformed.x == entry.data.i32[data_index] &&
+        transformed.y == entry.data.i32[data_index + 1]) {
+      continue;
+    }
+
+    if (updated_data->empty()) {
+      updated_data->assign(entry.data.i32, entry.data.i32 + entry.count);
+    }
+    (*updated_data)[data_index] = transformed.x;
+    (*updated_data)[data_index + 1] = transformed.y;
+  }
+}
 
-  if (res != OK) {
-    ALOGE("%s: Updating tag: %u failed: %s (%d)", __FUNCTION__, tag_id,
-          strerror(-res), res);
+void ZoomRatioMapper::MapRegion(const float zoom_ratio,
+                                const Dimension& active_array_dimension,
+                                const bool is_request, int32_t* left,
+                                int32_t* top, int32_t* width,
+                                int32_t* height) {
+  // Without zoom, both directions only clamp the region to the active array.
+  if (zoom_ratio == 1.0f) {
+    utils::ClampBoundary(active_array_dimension, left, top, width, height);
+  } else if (is_request) {
+    utils::ConvertZoomRatio(zoom_ratio, active_array_dimension, left, top,
+                            width, height);
+  } else {
+    utils::RevertZoomRatio(zoom_ratio, active_array_dimension, true, left, top,
+                           width, height);
   }
 }
 
@@ -41,27 +41,49 @@ class ZoomRatioMapper {
   void UpdateCaptureResult(CaptureResult* result);
 
  private:
+  // Type of the coordinates in a metadata tag.
+  enum class CoordinateType {
+    kNone,
+    // [left, top, width, height]
+    kRect,
+    // Array of [left, top, right, bottom, weight]
+    kWeightedRect,
+    // Array of [x, y]
+    kPoints,
+  };
+
+  // Return the type of the coordinates in tag_id that ApplyZoomRatio maps, or
+  // kNone if they are not mapped.
+  static CoordinateType GetCoordinateType(uint32_t tag_id, bool is_request);
+
   // Apply zoom ratio to the capture request or result.
   void ApplyZoomRatio(const Dimension& active_array_dimension,
                       const bool is_request, HalCameraMetadata* metadata);
 
-  // Update rect region with respect to zoom ratio and active array
-  // dimension.
-  void UpdateRects(float zoom_ratio, const uint32_t tag_id,
-                   const Dimension& active_array_dimension,
-                   const bool is_request, HalCameraMetadata* metadata);
-
-  // Update weighted rect regions with respect to zoom ratio and active array
-  // dimension.
-  void UpdateWeightedRects(float zoom_ratio, const uint32_t tag_id,
-                           const Dimension& active_array_dimension,
-                           const bool is_request, HalCameraMetadata* metadata);
-
-  // Update point position with respect to zoom ratio and active array
-  // dimension.
-  void UpdatePoints(float zoom_ratio, const uint32_t tag_id,
-                    const Dimension& active_array_dimension,
-                    HalCameraMetadata* metadata);
+  // Map the rect region in entry with respect to zoom ratio and active array
+  // dimension. updated_data is left empty if the region doesn't change.
+  void MapRect(float zoom_ratio, const Dimension& active_array_dimension,
+               const bool is_request, const camera_metadata_ro_entry& entry,
+               std::vector<int32_t>* updated_data);
+
+  // Map the weighted rect regions in entry with respect to zoom ratio and
+  // active array dimension. updated_data is left empty if no region changes.
+  void MapWeightedRects(float zoom_ratio,
+                        const Dimension& active_array_dimension,
+                        const bool is_request,
+                        const camera_metadata_ro_entry& entry,
+                        std::vector<int32_t>* updated_data);
+
+  // Map the point positions in entry with respect to zoom ratio and active
+  // array dimension. updated_data is left empty if no point changes.
+  void MapPoints(float zoom_ratio, const Dimension& active_array_dimension,
+                 const camera_metadata_ro_entry& entry,
+                 std::vector<int32_t>* updated_data);
+
+  // Map a region with respect to zoom ratio and active array dimension.
+  void MapRegion(float zoom_ratio, const Dimension& active_array_dimension,
+                 const bool is_request, int32_t* left, int32_t* top,
+                 int32_t* width, int32_t* height);
 
   // Active array dimension of logical camera.
   Dimension active_array_dimension_;
@@ -21,6 +21,7 @@
 #include <log/log.h>
 #include <utils/Trace.h>
 
+#include <algorithm>
 #include <time.h>
 
 #include "zsl_buffer_manager.h"
@@ -31,6 +32,8 @@ namespace google_camera_hal {
 ZslBufferManager::ZslBufferManager(IHalBufferAllocator* allocator)
     : kMemoryProfilingEnabled(
           property_get_bool("persist.camera.hal.memoryprofile", false)),
+      kMaxPrewarmBuffers(static_cast<uint32_t>(std::max(
+          property_get_int32("persist.camera.hal.zsl_prewarm_buffers", 0), 0))),
       buffer_allocator_(allocator) {
 }
 
@@ -52,7 +55,17 @@ status_t ZslBufferManager::AllocateBuffers(
     return ALREADY_EXISTS;
   }
 
-  // Create a buffer allocator if the client doesn't specify one.
+  // Use the shared gralloc buffer cache if the client doesn't specify an
+  // allocator, so buffers freed by a previous stream configuration can be
+  // reused.
+  if (buffer_allocator_ == nullptr) {
+    cached_buffer_allocator_ = CachedBufferAllocator::GetGrallocInstance();
+    buffer_allocator_ = cached_buffer_allocator_;
+  } else if (buffer_allocator_ == CachedBufferAllocator::GetHwlInstance()) {
+    cached_buffer_allocator_ = CachedBufferAllocator::GetHwlInstance();
+  }
+
+  // Create a buffer allocator if the shared one is not available.
   if (buffer_allocator_ == nullptr) {
     // Create a buffer manager.
     internal_buffer_allocator_ = GrallocBufferAllocator::Create();
@@ -72,6 +85,21 @@ status_t ZslBufferManager::AllocateBuffers(
     return res;
   }
 
+  // Prewarm up to kMaxPrewarmBuffers of the buffers that GetEmptyBuffer() may
+  // allocate on demand, so growing the pool while streaming takes buffers from
+  // the cache.
+  if (cached_buffer_allocator_ != nullptr && kMaxPrewarmBuffers > 0 &&
+      buffer_descriptor.max_num_buffers > num_buffers) {
+    HalBufferDescriptor prewarm_descriptor = buffer_descriptor;
+    prewarm_descriptor.immediate_num_buffers = std::min(
+        buffer_descriptor.max_num_buffers - num_buffers, kMaxPrewarmBuffers);
+    res = cached_buffer_allocator_->Prewarm(prewarm_descriptor);
+    if (res != OK) {
+      ALOGW("%s: Prewarming %u buffers failed: %s(%d)", __FUNCTION__,
+            prewarm_descriptor.immediate_num_buffers, strerror(-res), res);
+    }
+  }
+
   allocated_ = true;
   return OK;
 }
@@ -477,9 +505,11 @@ bool ZslBufferManager::IsPendingBufferEmpty() {
   return true;
 }
 
-void ZslBufferManager::AddPendingBuffers(const std::vector<ZslBuffer>& buffers) {
+void ZslBufferManager::AddPendingBuffers(
+    uint32_t frame_number, const std::vector<ZslBuffer>& buffers) {
   ATRACE_CALL();
   std::lock_guard<std::mutex> lock(pending_zsl_buffers_mutex);
+  std::vector<ZslBuffer>& pending_buffers = pending_zsl_buffers_[frame_number];
   for (auto& buffer : buffers) {
     ZslBuffer zsl_buffer = {
         .frame_number = buffer.frame_number,
@@ -487,11 +517,12 @@ void ZslBufferManager::AddPendingBuffers(const std::vector<ZslBuffer>& buffers)
         .metadata = HalCameraMetadata::Clone(buffer.metadata.get()),
     };
 
-    pending_zsl_buffers_.emplace(buffer.buffer.buffer, std::move(zsl_buffer));
+    pending_buffers.push_back(std::move(zsl_buffer));
   }
 }
 
-status_t ZslBufferManager::CleanPendingBuffers(std::vector<ZslBuffer>* buffers) {
+status_t ZslBufferManager::CleanPendingBuffers(
+    uint32_t frame_number, std::vector<ZslBuffer>* buffers) {
   ATRACE_CALL();
   if (buffers == nullptr) {
     ALOGE("%s: buffers is nullptr", __FUNCTION__);
@@ -499,17 +530,18 @@ status_t ZslBufferManager::CleanPendingBuffers(std::vector<ZslBuffer>* buffers)
   }
 
   std::lock_guard<std::mutex> lock(pending_zsl_buffers_mutex);
-  if (pending_zsl_buffers_.empty()) {
-    ALOGE("%s: There is no empty buffer.", __FUNCTION__);
-    return BAD_VALUE;
+  auto pending_iter = pending_zsl_buffers_.find(frame_number);
+  if (pending_iter == pending_zsl_buffers_.end()) {
+    ALOGV("%s: Frame %u doesn't hold any buffers.", __FUNCTION__,
+          frame_number);
+    return NAME_NOT_FOUND;
   }
 
-  for (auto zsl_buffer_iter = pending_zsl_buffers_.begin();
-       zsl_buffer_iter != pending_zsl_buffers_.end(); zsl_buffer_iter++) {
-    buffers->push_back(std::move(zsl_buffer_iter->second));
+  for (auto& zsl_buffer : pending_iter->second) {
+    buffers->push_back(std::move(zsl_buffer));
   }
 
-  pending_zsl_buffers_.clear();
+  pending_zsl_buffers_.erase(pending_iter);
   return OK;
 }
 
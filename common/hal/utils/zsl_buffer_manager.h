@@ -26,6 +26,7 @@
 #include <mutex>
 #include <vector>
 
+#include "cached_buffer_allocator.h"
 #include "gralloc_buffer_allocator.h"
 #include "hal_buffer_allocator.h"
 
@@ -104,11 +105,16 @@ class ZslBufferManager {
   // Check pending_zsl_buffers_ is empty or not.
   bool IsPendingBufferEmpty();
 
-  // Add buffer map to pending_zsl_buffers_
-  void AddPendingBuffers(const std::vector<ZslBuffer>& buffers);
+  // Add buffers to pending_zsl_buffers_ as the buffers held by the request of
+  // frame_number.
+  void AddPendingBuffers(uint32_t frame_number,
+                         const std::vector<ZslBuffer>& buffers);
 
-  // Clean buffer map from pending_zsl_buffers_
-  status_t CleanPendingBuffers(std::vector<ZslBuffer>* buffers);
+  // Move the buffers held by the request of frame_number from
+  // pending_zsl_buffers_ to buffers. Returns NAME_NOT_FOUND if the request
+  // doesn't hold any buffers.
+  status_t CleanPendingBuffers(uint32_t frame_number,
+                               std::vector<ZslBuffer>* buffers);
 
  private:
   static const uint32_t kMaxPartialZslBuffers = 100;
@@ -128,6 +134,12 @@ class ZslBufferManager {
 
   const bool kMemoryProfilingEnabled;
 
+  // Maximum number of buffers that may be allocated on demand to prewarm in
+  // the buffer cache when buffers are allocated. Read from
+  // persist.camera.hal.zsl_prewarm_buffers. 0 disables prewarming so the pool
+  // grows lazily.
+  const uint32_t kMaxPrewarmBuffers;
+
   // Remove the oldest metadata.
   status_t RemoveOldestMetadataLocked();
 
@@ -152,6 +164,10 @@ class ZslBufferManager {
   // external buffer allocator
   IHalBufferAllocator* buffer_allocator_ = nullptr;
 
+  // Set if buffer_allocator_ is a process-wide CachedBufferAllocator. Used to
+  // prewarm the buffers that may be allocated on demand.
+  CachedBufferAllocator* cached_buffer_allocator_ = nullptr;
+
   // Empty ZSL buffer queue. Protected by mZslBuffersLock.
   std::deque<buffer_handle_t> empty_zsl_buffers_;
 
@@ -172,8 +188,9 @@ class ZslBufferManager {
 
   std::mutex pending_zsl_buffers_mutex;
 
-  // Map from buffer handle to ZSL buffer. Protected by pending_zsl_buffers_mutex.
-  std::unordered_map<buffer_handle_t, ZslBuffer> pending_zsl_buffers_;
+  // Map from the frame number of a request to the ZSL buffers it holds.
+  // Protected by pending_zsl_buffers_mutex.
+  std::map<uint32_t, std::vector<ZslBuffer>> pending_zsl_buffers_;
 
   // Store the buffer descriptor when call AllocateBuffers()
   // Use it for AllocateExtraBuffers()
@@ -0,0 +1,647 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "ReferenceDepthGenerator"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <future>
+#include <vector>
+
+#include "reference_depth_generator.h"
+
+namespace android {
+namespace depth_generator {
+
+namespace {
+// DEPTH16 samples hold the range in millimeters in the low 13 bits and the
+// confidence in the high 3 bits.
+const uint16_t kMaxDepth16Range = 0x1FFF;
+const uint16_t kDepth16ConfidenceShift = 13;
+// DEPTH16 confidence 0 means 100% confidence, 1 means 0% confidence and
+// values 2 to 7 increase linearly from there.
+const uint8_t kDepth16FullConfidence = 0;
+const uint8_t kDepth16NoConfidence = 1;
+const uint8_t kDepth16ConfidenceSteps = 7;
+// Relative cost difference between the best and second best disparity
+// considered as full confidence.
+const float kFullConfidenceUniqueness = 0.5f;
+const uint16_t kInvalidCost = UINT16_MAX;
+
+// Add |left[i] - right[i]| to sums[i], or subtract it if kSubtract is true,
+// for i in [0, count).
+template <bool kSubtract>
+void AccumulateAbsDiff(const uint8_t* left, const uint8_t* right,
+                       int32_t count, uint16_t* sums) {
+  int32_t i = 0;
+#if defined(__ARM_NEON)
+  for (; i + 16 <= count; i += 16) {
+    uint8x16_t diff = vabdq_u8(vld1q_u8(left + i), vld1q_u8(right + i));
+    uint16x8_t low = vld1q_u16(sums + i);
+    uint16x8_t high = vld1q_u16(sums + i + 8);
+    if (kSubtract) {
+      low = vsubw_u8(low, vget_low_u8(diff));
+      high = vsubw_u8(high, vget_high_u8(diff));
+    } else {
+      low = vaddw_u8(low, vget_low_u8(diff));
+      high = vaddw_u8(high, vget_high_u8(diff));
+    }
+    vst1q_u16(sums + i, low);
+    vst1q_u16(sums + i + 8, high);
+  }
+#elif defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= count; i += 16) {
+    __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+    __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(right + i));
+    __m128i diff = _mm_or_si128(_mm_subs_epu8(l, r), _mm_subs_epu8(r, l));
+    __m128i* out = reinterpret_cast<__m128i*>(sums + i);
+    __m128i low = _mm_loadu_si128(out);
+    __m128i high = _mm_loadu_si128(out + 1);
+    if (kSubtract) {
+      low = _mm_sub_epi16(low, _mm_unpacklo_epi8(diff, zero));
+      high = _mm_sub_epi16(high, _mm_unpackhi_epi8(diff, zero));
+    } else {
+      low = _mm_add_epi16(low, _mm_unpacklo_epi8(diff, zero));
+      high = _mm_add_epi16(high, _mm_unpackhi_epi8(diff, zero));
+    }
+    _mm_storeu_si128(out, low);
+    _mm_storeu_si128(out + 1, high);
+  }
+#endif
+  for (; i < count; i++) {
+    uint16_t diff =
+        left[i] > right[i] ? left[i] - right[i] : right[i] - left[i];
+    sums[i] = kSubtract ? sums[i] - diff : sums[i] + diff;
+  }
+}
+
+#if defined(__ARM_NEON) || defined(__SSE2__)
+#define HAS_VECTOR16 1
+// Operations on 8 lanes of uint16_t. Comparisons return all ones in the lanes
+// where they hold.
+#if defined(__ARM_NEON)
+using Vector16 = uint16x8_t;
+inline Vector16 Load(const uint16_t* addr) {
+  return vld1q_u16(addr);
+}
+inline void Store(uint16_t* addr, Vector16 value) {
+  vst1q_u16(addr, value);
+}
+inline Vector16 Splat(uint16_t value) {
+  return vdupq_n_u16(value);
+}
+inline Vector16 Add(Vector16 a, Vector16 b) {
+  return vaddq_u16(a, b);
+}
+inline Vector16 Less(Vector16 a, Vector16 b) {
+  return vcltq_u16(a, b);
+}
+inline Vector16 Greater(Vector16 a, Vector16 b) {
+  return vcgtq_u16(a, b);
+}
+inline Vector16 Equal(Vector16 a, Vector16 b) {
+  return vceqq_u16(a, b);
+}
+inline Vector16 Min(Vector16 a, Vector16 b) {
+  return vminq_u16(a, b);
+}
+inline Vector16 Select(Vector16 mask, Vector16 a, Vector16 b) {
+  return vbslq_u16(mask, a, b);
+}
+#else
+using Vector16 = __m128i;
+inline Vector16 Load(const uint16_t* addr) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(addr));
+}
+inline void Store(uint16_t* addr, Vector16 value) {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(addr), value);
+}
+inline Vector16 Splat(uint16_t value) {
+  return _mm_set1_epi16(static_cast<int16_t>(value));
+}
+inline Vector16 Add(Vector16 a, Vector16 b) {
+  return _mm_add_epi16(a, b);
+}
+// SSE2 only compares signed 16-bit values. Flipping the sign bits maps the
+// unsigned order onto the signed order.
+inline Vector16 Less(Vector16 a, Vector16 b) {
+  const __m128i sign_bits = _mm_set1_epi16(INT16_MIN);
+  return _mm_cmplt_epi16(_mm_xor_si128(a, sign_bits),
+                         _mm_xor_si128(b, sign_bits));
+}
+inline Vector16 Greater(Vector16 a, Vector16 b) {
+  return Less(b, a);
+}
+inline Vector16 Equal(Vector16 a, Vector16 b) {
+  return _mm_cmpeq_epi16(a, b);
+}
+inline Vector16 Select(Vector16 mask, Vector16 a, Vector16 b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+inline Vector16 Min(Vector16 a, Vector16 b) {
+  return Select(Less(a, b), a, b);
+}
+#endif
+const int32_t kVector16Lanes = 8;
+#endif
+
+// Sum window_size consecutive column sums for each of count windows. Every
+// window is summed on its own instead of sliding a running sum, so windows
+// can be summed in parallel.
+void SumWindows(const uint16_t* column_sums, int32_t window_size,
+                int32_t count, uint16_t* window_costs) {
+  int32_t x = 0;
+#if HAS_VECTOR16
+  for (; x + kVector16Lanes <= count; x += kVector16Lanes) {
+    Vector16 sum = Load(column_sums + x);
+    for (int32_t k = 1; k < window_size; k++) {
+      sum = Add(sum, Load(column_sums + x + k));
+    }
+    Store(window_costs + x, sum);
+  }
+#endif
+  for (; x < count; x++) {
+    uint16_t sum = 0;
+    for (int32_t k = 0; k < window_size; k++) {
+      sum += column_sums[x + k];
+    }
+    window_costs[x] = sum;
+  }
+}
+
+// Matching state of a row of pixels.
+struct RowMatches {
+  explicit RowMatches(int32_t width)
+      : best_costs(width),
+        second_costs(width),
+        best_disparities(width),
+        before_best_costs(width),
+        after_best_costs(width),
+        last_costs(width) {
+  }
+
+  void Reset() {
+    std::fill(best_costs.begin(), best_costs.end(), kInvalidCost);
+    std::fill(second_costs.begin(), second_costs.end(), kInvalidCost);
+    std::fill(best_disparities.begin(), best_disparities.end(), 0);
+    std::fill(before_best_costs.begin(), before_best_costs.end(),
+              kInvalidCost);
+    std::fill(after_best_costs.begin(), after_best_costs.end(), kInvalidCost);
+    std::fill(last_costs.begin(), last_costs.end(), kInvalidCost);
+  }
+
+  std::vector<uint16_t> best_costs;
+  std::vector<uint16_t> second_costs;
+  std::vector<uint16_t> best_disparities;
+  // Costs of the disparities next to the best one, for sub-pixel refinement.
+  std::vector<uint16_t> before_best_costs;
+  std::vector<uint16_t> after_best_costs;
+  // Costs of the previous disparity.
+  std::vector<uint16_t> last_costs;
+};
+
+// Update the matching state of pixels [x_begin, x_end) with the window costs
+// of disparity. Disparities next to the best one are not counted as the
+// second best since their costs are always close to the best cost.
+void UpdateMatches(uint16_t disparity, int32_t x_begin, int32_t x_end,
+                   const uint16_t* window_costs, RowMatches* matches) {
+  uint16_t* best_costs = matches->best_costs.data();
+  uint16_t* second_costs = matches->second_costs.data();
+  uint16_t* best_disparities = matches->best_disparities.data();
+  uint16_t* before_best_costs = matches->before_best_costs.data();
+  uint16_t* after_best_costs = matches->after_best_costs.data();
+  uint16_t* last_costs = matches->last_costs.data();
+
+  int32_t x = x_begin;
+#if HAS_VECTOR16
+  const Vector16 disparities = Splat(disparity);
+  const Vector16 invalid_costs = Splat(kInvalidCost);
+  const Vector16 ones = Splat(1);
+  for (; x + kVector16Lanes <= x_end; x += kVector16Lanes) {
+    Vector16 cost = Load(window_costs + x);
+    Vector16 best_cost = Load(best_costs + x);
+    Vector16 best_disparity = Load(best_disparities + x);
+    Vector16 after_best_disparity = Add(best_disparity, ones);
+    Vector16 is_best = Less(cost, best_cost);
+    Vector16 is_after_best = Equal(disparities, after_best_disparity);
+    Vector16 is_far_from_best = Greater(disparities, after_best_disparity);
+
+    Vector16 second_cost =
+        Select(is_best, Select(is_far_from_best, best_cost, invalid_costs),
+               Select(is_after_best, invalid_costs, cost));
+    Store(second_costs + x, Min(Load(second_costs + x), second_cost));
+    Store(before_best_costs + x, Select(is_best, Load(last_costs + x),
+                                        Load(before_best_costs + x)));
+    Store(after_best_costs + x,
+          Select(is_best, invalid_costs,
+                 Select(is_after_best, cost, Load(after_best_costs + x))));
+    Store(best_costs + x, Select(is_best, cost, best_cost));
+    Store(best_disparities + x, Select(is_best, disparities, best_disparity));
+    Store(last_costs + x, cost);
+  }
+#endif
+  for (; x < x_end; x++) {
+    uint16_t cost = window_costs[x];
+    if (cost < best_costs[x]) {
+      if (disparity > best_disparities[x] + 1) {
+        second_costs[x] = std::min(second_costs[x], best_costs[x]);
+      }
+      before_best_costs[x] = last_costs[x];
+      after_best_costs[x] = kInvalidCost;
+      best_costs[x] = cost;
+      best_disparities[x] = disparity;
+    } else if (disparity == best_disparities[x] + 1) {
+      after_best_costs[x] = cost;
+    } else if (cost < second_costs[x]) {
+      second_costs[x] = cost;
+    }
+    last_costs[x] = cost;
+  }
+}
+
+// Return the DEPTH16 confidence of a match.
+uint8_t GetDepth16Confidence(uint16_t best_cost, uint16_t second_cost) {
+  if (second_cost == kInvalidCost || second_cost == 0) {
+    return kDepth16FullConfidence;
+  }
+
+  float uniqueness =
+      static_cast<float>(second_cost - best_cost) / second_cost;
+  if (uniqueness >= kFullConfidenceUniqueness) {
+    return kDepth16FullConfidence;
+  }
+
+  return kDepth16NoConfidence +
+         static_cast<uint8_t>(uniqueness / kFullConfidenceUniqueness *
+                              (kDepth16ConfidenceSteps - 1));
+}
+}  // namespace
+
+std::unique_ptr<ReferenceDepthGenerator> ReferenceDepthGenerator::Create(
+    const Config& config) {
+  ATRACE_CALL();
+  if (config.max_disparity == 0 || config.max_disparity > kMaxDisparity) {
+    ALOGE("%s: Unsupported max disparity %u", __FUNCTION__,
+          config.max_disparity);
+    return nullptr;
+  }
+
+  if (config.window_radius > kMaxWindowRadius) {
+    ALOGE("%s: Unsupported window radius %u", __FUNCTION__,
+          config.window_radius);
+    return nullptr;
+  }
+
+  if (config.focal_length <= 0.0f || config.baseline <= 0.0f) {
+    ALOGE("%s: Invalid focal length %f or baseline %f", __FUNCTION__,
+          config.focal_length, config.baseline);
+    return nullptr;
+  }
+
+  auto generator = std::unique_ptr<ReferenceDepthGenerator>(
+      new ReferenceDepthGenerator(config));
+  if (generator == nullptr) {
+    ALOGE("%s: Creating ReferenceDepthGenerator failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  generator->worker_thread_ = std::thread(
+      &ReferenceDepthGenerator::WorkerThreadLoop, generator.get());
+
+  return generator;
+}
+
+ReferenceDepthGenerator::ReferenceDepthGenerator(const Config& config)
+    : config_(config) {
+  num_threads_ = config.num_threads;
+  if (num_threads_ == 0) {
+    num_threads_ = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+}
+
+ReferenceDepthGenerator::~ReferenceDepthGenerator() {
+  ATRACE_CALL();
+  {
+    std::lock_guard<std::mutex> lock(request_lock_);
+    worker_thread_exiting_ = true;
+    if (!pending_requests_.empty()) {
+      ALOGW("%s: Dropping %zu pending requests.", __FUNCTION__,
+            pending_requests_.size());
+      pending_requests_.clear();
+    }
+  }
+  request_condition_.notify_one();
+
+  if (worker_thread_.joinable()) {
+    worker_thread_.join();
+  }
+}
+
+void ReferenceDepthGenerator::SetResultCallback(
+    DepthResultCallbackFunction callback) {
+  std::lock_guard<std::mutex> lock(callback_lock_);
+  result_callback_ = callback;
+}
+
+status_t ReferenceDepthGenerator::EnqueueProcessRequest(
+    const DepthRequestInfo& request_info) {
+  ATRACE_CALL();
+  {
+    std::lock_guard<std::mutex> lock(callback_lock_);
+    if (result_callback_ == nullptr) {
+      ALOGE("%s: Result callback is not set.", __FUNCTION__);
+      return NO_INIT;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(request_lock_);
+  pending_requests_.push_back(request_info);
+  request_condition_.notify_one();
+  return OK;
+}
+
+void ReferenceDepthGenerator::WorkerThreadLoop() {
+  while (true) {
+    DepthRequestInfo request_info;
+    {
+      std::unique_lock<std::mutex> lock(request_lock_);
+      request_condition_.wait(lock, [this] {
+        return worker_thread_exiting_ || !pending_requests_.empty();
+      });
+      if (worker_thread_exiting_) {
+        return;
+      }
+
+      request_info = pending_requests_.front();
+      pending_requests_.pop_front();
+    }
+
+    status_t res = ExecuteProcessRequest(request_info);
+
+    DepthResultCallbackFunction callback;
+    {
+      std::lock_guard<std::mutex> lock(callback_lock_);
+      callback = result_callback_;
+    }
+
+    if (callback != nullptr) {
+      callback(res == OK ? DepthResultStatus::kOk : DepthResultStatus::kError,
+               request_info.frame_number);
+    }
+  }
+}
+
+status_t ReferenceDepthGenerator::GetInputImages(
+    const DepthRequestInfo& request_info, Image* left, Image* right) const {
+  if (request_info.ir_buffer.size() < 2) {
+    ALOGE("%s: Frame %u has %zu NIR buffer sequences, 2 are needed.",
+          __FUNCTION__, request_info.frame_number,
+          request_info.ir_buffer.size());
+    return BAD_VALUE;
+  }
+
+  Image* images[] = {left, right};
+  for (size_t i = 0; i < 2; i++) {
+    if (request_info.ir_buffer[i].empty() ||
+        request_info.ir_buffer[i][0].planes.empty() ||
+        request_info.ir_buffer[i][0].planes[0].addr == nullptr) {
+      ALOGE("%s: Frame %u misses NIR buffer %zu.", __FUNCTION__,
+            request_info.frame_number, i);
+      return BAD_VALUE;
+    }
+
+    const Buffer& buffer = request_info.ir_buffer[i][0];
+    if (buffer.format != HAL_PIXEL_FORMAT_Y8) {
+      ALOGE("%s: Unsupported NIR buffer format 0x%x", __FUNCTION__,
+            buffer.format);
+      return BAD_VALUE;
+    }
+
+    images[i]->data = buffer.planes[0].addr;
+    images[i]->width = buffer.width;
+    images[i]->height = buffer.height;
+    images[i]->stride = std::max(buffer.planes[0].stride, buffer.width);
+  }
+
+  if (left->width != right->width || left->height != right->height ||
+      left->width == 0 || left->height == 0) {
+    ALOGE("%s: NIR buffer sizes %dx%d and %dx%d are not supported.",
+          __FUNCTION__, left->width, left->height, right->width,
+          right->height);
+    return BAD_VALUE;
+  }
+
+  return OK;
+}
+
+status_t ReferenceDepthGenerator::ExecuteProcessRequest(
+    const DepthRequestInfo& request_info) {
+  ATRACE_CALL();
+  Image left;
+  Image right;
+  status_t res = GetInputImages(request_info, &left, &right);
+  if (res != OK) {
+    return res;
+  }
+
+  std::vector<float> disparity(left.width * left.height, 0.0f);
+  std::vector<uint8_t> confidence(left.width * left.height,
+                                  kDepth16NoConfidence);
+
+  // Split the rows into one band per thread and process the first band on
+  // the calling thread.
+  int32_t num_bands = std::min<int32_t>(num_threads_, left.height);
+  int32_t band_height = (left.height + num_bands - 1) / num_bands;
+  std::vector<std::future<void>> bands;
+  for (int32_t row = band_height; row < left.height; row += band_height) {
+    int32_t row_end = std::min(row + band_height, left.height);
+    bands.push_back(std::async(std::launch::async, [&, row, row_end] {
+      ComputeDisparityRows(left, right, row, row_end, disparity.data(),
+                           confidence.data());
+    }));
+  }
+
+  ComputeDisparityRows(left, right, /*row_begin=*/0,
+                       std::min(band_height, left.height), disparity.data(),
+                       confidence.data());
+  for (auto& band : bands) {
+    band.wait();
+  }
+
+  res = WriteDepthBuffer(left, disparity.data(), confidence.data(),
+                         request_info.depth_buffer);
+  if (res != OK) {
+    ALOGE("%s: Writing the depth buffer of frame %u failed.", __FUNCTION__,
+          request_info.frame_number);
+    return res;
+  }
+
+  ALOGV("%s: Frame %u processed.", __FUNCTION__, request_info.frame_number);
+  return OK;
+}
+
+void ReferenceDepthGenerator::ComputeDisparityRows(
+    const Image& left, const Image& right, int32_t row_begin, int32_t row_end,
+    float* disparity, uint8_t* confidence) const {
+  ATRACE_CALL();
+  const int32_t width = left.width;
+  const int32_t radius = config_.window_radius;
+  const int32_t window_size = 2 * radius + 1;
+  const int32_t max_disparity =
+      std::min<int32_t>(config_.max_disparity, width - window_size);
+  if (max_disparity < 0) {
+    return;
+  }
+
+  // Column sums of the window rows, one row of sums per disparity. Rows are
+  // processed one at a time so the working set stays in the cache.
+  std::vector<uint16_t> column_sums((max_disparity + 1) * width, 0);
+  // Matching state of the pixels in the current row.
+  RowMatches matches(width);
+  // Window costs of the current disparity.
+  std::vector<uint16_t> window_costs(width);
+
+  // Rows outside of the image repeat the border rows.
+  auto get_row = [](const Image& image, int32_t row) {
+    row = std::min(std::max(row, 0), image.height - 1);
+    return image.data + row * image.stride;
+  };
+
+  for (int32_t d = 0; d <= max_disparity; d++) {
+    // Left pixels [d, width) match right pixels [0, width - d).
+    uint16_t* sums = column_sums.data() + d * width + d;
+    for (int32_t row = row_begin - radius; row <= row_begin + radius; row++) {
+      AccumulateAbsDiff</*kSubtract=*/false>(
+          get_row(left, row) + d, get_row(right, row), width - d, sums);
+    }
+  }
+
+  for (int32_t row = row_begin; row < row_end; row++) {
+    matches.Reset();
+
+    for (int32_t d = 0; d <= max_disparity; d++) {
+      const uint16_t* row_sums = column_sums.data() + d * width;
+      if (row > row_begin) {
+        // Slide the window down by one row.
+        uint16_t* sums = column_sums.data() + d * width + d;
+        AccumulateAbsDiff</*kSubtract=*/false>(
+            get_row(left, row + radius) + d, get_row(right, row + radius),
+            width - d, sums);
+        AccumulateAbsDiff</*kSubtract=*/true>(
+            get_row(left, row - radius - 1) + d,
+            get_row(right, row - radius - 1), width - d, sums);
+      }
+
+      // Windows must not reach past the left edge of the right image.
+      const int32_t x_begin = d + radius;
+      const int32_t x_end = width - radius;
+      SumWindows(row_sums + d, window_size, x_end - x_begin,
+                 window_costs.data() + x_begin);
+      UpdateMatches(d, x_begin, x_end, window_costs.data(), &matches);
+    }
+
+    for (int32_t x = 0; x < width; x++) {
+      size_t out = row * width + x;
+      uint16_t best_cost = matches.best_costs[x];
+      uint16_t second_cost = matches.second_costs[x];
+      uint16_t best_disparity = matches.best_disparities[x];
+      // Disparity 0 is at infinity and has no depth.
+      if (best_cost == kInvalidCost || best_disparity == 0) {
+        continue;
+      }
+
+      if (second_cost != kInvalidCost &&
+          second_cost - best_cost <
+              config_.uniqueness_ratio * static_cast<float>(second_cost)) {
+        continue;
+      }
+
+      float refined_disparity = best_disparity;
+      uint16_t before = matches.before_best_costs[x];
+      uint16_t after = matches.after_best_costs[x];
+      if (before != kInvalidCost && after != kInvalidCost) {
+        // Fit a parabola through the costs around the best disparity.
+        float denominator = before + after - 2.0f * best_cost;
+        if (denominator > 0.0f) {
+          refined_disparity += (before - after) / (2.0f * denominator);
+        }
+      }
+
+      disparity[out] = refined_disparity;
+      confidence[out] = GetDepth16Confidence(best_cost, second_cost);
+    }
+  }
+}
+
+status_t ReferenceDepthGenerator::WriteDepthBuffer(
+    const Image& left, const float* disparity, const uint8_t* confidence,
+    const Buffer& depth_buffer) const {
+  ATRACE_CALL();
+  if (depth_buffer.format != HAL_PIXEL_FORMAT_Y16 ||
+      depth_buffer.planes.empty() ||
+      depth_buffer.planes[0].addr == nullptr || depth_buffer.width == 0 ||
+      depth_buffer.height == 0) {
+    ALOGE("%s: Unsupported depth buffer format 0x%x or size %ux%u",
+          __FUNCTION__, depth_buffer.format, depth_buffer.width,
+          depth_buffer.height);
+    return BAD_VALUE;
+  }
+
+  // Some clients set the stride in pixels.
+  const uint32_t stride = std::max(depth_buffer.planes[0].stride,
+                                   depth_buffer.width * 2);
+  const float depth_scale = config_.focal_length * config_.baseline;
+  for (uint32_t y = 0; y < depth_buffer.height; y++) {
+    uint16_t* out = reinterpret_cast<uint16_t*>(depth_buffer.planes[0].addr +
+                                                y * stride);
+    // The depth buffer may be scaled relative to the NIR buffers.
+    size_t row = static_cast<size_t>(y) * left.height / depth_buffer.height;
+    for (uint32_t x = 0; x < depth_buffer.width; x++) {
+      size_t i = row * left.width + x * left.width / depth_buffer.width;
+      if (disparity[i] <= 0.0f) {
+        // Range 0 means there is no depth.
+        out[x] = kDepth16NoConfidence << kDepth16ConfidenceShift;
+        continue;
+      }
+
+      float depth = std::min(depth_scale / disparity[i],
+                             static_cast<float>(kMaxDepth16Range));
+      out[x] = static_cast<uint16_t>(depth) |
+               (confidence[i] << kDepth16ConfidenceShift);
+    }
+  }
+
+  return OK;
+}
+
+}  // namespace depth_generator
+}  // namespace android
+
+extern "C" android::depth_generator::DepthGenerator* CreateDepthGenerator() {
+  return android::depth_generator::ReferenceDepthGenerator::Create(
+             android::depth_generator::ReferenceDepthGenerator::Config())
+      .release();
+}
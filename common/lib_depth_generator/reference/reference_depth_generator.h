@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HARDWARE_GOOGLE_CAMERA_LIB_REFERENCE_DEPTH_GENERATOR_H_
+#define HARDWARE_GOOGLE_CAMERA_LIB_REFERENCE_DEPTH_GENERATOR_H_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "depth_generator.h"
+
+namespace android {
+namespace depth_generator {
+
+// ReferenceDepthGenerator is a CPU implementation of DepthGenerator. It runs
+// block matching stereo on the two NIR buffers of a request and writes a
+// DEPTH16 buffer. The matching cost is the sum of absolute differences (SAD)
+// over a square window. Rows are split across threads. Color buffers are not
+// used.
+class ReferenceDepthGenerator : public DepthGenerator {
+ public:
+  struct Config {
+    // Largest disparity searched, in NIR buffer pixels. At most
+    // kMaxDisparity.
+    uint32_t max_disparity = 64;
+    // The matching window is (2 * window_radius + 1) pixels wide and tall. At
+    // most kMaxWindowRadius.
+    uint32_t window_radius = 3;
+    // Focal length of the NIR cameras in NIR buffer pixels.
+    float focal_length = 500.0f;
+    // Distance between the NIR cameras in millimeters.
+    float baseline = 50.0f;
+    // Minimum relative cost difference between the best and the second best
+    // disparity of a valid match.
+    float uniqueness_ratio = 0.05f;
+    // Number of threads processing a request. 0 uses one thread per CPU.
+    uint32_t num_threads = 0;
+  };
+
+  static const uint32_t kMaxDisparity = 255;
+  // Window costs of larger windows may overflow 16 bits.
+  static const uint32_t kMaxWindowRadius = 7;
+
+  // Create a ReferenceDepthGenerator.
+  static std::unique_ptr<ReferenceDepthGenerator> Create(const Config& config);
+
+  virtual ~ReferenceDepthGenerator();
+
+  // Override functions of DepthGenerator start.
+  status_t EnqueueProcessRequest(const DepthRequestInfo& request_info) override;
+
+  status_t ExecuteProcessRequest(const DepthRequestInfo& request_info) override;
+
+  void SetResultCallback(DepthResultCallbackFunction callback) override;
+  // Override functions of DepthGenerator end.
+
+ protected:
+  explicit ReferenceDepthGenerator(const Config& config);
+
+ private:
+  // An 8-bit NIR image.
+  struct Image {
+    const uint8_t* data = nullptr;
+    int32_t width = 0;
+    int32_t height = 0;
+    // In bytes
+    int32_t stride = 0;
+  };
+
+  // Return the NIR images of a request, or BAD_VALUE if the request buffers
+  // are not supported.
+  status_t GetInputImages(const DepthRequestInfo& request_info, Image* left,
+                          Image* right) const;
+
+  // Compute the disparity and the DEPTH16 confidence of rows
+  // [row_begin, row_end) of the left image. disparity and confidence hold
+  // values for the whole image. Disparity 0 marks pixels without a match.
+  void ComputeDisparityRows(const Image& left, const Image& right,
+                            int32_t row_begin, int32_t row_end,
+                            float* disparity, uint8_t* confidence) const;
+
+  // Convert the disparity to depth and write it to the depth buffer.
+  status_t WriteDepthBuffer(const Image& left, const float* disparity,
+                            const uint8_t* confidence,
+                            const Buffer& depth_buffer) const;
+
+  // Process the enqueued requests until the generator is destroyed.
+  void WorkerThreadLoop();
+
+  const Config config_;
+
+  // Number of threads processing a request.
+  uint32_t num_threads_ = 1;
+
+  std::mutex callback_lock_;
+
+  // Callback to return asynchronous results. Must be protected by
+  // callback_lock_.
+  DepthResultCallbackFunction result_callback_;
+
+  std::mutex request_lock_;
+
+  // Notified when a request is enqueued or the generator is destroyed.
+  std::condition_variable request_condition_;
+
+  // Requests waiting for the worker thread. Must be protected by
+  // request_lock_.
+  std::deque<DepthRequestInfo> pending_requests_;
+
+  // Whether the worker thread should exit. Must be protected by request_lock_.
+  bool worker_thread_exiting_ = false;
+
+  // Thread processing the enqueued requests.
+  std::thread worker_thread_;
+};
+
+}  // namespace depth_generator
+}  // namespace android
+
+#endif  // HARDWARE_GOOGLE_CAMERA_LIB_REFERENCE_DEPTH_GENERATOR_H_
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ReferenceDepthGeneratorBenchmark"
+#include <benchmark/benchmark.h>
+#include <log/log.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "reference_depth_generator.h"
+
+namespace android {
+namespace depth_generator {
+
+// Disparities of the synthetic scene: a box in front of a plane.
+static const uint32_t kBackgroundDisparity = 8;
+static const uint32_t kForegroundDisparity = 24;
+// Matches within this distance of the ground truth disparity are correct.
+static const float kDisparityTolerance = 1.0f;
+
+// A synthetic NIR stereo pair with known disparity, and a DEPTH16 output
+// buffer.
+class StereoScene {
+ public:
+  StereoScene(uint32_t width, uint32_t height)
+      : width_(width),
+        height_(height),
+        left_(width * height),
+        right_(width * height),
+        depth_(width * height),
+        ground_truth_(width * height) {
+    // Random texture gives every window a unique match. The fixed seed keeps
+    // runs comparable.
+    std::mt19937 random_engine(/*seed=*/1);
+    std::uniform_int_distribution<uint32_t> distribution(0, 255);
+    for (auto& pixel : right_) {
+      pixel = distribution(random_engine);
+    }
+
+    for (uint32_t y = 0; y < height; y++) {
+      for (uint32_t x = 0; x < width; x++) {
+        bool foreground = x >= width / 4 && x < width * 3 / 4 &&
+                          y >= height / 4 && y < height * 3 / 4;
+        uint32_t disparity =
+            foreground ? kForegroundDisparity : kBackgroundDisparity;
+        ground_truth_[y * width + x] = disparity;
+        left_[y * width + x] =
+            x >= disparity ? right_[y * width + x - disparity]
+                           : distribution(random_engine);
+      }
+    }
+
+    request_info_.frame_number = 0;
+    request_info_.ir_buffer = {{CreateBuffer(HAL_PIXEL_FORMAT_Y8, left_.data(),
+                                             width)},
+                               {CreateBuffer(HAL_PIXEL_FORMAT_Y8,
+                                             right_.data(), width)}};
+    request_info_.depth_buffer =
+        CreateBuffer(HAL_PIXEL_FORMAT_Y16,
+                     reinterpret_cast<uint8_t*>(depth_.data()), width * 2);
+  }
+
+  const DepthRequestInfo& GetRequestInfo() const {
+    return request_info_;
+  }
+
+  // Return the ratio of pixels with depth and the ratio of those pixels whose
+  // disparity is off by more than kDisparityTolerance.
+  void GetAccuracy(const ReferenceDepthGenerator::Config& config,
+                   double* valid_ratio, double* error_ratio) const {
+    uint32_t num_valid = 0;
+    uint32_t num_errors = 0;
+    for (size_t i = 0; i < depth_.size(); i++) {
+      uint16_t range = depth_[i] & 0x1FFF;
+      if (range == 0) {
+        continue;
+      }
+
+      num_valid++;
+      float disparity = config.focal_length * config.baseline / range;
+      if (std::fabs(disparity - ground_truth_[i]) > kDisparityTolerance) {
+        num_errors++;
+      }
+    }
+
+    *valid_ratio = static_cast<double>(num_valid) / depth_.size();
+    *error_ratio =
+        num_valid > 0 ? static_cast<double>(num_errors) / num_valid : 0.0;
+  }
+
+ private:
+  Buffer CreateBuffer(android_pixel_format_t format, uint8_t* addr,
+                      uint32_t stride) {
+    Buffer buffer;
+    buffer.format = format;
+    buffer.width = width_;
+    buffer.height = height_;
+    buffer.planes.push_back(
+        {.addr = addr, .stride = stride, .scanline = height_});
+    return buffer;
+  }
+
+  const uint32_t width_;
+  const uint32_t height_;
+  std::vector<uint8_t> left_;
+  std::vector<uint8_t> right_;
+  std::vector<uint16_t> depth_;
+  std::vector<uint32_t> ground_truth_;
+  DepthRequestInfo request_info_;
+};
+
+// Arguments: width, height, number of threads, window radius.
+static void BM_ExecuteProcessRequest(benchmark::State& state) {
+  const uint32_t width = state.range(0);
+  const uint32_t height = state.range(1);
+  ReferenceDepthGenerator::Config config;
+  config.num_threads = state.range(2);
+  config.window_radius = state.range(3);
+
+  auto generator = ReferenceDepthGenerator::Create(config);
+  if (generator == nullptr) {
+    state.SkipWithError("Creating ReferenceDepthGenerator failed");
+    return;
+  }
+
+  StereoScene scene(width, height);
+  for (auto _ : state) {
+    if (generator->ExecuteProcessRequest(scene.GetRequestInfo()) != OK) {
+      state.SkipWithError("Processing the depth request failed");
+      return;
+    }
+  }
+
+  double valid_ratio = 0.0;
+  double error_ratio = 0.0;
+  scene.GetAccuracy(config, &valid_ratio, &error_ratio);
+  state.counters["valid_ratio"] = valid_ratio;
+  state.counters["error_ratio"] = error_ratio;
+  state.counters["pixel_time"] = benchmark::Counter(
+      width * height, benchmark::Counter::kIsIterationInvariantRate |
+                          benchmark::Counter::kInvert);
+}
+
+static void GetBenchmarkArguments(benchmark::internal::Benchmark* benchmark) {
+  for (int64_t num_threads : {1, 2, 4}) {
+    for (int64_t window_radius : {2, 3, 5}) {
+      benchmark->Args({640, 480, num_threads, window_radius});
+    }
+  }
+  benchmark->Args({1280, 960, 4, 3});
+}
+
+BENCHMARK(BM_ExecuteProcessRequest)
+    ->ArgNames({"width", "height", "threads", "radius"})
+    ->Apply(GetBenchmarkArguments)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace depth_generator
+}  // namespace android
+
+BENCHMARK_MAIN();
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "EmulatedBufferAllocatorHwl"
+#include "EmulatedBufferAllocatorHwl.h"
+
+#include <gralloc_buffer_allocator.h>
+#include <log/log.h>
+
+namespace android {
+
+using google_camera_hal::GrallocBufferAllocator;
+
+std::unique_ptr<EmulatedBufferAllocatorHwl>
+EmulatedBufferAllocatorHwl::Create() {
+  auto allocator = std::unique_ptr<EmulatedBufferAllocatorHwl>(
+      new EmulatedBufferAllocatorHwl());
+  if (allocator == nullptr) {
+    ALOGE("%s: Creating EmulatedBufferAllocatorHwl failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  allocator->gralloc_allocator_ = GrallocBufferAllocator::Create();
+  if (allocator->gralloc_allocator_ == nullptr) {
+    ALOGE("%s: Creating GrallocBufferAllocator failed.", __FUNCTION__);
+    return nullptr;
+  }
+
+  return allocator;
+}
+
+EmulatedBufferAllocatorHwl::~EmulatedBufferAllocatorHwl() {
+  std::lock_guard<std::mutex> lock(buffers_lock_);
+  if (!allocated_buffers_.empty()) {
+    ALOGW("%s: Releasing %zu buffers that were not freed.", __FUNCTION__,
+          allocated_buffers_.size());
+    std::vector<buffer_handle_t> buffers(allocated_buffers_.begin(),
+                                         allocated_buffers_.end());
+    gralloc_allocator_->FreeBuffers(&buffers);
+  }
+}
+
+status_t EmulatedBufferAllocatorHwl::AllocateBuffers(
+    const HalBufferDescriptor& buffer_descriptor,
+    std::vector<buffer_handle_t>* buffers) {
+  if (buffers == nullptr) {
+    ALOGE("%s: buffers is nullptr", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  std::vector<buffer_handle_t> new_buffers;
+  status_t res =
+      gralloc_allocator_->AllocateBuffers(buffer_descriptor, &new_buffers);
+  if (res != OK) {
+    ALOGE("%s: Allocating %u buffers failed: %s(%d)", __FUNCTION__,
+          buffer_descriptor.immediate_num_buffers, strerror(-res), res);
+    return res;
+  }
+
+  std::lock_guard<std::mutex> lock(buffers_lock_);
+  for (auto& buffer : new_buffers) {
+    allocated_buffers_.insert(buffer);
+    buffers->push_back(buffer);
+  }
+
+  return OK;
+}
+
+status_t EmulatedBufferAllocatorHwl::FreeBuffers(
+    std::vector<buffer_handle_t>* buffers) {
+  if (buffers == nullptr) {
+    ALOGE("%s: buffers is nullptr", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  std::lock_guard<std::mutex> lock(buffers_lock_);
+  for (auto& buffer : *buffers) {
+    if (allocated_buffers_.find(buffer) == allocated_buffers_.end()) {
+      ALOGE("%s: Buffer %p was not allocated by this allocator.", __FUNCTION__,
+            buffer);
+      return BAD_VALUE;
+    }
+  }
+
+  for (auto& buffer : *buffers) {
+    allocated_buffers_.erase(buffer);
+  }
+
+  gralloc_allocator_->FreeBuffers(buffers);
+  return OK;
+}
+
+bool EmulatedBufferAllocatorHwl::IsHwlAllocatedBuffer(buffer_handle_t buffer) {
+  std::lock_guard<std::mutex> lock(buffers_lock_);
+  return allocated_buffers_.find(buffer) != allocated_buffers_.end();
+}
+
+}  // namespace android
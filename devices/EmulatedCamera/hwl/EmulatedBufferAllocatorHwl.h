@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_BUFFER_ALLOCATOR_HWL_H
+#define EMULATOR_CAMERA_HAL_HWL_BUFFER_ALLOCATOR_HWL_H
+
+#include <camera_buffer_allocator_hwl.h>
+#include <hal_buffer_allocator.h>
+
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+
+namespace android {
+
+using google_camera_hal::CameraBufferAllocatorHwl;
+using google_camera_hal::HalBufferDescriptor;
+using google_camera_hal::IHalBufferAllocator;
+
+// EmulatedBufferAllocatorHwl allocates HWL buffers from gralloc. The HAL
+// caches the buffers it frees so they can be reused by later stream
+// configurations.
+class EmulatedBufferAllocatorHwl : public CameraBufferAllocatorHwl {
+ public:
+  static std::unique_ptr<EmulatedBufferAllocatorHwl> Create();
+
+  virtual ~EmulatedBufferAllocatorHwl();
+
+  // Override functions in CameraBufferAllocatorHwl.
+  status_t AllocateBuffers(const HalBufferDescriptor& buffer_descriptor,
+                           std::vector<buffer_handle_t>* buffers) override;
+
+  status_t FreeBuffers(std::vector<buffer_handle_t>* buffers) override;
+
+  bool IsHwlAllocatedBuffer(buffer_handle_t buffer) override;
+  // End of override functions in CameraBufferAllocatorHwl.
+
+ protected:
+  EmulatedBufferAllocatorHwl() = default;
+
+ private:
+  EmulatedBufferAllocatorHwl(const EmulatedBufferAllocatorHwl&) = delete;
+  EmulatedBufferAllocatorHwl& operator=(const EmulatedBufferAllocatorHwl&) =
+      delete;
+
+  std::unique_ptr<IHalBufferAllocator> gralloc_allocator_;
+
+  std::mutex buffers_lock_;
+
+  // Buffers allocated and not freed yet. Protected by buffers_lock_.
+  std::unordered_set<buffer_handle_t> allocated_buffers_;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_BUFFER_ALLOCATOR_HWL_H
@@ -27,12 +27,14 @@
 namespace android {
 
 std::unique_ptr<CameraDeviceHwl> EmulatedCameraDeviceHwlImpl::Create(
-    uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta,
-    PhysicalDeviceMapPtr physical_devices,
+    uint32_t camera_id, std::shared_ptr<const HalCameraMetadata> static_meta,
+    PhysicalDeviceSnapshotMapPtr physical_devices,
+    std::shared_ptr<StreamCombinationIndex> stream_combination_index,
     std::shared_ptr<EmulatedTorchState> torch_state) {
   auto device = std::unique_ptr<EmulatedCameraDeviceHwlImpl>(
       new EmulatedCameraDeviceHwlImpl(camera_id, std::move(static_meta),
                                       std::move(physical_devices),
+                                      std::move(stream_combination_index),
                                       torch_state));
 
   if (device == nullptr) {
@@ -54,11 +56,13 @@ std::unique_ptr<CameraDeviceHwl> EmulatedCameraDeviceHwlImpl::Create(
 }
 
 EmulatedCameraDeviceHwlImpl::EmulatedCameraDeviceHwlImpl(
-    uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta,
-    PhysicalDeviceMapPtr physical_devices,
+    uint32_t camera_id, std::shared_ptr<const HalCameraMetadata> static_meta,
+    PhysicalDeviceSnapshotMapPtr physical_devices,
+    std::shared_ptr<StreamCombinationIndex> stream_combination_index,
     std::shared_ptr<EmulatedTorchState> torch_state)
     : camera_id_(camera_id),
       static_metadata_(std::move(static_meta)),
+      stream_combination_index_(std::move(stream_combination_index)),
       physical_device_map_(std::move(physical_devices)),
       torch_state_(torch_state) {}
 
@@ -67,16 +71,12 @@ uint32_t EmulatedCameraDeviceHwlImpl::GetCameraId() const {
 }
 
 status_t EmulatedCameraDeviceHwlImpl::Initialize() {
-  auto ret = GetSensorCharacteristics(static_metadata_.get(), &sensor_chars_);
-  if (ret != OK) {
-    ALOGE("%s: Unable to extract sensor characteristics %s (%d)", __FUNCTION__,
-          strerror(-ret), ret);
-    return ret;
+  if ((static_metadata_.get() == nullptr) ||
+      (stream_combination_index_.get() == nullptr)) {
+    ALOGE("%s: Missing camera characteristics!", __FUNCTION__);
+    return BAD_VALUE;
   }
 
-  stream_coniguration_map_ =
-      std::make_unique<StreamConfigurationMap>(*static_metadata_);
-
   return OK;
 }
 
@@ -163,8 +163,8 @@ status_t EmulatedCameraDeviceHwlImpl::CreateCameraDeviceSessionHwl(
 
 bool EmulatedCameraDeviceHwlImpl::IsStreamCombinationSupported(
     const StreamConfiguration& stream_config) {
-  return EmulatedSensor::IsStreamCombinationSupported(
-      stream_config, *stream_coniguration_map_, sensor_chars_);
+  return stream_combination_index_->IsStreamCombinationSupported(
+      stream_config);
 }
 
 }  // namespace android
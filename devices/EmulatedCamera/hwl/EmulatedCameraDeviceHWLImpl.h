@@ -23,7 +23,7 @@
 #include "EmulatedSensor.h"
 #include "EmulatedTorchState.h"
 #include "utils/HWLUtils.h"
-#include "utils/StreamConfigurationMap.h"
+#include "utils/StreamCombinationIndex.h"
 
 namespace android {
 
@@ -37,9 +37,14 @@ using google_camera_hal::TorchMode;
 
 class EmulatedCameraDeviceHwlImpl : public CameraDeviceHwl {
  public:
+  // 'static_meta' and 'physical_devices' are immutable snapshots owned by the
+  // provider, they are only cloned when handed out to the framework or to a
+  // new session. 'stream_combination_index' is shared by all instances of
+  // the same camera.
   static std::unique_ptr<CameraDeviceHwl> Create(
-      uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta,
-      PhysicalDeviceMapPtr physical_devices,
+      uint32_t camera_id, std::shared_ptr<const HalCameraMetadata> static_meta,
+      PhysicalDeviceSnapshotMapPtr physical_devices,
+      std::shared_ptr<StreamCombinationIndex> stream_combination_index,
       std::shared_ptr<EmulatedTorchState> torch_state);
 
   virtual ~EmulatedCameraDeviceHwlImpl() = default;
@@ -70,20 +75,20 @@ class EmulatedCameraDeviceHwlImpl : public CameraDeviceHwl {
   // End of override functions in CameraDeviceHwl.
 
  private:
-  EmulatedCameraDeviceHwlImpl(uint32_t camera_id,
-                              std::unique_ptr<HalCameraMetadata> static_meta,
-                              PhysicalDeviceMapPtr physical_devices,
-                              std::shared_ptr<EmulatedTorchState> torch_state);
+  EmulatedCameraDeviceHwlImpl(
+      uint32_t camera_id, std::shared_ptr<const HalCameraMetadata> static_meta,
+      PhysicalDeviceSnapshotMapPtr physical_devices,
+      std::shared_ptr<StreamCombinationIndex> stream_combination_index,
+      std::shared_ptr<EmulatedTorchState> torch_state);
 
   status_t Initialize();
 
   const uint32_t camera_id_ = 0;
 
-  std::unique_ptr<HalCameraMetadata> static_metadata_;
-  std::unique_ptr<StreamConfigurationMap> stream_coniguration_map_;
-  PhysicalDeviceMapPtr physical_device_map_;
+  std::shared_ptr<const HalCameraMetadata> static_metadata_;
+  std::shared_ptr<StreamCombinationIndex> stream_combination_index_;
+  PhysicalDeviceSnapshotMapPtr physical_device_map_;
   std::shared_ptr<EmulatedTorchState> torch_state_;
-  SensorCharacteristics sensor_chars_;
 };
 
 }  // namespace android
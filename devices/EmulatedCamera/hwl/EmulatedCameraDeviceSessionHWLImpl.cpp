@@ -18,6 +18,7 @@
 
 #include "EmulatedCameraDeviceSessionHWLImpl.h"
 
+#include <cutils/properties.h>
 #include <hardware/gralloc.h>
 #include <inttypes.h>
 #include <log/log.h>
@@ -28,6 +29,23 @@
 
 namespace android {
 
+// Reads the request queue backpressure policy, one of "block", "fail" or
+// "drop_oldest".
+static BackpressurePolicy GetBackpressurePolicy() {
+  char value[PROPERTY_VALUE_MAX];
+  property_get("vendor.camera.emulator.backpressure", value, "block");
+  if (strcmp(value, "fail") == 0) {
+    return BackpressurePolicy::kFailFast;
+  } else if (strcmp(value, "drop_oldest") == 0) {
+    return BackpressurePolicy::kDropOldest;
+  } else if (strcmp(value, "block") != 0) {
+    ALOGW("%s: Unknown backpressure policy: %s, blocking instead!",
+          __FUNCTION__, value);
+  }
+
+  return BackpressurePolicy::kBlock;
+}
+
 std::unique_ptr<EmulatedCameraDeviceSessionHwlImpl>
 EmulatedCameraDeviceSessionHwlImpl::Create(
     uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta,
@@ -61,8 +79,6 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Initialize(
     uint32_t camera_id, std::unique_ptr<HalCameraMetadata> static_meta) {
   camera_id_ = camera_id;
   static_metadata_ = std::move(static_meta);
-  stream_coniguration_map_ =
-      std::make_unique<StreamConfigurationMap>(*static_metadata_);
   camera_metadata_ro_entry_t entry;
   auto ret = static_metadata_->Get(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &entry);
   if (ret != OK) {
@@ -80,6 +96,9 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Initialize(
     return ret;
   }
 
+  stream_combination_index_ = std::make_unique<StreamCombinationIndex>(
+      *static_metadata_, sensor_chars_);
+
   auto logical_chars = std::make_unique<LogicalCharacteristics>();
   logical_chars->emplace(camera_id_, sensor_chars_);
   for (const auto& it : *physical_device_map_) {
@@ -93,8 +112,12 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Initialize(
       return ret;
     }
   }
+  // Optionally give every physical camera its own sensor thread
+  bool per_camera_threads =
+      property_get_bool("vendor.camera.emulator.per_camera_sensor", false);
   sp<EmulatedSensor> emulated_sensor = new EmulatedSensor();
-  ret = emulated_sensor->StartUp(camera_id_, std::move(logical_chars));
+  ret = emulated_sensor->StartUp(camera_id_, std::move(logical_chars),
+                                 per_camera_threads);
   if (ret != OK) {
     ALOGE("%s: Failed on sensor start up %s (%d)", __FUNCTION__, strerror(-ret),
           ret);
@@ -103,6 +126,7 @@ status_t EmulatedCameraDeviceSessionHwlImpl::Initialize(
 
   request_processor_ =
       std::make_unique<EmulatedRequestProcessor>(camera_id_, emulated_sensor);
+  request_processor_->SetBackpressurePolicy(GetBackpressurePolicy());
 
   return request_processor_->Initialize(
       HalCameraMetadata::Clone(static_metadata_.get()),
@@ -140,8 +164,8 @@ status_t EmulatedCameraDeviceSessionHwlImpl::ConfigurePipeline(
     return ALREADY_EXISTS;
   }
 
-  if (!EmulatedSensor::IsStreamCombinationSupported(
-          request_config, *stream_coniguration_map_, sensor_chars_)) {
+  if (!stream_combination_index_->IsStreamCombinationSupported(
+          request_config)) {
     ALOGE("%s: Stream combination not supported!", __FUNCTION__);
     return BAD_VALUE;
   }
@@ -259,8 +283,8 @@ status_t EmulatedCameraDeviceSessionHwlImpl::SubmitRequests(
         const auto& streams = pipelines_[request.pipeline_id].streams;
         auto input_stream = streams.at(input_buffer.stream_id);
         auto output_formats =
-            stream_coniguration_map_->GetValidOutputFormatsForInput(
-                input_stream.override_format);
+            stream_combination_index_->GetStreamConfigurationMap()
+                .GetValidOutputFormatsForInput(input_stream.override_format);
         for (const auto& output_buffer : request.output_buffers) {
           auto output_stream = streams.at(output_buffer.stream_id);
           if (output_formats.find(output_stream.override_format) ==
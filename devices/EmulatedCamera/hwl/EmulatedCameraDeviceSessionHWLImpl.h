@@ -25,7 +25,7 @@
 #include "EmulatedRequestProcessor.h"
 #include "EmulatedTorchState.h"
 #include "multicam_coordinator_hwl.h"
-#include "utils/StreamConfigurationMap.h"
+#include "utils/StreamCombinationIndex.h"
 
 namespace android {
 
@@ -167,7 +167,7 @@ class EmulatedCameraDeviceSessionHwlImpl : public CameraDeviceSessionHwl {
   std::unique_ptr<HalCameraMetadata> static_metadata_;
   std::vector<EmulatedPipeline> pipelines_;
   std::unique_ptr<EmulatedRequestProcessor> request_processor_;
-  std::unique_ptr<StreamConfigurationMap> stream_coniguration_map_;
+  std::unique_ptr<StreamCombinationIndex> stream_combination_index_;
   SensorCharacteristics sensor_chars_;
   std::shared_ptr<EmulatedTorchState> torch_state_;
   PhysicalDeviceMapPtr physical_device_map_;
@@ -16,14 +16,18 @@
 
 //#define LOG_NDEBUG 0
 #define LOG_TAG "EmulatedCameraProviderHwlImpl"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
 #include "EmulatedCameraProviderHWLImpl.h"
 
 #include <android-base/file.h>
 #include <android-base/strings.h>
 #include <cutils/properties.h>
 #include <hardware/camera_common.h>
+#include <inttypes.h>
 #include <log/log.h>
+#include <utils/Trace.h>
 
+#include "EmulatedBufferAllocatorHwl.h"
 #include "EmulatedCameraDeviceHWLImpl.h"
 #include "EmulatedCameraDeviceSessionHWLImpl.h"
 #include "EmulatedLogicalRequestState.h"
@@ -41,6 +45,11 @@ const char* EmulatedCameraProviderHwlImpl::kConfigurationFileLocation[] = {
     "/vendor/etc/config/emu_camera_depth.json",
 };
 
+// Location of the binary characteristics caches generated from the camera
+// configuration files.
+const char* EmulatedCameraProviderHwlImpl::kCharacteristicsCacheLocation =
+    "/data/vendor/camera/";
+
 constexpr StreamSize s240pStreamSize = std::pair(240, 180);
 constexpr StreamSize s720pStreamSize = std::pair(1280, 720);
 constexpr StreamSize s1440pStreamSize = std::pair(1920, 1440);
@@ -167,13 +176,14 @@ static bool SupportsCapability(const uint32_t camera_id,
 
 bool EmulatedCameraProviderHwlImpl::SupportsMandatoryConcurrentStreams(
     uint32_t camera_id) {
-  HalCameraMetadata& static_metadata = *(static_metadata_[camera_id]);
-  auto map = std::make_unique<StreamConfigurationMap>(static_metadata);
-  auto yuv_output_sizes = map->GetOutputSizes(HAL_PIXEL_FORMAT_YCBCR_420_888);
-  auto blob_output_sizes = map->GetOutputSizes(HAL_PIXEL_FORMAT_BLOB);
-  auto depth16_output_sizes = map->GetOutputSizes(HAL_PIXEL_FORMAT_Y16);
+  const HalCameraMetadata& static_metadata = *(static_metadata_[camera_id]);
+  auto& map =
+      stream_combination_indices_[camera_id]->GetStreamConfigurationMap();
+  auto yuv_output_sizes = map.GetOutputSizes(HAL_PIXEL_FORMAT_YCBCR_420_888);
+  auto blob_output_sizes = map.GetOutputSizes(HAL_PIXEL_FORMAT_BLOB);
+  auto depth16_output_sizes = map.GetOutputSizes(HAL_PIXEL_FORMAT_Y16);
   auto priv_output_sizes =
-      map->GetOutputSizes(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED);
+      map.GetOutputSizes(HAL_PIXEL_FORMAT_IMPLEMENTATION_DEFINED);
 
   if (!SupportsCapability(
           camera_id, static_metadata,
@@ -258,17 +268,9 @@ status_t EmulatedCameraProviderHwlImpl::GetConcurrentStreamingCameraIds(
   if (combinations == nullptr) {
     return BAD_VALUE;
   }
-  // Collect all camera ids that support the guaranteed stream combinations
-  // (720p YUV and IMPLEMENTATION_DEFINED) and put them in one set. We don't
-  // make all possible combinations since it should be possible to stream all
-  // of them at once in the emulated camera.
-  std::unordered_set<uint32_t> candidate_ids;
-  for (auto& entry : camera_id_map_) {
-    if (SupportsMandatoryConcurrentStreams(entry.first)) {
-      candidate_ids.insert(entry.first);
-    }
-  }
-  combinations->emplace_back(std::move(candidate_ids));
+  // All camera ids that support the guaranteed stream combinations are
+  // collected during Initialize() and put in one set.
+  combinations->emplace_back(concurrent_camera_ids_);
   return OK;
 }
 
@@ -277,27 +279,16 @@ status_t EmulatedCameraProviderHwlImpl::IsConcurrentStreamCombinationSupported(
     bool* is_supported) {
   *is_supported = false;
 
-  // Go through the given camera ids, get their sensor characteristics, stream
-  // config maps and call EmulatedSensor::IsStreamCombinationSupported()
+  // Go through the given camera ids and check their stream combinations
+  // against the indices compiled during Initialize()
   for (auto& config : configs) {
-    // TODO: Consider caching sensor characteristics and StreamConfigurationMap
-    if (camera_id_map_.find(config.camera_id) == camera_id_map_.end()) {
+    auto index = stream_combination_indices_.find(config.camera_id);
+    if (index == stream_combination_indices_.end()) {
       ALOGE("%s: Camera id %u does not exist", __FUNCTION__, config.camera_id);
       return BAD_VALUE;
     }
-    auto stream_configuration_map = std::make_unique<StreamConfigurationMap>(
-        *(static_metadata_[config.camera_id]));
-    SensorCharacteristics sensor_chars;
-    status_t ret = GetSensorCharacteristics(
-        (static_metadata_[config.camera_id]).get(), &sensor_chars);
-    if (ret != OK) {
-      ALOGE("%s: Unable to extract sensor chars for camera id %u", __FUNCTION__,
-            config.camera_id);
-      return UNKNOWN_ERROR;
-    }
-    if (!EmulatedSensor::IsStreamCombinationSupported(
-            config.stream_configuration, *stream_configuration_map,
-            sensor_chars)) {
+    if (!index->second->IsStreamCombinationSupported(
+            config.stream_configuration)) {
       return OK;
     }
   }
@@ -568,11 +559,11 @@ status_t InsertRationalTag(const Json::Value& json_value, uint32_t tag_id,
   return ret;
 }
 
-uint32_t EmulatedCameraProviderHwlImpl::ParseCharacteristics(
-    const Json::Value& value, ssize_t id) {
+std::unique_ptr<HalCameraMetadata>
+EmulatedCameraProviderHwlImpl::ParseCharacteristics(const Json::Value& value) {
   if (!value.isObject()) {
     ALOGE("%s: Configuration root is not an object", __FUNCTION__);
-    return BAD_VALUE;
+    return nullptr;
   }
 
   auto static_meta = HalCameraMetadata::Create(1, 10);
@@ -611,9 +602,90 @@ uint32_t EmulatedCameraProviderHwlImpl::ParseCharacteristics(
     }
   }
 
+  return static_meta;
+}
+
+status_t EmulatedCameraProviderHwlImpl::LoadCharacteristics(
+    const char* config_path,
+    std::vector<std::unique_ptr<HalCameraMetadata>>* devices /*out*/) {
+  ATRACE_CALL();
+  std::string config;
+  if (!android::base::ReadFileToString(config_path, &config)) {
+    ALOGW("%s: Could not open configuration file: %s", __FUNCTION__,
+          config_path);
+    return NAME_NOT_FOUND;
+  }
+
+  // Converting the json configuration tag by tag is expensive, re-use the
+  // binary metadata from the last conversion as long as the configuration,
+  // the build and the parser are unchanged.
+  std::string cache_path = std::string(kCharacteristicsCacheLocation) +
+                           android::base::Basename(config_path) + ".cache";
+  uint64_t config_hash = CameraMetadataCache::GetSourceHash(
+      config, kCharacteristicsParserVersion);
+  if (CameraMetadataCache::Load(cache_path, config_hash, devices) == OK) {
+    return OK;
+  }
+
+  Json::Reader config_reader;
+  Json::Value root;
+  if (!config_reader.parse(config, root)) {
+    ALOGE("Could not parse configuration file: %s",
+          config_reader.getFormattedErrorMessages().c_str());
+    return BAD_VALUE;
+  }
+
+  devices->clear();
+  if (root.isArray()) {
+    devices->reserve(root.size());
+    for (const auto& device : root) {
+      devices->push_back(ParseCharacteristics(device));
+      if (devices->back() == nullptr) {
+        return BAD_VALUE;
+      }
+    }
+  } else {
+    devices->push_back(ParseCharacteristics(root));
+    if (devices->back() == nullptr) {
+      return BAD_VALUE;
+    }
+  }
+
+  if (CameraMetadataCache::Store(cache_path, config_hash, *devices) != OK) {
+    ALOGW("%s: Unable to cache the characteristics of %s", __FUNCTION__,
+          config_path);
+  }
+
+  return OK;
+}
+
+EmulatedCameraProviderHwlImpl::ConfigurationLoadResult
+EmulatedCameraProviderHwlImpl::LoadConfiguration(const char* config_path) {
+  ATRACE_NAME(config_path);
+  ConfigurationLoadResult result;
+  auto start = systemTime();
+  result.status = LoadCharacteristics(config_path, &result.devices);
+  if (result.status == OK) {
+    for (auto& device : result.devices) {
+      result.status = ValidateCharacteristics(device.get());
+      if (result.status != OK) {
+        break;
+      }
+    }
+  }
+  result.duration = systemTime() - start;
+
+  return result;
+}
+
+status_t EmulatedCameraProviderHwlImpl::ValidateCharacteristics(
+    HalCameraMetadata* static_meta) {
+  if (static_meta == nullptr) {
+    return BAD_VALUE;
+  }
+
   SensorCharacteristics sensor_characteristics;
-  auto ret =
-      GetSensorCharacteristics(static_meta.get(), &sensor_characteristics);
+  auto ret = GetSensorCharacteristics(static_meta, &sensor_characteristics);
   if (ret != OK) {
     ALOGE("%s: Unable to extract sensor characteristics!", __FUNCTION__);
     return ret;
@@ -628,6 +700,15 @@ uint32_t EmulatedCameraProviderHwlImpl::ParseCharacteristics(
   int32_t payload_frames = 0;
   static_meta->Set(google_camera_hal::kHdrplusPayloadFrames, &payload_frames, 1);
 
+  return OK;
+}
+
+uint32_t EmulatedCameraProviderHwlImpl::AddCharacteristics(
+    std::unique_ptr<HalCameraMetadata> static_meta, ssize_t id) {
+  if (static_meta.get() == nullptr) {
+    return BAD_VALUE;
+  }
+
   if (id < 0) {
     static_metadata_.push_back(std::move(static_meta));
     id = static_metadata_.size() - 1;
@@ -661,10 +742,10 @@ status_t EmulatedCameraProviderHwlImpl::WaitForQemuSfFakeCameraPropertyAvailable
 }
 
 status_t EmulatedCameraProviderHwlImpl::Initialize() {
+  ATRACE_CALL();
   // GCH expects all physical ids to be bigger than the logical ones.
   // Resize 'static_metadata_' to fit all logical devices and insert them
   // accordingly, push any remaining physical cameras in the back.
-  std::string config;
   size_t logical_id = 0;
   std::vector<const char*> configurationFileLocation;
   char prop[PROPERTY_VALUE_MAX];
@@ -692,78 +773,134 @@ status_t EmulatedCameraProviderHwlImpl::Initialize() {
   }
   static_metadata_.resize(sizeof(configurationFileLocation));
 
+  // Parsing and validating a configuration file does not depend on any of
+  // the others, load all of them concurrently. The results are merged in file
+  // order below since the camera ids depend on it.
+  auto init_start = systemTime();
+  std::vector<std::future<ConfigurationLoadResult>> config_loads;
+  config_loads.reserve(configurationFileLocation.size());
   for (const auto& config_path : configurationFileLocation) {
-    if (!android::base::ReadFileToString(config_path, &config)) {
-      ALOGW("%s: Could not open configuration file: %s", __FUNCTION__,
-            config_path);
+    config_loads.push_back(std::async(std::launch::async, [this, config_path] {
+      return LoadConfiguration(config_path);
+    }));
+  }
+
+  std::vector<uint32_t> logical_devices;
+  for (size_t i = 0; i < config_loads.size(); i++) {
+    const char* config_path = configurationFileLocation[i];
+    auto load = config_loads[i].get();
+    if (load.status == NAME_NOT_FOUND) {
       continue;
+    } else if (load.status != OK) {
+      return load.status;
     }
 
-    Json::Reader config_reader;
-    Json::Value root;
-    if (!config_reader.parse(config, root)) {
-      ALOGE("Could not parse configuration file: %s",
-            config_reader.getFormattedErrorMessages().c_str());
+    auto& devices = load.devices;
+    if (devices.empty()) {
+      ALOGE("%s: No devices found in %s", __FUNCTION__, config_path);
       return BAD_VALUE;
     }
-
-    if (root.isArray()) {
-      auto device_iter = root.begin();
-      auto result_id = ParseCharacteristics(*device_iter, logical_id);
-      if (logical_id != result_id) {
-        return result_id;
-      }
-      device_iter++;
-
-      // The first device entry is always the logical camera followed by the
-      // physical devices. They must be at least 2.
-      camera_id_map_.emplace(logical_id, std::vector<std::pair<CameraDeviceStatus, uint32_t>>());
-      if (root.size() >= 3) {
-        camera_id_map_[logical_id].reserve(root.size() - 1);
-        size_t current_physical_device = 0;
-        while (device_iter != root.end()) {
-          auto physical_id = ParseCharacteristics(*device_iter, /*id*/ -1);
-          if (physical_id < 0) {
-            return physical_id;
-          }
-          // Only notify unavailable physical camera if there are more than 2
-          // physical cameras backing the logical camera
-          auto device_status = (current_physical_device < 2) ? CameraDeviceStatus::kPresent :
-              CameraDeviceStatus::kNotPresent;
-          camera_id_map_[logical_id].push_back(std::make_pair(device_status, physical_id));
-          device_iter++; current_physical_device++;
-        }
-
-        auto physical_devices = std::make_unique<PhysicalDeviceMap>();
-        for (const auto& physical_device : camera_id_map_[logical_id]) {
-          physical_devices->emplace(
-              physical_device.second, std::make_pair(physical_device.first,
-              HalCameraMetadata::Clone(
-                  static_metadata_[physical_device.second].get())));
-        }
-        auto updated_logical_chars =
-            EmulatedLogicalRequestState::AdaptLogicalCharacteristics(
-                HalCameraMetadata::Clone(static_metadata_[logical_id].get()),
-                std::move(physical_devices));
-        if (updated_logical_chars.get() != nullptr) {
-          static_metadata_[logical_id].swap(updated_logical_chars);
-        } else {
-          ALOGE("%s: Failed to updating logical camera characteristics!",
-                __FUNCTION__);
-          return BAD_VALUE;
+    ALOGI("%s: Camera %zu: %zu device(s) loaded from %s in %" PRId64 " us",
+          __FUNCTION__, logical_id, devices.size(), config_path,
+          ns2us(load.duration));
+
+    auto device_iter = devices.begin();
+    auto result_id = AddCharacteristics(std::move(*device_iter), logical_id);
+    if (logical_id != result_id) {
+      return result_id;
+    }
+    device_iter++;
+
+    // The first device entry is always the logical camera followed by the
+    // physical devices. They must be at least 2.
+    camera_id_map_.emplace(logical_id, std::vector<std::pair<CameraDeviceStatus, uint32_t>>());
+    if (devices.size() >= 3) {
+      camera_id_map_[logical_id].reserve(devices.size() - 1);
+      size_t current_physical_device = 0;
+      while (device_iter != devices.end()) {
+        auto physical_id =
+            AddCharacteristics(std::move(*device_iter), /*id*/ -1);
+        if (physical_id < 0) {
+          return physical_id;
         }
+        // Only notify unavailable physical camera if there are more than 2
+        // physical cameras backing the logical camera
+        auto device_status = (current_physical_device < 2) ? CameraDeviceStatus::kPresent :
+            CameraDeviceStatus::kNotPresent;
+        camera_id_map_[logical_id].push_back(std::make_pair(device_status, physical_id));
+        device_iter++; current_physical_device++;
       }
-    } else {
-      auto result_id = ParseCharacteristics(root, logical_id);
-      if (result_id != logical_id) {
-        return result_id;
-      }
-      camera_id_map_.emplace(logical_id, std::vector<std::pair<CameraDeviceStatus, uint32_t>>());
+      logical_devices.push_back(logical_id);
     }
 
     logical_id++;
   }
 
+  // Logical characteristics only depend on their own physical devices, adapt
+  // all logical cameras concurrently as well.
+  std::vector<std::future<std::unique_ptr<HalCameraMetadata>>> adaptations;
+  adaptations.reserve(logical_devices.size());
+  for (const auto& id : logical_devices) {
+    auto physical_devices = std::make_unique<PhysicalDeviceMap>();
+    for (const auto& physical_device : camera_id_map_[id]) {
+      physical_devices->emplace(
+          physical_device.second, std::make_pair(physical_device.first,
+          HalCameraMetadata::Clone(
+              static_metadata_[physical_device.second].get())));
+    }
+    auto logical_chars = HalCameraMetadata::Clone(static_metadata_[id].get());
+    adaptations.push_back(std::async(
+        std::launch::async,
+        [logical_chars = std::move(logical_chars),
+         physical_devices = std::move(physical_devices)]() mutable {
+          return EmulatedLogicalRequestState::AdaptLogicalCharacteristics(
+              std::move(logical_chars), std::move(physical_devices));
+        }));
+  }
+
+  for (size_t i = 0; i < adaptations.size(); i++) {
+    auto updated_logical_chars = adaptations[i].get();
+    if (updated_logical_chars.get() != nullptr) {
+      static_metadata_[logical_devices[i]] = std::move(updated_logical_chars);
+    } else {
+      ALOGE("%s: Failed to updating logical camera characteristics!",
+            __FUNCTION__);
+      return BAD_VALUE;
+    }
+  }
+
+  // The characteristics are final, snapshot the physical devices once so that
+  // opening a camera device does not need to clone any metadata.
+  for (const auto& device : camera_id_map_) {
+    auto physical_devices = std::make_shared<PhysicalDeviceSnapshotMap>();
+    for (const auto& physical_device : device.second) {
+      physical_devices->emplace(
+          physical_device.second,
+          std::make_pair(physical_device.first,
+                         static_metadata_[physical_device.second]));
+    }
+    physical_device_snapshots_.emplace(device.first,
+                                       std::move(physical_devices));
+
+    SensorCharacteristics sensor_chars;
+    auto ret = GetSensorCharacteristics(static_metadata_[device.first].get(),
+                                        &sensor_chars);
+    if (ret != OK) {
+      ALOGE("%s: Unable to extract sensor chars for camera id %u",
+            __FUNCTION__, device.first);
+      return ret;
+    }
+    stream_combination_indices_.emplace(
+        device.first, std::make_shared<StreamCombinationIndex>(
+                          *static_metadata_[device.first], sensor_chars));
+    if (SupportsMandatoryConcurrentStreams(device.first)) {
+      concurrent_camera_ids_.insert(device.first);
+    }
+  }
+
+  ALOGI("%s: %zu camera(s) initialized in %" PRId64 " us", __FUNCTION__,
+        camera_id_map_.size(), ns2us(systemTime() - init_start));
+
   return OK;
 }
 
@@ -851,8 +988,7 @@ status_t EmulatedCameraProviderHwlImpl::CreateCameraDeviceHwl(
     return BAD_VALUE;
   }
 
-  std::unique_ptr<HalCameraMetadata> meta =
-      HalCameraMetadata::Clone(static_metadata_[camera_id].get());
+  const auto& meta = static_metadata_[camera_id];
 
   std::shared_ptr<EmulatedTorchState> torch_state;
   camera_metadata_ro_entry entry;
@@ -868,14 +1004,9 @@ status_t EmulatedCameraProviderHwlImpl::CreateCameraDeviceHwl(
     torch_state = std::make_shared<EmulatedTorchState>(camera_id, torch_cb_);
   }
 
-  auto physical_devices = std::make_unique<PhysicalDeviceMap>();
-  for (const auto& physical_device : camera_id_map_[camera_id]) {
-      physical_devices->emplace(
-          physical_device.second, std::make_pair(physical_device.first,
-          HalCameraMetadata::Clone(static_metadata_[physical_device.second].get())));
-  }
   *camera_device_hwl = EmulatedCameraDeviceHwlImpl::Create(
-      camera_id, std::move(meta), std::move(physical_devices), torch_state);
+      camera_id, meta, physical_device_snapshots_[camera_id],
+      stream_combination_indices_[camera_id], torch_state);
   if (*camera_device_hwl == nullptr) {
     ALOGE("%s: Cannot create EmulatedCameraDeviceHWlImpl.", __FUNCTION__);
     return BAD_VALUE;
@@ -891,7 +1022,12 @@ status_t EmulatedCameraProviderHwlImpl::CreateBufferAllocatorHwl(
     return BAD_VALUE;
   }
 
-  // Currently not supported
-  return INVALID_OPERATION;
+  *camera_buffer_allocator_hwl = EmulatedBufferAllocatorHwl::Create();
+  if (*camera_buffer_allocator_hwl == nullptr) {
+    ALOGE("%s: Creating EmulatedBufferAllocatorHwl failed.", __FUNCTION__);
+    return NO_INIT;
+  }
+
+  return OK;
 }
 }  // namespace android
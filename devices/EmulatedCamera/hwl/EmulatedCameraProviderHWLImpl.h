@@ -17,18 +17,23 @@
 #ifndef EMULATOR_CAMERA_HAL_HWL_CAMERA_PROVIDER_HWL_H
 #define EMULATOR_CAMERA_HAL_HWL_CAMERA_PROVIDER_HWL_H
 
+#include <camera_metadata_cache.h>
 #include <camera_provider_hwl.h>
 #include <hal_types.h>
 #include <json/json.h>
 #include <json/reader.h>
 #include <future>
 
+#include "utils/HWLUtils.h"
+#include "utils/StreamCombinationIndex.h"
+
 namespace android {
 
 using google_camera_hal::CameraBufferAllocatorHwl;
 using google_camera_hal::CameraDeviceHwl;
 using google_camera_hal::CameraDeviceStatus;
 using google_camera_hal::CameraIdAndStreamConfiguration;
+using google_camera_hal::CameraMetadataCache;
 using google_camera_hal::CameraProviderHwl;
 using google_camera_hal::HalCameraMetadata;
 using google_camera_hal::HwlCameraProviderCallback;
@@ -75,17 +80,50 @@ class EmulatedCameraProviderHwlImpl : public CameraProviderHwl {
 
  private:
   status_t Initialize();
-  uint32_t ParseCharacteristics(const Json::Value& root, ssize_t id);
+  // Convert a single device entry of a json configuration to metadata.
+  std::unique_ptr<HalCameraMetadata> ParseCharacteristics(
+      const Json::Value& root);
+  // Load the characteristics of all devices in a configuration file, either
+  // from the binary cache or by parsing the json configuration.
+  status_t LoadCharacteristics(
+      const char* config_path,
+      std::vector<std::unique_ptr<HalCameraMetadata>>* devices /*out*/);
+
+  struct ConfigurationLoadResult {
+    status_t status = OK;
+    std::vector<std::unique_ptr<HalCameraMetadata>> devices;
+    nsecs_t duration = 0;
+  };
+  // Load and validate all devices of a configuration file. Independent of
+  // any provider state so that configuration files can load concurrently.
+  ConfigurationLoadResult LoadConfiguration(const char* config_path);
+  status_t ValidateCharacteristics(HalCameraMetadata* static_meta);
+  // Add validated device characteristics with the given id. Appends the
+  // device when id is negative. Returns the device id.
+  uint32_t AddCharacteristics(std::unique_ptr<HalCameraMetadata> static_meta,
+                              ssize_t id);
   status_t GetTagFromName(const char* name, uint32_t* tag);
   status_t WaitForQemuSfFakeCameraPropertyAvailable();
   bool SupportsMandatoryConcurrentStreams(uint32_t camera_id);
 
   static const char* kConfigurationFileLocation[];
+  static const char* kCharacteristicsCacheLocation;
+  // Bump when ParseCharacteristics() converts configurations differently.
+  static const uint32_t kCharacteristicsParserVersion = 1;
 
-  std::vector<std::unique_ptr<HalCameraMetadata>> static_metadata_;
+  // Immutable after Initialize(), shared with every device instance.
+  std::vector<std::shared_ptr<const HalCameraMetadata>> static_metadata_;
   // Logical to physical camera Id mapping. Empty value vector in case
   // of regular non-logical device.
   std::unordered_map<uint32_t, std::vector<std::pair<CameraDeviceStatus, uint32_t>>> camera_id_map_;
+  // Physical device snapshots of each camera in 'camera_id_map_'.
+  std::unordered_map<uint32_t, PhysicalDeviceSnapshotMapPtr>
+      physical_device_snapshots_;
+  // Supported stream combinations of each camera in 'camera_id_map_'.
+  std::unordered_map<uint32_t, std::shared_ptr<StreamCombinationIndex>>
+      stream_combination_indices_;
+  // Cameras that support the mandatory concurrent stream combinations.
+  std::unordered_set<uint32_t> concurrent_camera_ids_;
   HwlTorchModeStatusChangeFunc torch_cb_;
   HwlPhysicalCameraDeviceStatusChangeFunc physical_camera_status_cb_;
 
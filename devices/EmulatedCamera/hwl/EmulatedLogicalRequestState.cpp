@@ -20,6 +20,7 @@
 #include "EmulatedLogicalRequestState.h"
 
 #include <log/log.h>
+#include <utils/Trace.h>
 
 #include "vendor_tag_defs.h"
 
@@ -76,6 +77,10 @@ status_t EmulatedLogicalRequestState::Initialize(
         physical_request_states_.emplace(it.first,
                                          std::move(physical_request_state));
       }
+
+      // The logical request state is processed on the calling thread.
+      worker_pool_ =
+          std::make_unique<WorkerPool>(physical_request_states_.size());
     }
   }
 
@@ -91,30 +96,65 @@ status_t EmulatedLogicalRequestState::GetDefaultRequest(
 std::unique_ptr<HwlPipelineResult>
 EmulatedLogicalRequestState::InitializeLogicalResult(uint32_t pipeline_id,
                                                      uint32_t frame_number) {
-  auto ret = logical_request_state_->InitializeResult(pipeline_id, frame_number);
-  if (is_logical_device_) {
-    if ((physical_camera_output_ids_.get() != nullptr) &&
-        (!physical_camera_output_ids_->empty())) {
-      ret->physical_camera_results.reserve(physical_camera_output_ids_->size());
-      for (const auto& it : *physical_camera_output_ids_) {
-        ret->physical_camera_results[it] =
-            std::move(physical_request_states_[it]
-                          ->InitializeResult(pipeline_id, frame_number)
-                          ->result_metadata);
+  ATRACE_CALL();
+  if (!is_logical_device_) {
+    return logical_request_state_->InitializeResult(pipeline_id, frame_number);
+  }
+
+  // Physical results are independent of each other and of the logical
+  // result, build them in parallel and merge afterwards.
+  std::unique_ptr<HwlPipelineResult> ret;
+  std::vector<std::pair<uint32_t, std::unique_ptr<HwlPipelineResult>>>
+      physical_results;
+  std::vector<std::function<void()>> tasks;
+  if ((physical_camera_output_ids_.get() != nullptr) &&
+      (!physical_camera_output_ids_->empty())) {
+    physical_results.reserve(physical_camera_output_ids_->size());
+    tasks.reserve(physical_camera_output_ids_->size() + 1);
+    for (const auto& it : *physical_camera_output_ids_) {
+      auto physical_request_state = physical_request_states_.find(it);
+      if (physical_request_state == physical_request_states_.end()) {
+        ALOGE("%s: Unknown physical device id: %u", __FUNCTION__, it);
+        continue;
+      }
+      physical_results.emplace_back(it, nullptr);
+      auto* result = &physical_results.back().second;
+      EmulatedRequestState* state = physical_request_state->second.get();
+      tasks.push_back([state, result, pipeline_id, frame_number]() {
+        *result = state->InitializeResult(pipeline_id, frame_number);
+      });
+    }
+  }
+  tasks.push_back([this, &ret, pipeline_id, frame_number]() {
+    ret = logical_request_state_->InitializeResult(pipeline_id, frame_number);
+  });
+  worker_pool_->RunAndWait(std::move(tasks));
+
+  if (ret.get() == nullptr) {
+    return nullptr;
+  }
+
+  if (!physical_results.empty()) {
+    ret->physical_camera_results.reserve(physical_results.size());
+    for (auto& physical_result : physical_results) {
+      if (physical_result.second.get() != nullptr) {
+        ret->physical_camera_results[physical_result.first] =
+            std::move(physical_result.second->result_metadata);
       }
     }
-    auto physical_device_id =
-        std::to_string(physical_focal_length_map_[current_focal_length_]);
-    std::vector<uint8_t> result;
-    result.reserve(physical_device_id.size() + 1);
-    result.insert(result.end(), physical_device_id.begin(),
-                  physical_device_id.end());
-    result.push_back('\0');
-
-    ret->result_metadata->Set(ANDROID_LOGICAL_MULTI_CAMERA_ACTIVE_PHYSICAL_ID,
-                              result.data(), result.size());
   }
 
+  auto physical_device_id =
+      std::to_string(physical_focal_length_map_[current_focal_length_]);
+  std::vector<uint8_t> result;
+  result.reserve(physical_device_id.size() + 1);
+  result.insert(result.end(), physical_device_id.begin(),
+                physical_device_id.end());
+  result.push_back('\0');
+
+  ret->result_metadata->Set(ANDROID_LOGICAL_MULTI_CAMERA_ACTIVE_PHYSICAL_ID,
+                            result.data(), result.size());
+
   return ret;
 }
 
@@ -134,50 +174,78 @@ status_t EmulatedLogicalRequestState::InitializeLogicalSettings(
   // Track the maximum frame duration and override this value at the end for all
   // logical settings.
   nsecs_t max_frame_duration = 0;
-  if (is_logical_device_) {
-    std::swap(physical_camera_output_ids_, physical_camera_output_ids);
-
-    for (const auto& physical_request_state : physical_request_states_) {
-      // All physical devices will receive requests and will keep
-      // updating their respective request state.
-      // However only physical devices referenced by client need to propagate
-      // and apply their settings.
-      EmulatedSensor::SensorSettings physical_sensor_settings;
-      auto ret = physical_request_state.second->InitializeSensorSettings(
-          HalCameraMetadata::Clone(request_settings.get()),
-          &physical_sensor_settings);
-      if (ret != OK) {
-        ALOGE(
-            "%s: Initialization of physical sensor settings for device id: %u  "
-            "failed!",
-            __FUNCTION__, physical_request_state.first);
-        return ret;
-      }
+  if (!is_logical_device_) {
+    EmulatedSensor::SensorSettings sensor_settings;
+    auto ret = logical_request_state_->InitializeSensorSettings(
+        std::move(request_settings), &sensor_settings);
+    logical_settings->emplace(logical_camera_id_, sensor_settings);
+    return ret;
+  }
 
-      if (physical_camera_output_ids_->find(physical_request_state.first) !=
-          physical_camera_output_ids_->end()) {
-        logical_settings->emplace(physical_request_state.first,
-                                  physical_sensor_settings);
-        if (max_frame_duration < physical_sensor_settings.exposure_time) {
-          max_frame_duration = physical_sensor_settings.exposure_time;
-        }
-      }
+  ATRACE_CALL();
+  std::swap(physical_camera_output_ids_, physical_camera_output_ids);
+
+  // All physical devices will receive requests and will keep updating their
+  // respective request state. The request states are independent of each
+  // other so update them in parallel. The settings are cloned up front on
+  // this thread since the tasks must not share the request metadata. The
+  // logical request state is only updated once all physical ones succeeded.
+  struct PhysicalUpdate {
+    uint32_t camera_id;
+    EmulatedRequestState* request_state;
+    std::unique_ptr<HalCameraMetadata> request_settings;
+    EmulatedSensor::SensorSettings sensor_settings;
+    status_t ret = OK;
+  };
+  std::vector<PhysicalUpdate> physical_updates(physical_request_states_.size());
+  std::vector<std::function<void()>> tasks;
+  tasks.reserve(physical_request_states_.size());
+  size_t i = 0;
+  for (const auto& physical_request_state : physical_request_states_) {
+    auto& update = physical_updates[i++];
+    update.camera_id = physical_request_state.first;
+    update.request_state = physical_request_state.second.get();
+    update.request_settings = HalCameraMetadata::Clone(request_settings.get());
+    tasks.push_back([&update]() {
+      update.ret = update.request_state->InitializeSensorSettings(
+          std::move(update.request_settings), &update.sensor_settings);
+    });
+  }
+  worker_pool_->RunAndWait(std::move(tasks));
+
+  // Only physical devices referenced by client need to propagate and apply
+  // their settings.
+  for (const auto& update : physical_updates) {
+    if (update.ret != OK) {
+      ALOGE(
+          "%s: Initialization of physical sensor settings for device id: %u  "
+          "failed!",
+          __FUNCTION__, update.camera_id);
+      return update.ret;
     }
 
-    camera_metadata_ro_entry entry;
-    auto stat = request_settings->Get(ANDROID_LENS_FOCAL_LENGTH, &entry);
-    if ((stat == OK) && (entry.count == 1)) {
-      if (physical_focal_length_map_.find(entry.data.f[0]) !=
-          physical_focal_length_map_.end()) {
-        current_focal_length_ = entry.data.f[0];
-      } else {
-        ALOGE("%s: Unsupported focal length set: %5.2f, re-using older value!",
-              __FUNCTION__, entry.data.f[0]);
+    if (physical_camera_output_ids_->find(update.camera_id) !=
+        physical_camera_output_ids_->end()) {
+      logical_settings->emplace(update.camera_id, update.sensor_settings);
+      if (max_frame_duration < update.sensor_settings.exposure_time) {
+        max_frame_duration = update.sensor_settings.exposure_time;
       }
+    }
+  }
+
+  camera_metadata_ro_entry entry;
+  auto stat = request_settings->Get(ANDROID_LENS_FOCAL_LENGTH, &entry);
+  if ((stat == OK) && (entry.count == 1)) {
+    if (physical_focal_length_map_.find(entry.data.f[0]) !=
+        physical_focal_length_map_.end()) {
+      current_focal_length_ = entry.data.f[0];
     } else {
-      ALOGW("%s: Focal length absent from request, re-using older value!",
-            __FUNCTION__);
+      ALOGE("%s: Unsupported focal length set: %5.2f, re-using older value!",
+            __FUNCTION__, entry.data.f[0]);
     }
+  } else {
+    ALOGW("%s: Focal length absent from request, re-using older value!",
+          __FUNCTION__);
   }
 
   EmulatedSensor::SensorSettings sensor_settings;
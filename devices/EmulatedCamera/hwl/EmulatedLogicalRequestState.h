@@ -20,6 +20,7 @@
 #include "EmulatedRequestState.h"
 #include "hwl_types.h"
 #include "utils/HWLUtils.h"
+#include "utils/WorkerPool.h"
 
 namespace android {
 
@@ -61,6 +62,9 @@ class EmulatedLogicalRequestState {
   // Maps particular focal length to physical device id
   std::unordered_map<float, uint32_t> physical_focal_length_map_;
   float current_focal_length_ = 0.f;
+  // Runs the per-physical-camera request state updates in parallel. Only
+  // created for logical devices.
+  std::unique_ptr<WorkerPool> worker_pool_;
 
   EmulatedLogicalRequestState(const EmulatedLogicalRequestState&) = delete;
   EmulatedLogicalRequestState& operator=(const EmulatedLogicalRequestState&) =
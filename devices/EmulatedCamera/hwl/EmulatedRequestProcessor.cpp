@@ -21,6 +21,7 @@
 
 #include <HandleImporter.h>
 #include <hardware/gralloc.h>
+#include <inttypes.h>
 #include <log/log.h>
 #include <sync/sync.h>
 #include <utils/Timers.h>
@@ -40,14 +41,30 @@ EmulatedRequestProcessor::EmulatedRequestProcessor(uint32_t camera_id,
       sensor_(sensor),
       request_state_(std::make_unique<EmulatedLogicalRequestState>(camera_id)) {
   ATRACE_CALL();
+  acquisition_thread_ =
+      std::thread([this] { this->RequestAcquisitionLoop(); });
   request_thread_ = std::thread([this] { this->RequestProcessorLoop(); });
 }
 
 EmulatedRequestProcessor::~EmulatedRequestProcessor() {
   ATRACE_CALL();
-  processor_done_ = true;
+  {
+    std::lock_guard<std::mutex> lock(process_mutex_);
+    processor_done_ = true;
+  }
+  request_condition_.notify_all();
+  acquisition_thread_.join();
   request_thread_.join();
 
+  {
+    std::lock_guard<std::mutex> lock(process_mutex_);
+    ALOGI("%s: Request queue depth: %zu max queued: %zu blocked: %" PRIu64
+          " rejected: %" PRIu64 " dropped: %" PRIu64,
+          __FUNCTION__, pipeline_depth_, queue_stats_.max_queued_requests,
+          queue_stats_.blocked_submissions, queue_stats_.rejected_submissions,
+          queue_stats_.dropped_requests);
+  }
+
   auto ret = sensor_->ShutDown();
   if (ret != OK) {
     ALOGE("%s: Failed during sensor shutdown %s (%d)", __FUNCTION__,
@@ -68,8 +85,44 @@ status_t EmulatedRequestProcessor::ProcessPipelineRequests(
             request.pipeline_id);
       return BAD_VALUE;
     }
+  }
+
+  if ((backpressure_policy_ == BackpressurePolicy::kFailFast) &&
+      (GetQueuedRequestCountLocked() + requests.size() > pipeline_depth_ + 1)) {
+    // Fail the requests with ERROR_REQUEST instead of failing the submission,
+    // so the session stays usable and the client can submit again.
+    for (const auto& request : requests) {
+      auto output_buffers = CreateSensorBuffers(
+          frame_number, request.output_buffers,
+          pipelines[request.pipeline_id].streams, request.pipeline_id,
+          pipelines[request.pipeline_id].cb);
+      auto input_buffers = CreateSensorBuffers(
+          frame_number, request.input_buffers,
+          pipelines[request.pipeline_id].streams, request.pipeline_id,
+          pipelines[request.pipeline_id].cb);
+      if (input_buffers.get() != nullptr) {
+        for (auto& input_buffer : *input_buffers) {
+          input_buffer->is_failed_request = true;
+        }
+      }
+      NotifyFailedRequest(output_buffers.get());
+    }
+    queue_stats_.rejected_submissions++;
+    ATRACE_INT64("emulated_rejected_submissions",
+                 queue_stats_.rejected_submissions);
+    return OK;
+  }
 
-    while (pending_requests_.size() > EmulatedSensor::kPipelineDepth) {
+  for (const auto& request : requests) {
+    while (GetQueuedRequestCountLocked() > pipeline_depth_) {
+      if ((backpressure_policy_ == BackpressurePolicy::kDropOldest) &&
+          DropOldestPendingRequestLocked()) {
+        continue;
+      }
+
+      queue_stats_.blocked_submissions++;
+      ATRACE_INT64("emulated_blocked_submissions",
+                   queue_stats_.blocked_submissions);
       auto result = request_condition_.wait_for(
           lock, std::chrono::nanoseconds(
                     EmulatedSensor::kSupportedFrameDurationRange[1]));
@@ -92,11 +145,62 @@ status_t EmulatedRequestProcessor::ProcessPipelineRequests(
         {.settings = HalCameraMetadata::Clone(request.settings.get()),
          .input_buffers = std::move(input_buffers),
          .output_buffers = std::move(output_buffers)});
+
+    auto queued_requests = GetQueuedRequestCountLocked();
+    queue_stats_.max_queued_requests =
+        std::max(queue_stats_.max_queued_requests, queued_requests);
+    ATRACE_INT("emulated_queued_requests", queued_requests);
   }
+  request_condition_.notify_all();
 
   return OK;
 }
 
+bool EmulatedRequestProcessor::IsDroppableRequest(
+    const PendingRequest& request) {
+  if ((request.settings.get() != nullptr) ||
+      ((request.input_buffers.get() != nullptr) &&
+       !request.input_buffers->empty()) ||
+      (request.output_buffers.get() == nullptr) ||
+      request.output_buffers->empty()) {
+    return false;
+  }
+
+  for (const auto& output_buffer : *request.output_buffers) {
+    if ((output_buffer->format == HAL_PIXEL_FORMAT_BLOB) ||
+        (output_buffer->format == HAL_PIXEL_FORMAT_RAW16)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool EmulatedRequestProcessor::DropOldestPendingRequestLocked() {
+  if (pending_requests_.empty() ||
+      !IsDroppableRequest(pending_requests_.front())) {
+    return false;
+  }
+
+  NotifyFailedRequest(pending_requests_.front().output_buffers.get());
+  pending_requests_.pop();
+  queue_stats_.dropped_requests++;
+  ATRACE_INT64("emulated_dropped_requests", queue_stats_.dropped_requests);
+
+  return true;
+}
+
+void EmulatedRequestProcessor::SetBackpressurePolicy(
+    BackpressurePolicy policy) {
+  std::lock_guard<std::mutex> lock(process_mutex_);
+  backpressure_policy_ = policy;
+}
+
+size_t EmulatedRequestProcessor::GetQueuedRequestCountLocked() const {
+  return pending_requests_.size() + prepared_requests_.size() +
+         (acquiring_request_ ? 1 : 0);
+}
+
 std::unique_ptr<Buffers> EmulatedRequestProcessor::CreateSensorBuffers(
     uint32_t frame_number, const std::vector<StreamBuffer>& buffers,
     const std::unordered_map<uint32_t, EmulatedStream>& streams,
@@ -118,15 +222,19 @@ std::unique_ptr<Buffers> EmulatedRequestProcessor::CreateSensorBuffers(
   return sensor_buffers;
 }
 
-void EmulatedRequestProcessor::NotifyFailedRequest(const PendingRequest& request) {
-  if (request.output_buffers->at(0)->callback.notify != nullptr) {
+void EmulatedRequestProcessor::NotifyFailedRequest(Buffers* output_buffers) {
+  if ((output_buffers == nullptr) || output_buffers->empty()) {
+    return;
+  }
+
+  if (output_buffers->at(0)->callback.notify != nullptr) {
     // Mark all output buffers for this request in order not to send
     // ERROR_BUFFER for them.
-    for (auto& output_buffer : *(request.output_buffers)) {
+    for (auto& output_buffer : *output_buffers) {
       output_buffer->is_failed_request = true;
     }
 
-    auto output_buffer = std::move(request.output_buffers->at(0));
+    auto output_buffer = std::move(output_buffers->at(0));
     NotifyMessage msg = {
         .type = MessageType::kError,
         .message.error = {.frame_number = output_buffer->frame_number,
@@ -137,16 +245,28 @@ void EmulatedRequestProcessor::NotifyFailedRequest(const PendingRequest& request
 }
 
 status_t EmulatedRequestProcessor::Flush() {
-  std::lock_guard<std::mutex> lock(process_mutex_);
-  // First flush in-flight requests
+  std::unique_lock<std::mutex> lock(process_mutex_);
+  // Stop handing prepared requests to the sensor. Let a request that is
+  // already waiting on its fences complete, it is queued as prepared
+  // afterwards.
+  flushing_ = true;
+  request_condition_.wait(lock, [this] { return !acquiring_request_; });
+
+  // Flush in-flight requests, no new ones reach the sensor while flushing_ is
+  // set.
   auto ret = sensor_->Flush();
 
-  // Then the rest of the pending requests
+  // Then the rest of the prepared and pending requests, oldest first
+  while (!prepared_requests_.empty()) {
+    NotifyFailedRequest(prepared_requests_.front().output_buffers.get());
+    prepared_requests_.pop();
+  }
   while (!pending_requests_.empty()) {
-    const auto& request = pending_requests_.front();
-    NotifyFailedRequest(request);
+    NotifyFailedRequest(pending_requests_.front().output_buffers.get());
     pending_requests_.pop();
   }
+  flushing_ = false;
+  request_condition_.notify_all();
 
   return ret;
 }
@@ -345,6 +465,106 @@ std::unique_ptr<Buffers> EmulatedRequestProcessor::AcquireBuffers(
   return acquired_buffers;
 }
 
+std::unique_ptr<PreparedRequest> EmulatedRequestProcessor::PrepareRequest(
+    PendingRequest* request) {
+  ATRACE_CALL();
+  status_t ret;
+  auto frame_number = request->output_buffers->at(0)->frame_number;
+  auto notify_callback = request->output_buffers->at(0)->callback;
+  auto pipeline_id = request->output_buffers->at(0)->pipeline_id;
+
+  auto output_buffers = AcquireBuffers(request->output_buffers.get());
+  auto input_buffers = AcquireBuffers(request->input_buffers.get());
+  if (!output_buffers->empty()) {
+    std::unique_ptr<EmulatedSensor::LogicalCameraSettings> logical_settings =
+        std::make_unique<EmulatedSensor::LogicalCameraSettings>();
+
+    std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids =
+        std::make_unique<std::set<uint32_t>>();
+    for (const auto& it : *output_buffers) {
+      if (it->camera_id != camera_id_) {
+        physical_camera_output_ids->emplace(it->camera_id);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(request_state_mutex_);
+    // Repeating requests usually include valid settings only during the
+    // initial call. Afterwards an invalid settings pointer means that
+    // there are no changes in the parameters and Hal should re-use the
+    // last valid values.
+    // TODO: Add support for individual physical camera requests.
+    if (request->settings.get() != nullptr) {
+      ret = request_state_->InitializeLogicalSettings(
+          HalCameraMetadata::Clone(request->settings.get()),
+          std::move(physical_camera_output_ids), logical_settings.get());
+      last_settings_ = std::move(request->settings);
+    } else {
+      ret = request_state_->InitializeLogicalSettings(
+          HalCameraMetadata::Clone(last_settings_.get()),
+          std::move(physical_camera_output_ids), logical_settings.get());
+    }
+
+    if (ret == OK) {
+      auto prepared_request = std::make_unique<PreparedRequest>();
+      prepared_request->logical_settings = std::move(logical_settings);
+      prepared_request->result =
+          request_state_->InitializeLogicalResult(pipeline_id, frame_number);
+      prepared_request->input_buffers = std::move(input_buffers);
+      prepared_request->output_buffers = std::move(output_buffers);
+      return prepared_request;
+    }
+  }
+
+  // No further processing is needed, just fail the result which will
+  // complete this request.
+  NotifyMessage msg{.type = MessageType::kError,
+                    .message.error = {
+                        .frame_number = frame_number,
+                        .error_stream_id = -1,
+                        .error_code = ErrorCode::kErrorResult,
+                    }};
+
+  notify_callback.notify(pipeline_id, msg);
+
+  return nullptr;
+}
+
+void EmulatedRequestProcessor::RequestAcquisitionLoop() {
+  ATRACE_CALL();
+
+  while (true) {
+    PendingRequest request;
+    {
+      std::unique_lock<std::mutex> lock(process_mutex_);
+      request_condition_.wait(lock, [this] {
+        return processor_done_ ||
+               (!flushing_ && !pending_requests_.empty() &&
+                (prepared_requests_.size() < kMaxPreparedRequests));
+      });
+      if (processor_done_) {
+        break;
+      }
+
+      request = std::move(pending_requests_.front());
+      pending_requests_.pop();
+      acquiring_request_ = true;
+    }
+
+    // Fence waits can take up to a frame duration, keep them outside of
+    // process_mutex_ so that new requests and the sensor hand-off proceed.
+    auto prepared_request = PrepareRequest(&request);
+
+    {
+      std::lock_guard<std::mutex> lock(process_mutex_);
+      if (prepared_request.get() != nullptr) {
+        prepared_requests_.push(std::move(*prepared_request));
+      }
+      acquiring_request_ = false;
+    }
+    request_condition_.notify_all();
+  }
+}
+
 void EmulatedRequestProcessor::RequestProcessorLoop() {
   ATRACE_CALL();
 
@@ -352,74 +572,15 @@ void EmulatedRequestProcessor::RequestProcessorLoop() {
   while (!processor_done_ && vsync_status_) {
     {
       std::lock_guard<std::mutex> lock(process_mutex_);
-      if (!pending_requests_.empty()) {
-        status_t ret;
-        const auto& request = pending_requests_.front();
-        auto frame_number = request.output_buffers->at(0)->frame_number;
-        auto notify_callback = request.output_buffers->at(0)->callback;
-        auto pipeline_id = request.output_buffers->at(0)->pipeline_id;
-
-        auto output_buffers = AcquireBuffers(request.output_buffers.get());
-        auto input_buffers = AcquireBuffers(request.input_buffers.get());
-        if (!output_buffers->empty()) {
-          std::unique_ptr<EmulatedSensor::LogicalCameraSettings> logical_settings =
-              std::make_unique<EmulatedSensor::LogicalCameraSettings>();
-
-          std::unique_ptr<std::set<uint32_t>> physical_camera_output_ids =
-              std::make_unique<std::set<uint32_t>>();
-          for (const auto& it : *output_buffers) {
-            if (it->camera_id != camera_id_) {
-              physical_camera_output_ids->emplace(it->camera_id);
-            }
-          }
-
-          // Repeating requests usually include valid settings only during the
-          // initial call. Afterwards an invalid settings pointer means that
-          // there are no changes in the parameters and Hal should re-use the
-          // last valid values.
-          // TODO: Add support for individual physical camera requests.
-          if (request.settings.get() != nullptr) {
-            ret = request_state_->InitializeLogicalSettings(
-                HalCameraMetadata::Clone(request.settings.get()),
-                std::move(physical_camera_output_ids), logical_settings.get());
-            last_settings_ = HalCameraMetadata::Clone(request.settings.get());
-          } else {
-            ret = request_state_->InitializeLogicalSettings(
-                HalCameraMetadata::Clone(last_settings_.get()),
-                std::move(physical_camera_output_ids), logical_settings.get());
-          }
-
-          if (ret == OK) {
-            auto result = request_state_->InitializeLogicalResult(pipeline_id,
-                                                                  frame_number);
-            sensor_->SetCurrentRequest(
-                std::move(logical_settings), std::move(result),
-                std::move(input_buffers), std::move(output_buffers));
-          } else {
-            NotifyMessage msg{.type = MessageType::kError,
-                              .message.error = {
-                                  .frame_number = frame_number,
-                                  .error_stream_id = -1,
-                                  .error_code = ErrorCode::kErrorResult,
-                              }};
-
-            notify_callback.notify(pipeline_id, msg);
-          }
-        } else {
-          // No further processing is needed, just fail the result which will
-          // complete this request.
-          NotifyMessage msg{.type = MessageType::kError,
-                            .message.error = {
-                                .frame_number = frame_number,
-                                .error_stream_id = -1,
-                                .error_code = ErrorCode::kErrorResult,
-                            }};
-
-          notify_callback.notify(pipeline_id, msg);
-        }
-
-        pending_requests_.pop();
-        request_condition_.notify_one();
+      if (!flushing_ && !prepared_requests_.empty()) {
+        auto& request = prepared_requests_.front();
+        sensor_->SetCurrentRequest(std::move(request.logical_settings),
+                                   std::move(request.result),
+                                   std::move(request.input_buffers),
+                                   std::move(request.output_buffers));
+        prepared_requests_.pop();
+        ATRACE_INT("emulated_queued_requests", GetQueuedRequestCountLocked());
+        request_condition_.notify_all();
       }
     }
 
@@ -431,14 +592,28 @@ void EmulatedRequestProcessor::RequestProcessorLoop() {
 status_t EmulatedRequestProcessor::Initialize(
     std::unique_ptr<HalCameraMetadata> static_meta,
     PhysicalDeviceMapPtr physical_devices) {
-  std::lock_guard<std::mutex> lock(process_mutex_);
+  if (static_meta.get() == nullptr) {
+    return BAD_VALUE;
+  }
+
+  camera_metadata_ro_entry_t entry;
+  auto ret = static_meta->Get(ANDROID_REQUEST_PIPELINE_MAX_DEPTH, &entry);
+  if ((ret == OK) && (entry.count == 1)) {
+    // A deeper queue would only add latency and in-flight buffers, the
+    // sensor pipeline itself is kPipelineDepth deep.
+    std::lock_guard<std::mutex> lock(process_mutex_);
+    pipeline_depth_ =
+        std::min<size_t>(entry.data.u8[0], EmulatedSensor::kPipelineDepth);
+  }
+
+  std::lock_guard<std::mutex> lock(request_state_mutex_);
   return request_state_->Initialize(std::move(static_meta),
                                     std::move(physical_devices));
 }
 
 status_t EmulatedRequestProcessor::GetDefaultRequest(
     RequestTemplate type, std::unique_ptr<HalCameraMetadata>* default_settings) {
-  std::lock_guard<std::mutex> lock(process_mutex_);
+  std::lock_guard<std::mutex> lock(request_state_mutex_);
   return request_state_->GetDefaultRequest(type, default_settings);
 }
 
@@ -54,6 +54,40 @@ struct PendingRequest {
   std::unique_ptr<Buffers> output_buffers;
 };
 
+// A request with acquired buffers and sensor settings, ready to be handed to
+// the sensor on the next vsync.
+struct PreparedRequest {
+  std::unique_ptr<EmulatedSensor::LogicalCameraSettings> logical_settings;
+  std::unique_ptr<HwlPipelineResult> result;
+  std::unique_ptr<Buffers> input_buffers;
+  std::unique_ptr<Buffers> output_buffers;
+};
+
+// Defines how ProcessPipelineRequests reacts once the request queue holds
+// more requests than the pipeline depth.
+enum class BackpressurePolicy {
+  // Wait for a free slot, fail with TIMED_OUT after the max frame duration.
+  kBlock,
+  // Fail the requests with ERROR_REQUEST right away without queueing them.
+  // The submission itself succeeds.
+  kFailFast,
+  // Fail the oldest pending request if it is a repeating preview request.
+  // Falls back to kBlock otherwise.
+  kDropOldest,
+};
+
+// Request queue totals. Published as trace counters and logged when the
+// processor shuts down.
+struct RequestQueueStats {
+  size_t max_queued_requests = 0;
+  // Submissions that had to wait for a free slot
+  uint64_t blocked_submissions = 0;
+  // Submissions whose requests were failed right away
+  uint64_t rejected_submissions = 0;
+  // Pending requests that were dropped to make room for new ones
+  uint64_t dropped_requests = 0;
+};
+
 class EmulatedRequestProcessor {
  public:
   EmulatedRequestProcessor(uint32_t camera_id, sp<EmulatedSensor> sensor);
@@ -71,12 +105,28 @@ class EmulatedRequestProcessor {
 
   status_t Flush();
 
+  void SetBackpressurePolicy(BackpressurePolicy policy);
+
   status_t Initialize(std::unique_ptr<HalCameraMetadata> static_meta,
                       PhysicalDeviceMapPtr physical_devices);
 
  private:
+  // Requests pass through two stages. The acquisition stage waits on the
+  // acquire fences and prepares the sensor settings ahead of time, without
+  // holding process_mutex_. The processor stage only hands prepared requests
+  // to the sensor in sync with vsync.
+  void RequestAcquisitionLoop();
   void RequestProcessorLoop();
 
+  // Wait on the request acquire fences and prepare its sensor settings and
+  // result. Returns nullptr if the request failed and was already notified.
+  std::unique_ptr<PreparedRequest> PrepareRequest(PendingRequest* request);
+
+  // Maximum number of prepared requests waiting for the sensor. Settings are
+  // prepared one frame ahead of the sensor.
+  static const size_t kMaxPreparedRequests = 1;
+
+  std::thread acquisition_thread_;
   std::thread request_thread_;
   std::atomic_bool processor_done_ = false;
 
@@ -103,13 +153,43 @@ class EmulatedRequestProcessor {
                                                    HwlPipelineCallback callback,
                                                    StreamBuffer stream_buffer);
   std::unique_ptr<Buffers> AcquireBuffers(Buffers* buffers);
-  void NotifyFailedRequest(const PendingRequest& request);
+  void NotifyFailedRequest(Buffers* output_buffers);
+
+  // Number of requests queued in the processor. Must be called with
+  // process_mutex_ locked.
+  size_t GetQueuedRequestCountLocked() const;
+
+  // Whether the request can be dropped under kDropOldest. Only repeating
+  // requests that re-use the last settings and have no stalling or
+  // reprocess buffers qualify.
+  static bool IsDroppableRequest(const PendingRequest& request);
+
+  // Fail and remove the oldest pending request if it can be dropped. Must be
+  // called with process_mutex_ locked.
+  bool DropOldestPendingRequestLocked();
 
   std::mutex process_mutex_;
+  // Signaled whenever any of the request queues or stage flags change.
   std::condition_variable request_condition_;
-  std::queue<PendingRequest> pending_requests_;
+  std::queue<PendingRequest> pending_requests_;  // Protected by process_mutex_.
+  // Protected by process_mutex_.
+  std::queue<PreparedRequest> prepared_requests_;
+  // Whether the acquisition stage works on a request outside the queues.
+  bool acquiring_request_ = false;  // Protected by process_mutex_.
+  // Set while Flush() runs, no request is acquired or handed to the sensor.
+  bool flushing_ = false;  // Protected by process_mutex_.
+  // Maximum number of requests queued beyond the one in the sensor. Follows
+  // ANDROID_REQUEST_PIPELINE_MAX_DEPTH but never exceeds
+  // EmulatedSensor::kPipelineDepth. Protected by process_mutex_.
+  size_t pipeline_depth_ = EmulatedSensor::kPipelineDepth;
+  // Protected by process_mutex_.
+  BackpressurePolicy backpressure_policy_ = BackpressurePolicy::kBlock;
+  RequestQueueStats queue_stats_;  // Protected by process_mutex_.
   uint32_t camera_id_;
   sp<EmulatedSensor> sensor_;
+
+  // Protects request_state_ and last_settings_.
+  std::mutex request_state_mutex_;
   std::unique_ptr<EmulatedLogicalRequestState>
       request_state_;  // Stores and handles 3A and related camera states.
   std::unique_ptr<HalCameraMetadata> last_settings_;
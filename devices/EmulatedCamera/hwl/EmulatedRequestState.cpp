@@ -21,7 +21,11 @@
 
 #include <inttypes.h>
 #include <log/log.h>
+#include <string.h>
 #include <utils/HWLUtils.h>
+#include <utils/Trace.h>
+
+#include <iterator>
 
 #include "EmulatedRequestProcessor.h"
 
@@ -59,34 +63,190 @@ T GetClosestValue(T val, T min, T max) {
   }
 }
 
+// Copy the data of entry into control if the element count matches. Metering
+// regions may contain more than one region, in which case only the first one
+// is used.
+template <typename RequestControl>
+static void DecodeRequestControl(const camera_metadata_ro_entry_t& entry,
+                                 bool allow_extra_elements,
+                                 RequestControl* control /*out*/) {
+  size_t count = std::size(control->value);
+  if ((entry.count == count) ||
+      (allow_extra_elements && (entry.count > count))) {
+    memcpy(control->value, entry.data.u8, sizeof(control->value));
+    control->present = true;
+  }
+}
+
+void EmulatedRequestState::DecodeRequestControls(
+    const HalCameraMetadata& settings, RequestControls* controls /*out*/) {
+  ATRACE_CALL();
+  *controls = {};
+
+  const camera_metadata_t* metadata = settings.GetRawCameraMetadata();
+  if (metadata == nullptr) {
+    return;
+  }
+
+  size_t entry_count = get_camera_metadata_entry_count(metadata);
+  camera_metadata_ro_entry_t entry;
+  for (size_t i = 0; i < entry_count; i++) {
+    if (get_camera_metadata_ro_entry(metadata, i, &entry) != OK) {
+      continue;
+    }
+
+    switch (entry.tag) {
+      case ANDROID_CONTROL_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->control_mode);
+        break;
+      case ANDROID_CONTROL_SCENE_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->scene_mode);
+        break;
+      case ANDROID_CONTROL_EXTENDED_SCENE_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->extended_scene_mode);
+        break;
+      case ANDROID_CONTROL_ZOOM_RATIO:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->zoom_ratio);
+        break;
+      case ANDROID_CONTROL_VIDEO_STABILIZATION_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->vstab_mode);
+        break;
+      case ANDROID_CONTROL_CAPTURE_INTENT:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->capture_intent);
+        break;
+      case ANDROID_CONTROL_AE_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->ae_mode);
+        break;
+      case ANDROID_CONTROL_AE_LOCK:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->ae_lock);
+        break;
+      case ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->ae_exposure_compensation);
+        break;
+      case ANDROID_CONTROL_AE_TARGET_FPS_RANGE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->ae_target_fps_range);
+        break;
+      case ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->ae_precapture_trigger);
+        break;
+      case ANDROID_CONTROL_AE_REGIONS:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/true,
+                             &controls->ae_regions);
+        break;
+      case ANDROID_CONTROL_AWB_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->awb_mode);
+        break;
+      case ANDROID_CONTROL_AWB_LOCK:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->awb_lock);
+        break;
+      case ANDROID_CONTROL_AWB_REGIONS:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/true,
+                             &controls->awb_regions);
+        break;
+      case ANDROID_CONTROL_AF_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->af_mode);
+        break;
+      case ANDROID_CONTROL_AF_TRIGGER:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->af_trigger);
+        break;
+      case ANDROID_CONTROL_AF_REGIONS:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/true,
+                             &controls->af_regions);
+        break;
+      case ANDROID_EDGE_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->edge_mode);
+        break;
+      case ANDROID_FLASH_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->flash_mode);
+        break;
+      case ANDROID_LENS_FOCUS_DISTANCE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->focus_distance);
+        break;
+      case ANDROID_SCALER_CROP_REGION:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->crop_region);
+        break;
+      case ANDROID_SCALER_ROTATE_AND_CROP:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->rotate_and_crop);
+        break;
+      case ANDROID_SENSOR_EXPOSURE_TIME:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->exposure_time);
+        break;
+      case ANDROID_SENSOR_FRAME_DURATION:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->frame_duration);
+        break;
+      case ANDROID_SENSOR_SENSITIVITY:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->sensitivity);
+        break;
+      case ANDROID_STATISTICS_LENS_SHADING_MAP_MODE:
+        DecodeRequestControl(entry, /*allow_extra_elements=*/false,
+                             &controls->lens_shading_map_mode);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
 status_t EmulatedRequestState::Update3AMeteringRegion(
-    uint32_t tag, const HalCameraMetadata& settings, int32_t* region /*out*/) {
-  if ((region == nullptr) || ((tag != ANDROID_CONTROL_AE_REGIONS) &&
-                              (tag != ANDROID_CONTROL_AF_REGIONS) &&
-                              (tag != ANDROID_CONTROL_AWB_REGIONS))) {
+    uint32_t tag, const RequestControls& controls, int32_t* region /*out*/) {
+  if (region == nullptr) {
     return BAD_VALUE;
   }
 
-  camera_metadata_ro_entry_t entry;
-  auto ret = settings.Get(ANDROID_SCALER_CROP_REGION, &entry);
-  if ((ret == OK) && (entry.count > 0)) {
+  const RequestControl<int32_t, 5>* a_region_control;
+  switch (tag) {
+    case ANDROID_CONTROL_AE_REGIONS:
+      a_region_control = &controls.ae_regions;
+      break;
+    case ANDROID_CONTROL_AF_REGIONS:
+      a_region_control = &controls.af_regions;
+      break;
+    case ANDROID_CONTROL_AWB_REGIONS:
+      a_region_control = &controls.awb_regions;
+      break;
+    default:
+      return BAD_VALUE;
+  }
+
+  if (controls.crop_region.present && a_region_control->present) {
+    const int32_t* crop = controls.crop_region.value;
     int32_t crop_region[4];
-    crop_region[0] = entry.data.i32[0];
-    crop_region[1] = entry.data.i32[1];
-    crop_region[2] = entry.data.i32[2] + crop_region[0];
-    crop_region[3] = entry.data.i32[3] + crop_region[1];
-    ret = settings.Get(tag, &entry);
-    if ((ret == OK) && (entry.count > 0)) {
-      const int32_t* a_region = entry.data.i32;
-      // calculate the intersection of 3A and CROP regions
-      if (a_region[0] < crop_region[2] && crop_region[0] < a_region[2] &&
-          a_region[1] < crop_region[3] && crop_region[1] < a_region[3]) {
-        region[0] = std::max(a_region[0], crop_region[0]);
-        region[1] = std::max(a_region[1], crop_region[1]);
-        region[2] = std::min(a_region[2], crop_region[2]);
-        region[3] = std::min(a_region[3], crop_region[3]);
-        region[4] = entry.data.i32[4];
-      }
+    crop_region[0] = crop[0];
+    crop_region[1] = crop[1];
+    crop_region[2] = crop[2] + crop_region[0];
+    crop_region[3] = crop[3] + crop_region[1];
+    const int32_t* a_region = a_region_control->value;
+    // calculate the intersection of 3A and CROP regions
+    if (a_region[0] < crop_region[2] && crop_region[0] < a_region[2] &&
+        a_region[1] < crop_region[3] && crop_region[1] < a_region[3]) {
+      region[0] = std::max(a_region[0], crop_region[0]);
+      region[1] = std::max(a_region[1], crop_region[1]);
+      region[2] = std::min(a_region[2], crop_region[2]);
+      region[3] = std::min(a_region[3], crop_region[3]);
+      region[4] = a_region[4];
     }
   }
 
@@ -99,11 +259,9 @@ status_t EmulatedRequestState::CompensateAE() {
     return OK;
   }
 
-  camera_metadata_ro_entry_t entry;
-  auto ret =
-      request_settings_->Get(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    exposure_compensation_ = entry.data.i32[0];
+  if (request_controls_.ae_exposure_compensation.present) {
+    exposure_compensation_ =
+        request_controls_.ae_exposure_compensation.value[0];
   } else {
     ALOGW("%s: AE compensation absent from request,  re-using previous value!",
           __FUNCTION__);
@@ -122,10 +280,8 @@ status_t EmulatedRequestState::CompensateAE() {
 }
 
 status_t EmulatedRequestState::DoFakeAE() {
-  camera_metadata_ro_entry_t entry;
-  auto ret = request_settings_->Get(ANDROID_CONTROL_AE_LOCK, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    ae_lock_ = entry.data.u8[0];
+  if (request_controls_.ae_lock.present) {
+    ae_lock_ = request_controls_.ae_lock.value[0];
   } else {
     ae_lock_ = ANDROID_CONTROL_AE_LOCK_OFF;
   }
@@ -136,27 +292,25 @@ status_t EmulatedRequestState::DoFakeAE() {
   }
 
   FPSRange fps_range;
-  ret = request_settings_->Get(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &entry);
-  if ((ret == OK) && (entry.count == 2)) {
+  if (request_controls_.ae_target_fps_range.present) {
+    const int32_t* target_fps = request_controls_.ae_target_fps_range.value;
     for (const auto& it : available_fps_ranges_) {
-      if ((it.min_fps == entry.data.i32[0]) &&
-          (it.max_fps == entry.data.i32[1])) {
-        fps_range = {entry.data.i32[0], entry.data.i32[1]};
+      if ((it.min_fps == target_fps[0]) && (it.max_fps == target_fps[1])) {
+        fps_range = {target_fps[0], target_fps[1]};
         break;
       }
     }
     if (fps_range.max_fps == 0) {
       ALOGE("%s: Unsupported framerate range [%d, %d]", __FUNCTION__,
-            entry.data.i32[0], entry.data.i32[1]);
+            target_fps[0], target_fps[1]);
       return BAD_VALUE;
     }
   } else {
     fps_range = *available_fps_ranges_.begin();
   }
 
-  ret = request_settings_->Get(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    ae_trigger_ = entry.data.u8[0];
+  if (request_controls_.ae_precapture_trigger.present) {
+    ae_trigger_ = request_controls_.ae_precapture_trigger.value[0];
   } else {
     ae_trigger_ = ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER_IDLE;
   }
@@ -265,7 +419,7 @@ status_t EmulatedRequestState::DoFakeAE() {
 status_t EmulatedRequestState::ProcessAWB() {
   if (max_awb_regions_ > 0) {
     auto ret = Update3AMeteringRegion(ANDROID_CONTROL_AWB_REGIONS,
-                                      *request_settings_, awb_metering_region_);
+                                      request_controls_, awb_metering_region_);
     if (ret != OK) {
       return ret;
     }
@@ -275,10 +429,8 @@ status_t EmulatedRequestState::ProcessAWB() {
       supports_manual_post_processing_) {
     // TODO: Add actual manual support
   } else if (is_backward_compatible_) {
-    camera_metadata_ro_entry_t entry;
-    auto ret = request_settings_->Get(ANDROID_CONTROL_AWB_LOCK, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      awb_lock_ = entry.data.u8[0];
+    if (request_controls_.awb_lock.present) {
+      awb_lock_ = request_controls_.awb_lock.value[0];
     } else {
       awb_lock_ = ANDROID_CONTROL_AWB_LOCK_OFF;
     }
@@ -296,22 +448,19 @@ status_t EmulatedRequestState::ProcessAWB() {
 }
 
 status_t EmulatedRequestState::ProcessAF() {
-  camera_metadata_ro_entry entry;
-
   if (max_af_regions_ > 0) {
     auto ret = Update3AMeteringRegion(ANDROID_CONTROL_AF_REGIONS,
-                                      *request_settings_, af_metering_region_);
+                                      request_controls_, af_metering_region_);
     if (ret != OK) {
       return ret;
     }
   }
   if (af_mode_ == ANDROID_CONTROL_AF_MODE_OFF) {
-    camera_metadata_ro_entry_t entry;
-    auto ret = request_settings_->Get(ANDROID_LENS_FOCUS_DISTANCE, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if ((entry.data.f[0] >= 0.f) &&
-          (entry.data.f[0] <= minimum_focus_distance_)) {
-        focus_distance_ = entry.data.f[0];
+    if (request_controls_.focus_distance.present) {
+      float focus_distance = request_controls_.focus_distance.value[0];
+      if ((focus_distance >= 0.f) &&
+          (focus_distance <= minimum_focus_distance_)) {
+        focus_distance_ = focus_distance;
       } else {
         ALOGE(
             "%s: Unsupported focus distance, It should be within "
@@ -324,9 +473,8 @@ status_t EmulatedRequestState::ProcessAF() {
     return OK;
   }
 
-  auto ret = request_settings_->Get(ANDROID_CONTROL_AF_TRIGGER, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    af_trigger_ = entry.data.u8[0];
+  if (request_controls_.af_trigger.present) {
+    af_trigger_ = request_controls_.af_trigger.value[0];
   } else {
     af_trigger_ = ANDROID_CONTROL_AF_TRIGGER_IDLE;
   }
@@ -476,14 +624,13 @@ status_t EmulatedRequestState::ProcessAF() {
 status_t EmulatedRequestState::ProcessAE() {
   if (max_ae_regions_ > 0) {
     auto ret = Update3AMeteringRegion(ANDROID_CONTROL_AE_REGIONS,
-                                      *request_settings_, ae_metering_region_);
+                                      request_controls_, ae_metering_region_);
     if (ret != OK) {
       ALOGE("%s: Failed updating the 3A metering regions: %d, (%s)",
             __FUNCTION__, ret, strerror(-ret));
     }
   }
 
-  camera_metadata_ro_entry_t entry;
   bool auto_ae_mode = false;
   bool auto_ae_flash_mode = false;
   switch (ae_mode_) {
@@ -498,11 +645,11 @@ status_t EmulatedRequestState::ProcessAE() {
   if (((ae_mode_ == ANDROID_CONTROL_AE_MODE_OFF) ||
        (control_mode_ == ANDROID_CONTROL_MODE_OFF)) &&
       supports_manual_sensor_) {
-    auto ret = request_settings_->Get(ANDROID_SENSOR_EXPOSURE_TIME, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if ((entry.data.i64[0] >= sensor_exposure_time_range_.first) &&
-          (entry.data.i64[0] <= sensor_exposure_time_range_.second)) {
-        sensor_exposure_time_ = entry.data.i64[0];
+    if (request_controls_.exposure_time.present) {
+      nsecs_t exposure_time = request_controls_.exposure_time.value[0];
+      if ((exposure_time >= sensor_exposure_time_range_.first) &&
+          (exposure_time <= sensor_exposure_time_range_.second)) {
+        sensor_exposure_time_ = exposure_time;
       } else {
         ALOGE(
             "%s: Sensor exposure time"
@@ -513,12 +660,11 @@ status_t EmulatedRequestState::ProcessAE() {
       }
     }
 
-    ret = request_settings_->Get(ANDROID_SENSOR_FRAME_DURATION, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if ((entry.data.i64[0] >=
-           EmulatedSensor::kSupportedFrameDurationRange[0]) &&
-          (entry.data.i64[0] <= sensor_max_frame_duration_)) {
-        sensor_frame_duration_ = entry.data.i64[0];
+    if (request_controls_.frame_duration.present) {
+      nsecs_t frame_duration = request_controls_.frame_duration.value[0];
+      if ((frame_duration >= EmulatedSensor::kSupportedFrameDurationRange[0]) &&
+          (frame_duration <= sensor_max_frame_duration_)) {
+        sensor_frame_duration_ = frame_duration;
       } else {
         ALOGE(
             "%s: Sensor frame duration "
@@ -533,11 +679,11 @@ status_t EmulatedRequestState::ProcessAE() {
       sensor_frame_duration_ = sensor_exposure_time_;
     }
 
-    ret = request_settings_->Get(ANDROID_SENSOR_SENSITIVITY, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if ((entry.data.i32[0] >= sensor_sensitivity_range_.first) &&
-          (entry.data.i32[0] <= sensor_sensitivity_range_.second)) {
-        sensor_sensitivity_ = entry.data.i32[0];
+    if (request_controls_.sensitivity.present) {
+      int32_t sensitivity = request_controls_.sensitivity.value[0];
+      if ((sensitivity >= sensor_sensitivity_range_.first) &&
+          (sensitivity <= sensor_sensitivity_range_.second)) {
+        sensor_sensitivity_ = sensitivity;
       } else {
         ALOGE("%s: Sensor sensitivity not within supported range[%d, %d]",
               __FUNCTION__, sensor_sensitivity_range_.first,
@@ -570,10 +716,10 @@ status_t EmulatedRequestState::ProcessAE() {
     // and the appropriate AE mode is set or during still capture with auto
     // flash AE modes.
     bool manual_flash_mode = false;
-    auto ret = request_settings_->Get(ANDROID_FLASH_MODE, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if ((entry.data.u8[0] == ANDROID_FLASH_MODE_SINGLE) ||
-          (entry.data.u8[0] == ANDROID_FLASH_MODE_TORCH)) {
+    if (request_controls_.flash_mode.present) {
+      uint8_t flash_mode = request_controls_.flash_mode.value[0];
+      if ((flash_mode == ANDROID_FLASH_MODE_SINGLE) ||
+          (flash_mode == ANDROID_FLASH_MODE_TORCH)) {
         manual_flash_mode = true;
       }
     }
@@ -581,11 +727,10 @@ status_t EmulatedRequestState::ProcessAE() {
       flash_state_ = ANDROID_FLASH_STATE_FIRED;
     } else {
       bool is_still_capture = false;
-      ret = request_settings_->Get(ANDROID_CONTROL_CAPTURE_INTENT, &entry);
-      if ((ret == OK) && (entry.count == 1)) {
-        if (entry.data.u8[0] == ANDROID_CONTROL_CAPTURE_INTENT_STILL_CAPTURE) {
-          is_still_capture = true;
-        }
+      if (request_controls_.capture_intent.present &&
+          (request_controls_.capture_intent.value[0] ==
+           ANDROID_CONTROL_CAPTURE_INTENT_STILL_CAPTURE)) {
+        is_still_capture = true;
       }
       if (is_still_capture && auto_ae_flash_mode) {
         flash_state_ = ANDROID_FLASH_STATE_FIRED;
@@ -607,24 +752,24 @@ status_t EmulatedRequestState::InitializeSensorSettings(
 
   std::lock_guard<std::mutex> lock(request_state_mutex_);
   request_settings_ = std::move(request_settings);
-  camera_metadata_ro_entry_t entry;
-  auto ret = request_settings_->Get(ANDROID_CONTROL_MODE, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    if (available_control_modes_.find(entry.data.u8[0]) !=
+  DecodeRequestControls(*request_settings_, &request_controls_);
+  const RequestControls& controls = request_controls_;
+  if (controls.control_mode.present) {
+    if (available_control_modes_.find(controls.control_mode.value[0]) !=
         available_control_modes_.end()) {
-      control_mode_ = entry.data.u8[0];
+      control_mode_ = controls.control_mode.value[0];
     } else {
       ALOGE("%s: Unsupported control mode!", __FUNCTION__);
       return BAD_VALUE;
     }
   }
 
-  ret = request_settings_->Get(ANDROID_CONTROL_SCENE_MODE, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
+  if (controls.scene_mode.present) {
+    uint8_t scene_mode = controls.scene_mode.value[0];
     // Disabled scene is not expected to be among the available scene list
-    if ((entry.data.u8[0] == ANDROID_CONTROL_SCENE_MODE_DISABLED) ||
-        (available_scenes_.find(entry.data.u8[0]) != available_scenes_.end())) {
-      scene_mode_ = entry.data.u8[0];
+    if ((scene_mode == ANDROID_CONTROL_SCENE_MODE_DISABLED) ||
+        (available_scenes_.find(scene_mode) != available_scenes_.end())) {
+      scene_mode_ = scene_mode;
     } else {
       ALOGE("%s: Unsupported scene mode!", __FUNCTION__);
       return BAD_VALUE;
@@ -632,12 +777,12 @@ status_t EmulatedRequestState::InitializeSensorSettings(
   }
 
   float min_zoom = min_zoom_, max_zoom = max_zoom_;
-  ret = request_settings_->Get(ANDROID_CONTROL_EXTENDED_SCENE_MODE, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
+  if (controls.extended_scene_mode.present) {
+    uint8_t extended_scene_mode = controls.extended_scene_mode.value[0];
     bool extended_scene_mode_valid = false;
     for (const auto& cap : available_extended_scene_mode_caps_) {
-      if (cap.mode == entry.data.u8[0]) {
-        extended_scene_mode_ = entry.data.u8[0];
+      if (cap.mode == extended_scene_mode) {
+        extended_scene_mode_ = extended_scene_mode;
         min_zoom = cap.min_zoom;
         max_zoom = cap.max_zoom;
         extended_scene_mode_valid = true;
@@ -646,7 +791,7 @@ status_t EmulatedRequestState::InitializeSensorSettings(
     }
     if (!extended_scene_mode_valid) {
       ALOGE("%s: Unsupported extended scene mode %d!", __FUNCTION__,
-            entry.data.u8[0]);
+            extended_scene_mode);
       return BAD_VALUE;
     }
     if (extended_scene_mode_ != ANDROID_CONTROL_EXTENDED_SCENE_MODE_DISABLED) {
@@ -655,45 +800,45 @@ status_t EmulatedRequestState::InitializeSensorSettings(
   }
 
   // Check zoom ratio range and override to supported range
-  ret = request_settings_->Get(ANDROID_CONTROL_ZOOM_RATIO, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    zoom_ratio_ = std::min(std::max(entry.data.f[0], min_zoom), max_zoom);
+  if (controls.zoom_ratio.present) {
+    zoom_ratio_ =
+        std::min(std::max(controls.zoom_ratio.value[0], min_zoom), max_zoom);
   }
 
   // Check rotate_and_crop setting
-  ret = request_settings_->Get(ANDROID_SCALER_ROTATE_AND_CROP, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    if (available_rotate_crop_modes_.find(entry.data.u8[0]) !=
+  if (controls.rotate_and_crop.present) {
+    uint8_t rotate_and_crop = controls.rotate_and_crop.value[0];
+    if (available_rotate_crop_modes_.find(rotate_and_crop) !=
         available_rotate_crop_modes_.end()) {
-      rotate_and_crop_ = entry.data.u8[0];
+      rotate_and_crop_ = rotate_and_crop;
     } else {
-      ALOGE("%s: Unsupported rotate and crop mode: %u", __FUNCTION__, entry.data.u8[0]);
+      ALOGE("%s: Unsupported rotate and crop mode: %u", __FUNCTION__,
+            rotate_and_crop);
       return BAD_VALUE;
     }
   }
 
   // Check video stabilization parameter
   uint8_t vstab_mode = ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF;
-  ret = request_settings_->Get(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    if (available_vstab_modes_.find(entry.data.u8[0]) !=
-      available_vstab_modes_.end()) {
-      vstab_mode = entry.data.u8[0];
+  if (controls.vstab_mode.present) {
+    if (available_vstab_modes_.find(controls.vstab_mode.value[0]) !=
+        available_vstab_modes_.end()) {
+      vstab_mode = controls.vstab_mode.value[0];
     } else {
       ALOGE("%s: Unsupported video stabilization mode: %u! Video stabilization will be disabled!",
-            __FUNCTION__, entry.data.u8[0]);
+            __FUNCTION__, controls.vstab_mode.value[0]);
     }
   }
 
-  // Check video stabilization parameter
+  // Check edge mode parameter
   uint8_t edge_mode = ANDROID_EDGE_MODE_OFF;
-  ret = request_settings_->Get(ANDROID_EDGE_MODE, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    if (available_edge_modes_.find(entry.data.u8[0]) !=
-      available_edge_modes_.end()) {
-      edge_mode = entry.data.u8[0];
+  if (controls.edge_mode.present) {
+    if (available_edge_modes_.find(controls.edge_mode.value[0]) !=
+        available_edge_modes_.end()) {
+      edge_mode = controls.edge_mode.value[0];
     } else {
-      ALOGE("%s: Unsupported edge mode: %u", __FUNCTION__, entry.data.u8[0]);
+      ALOGE("%s: Unsupported edge mode: %u", __FUNCTION__,
+            controls.edge_mode.value[0]);
       return BAD_VALUE;
     }
   }
@@ -703,32 +848,29 @@ status_t EmulatedRequestState::InitializeSensorSettings(
   if ((scene_mode_ == ANDROID_CONTROL_SCENE_MODE_DISABLED) ||
       (scene_mode_ == ANDROID_CONTROL_SCENE_MODE_FACE_PRIORITY) ||
       (control_mode_ != ANDROID_CONTROL_MODE_USE_SCENE_MODE)) {
-    ret = request_settings_->Get(ANDROID_CONTROL_AE_MODE, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if (available_ae_modes_.find(entry.data.u8[0]) !=
+    if (controls.ae_mode.present) {
+      if (available_ae_modes_.find(controls.ae_mode.value[0]) !=
           available_ae_modes_.end()) {
-        ae_mode_ = entry.data.u8[0];
+        ae_mode_ = controls.ae_mode.value[0];
       } else {
         ALOGE("%s: Unsupported AE mode! Using last valid mode!", __FUNCTION__);
       }
     }
 
-    ret = request_settings_->Get(ANDROID_CONTROL_AWB_MODE, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if (available_awb_modes_.find(entry.data.u8[0]) !=
+    if (controls.awb_mode.present) {
+      if (available_awb_modes_.find(controls.awb_mode.value[0]) !=
           available_awb_modes_.end()) {
-        awb_mode_ = entry.data.u8[0];
+        awb_mode_ = controls.awb_mode.value[0];
       } else {
         ALOGE("%s: Unsupported AWB mode! Using last valid mode!", __FUNCTION__);
       }
     }
 
-    ret = request_settings_->Get(ANDROID_CONTROL_AF_MODE, &entry);
-    if ((ret == OK) && (entry.count == 1)) {
-      if (available_af_modes_.find(entry.data.u8[0]) !=
+    if (controls.af_mode.present) {
+      if (available_af_modes_.find(controls.af_mode.value[0]) !=
           available_af_modes_.end()) {
-        af_mode_changed_ = af_mode_ != entry.data.u8[0];
-        af_mode_ = entry.data.u8[0];
+        af_mode_changed_ = af_mode_ != controls.af_mode.value[0];
+        af_mode_ = controls.af_mode.value[0];
       } else {
         ALOGE("%s: Unsupported AF mode! Using last valid mode!", __FUNCTION__);
       }
@@ -738,7 +880,7 @@ status_t EmulatedRequestState::InitializeSensorSettings(
     if (it != scene_overrides_.end()) {
       ae_mode_ = it->second.ae_mode;
       awb_mode_ = it->second.awb_mode;
-      af_mode_changed_ = af_mode_ != entry.data.u8[0];
+      af_mode_changed_ = af_mode_ != it->second.af_mode;
       af_mode_ = it->second.af_mode;
     } else {
       ALOGW(
@@ -748,7 +890,7 @@ status_t EmulatedRequestState::InitializeSensorSettings(
     }
   }
 
-  ret = ProcessAE();
+  auto ret = ProcessAE();
   if (ret != OK) {
     return ret;
   }
@@ -763,11 +905,12 @@ status_t EmulatedRequestState::InitializeSensorSettings(
     return ret;
   }
 
-  ret = request_settings_->Get(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, &entry);
-  if ((ret == OK) && (entry.count == 1)) {
-    if (available_lens_shading_map_modes_.find(entry.data.u8[0]) !=
+  if (controls.lens_shading_map_mode.present) {
+    if (available_lens_shading_map_modes_.find(
+            controls.lens_shading_map_mode.value[0]) !=
         available_lens_shading_map_modes_.end()) {
-      sensor_settings->lens_shading_map_mode = entry.data.u8[0];
+      sensor_settings->lens_shading_map_mode =
+          controls.lens_shading_map_mode.value[0];
     } else {
       ALOGE("%s: Unsupported lens shading map mode!", __FUNCTION__);
     }
@@ -790,141 +933,246 @@ status_t EmulatedRequestState::InitializeSensorSettings(
   return OK;
 }
 
-std::unique_ptr<HwlPipelineResult> EmulatedRequestState::InitializeResult(
-    uint32_t pipeline_id, uint32_t frame_number) {
-  std::lock_guard<std::mutex> lock(request_state_mutex_);
-  auto result = std::make_unique<HwlPipelineResult>();
-  result->camera_id = camera_id_;
-  result->pipeline_id = pipeline_id;
-  result->frame_number = frame_number;
-  result->result_metadata = HalCameraMetadata::Clone(request_settings_.get());
-  result->partial_result = partial_result_count_;
+status_t EmulatedRequestState::InitializeResultTemplate() {
+  struct TemplateEntry {
+    uint32_t tag;
+    const void* data;
+    size_t data_count;
+    bool is_dynamic;
+  };
+  std::vector<TemplateEntry> entries;
+  // Dynamic entries point to members that are patched into every result.
+  auto add_dynamic = [&entries](uint32_t tag, const void* data, size_t count) {
+    entries.push_back({tag, data, count, /*is_dynamic=*/true});
+  };
+  // Static entries are copied into the template once.
+  auto add_static = [&entries](uint32_t tag, const void* data, size_t count) {
+    entries.push_back({tag, data, count, /*is_dynamic=*/false});
+  };
 
   // Results supported on all emulated devices
-  result->result_metadata->Set(ANDROID_REQUEST_PIPELINE_DEPTH,
-                               &max_pipeline_depth_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_MODE, &control_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AF_MODE, &af_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AF_STATE, &af_state_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AWB_MODE, &awb_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AWB_STATE, &awb_state_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AE_MODE, &ae_mode_, 1);
-  result->result_metadata->Set(ANDROID_CONTROL_AE_STATE, &ae_state_, 1);
-  int32_t fps_range[] = {ae_target_fps_.min_fps, ae_target_fps_.max_fps};
-  result->result_metadata->Set(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, fps_range,
-                               ARRAY_SIZE(fps_range));
-  result->result_metadata->Set(ANDROID_FLASH_STATE, &flash_state_, 1);
-  result->result_metadata->Set(ANDROID_LENS_STATE, &lens_state_, 1);
+  add_static(ANDROID_REQUEST_PIPELINE_DEPTH, &max_pipeline_depth_, 1);
+  add_dynamic(ANDROID_CONTROL_MODE, &control_mode_, 1);
+  add_dynamic(ANDROID_CONTROL_AF_MODE, &af_mode_, 1);
+  add_dynamic(ANDROID_CONTROL_AF_STATE, &af_state_, 1);
+  add_dynamic(ANDROID_CONTROL_AWB_MODE, &awb_mode_, 1);
+  add_dynamic(ANDROID_CONTROL_AWB_STATE, &awb_state_, 1);
+  add_dynamic(ANDROID_CONTROL_AE_MODE, &ae_mode_, 1);
+  add_dynamic(ANDROID_CONTROL_AE_STATE, &ae_state_, 1);
+  static_assert(sizeof(FPSRange) == 2 * sizeof(int32_t),
+                "FPSRange must be laid out as two int32_t");
+  add_dynamic(ANDROID_CONTROL_AE_TARGET_FPS_RANGE, &ae_target_fps_.min_fps, 2);
+  add_dynamic(ANDROID_FLASH_STATE, &flash_state_, 1);
+  add_dynamic(ANDROID_LENS_STATE, &lens_state_, 1);
 
   // Results depending on device capability and features
+  uint8_t vstab_mode = ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF;
   if (is_backward_compatible_) {
-    result->result_metadata->Set(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER,
-                                 &ae_trigger_, 1);
-    result->result_metadata->Set(ANDROID_CONTROL_AF_TRIGGER, &af_trigger_, 1);
-    uint8_t vstab_mode = ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF;
-    result->result_metadata->Set(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE,
-                                 &vstab_mode, 1);
+    add_dynamic(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER, &ae_trigger_, 1);
+    add_dynamic(ANDROID_CONTROL_AF_TRIGGER, &af_trigger_, 1);
+    add_static(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE, &vstab_mode, 1);
     if (exposure_compensation_supported_) {
-      result->result_metadata->Set(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
-                                   &exposure_compensation_, 1);
+      add_dynamic(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
+                  &exposure_compensation_, 1);
     }
   }
   if (ae_lock_available_ && report_ae_lock_) {
-    result->result_metadata->Set(ANDROID_CONTROL_AE_LOCK, &ae_lock_, 1);
+    add_dynamic(ANDROID_CONTROL_AE_LOCK, &ae_lock_, 1);
   }
   if (awb_lock_available_ && report_awb_lock_) {
-    result->result_metadata->Set(ANDROID_CONTROL_AWB_LOCK, &awb_lock_, 1);
+    add_dynamic(ANDROID_CONTROL_AWB_LOCK, &awb_lock_, 1);
   }
   if (scenes_supported_) {
-    result->result_metadata->Set(ANDROID_CONTROL_SCENE_MODE, &scene_mode_, 1);
+    add_dynamic(ANDROID_CONTROL_SCENE_MODE, &scene_mode_, 1);
   }
   if (max_ae_regions_ > 0) {
-    result->result_metadata->Set(ANDROID_CONTROL_AE_REGIONS, ae_metering_region_,
-                                 ARRAY_SIZE(ae_metering_region_));
+    add_dynamic(ANDROID_CONTROL_AE_REGIONS, ae_metering_region_,
+                ARRAY_SIZE(ae_metering_region_));
   }
   if (max_awb_regions_ > 0) {
-    result->result_metadata->Set(ANDROID_CONTROL_AWB_REGIONS,
-                                 awb_metering_region_,
-                                 ARRAY_SIZE(awb_metering_region_));
+    add_dynamic(ANDROID_CONTROL_AWB_REGIONS, awb_metering_region_,
+                ARRAY_SIZE(awb_metering_region_));
   }
   if (max_af_regions_ > 0) {
-    result->result_metadata->Set(ANDROID_CONTROL_AF_REGIONS, af_metering_region_,
-                                 ARRAY_SIZE(af_metering_region_));
+    add_dynamic(ANDROID_CONTROL_AF_REGIONS, af_metering_region_,
+                ARRAY_SIZE(af_metering_region_));
   }
   if (report_exposure_time_) {
-    result->result_metadata->Set(ANDROID_SENSOR_EXPOSURE_TIME,
-                                 &sensor_exposure_time_, 1);
+    add_dynamic(ANDROID_SENSOR_EXPOSURE_TIME, &sensor_exposure_time_, 1);
   }
   if (report_frame_duration_) {
-    result->result_metadata->Set(ANDROID_SENSOR_FRAME_DURATION,
-                                 &sensor_frame_duration_, 1);
+    add_dynamic(ANDROID_SENSOR_FRAME_DURATION, &sensor_frame_duration_, 1);
   }
   if (report_sensitivity_) {
-    result->result_metadata->Set(ANDROID_SENSOR_SENSITIVITY,
-                                 &sensor_sensitivity_, 1);
+    add_dynamic(ANDROID_SENSOR_SENSITIVITY, &sensor_sensitivity_, 1);
   }
   if (report_rolling_shutter_skew_) {
-    result->result_metadata->Set(
-        ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
-        &EmulatedSensor::kSupportedFrameDurationRange[0], 1);
+    add_static(ANDROID_SENSOR_ROLLING_SHUTTER_SKEW,
+               &EmulatedSensor::kSupportedFrameDurationRange[0], 1);
   }
   if (report_post_raw_boost_) {
-    result->result_metadata->Set(ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST,
-                                 &post_raw_boost_, 1);
+    add_static(ANDROID_CONTROL_POST_RAW_SENSITIVITY_BOOST, &post_raw_boost_,
+               1);
   }
   if (report_focus_distance_) {
-    result->result_metadata->Set(ANDROID_LENS_FOCUS_DISTANCE, &focus_distance_,
-                                 1);
+    add_dynamic(ANDROID_LENS_FOCUS_DISTANCE, &focus_distance_, 1);
   }
+  float focus_range[2] = {0.f};
   if (report_focus_range_) {
-    float focus_range[2] = {0.f};
     if (minimum_focus_distance_ > .0f) {
       focus_range[0] = 1 / minimum_focus_distance_;
     }
-    result->result_metadata->Set(ANDROID_LENS_FOCUS_RANGE, focus_range,
-                                 ARRAY_SIZE(focus_range));
+    add_static(ANDROID_LENS_FOCUS_RANGE, focus_range, ARRAY_SIZE(focus_range));
   }
   if (report_filter_density_) {
-    result->result_metadata->Set(ANDROID_LENS_FILTER_DENSITY, &filter_density_,
-                                 1);
+    add_static(ANDROID_LENS_FILTER_DENSITY, &filter_density_, 1);
   }
   if (report_ois_mode_) {
-    result->result_metadata->Set(ANDROID_LENS_OPTICAL_STABILIZATION_MODE,
-                                 &ois_mode_, 1);
+    add_static(ANDROID_LENS_OPTICAL_STABILIZATION_MODE, &ois_mode_, 1);
   }
   if (report_pose_rotation_) {
-    result->result_metadata->Set(ANDROID_LENS_POSE_ROTATION, pose_rotation_,
-                                 ARRAY_SIZE(pose_rotation_));
+    add_static(ANDROID_LENS_POSE_ROTATION, pose_rotation_,
+               ARRAY_SIZE(pose_rotation_));
   }
   if (report_pose_translation_) {
-    result->result_metadata->Set(ANDROID_LENS_POSE_TRANSLATION,
-                                 pose_translation_,
-                                 ARRAY_SIZE(pose_translation_));
+    add_static(ANDROID_LENS_POSE_TRANSLATION, pose_translation_,
+               ARRAY_SIZE(pose_translation_));
   }
   if (report_intrinsic_calibration_) {
-    result->result_metadata->Set(ANDROID_LENS_INTRINSIC_CALIBRATION,
-                                 intrinsic_calibration_,
-                                 ARRAY_SIZE(intrinsic_calibration_));
+    add_static(ANDROID_LENS_INTRINSIC_CALIBRATION, intrinsic_calibration_,
+               ARRAY_SIZE(intrinsic_calibration_));
   }
   if (report_distortion_) {
-    result->result_metadata->Set(ANDROID_LENS_DISTORTION, distortion_,
-                                 ARRAY_SIZE(distortion_));
+    add_static(ANDROID_LENS_DISTORTION, distortion_, ARRAY_SIZE(distortion_));
   }
   if (report_black_level_lock_) {
-    result->result_metadata->Set(ANDROID_BLACK_LEVEL_LOCK, &black_level_lock_,
-                                 1);
+    add_static(ANDROID_BLACK_LEVEL_LOCK, &black_level_lock_, 1);
   }
   if (report_scene_flicker_) {
-    result->result_metadata->Set(ANDROID_STATISTICS_SCENE_FLICKER,
-                                 &current_scene_flicker_, 1);
+    add_dynamic(ANDROID_STATISTICS_SCENE_FLICKER, &current_scene_flicker_, 1);
   }
   if (zoom_ratio_supported_) {
-    result->result_metadata->Set(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio_, 1);
+    add_dynamic(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio_, 1);
   }
   if (report_extended_scene_mode_) {
-    result->result_metadata->Set(ANDROID_CONTROL_EXTENDED_SCENE_MODE,
-                                 &extended_scene_mode_, 1);
+    add_dynamic(ANDROID_CONTROL_EXTENDED_SCENE_MODE, &extended_scene_mode_, 1);
+  }
+
+  size_t data_size = 0;
+  for (const auto& entry : entries) {
+    int type = get_camera_metadata_tag_type(entry.tag);
+    if (type < 0) {
+      ALOGE("%s: Invalid result tag 0x%x", __FUNCTION__, entry.tag);
+      return BAD_VALUE;
+    }
+    data_size +=
+        calculate_camera_metadata_entry_data_size(type, entry.data_count);
+  }
+
+  camera_metadata_t* result_template =
+      allocate_camera_metadata(entries.size(), data_size);
+  if (result_template == nullptr) {
+    ALOGE("%s: Failed to allocate the result template", __FUNCTION__);
+    return NO_MEMORY;
+  }
+
+  result_slots_.clear();
+  result_template_tags_.clear();
+  for (const auto& entry : entries) {
+    size_t entry_index = get_camera_metadata_entry_count(result_template);
+    auto ret = add_camera_metadata_entry(result_template, entry.tag, entry.data,
+                                         entry.data_count);
+    if (ret != OK) {
+      ALOGE("%s: Failed to add tag 0x%x to the result template", __FUNCTION__,
+            entry.tag);
+      free_camera_metadata(result_template);
+      return ret;
+    }
+
+    if (entry.is_dynamic) {
+      result_slots_.push_back({entry_index, entry.data, entry.data_count});
+    }
+    result_template_tags_.insert(entry.tag);
   }
+
+  result_template_ = HalCameraMetadata::Create(result_template);
+  return OK;
+}
+
+std::unique_ptr<HalCameraMetadata>
+EmulatedRequestState::CreateResultMetadataLocked() {
+  const camera_metadata_t* result_template =
+      result_template_->GetRawCameraMetadata();
+  const camera_metadata_t* settings =
+      (request_settings_.get() != nullptr)
+          ? request_settings_->GetRawCameraMetadata()
+          : nullptr;
+
+  // Size the result up front so that no entry below needs to grow it.
+  size_t entry_capacity = get_camera_metadata_entry_count(result_template);
+  size_t data_capacity = get_camera_metadata_data_count(result_template);
+  if (settings != nullptr) {
+    entry_capacity += get_camera_metadata_entry_count(settings);
+    data_capacity += get_camera_metadata_data_count(settings);
+  }
+
+  camera_metadata_t* result =
+      allocate_camera_metadata(entry_capacity, data_capacity);
+  if (result == nullptr) {
+    ALOGE("%s: Failed to allocate result metadata", __FUNCTION__);
+    return nullptr;
+  }
+
+  // The template is copied first, so the entry indices of the result slots
+  // are the same in the result.
+  auto ret = append_camera_metadata(result, result_template);
+  if (ret != OK) {
+    ALOGE("%s: Failed to copy the result template", __FUNCTION__);
+    free_camera_metadata(result);
+    return nullptr;
+  }
+
+  for (const auto& slot : result_slots_) {
+    ret = update_camera_metadata_entry(result, slot.entry_index, slot.data,
+                                       slot.data_count, nullptr);
+    if (ret != OK) {
+      ALOGE("%s: Failed to update result entry %zu", __FUNCTION__,
+            slot.entry_index);
+    }
+  }
+
+  // Request settings are reported back unless the result overrides them.
+  if (settings != nullptr) {
+    size_t entry_count = get_camera_metadata_entry_count(settings);
+    camera_metadata_ro_entry_t entry;
+    for (size_t i = 0; i < entry_count; i++) {
+      if ((get_camera_metadata_ro_entry(settings, i, &entry) != OK) ||
+          (result_template_tags_.find(entry.tag) !=
+           result_template_tags_.end())) {
+        continue;
+      }
+
+      ret = add_camera_metadata_entry(result, entry.tag, entry.data.u8,
+                                      entry.count);
+      if (ret != OK) {
+        ALOGE("%s: Failed to copy request tag 0x%x", __FUNCTION__, entry.tag);
+      }
+    }
+  }
+
+  return HalCameraMetadata::Create(result);
+}
+
+std::unique_ptr<HwlPipelineResult> EmulatedRequestState::InitializeResult(
+    uint32_t pipeline_id, uint32_t frame_number) {
+  std::lock_guard<std::mutex> lock(request_state_mutex_);
+  auto result = std::make_unique<HwlPipelineResult>();
+  result->camera_id = camera_id_;
+  result->pipeline_id = pipeline_id;
+  result->frame_number = frame_number;
+  result->result_metadata = CreateResultMetadataLocked();
+  result->partial_result = partial_result_count_;
+
   return result;
 }
 
@@ -2777,7 +3025,12 @@ status_t EmulatedRequestState::Initialize(
   std::lock_guard<std::mutex> lock(request_state_mutex_);
   static_metadata_ = std::move(staticMeta);
 
-  return InitializeRequestDefaults();
+  auto ret = InitializeRequestDefaults();
+  if (ret != OK) {
+    return ret;
+  }
+
+  return InitializeResultTemplate();
 }
 
 status_t EmulatedRequestState::GetDefaultRequest(
@@ -19,6 +19,7 @@
 
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "EmulatedSensor.h"
 #include "hwl_types.h"
@@ -55,6 +56,68 @@ class EmulatedRequestState {
       EmulatedSensor::SensorSettings* sensor_settings /*out*/);
 
  private:
+  // Decodes request settings outside of a capture session for benchmarks.
+  friend class EmulatedRequestStateHarness;
+
+  // A request control decoded from the request settings. "present" is set
+  // only when the settings contain the tag with the expected element count.
+  template <typename T, size_t N = 1>
+  struct RequestControl {
+    bool present = false;
+    T value[N] = {};
+  };
+
+  // Request controls used by the 3A state machines and the sensor settings.
+  // Filled by DecodeRequestControls() with a single pass over the request
+  // settings, so that per-frame processing doesn't search the settings for
+  // each tag.
+  struct RequestControls {
+    // android.control.*
+    RequestControl<uint8_t> control_mode;
+    RequestControl<uint8_t> scene_mode;
+    RequestControl<uint8_t> extended_scene_mode;
+    RequestControl<float> zoom_ratio;
+    RequestControl<uint8_t> vstab_mode;
+    RequestControl<uint8_t> capture_intent;
+    RequestControl<uint8_t> ae_mode;
+    RequestControl<uint8_t> ae_lock;
+    RequestControl<int32_t> ae_exposure_compensation;
+    RequestControl<int32_t, 2> ae_target_fps_range;
+    RequestControl<uint8_t> ae_precapture_trigger;
+    RequestControl<int32_t, 5> ae_regions;
+    RequestControl<uint8_t> awb_mode;
+    RequestControl<uint8_t> awb_lock;
+    RequestControl<int32_t, 5> awb_regions;
+    RequestControl<uint8_t> af_mode;
+    RequestControl<uint8_t> af_trigger;
+    RequestControl<int32_t, 5> af_regions;
+
+    // android.edge.*
+    RequestControl<uint8_t> edge_mode;
+
+    // android.flash.*
+    RequestControl<uint8_t> flash_mode;
+
+    // android.lens.*
+    RequestControl<float> focus_distance;
+
+    // android.scaler.*
+    RequestControl<int32_t, 4> crop_region;
+    RequestControl<uint8_t> rotate_and_crop;
+
+    // android.sensor.*
+    RequestControl<int64_t> exposure_time;
+    RequestControl<int64_t> frame_duration;
+    RequestControl<int32_t> sensitivity;
+
+    // android.statistics.*
+    RequestControl<uint8_t> lens_shading_map_mode;
+  };
+
+  // Decode all request controls from settings in one pass.
+  static void DecodeRequestControls(const HalCameraMetadata& settings,
+                                    RequestControls* controls /*out*/);
+
   bool SupportsCapability(uint8_t cap);
 
   status_t InitializeRequestDefaults();
@@ -81,17 +144,41 @@ class EmulatedRequestState {
   status_t InitializeInfoDefaults();
   status_t InitializeLensDefaults();
 
+  // Build result_template_ from the current device capabilities. Must be
+  // called after all defaults are initialized.
+  status_t InitializeResultTemplate();
+
+  // Create the result metadata of the current request from result_template_
+  // and request_settings_. Must be called with request_state_mutex_ locked.
+  std::unique_ptr<HalCameraMetadata> CreateResultMetadataLocked();
+
   status_t ProcessAE();
   status_t ProcessAF();
   status_t ProcessAWB();
   status_t DoFakeAE();
   status_t CompensateAE();
   status_t Update3AMeteringRegion(uint32_t tag,
-                                  const HalCameraMetadata& settings,
+                                  const RequestControls& controls,
                                   int32_t* region /*out*/);
 
   std::mutex request_state_mutex_;
   std::unique_ptr<HalCameraMetadata> request_settings_;
+  // Controls decoded from request_settings_.
+  RequestControls request_controls_;
+
+  // A result entry that is updated from a member variable for every result.
+  struct ResultSlot {
+    size_t entry_index;
+    const void* data;
+    size_t data_count;
+  };
+
+  // Result metadata with all tags reported by this device. Static values are
+  // filled when the template is built, and result_slots_ are updated in place
+  // for every result.
+  std::unique_ptr<HalCameraMetadata> result_template_;
+  std::vector<ResultSlot> result_slots_;
+  std::unordered_set<uint32_t> result_template_tags_;
 
   // Supported capabilities and features
   static const std::set<uint8_t> kSupportedCapabilites;
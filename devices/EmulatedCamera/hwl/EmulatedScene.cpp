@@ -378,9 +378,13 @@ void EmulatedScene::CalculateScene(nsecs_t time, int32_t handshake_divider) {
     handshake_y_ /= handshake_divider;
   }
 
-  if (sensor_event_queue_.get() != nullptr) {
+  const EmulatedScene* rotation_scene = screen_rotation_source_.get() != nullptr
+                                            ? screen_rotation_source_.get()
+                                            : this;
+  if (rotation_scene->sensor_event_queue_.get() != nullptr) {
     int32_t sensor_orientation = is_front_facing_ ? -sensor_orientation_ : sensor_orientation_;
-    int32_t scene_rotation = ((screen_rotation_ + 360) + sensor_orientation) % 360;
+    int32_t scene_rotation =
+        ((rotation_scene->screen_rotation_ + 360) + sensor_orientation) % 360;
     switch (scene_rotation) {
       case 90:
         current_scene_ = scene_rot90_;
@@ -435,6 +439,10 @@ void EmulatedScene::InitiliazeSceneRotation(bool clock_wise) {
   }
 }
 
+void EmulatedScene::SetScreenRotationSource(sp<EmulatedScene> scene) {
+  screen_rotation_source_ = scene;
+}
+
 void EmulatedScene::InitializeSensorQueue() {
   if (sensor_event_queue_.get() != nullptr) {
     return;
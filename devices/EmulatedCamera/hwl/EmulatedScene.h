@@ -47,6 +47,10 @@ class EmulatedScene : public RefBase {
 
   void InitializeSensorQueue();
 
+  // Follow the screen rotation reported to the sensor event queue of scene
+  // instead of creating a sensor event queue for this scene.
+  void SetScreenRotationSource(sp<EmulatedScene> scene);
+
   void Initialize(int sensor_width_px, int sensor_height_px,
                   float sensor_sensitivity);
 
@@ -111,6 +115,7 @@ class EmulatedScene : public RefBase {
   int32_t sensor_handle_;
   sp<IEventQueue> sensor_event_queue_;
   std::atomic_uint32_t screen_rotation_;
+  sp<EmulatedScene> screen_rotation_source_;
   uint8_t scene_rot0_[kSceneWidth*kSceneHeight];
   uint8_t scene_rot90_[kSceneWidth*kSceneHeight];
   uint8_t scene_rot180_[kSceneWidth*kSceneHeight];
@@ -134,6 +134,17 @@ float sqrtf_approx(float r) {
   return *(float*)(&r_i);
 }
 
+// Largest value returned by NoiseRand().
+static const unsigned int kNoiseRandMax = 0x7fffffff;
+
+// Linear congruential generator for the sensor noise. Unlike rand_r() the
+// sequence doesn't depend on the C library, so the rendered output of a seed
+// is the same on every platform.
+static inline unsigned int NoiseRand(unsigned int* seed) {
+  *seed = *seed * 1103515245u + 12345u;
+  return *seed & kNoiseRandMax;
+}
+
 EmulatedSensor::EmulatedSensor() : Thread(false), got_vsync_(false) {
   gamma_table_.resize(kSaturationPoint + 1);
   for (int32_t i = 0; i <= kSaturationPoint; i++) {
@@ -243,101 +254,10 @@ bool EmulatedSensor::AreCharacteristicsSupported(
   return true;
 }
 
-bool EmulatedSensor::IsStreamCombinationSupported(
-    const StreamConfiguration& config, StreamConfigurationMap& map,
-    const SensorCharacteristics& sensor_chars) {
-  uint32_t raw_stream_count = 0;
-  uint32_t input_stream_count = 0;
-  uint32_t processed_stream_count = 0;
-  uint32_t stalling_stream_count = 0;
-
-  for (const auto& stream : config.streams) {
-    if (stream.rotation != google_camera_hal::StreamRotation::kRotation0) {
-      ALOGE("%s: Stream rotation: 0x%x not supported!", __FUNCTION__,
-            stream.rotation);
-      return false;
-    }
-
-    if (stream.stream_type == google_camera_hal::StreamType::kInput) {
-      if (sensor_chars.max_input_streams == 0) {
-        ALOGE("%s: Input streams are not supported on this device!",
-              __FUNCTION__);
-        return false;
-      }
-
-      auto supported_outputs = map.GetValidOutputFormatsForInput(stream.format);
-      if (supported_outputs.empty()) {
-        ALOGE("%s: Input stream with format: 0x%x no supported on this device!",
-              __FUNCTION__, stream.format);
-        return false;
-      }
-
-      input_stream_count++;
-    } else {
-      switch (stream.format) {
-        case HAL_PIXEL_FORMAT_BLOB:
-          if ((stream.data_space != HAL_DATASPACE_V0_JFIF) &&
-              (stream.data_space != HAL_DATASPACE_UNKNOWN)) {
-            ALOGE("%s: Unsupported Blob dataspace 0x%x", __FUNCTION__,
-                  stream.data_space);
-            return false;
-          }
-          stalling_stream_count++;
-          break;
-        case HAL_PIXEL_FORMAT_RAW16:
-          raw_stream_count++;
-          break;
-        default:
-          processed_stream_count++;
-      }
-    }
-
-    auto output_sizes = map.GetOutputSizes(stream.format);
-    if (output_sizes.empty()) {
-      ALOGE("%s: Unsupported format: 0x%x", __FUNCTION__, stream.format);
-      return false;
-    }
-
-    auto stream_size = std::make_pair(stream.width, stream.height);
-    if (output_sizes.find(stream_size) == output_sizes.end()) {
-      ALOGE("%s: Stream with size %dx%d and format 0x%x is not supported!",
-            __FUNCTION__, stream.width, stream.height, stream.format);
-      return false;
-    }
-  }
-
-  if (raw_stream_count > sensor_chars.max_raw_streams) {
-    ALOGE("%s: RAW streams maximum %u exceeds supported maximum %u",
-          __FUNCTION__, raw_stream_count, sensor_chars.max_raw_streams);
-    return false;
-  }
-
-  if (processed_stream_count > sensor_chars.max_processed_streams) {
-    ALOGE("%s: Processed streams maximum %u exceeds supported maximum %u",
-          __FUNCTION__, processed_stream_count,
-          sensor_chars.max_processed_streams);
-    return false;
-  }
-
-  if (stalling_stream_count > sensor_chars.max_stalling_streams) {
-    ALOGE("%s: Stalling streams maximum %u exceeds supported maximum %u",
-          __FUNCTION__, stalling_stream_count,
-          sensor_chars.max_stalling_streams);
-    return false;
-  }
-
-  if (input_stream_count > sensor_chars.max_input_streams) {
-    ALOGE("%s: Input stream maximum %u exceeds supported maximum %u",
-          __FUNCTION__, input_stream_count, sensor_chars.max_input_streams);
-    return false;
-  }
-
-  return true;
-}
-
 status_t EmulatedSensor::StartUp(
     uint32_t logical_camera_id,
-    std::unique_ptr<LogicalCharacteristics> logical_chars) {
+    std::unique_ptr<LogicalCharacteristics> logical_chars,
+    bool per_camera_threads) {
   if (isRunning()) {
     return OK;
   }
@@ -364,11 +284,35 @@ status_t EmulatedSensor::StartUp(
   }
 
   logical_camera_id_ = logical_camera_id;
-  scene_ = new EmulatedScene(
-      device_chars->second.width, device_chars->second.height,
-      kElectronsPerLuxSecond, device_chars->second.orientation,
-      device_chars->second.is_front_facing);
-  scene_->InitializeSensorQueue();
+  render_contexts_.clear();
+  for (const auto& it : *chars_) {
+    RenderContext context;
+    context.scene = new EmulatedScene(it.second.width, it.second.height,
+                                      kElectronsPerLuxSecond,
+                                      it.second.orientation,
+                                      it.second.is_front_facing);
+    render_contexts_.emplace(it.first, std::move(context));
+  }
+  // Only the logical scene listens to the sensor service, the physical scenes
+  // follow its screen rotation.
+  auto logical_scene = render_contexts_.at(logical_camera_id).scene;
+  logical_scene->InitializeSensorQueue();
+  for (auto& it : render_contexts_) {
+    if (it.first != logical_camera_id) {
+      it.second.scene->SetScreenRotationSource(logical_scene);
+    }
+  }
+  if (per_camera_threads) {
+    vsync_generator_ = std::make_shared<VSyncGenerator>(kDefaultFrameDuration);
+    for (const auto& it : *chars_) {
+      physical_sensor_threads_.emplace(
+          it.first,
+          std::make_unique<PhysicalSensorThread>(it.first, vsync_generator_));
+    }
+  } else {
+    // The sensor thread renders one of the cameras itself.
+    render_pool_ = std::make_unique<WorkerPool>(render_contexts_.size() - 1);
+  }
   jpeg_compressor_ = std::make_unique<JpegCompressor>();
 
   auto res = run(LOG_TAG, ANDROID_PRIORITY_URGENT_DISPLAY);
@@ -385,6 +329,12 @@ status_t EmulatedSensor::ShutDown() {
   if (res != OK) {
     ALOGE("Unable to shut down sensor capture thread: %d", res);
   }
+
+  if (vsync_generator_.get() != nullptr) {
+    vsync_generator_->Stop();
+  }
+  physical_sensor_threads_.clear();
+
   return res;
 }
 
@@ -494,6 +444,10 @@ bool EmulatedSensor::threadLoop() {
     frame_duration = settings->begin()->second.frame_duration;
   }
 
+  if (vsync_generator_.get() != nullptr) {
+    vsync_generator_->SetPeriod(frame_duration);
+  }
+
   nsecs_t start_real_time = systemTime();
   // Stagefright cares about system time for timestamps, so base simulated
   // time on that.
@@ -527,16 +481,13 @@ bool EmulatedSensor::threadLoop() {
     }
   }
 
+  bool frame_queued = false;
   if ((next_buffers != nullptr) && (settings != nullptr)) {
     callback = next_buffers->at(0)->callback;
-    if (callback.notify != nullptr) {
-      NotifyMessage msg{
-          .type = MessageType::kShutter,
-          .message.shutter = {
-              .frame_number = next_buffers->at(0)->frame_number,
-              .timestamp_ns = static_cast<uint64_t>(next_capture_time_)}};
-      callback.notify(next_result->pipeline_id, msg);
-    }
+    // Buffers without settings or characteristics are dropped below.
+    uint32_t frame_number = next_buffers->at(0)->frame_number;
+    std::unordered_map<uint32_t, std::vector<std::unique_ptr<SensorBuffer>*>>
+        render_buffers;
     auto b = next_buffers->begin();
     while (b != next_buffers->end()) {
       auto device_settings = settings->find((*b)->camera_id);
@@ -555,177 +506,89 @@ bool EmulatedSensor::threadLoop() {
         continue;
       }
 
-      ALOGVV("Starting next capture: Exposure: %" PRIu64 " ms, gain: %d",
-             ns2ms(device_settings->second.exposure_time),
-             device_settings->second.gain);
-
-      scene_->Initialize(device_chars->second.width,
-                         device_chars->second.height, kElectronsPerLuxSecond);
-      scene_->SetExposureDuration((float)device_settings->second.exposure_time /
-                                  1e9);
-      scene_->SetColorFilterXYZ(device_chars->second.color_filter.rX,
-                                device_chars->second.color_filter.rY,
-                                device_chars->second.color_filter.rZ,
-                                device_chars->second.color_filter.grX,
-                                device_chars->second.color_filter.grY,
-                                device_chars->second.color_filter.grZ,
-                                device_chars->second.color_filter.gbX,
-                                device_chars->second.color_filter.gbY,
-                                device_chars->second.color_filter.gbZ,
-                                device_chars->second.color_filter.bX,
-                                device_chars->second.color_filter.bY,
-                                device_chars->second.color_filter.bZ);
-      uint32_t handshake_divider =
-        (device_settings->second.video_stab == ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_ON) ?
-        kReducedSceneHandshake : kRegularSceneHandshake;
-      scene_->CalculateScene(next_capture_time_, handshake_divider);
-
-      (*b)->stream_buffer.status = BufferStatus::kOk;
-      switch ((*b)->format) {
-        case HAL_PIXEL_FORMAT_RAW16:
-          if (!reprocess_request) {
-            CaptureRaw((*b)->plane.img.img, device_settings->second.gain,
-                       (*b)->width, device_chars->second);
-          } else {
-            ALOGE("%s: Reprocess requests with output format %x no supported!",
-                  __FUNCTION__, (*b)->format);
-            (*b)->stream_buffer.status = BufferStatus::kError;
-          }
-          break;
-        case HAL_PIXEL_FORMAT_RGB_888:
-          if (!reprocess_request) {
-            CaptureRGB((*b)->plane.img.img, (*b)->width, (*b)->height,
-                       (*b)->plane.img.stride, RGBLayout::RGB,
-                       device_settings->second.gain, device_chars->second);
-          } else {
-            ALOGE("%s: Reprocess requests with output format %x no supported!",
-                  __FUNCTION__, (*b)->format);
-            (*b)->stream_buffer.status = BufferStatus::kError;
-          }
-          break;
-        case HAL_PIXEL_FORMAT_RGBA_8888:
-          if (!reprocess_request) {
-            CaptureRGB((*b)->plane.img.img, (*b)->width, (*b)->height,
-                       (*b)->plane.img.stride, RGBLayout::RGBA,
-                       device_settings->second.gain, device_chars->second);
-          } else {
-            ALOGE("%s: Reprocess requests with output format %x no supported!",
-                  __FUNCTION__, (*b)->format);
-            (*b)->stream_buffer.status = BufferStatus::kError;
-          }
-          break;
-        case HAL_PIXEL_FORMAT_BLOB:
-          if ((*b)->dataSpace == HAL_DATASPACE_V0_JFIF) {
-            YUV420Frame yuv_input{
-                .width =
-                    reprocess_request ? (*next_input_buffer->begin())->width : 0,
-                .height = reprocess_request
-                              ? (*next_input_buffer->begin())->height
-                              : 0,
-                .planes = reprocess_request
-                              ? (*next_input_buffer->begin())->plane.img_y_crcb
-                              : YCbCrPlanes{}};
-            auto jpeg_input = std::make_unique<JpegYUV420Input>();
-            jpeg_input->width = (*b)->width;
-            jpeg_input->height = (*b)->height;
-            auto img =
-                new uint8_t[(jpeg_input->width * jpeg_input->height * 3) / 2];
-            jpeg_input->yuv_planes = {
-                .img_y = img,
-                .img_cb = img + jpeg_input->width * jpeg_input->height,
-                .img_cr = img + (jpeg_input->width * jpeg_input->height * 5) / 4,
-                .y_stride = jpeg_input->width,
-                .cbcr_stride = jpeg_input->width / 2,
-                .cbcr_step = 1};
-            jpeg_input->buffer_owner = true;
-            YUV420Frame yuv_output{.width = jpeg_input->width,
-                                   .height = jpeg_input->height,
-                                   .planes = jpeg_input->yuv_planes};
-
-            bool rotate =
-                device_settings->second.rotate_and_crop == ANDROID_SCALER_ROTATE_AND_CROP_90;
-            ProcessType process_type = reprocess_request ? REPROCESS :
-              (device_settings->second.edge_mode == ANDROID_EDGE_MODE_HIGH_QUALITY) ?
-              HIGH_QUALITY : REGULAR;
-            auto ret = ProcessYUV420(
-                yuv_input, yuv_output, device_settings->second.gain,
-                process_type, device_settings->second.zoom_ratio,
-                rotate, device_chars->second);
-            if (ret != 0) {
-              (*b)->stream_buffer.status = BufferStatus::kError;
-              break;
-            }
-
-            auto jpeg_job = std::make_unique<JpegYUV420Job>();
-            jpeg_job->exif_utils = std::unique_ptr<ExifUtils>(
-                ExifUtils::Create(device_chars->second));
-            jpeg_job->input = std::move(jpeg_input);
-            // If jpeg compression is successful, then the jpeg compressor
-            // must set the corresponding status.
-            (*b)->stream_buffer.status = BufferStatus::kError;
-            std::swap(jpeg_job->output, *b);
-            jpeg_job->result_metadata =
-                HalCameraMetadata::Clone(next_result->result_metadata.get());
-
-            Mutex::Autolock lock(control_mutex_);
-            jpeg_compressor_->QueueYUV420(std::move(jpeg_job));
-          } else {
-            ALOGE("%s: Format %x with dataspace %x is TODO", __FUNCTION__,
-                  (*b)->format, (*b)->dataSpace);
-            (*b)->stream_buffer.status = BufferStatus::kError;
-          }
-          break;
-        case HAL_PIXEL_FORMAT_YCrCb_420_SP:
-        case HAL_PIXEL_FORMAT_YCbCr_420_888: {
-          YUV420Frame yuv_input{
-              .width =
-                  reprocess_request ? (*next_input_buffer->begin())->width : 0,
-              .height =
-                  reprocess_request ? (*next_input_buffer->begin())->height : 0,
-              .planes = reprocess_request
-                            ? (*next_input_buffer->begin())->plane.img_y_crcb
-                            : YCbCrPlanes{}};
-          YUV420Frame yuv_output{.width = (*b)->width,
-                                 .height = (*b)->height,
-                                 .planes = (*b)->plane.img_y_crcb};
-          bool rotate =
-              device_settings->second.rotate_and_crop == ANDROID_SCALER_ROTATE_AND_CROP_90;
-          ProcessType process_type = reprocess_request ? REPROCESS :
-            (device_settings->second.edge_mode == ANDROID_EDGE_MODE_HIGH_QUALITY) ?
-            HIGH_QUALITY : REGULAR;
-          auto ret = ProcessYUV420(
-              yuv_input, yuv_output, device_settings->second.gain,
-              process_type, device_settings->second.zoom_ratio,
-              rotate, device_chars->second);
-          if (ret != 0) {
-            (*b)->stream_buffer.status = BufferStatus::kError;
-          }
-        } break;
-        case HAL_PIXEL_FORMAT_Y16:
-          if (!reprocess_request) {
-            if ((*b)->dataSpace == HAL_DATASPACE_DEPTH) {
-              CaptureDepth((*b)->plane.img.img, device_settings->second.gain,
-                           (*b)->width, (*b)->height, (*b)->plane.img.stride,
-                           device_chars->second);
-            } else {
-              ALOGE("%s: Format %x with dataspace %x is TODO", __FUNCTION__,
-                    (*b)->format, (*b)->dataSpace);
-              (*b)->stream_buffer.status = BufferStatus::kError;
-            }
-          } else {
-            ALOGE("%s: Reprocess requests with output format %x no supported!",
-                  __FUNCTION__, (*b)->format);
-            (*b)->stream_buffer.status = BufferStatus::kError;
-          }
-          break;
-        default:
-          ALOGE("%s: Unknown format %x, no output", __FUNCTION__, (*b)->format);
-          (*b)->stream_buffer.status = BufferStatus::kError;
-          break;
+      render_buffers[(*b)->camera_id].push_back(&(*b));
+      b++;
+    }
+
+    // Physical cameras are independent of each other and can be rendered in
+    // parallel. Buffers of the same camera share a scene and are rendered in
+    // order.
+    auto render_camera = [this, &settings, reprocess_request,
+                          &next_input_buffer, &next_result](
+                             uint32_t camera_id,
+                             const std::vector<std::unique_ptr<SensorBuffer>*>&
+                                 buffers,
+                             nsecs_t capture_time) {
+      auto* context = &render_contexts_.at(camera_id);
+      const auto& device_settings = settings->at(camera_id);
+      const auto& device_chars = chars_->at(camera_id);
+      for (auto* buffer : buffers) {
+        RenderBuffer(context, buffer, device_settings, device_chars,
+                     capture_time, reprocess_request, next_input_buffer.get(),
+                     next_result.get());
+      }
+    };
+
+    if (vsync_generator_.get() != nullptr) {
+      // Every physical sensor starts the frame on the next vsync, which also
+      // provides the capture timestamp.
+      nsecs_t reprocess_capture_time = next_capture_time_;
+      std::unordered_map<uint32_t, VSyncWork> work;
+      for (auto& camera_buffers : render_buffers) {
+        uint32_t camera_id = camera_buffers.first;
+        auto* buffers = &camera_buffers.second;
+        work.emplace(camera_id, [&render_camera, camera_id, buffers,
+                                 reprocess_request, reprocess_capture_time](
+                                    const VSync& vsync) {
+          render_camera(
+              camera_id, *buffers,
+              reprocess_request ? reprocess_capture_time : vsync.timestamp);
+        });
+      }
+
+      VSync vsync;
+      auto ret = vsync_generator_->QueueFrame(std::move(work), &vsync);
+      if (ret != OK) {
+        ALOGE("%s: Failed to queue frame %u: %s (%d)", __FUNCTION__,
+              frame_number, strerror(-ret), ret);
+      } else {
+        frame_queued = true;
+        if (!reprocess_request) {
+          next_capture_time_ = vsync.timestamp;
+        }
       }
+    }
+
+    if (callback.notify != nullptr) {
+      NotifyMessage msg{
+          .type = MessageType::kShutter,
+          .message.shutter = {
+              .frame_number = frame_number,
+              .timestamp_ns = static_cast<uint64_t>(next_capture_time_)}};
+      callback.notify(next_result->pipeline_id, msg);
+    }
 
-      b = next_buffers->erase(b);
+    if (vsync_generator_.get() != nullptr) {
+      if (frame_queued) {
+        vsync_generator_->WaitForFrameDone();
+      }
+    } else {
+      nsecs_t capture_time = next_capture_time_;
+      std::vector<std::function<void()>> render_tasks;
+      render_tasks.reserve(render_buffers.size());
+      for (auto& camera_buffers : render_buffers) {
+        uint32_t camera_id = camera_buffers.first;
+        auto* buffers = &camera_buffers.second;
+        render_tasks.push_back(
+            [&render_camera, camera_id, buffers, capture_time]() {
+              render_camera(camera_id, *buffers, capture_time);
+            });
+      }
+      render_pool_->RunAndWait(std::move(render_tasks));
     }
+
+    // Returning buffers invokes client callbacks, keep them on this thread.
+    next_buffers->clear();
   }
 
   if (reprocess_request) {
@@ -736,6 +599,17 @@ bool EmulatedSensor::threadLoop() {
     next_input_buffer->clear();
   }
 
+  if (vsync_generator_.get() != nullptr) {
+    // The shared vsync paces the frames. A queued frame already started on
+    // its vsync, otherwise wait for the next one.
+    ReturnResults(callback, std::move(settings), std::move(next_result));
+    if (!frame_queued) {
+      VSync vsync;
+      vsync_generator_->WaitForNextVSync(&vsync);
+    }
+    return true;
+  }
+
   nsecs_t work_done_real_time = systemTime();
   // Returning the results at this point is not entirely correct from timing
   // perspective. Under ideal conditions where 'ReturnResults' completes
@@ -775,6 +649,176 @@ bool EmulatedSensor::threadLoop() {
   return true;
 };
 
+void EmulatedSensor::RenderBuffer(RenderContext* context,
+                                  std::unique_ptr<SensorBuffer>* b,
+                                  const SensorSettings& settings,
+                                  const SensorCharacteristics& chars,
+                                  nsecs_t capture_time,
+                                  bool reprocess_request,
+                                  const Buffers* next_input_buffer,
+                                  const HwlPipelineResult* next_result) {
+  ATRACE_CALL();
+  ALOGVV("Starting next capture: Exposure: %" PRIu64 " ms, gain: %d",
+         ns2ms(settings.exposure_time), settings.gain);
+
+  context->scene->Initialize(chars.width, chars.height, kElectronsPerLuxSecond);
+  context->scene->SetExposureDuration((float)settings.exposure_time / 1e9);
+  context->scene->SetColorFilterXYZ(
+      chars.color_filter.rX, chars.color_filter.rY, chars.color_filter.rZ,
+      chars.color_filter.grX, chars.color_filter.grY, chars.color_filter.grZ,
+      chars.color_filter.gbX, chars.color_filter.gbY, chars.color_filter.gbZ,
+      chars.color_filter.bX, chars.color_filter.bY, chars.color_filter.bZ);
+  uint32_t handshake_divider =
+      (settings.video_stab == ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_ON)
+          ? kReducedSceneHandshake
+          : kRegularSceneHandshake;
+  context->scene->CalculateScene(capture_time, handshake_divider);
+
+  (*b)->stream_buffer.status = BufferStatus::kOk;
+  switch ((*b)->format) {
+    case HAL_PIXEL_FORMAT_RAW16:
+      if (!reprocess_request) {
+        CaptureRaw(context, (*b)->plane.img.img, settings.gain, (*b)->width,
+                   chars);
+      } else {
+        ALOGE("%s: Reprocess requests with output format %x no supported!",
+              __FUNCTION__, (*b)->format);
+        (*b)->stream_buffer.status = BufferStatus::kError;
+      }
+      break;
+    case HAL_PIXEL_FORMAT_RGB_888:
+      if (!reprocess_request) {
+        CaptureRGB(context, (*b)->plane.img.img, (*b)->width, (*b)->height,
+                   (*b)->plane.img.stride, RGBLayout::RGB, settings.gain,
+                   chars);
+      } else {
+        ALOGE("%s: Reprocess requests with output format %x no supported!",
+              __FUNCTION__, (*b)->format);
+        (*b)->stream_buffer.status = BufferStatus::kError;
+      }
+      break;
+    case HAL_PIXEL_FORMAT_RGBA_8888:
+      if (!reprocess_request) {
+        CaptureRGB(context, (*b)->plane.img.img, (*b)->width, (*b)->height,
+                   (*b)->plane.img.stride, RGBLayout::RGBA, settings.gain,
+                   chars);
+      } else {
+        ALOGE("%s: Reprocess requests with output format %x no supported!",
+              __FUNCTION__, (*b)->format);
+        (*b)->stream_buffer.status = BufferStatus::kError;
+      }
+      break;
+    case HAL_PIXEL_FORMAT_BLOB:
+      if ((*b)->dataSpace == HAL_DATASPACE_V0_JFIF) {
+        YUV420Frame yuv_input{
+            .width =
+                reprocess_request ? (*next_input_buffer->begin())->width : 0,
+            .height =
+                reprocess_request ? (*next_input_buffer->begin())->height : 0,
+            .planes = reprocess_request
+                          ? (*next_input_buffer->begin())->plane.img_y_crcb
+                          : YCbCrPlanes{}};
+        auto jpeg_input = std::make_unique<JpegYUV420Input>();
+        jpeg_input->width = (*b)->width;
+        jpeg_input->height = (*b)->height;
+        auto img =
+            new uint8_t[(jpeg_input->width * jpeg_input->height * 3) / 2];
+        jpeg_input->yuv_planes = {
+            .img_y = img,
+            .img_cb = img + jpeg_input->width * jpeg_input->height,
+            .img_cr = img + (jpeg_input->width * jpeg_input->height * 5) / 4,
+            .y_stride = jpeg_input->width,
+            .cbcr_stride = jpeg_input->width / 2,
+            .cbcr_step = 1};
+        jpeg_input->buffer_owner = true;
+        YUV420Frame yuv_output{.width = jpeg_input->width,
+                               .height = jpeg_input->height,
+                               .planes = jpeg_input->yuv_planes};
+
+        bool rotate =
+            settings.rotate_and_crop == ANDROID_SCALER_ROTATE_AND_CROP_90;
+        ProcessType process_type =
+            reprocess_request ? REPROCESS
+            : (settings.edge_mode == ANDROID_EDGE_MODE_HIGH_QUALITY)
+                ? HIGH_QUALITY
+                : REGULAR;
+        auto ret = ProcessYUV420(context, yuv_input, yuv_output, settings.gain,
+                                 process_type, settings.zoom_ratio, rotate,
+                                 chars);
+        if (ret != 0) {
+          (*b)->stream_buffer.status = BufferStatus::kError;
+          break;
+        }
+
+        auto jpeg_job = std::make_unique<JpegYUV420Job>();
+        jpeg_job->exif_utils =
+            std::unique_ptr<ExifUtils>(ExifUtils::Create(chars));
+        jpeg_job->input = std::move(jpeg_input);
+        // If jpeg compression is successful, then the jpeg compressor
+        // must set the corresponding status.
+        (*b)->stream_buffer.status = BufferStatus::kError;
+        std::swap(jpeg_job->output, *b);
+        jpeg_job->result_metadata =
+            HalCameraMetadata::Clone(next_result->result_metadata.get());
+
+        Mutex::Autolock lock(control_mutex_);
+        jpeg_compressor_->QueueYUV420(std::move(jpeg_job));
+      } else {
+        ALOGE("%s: Format %x with dataspace %x is TODO", __FUNCTION__,
+              (*b)->format, (*b)->dataSpace);
+        (*b)->stream_buffer.status = BufferStatus::kError;
+      }
+      break;
+    case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+    case HAL_PIXEL_FORMAT_YCbCr_420_888: {
+      YUV420Frame yuv_input{
+          .width =
+              reprocess_request ? (*next_input_buffer->begin())->width : 0,
+          .height =
+              reprocess_request ? (*next_input_buffer->begin())->height : 0,
+          .planes = reprocess_request
+                        ? (*next_input_buffer->begin())->plane.img_y_crcb
+                        : YCbCrPlanes{}};
+      YUV420Frame yuv_output{.width = (*b)->width,
+                             .height = (*b)->height,
+                             .planes = (*b)->plane.img_y_crcb};
+      bool rotate =
+          settings.rotate_and_crop == ANDROID_SCALER_ROTATE_AND_CROP_90;
+      ProcessType process_type =
+          reprocess_request ? REPROCESS
+          : (settings.edge_mode == ANDROID_EDGE_MODE_HIGH_QUALITY)
+              ? HIGH_QUALITY
+              : REGULAR;
+      auto ret = ProcessYUV420(context, yuv_input, yuv_output, settings.gain,
+                               process_type, settings.zoom_ratio, rotate,
+                               chars);
+      if (ret != 0) {
+        (*b)->stream_buffer.status = BufferStatus::kError;
+      }
+    } break;
+    case HAL_PIXEL_FORMAT_Y16:
+      if (!reprocess_request) {
+        if ((*b)->dataSpace == HAL_DATASPACE_DEPTH) {
+          CaptureDepth(context, (*b)->plane.img.img, settings.gain, (*b)->width,
+                       (*b)->height, (*b)->plane.img.stride, chars);
+        } else {
+          ALOGE("%s: Format %x with dataspace %x is TODO", __FUNCTION__,
+                (*b)->format, (*b)->dataSpace);
+          (*b)->stream_buffer.status = BufferStatus::kError;
+        }
+      } else {
+        ALOGE("%s: Reprocess requests with output format %x no supported!",
+              __FUNCTION__, (*b)->format);
+        (*b)->stream_buffer.status = BufferStatus::kError;
+      }
+      break;
+    default:
+      ALOGE("%s: Unknown format %x, no output", __FUNCTION__, (*b)->format);
+      (*b)->stream_buffer.status = BufferStatus::kError;
+      break;
+  }
+}
+
 void EmulatedSensor::ReturnResults(
     HwlPipelineCallback callback,
     std::unique_ptr<LogicalCameraSettings> settings,
@@ -891,7 +935,8 @@ void EmulatedSensor::CalculateAndAppendNoiseProfile(
   }
 }
 
-void EmulatedSensor::CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
+void EmulatedSensor::CaptureRaw(RenderContext* context, uint8_t* img,
+                                uint32_t gain, uint32_t width,
                                 const SensorCharacteristics& chars) {
   ATRACE_CALL();
   float total_gain = gain / 100.0 * GetBaseGainFactor(chars.max_raw_value);
@@ -902,13 +947,13 @@ void EmulatedSensor::CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
   // RGGB
   int bayer_select[4] = {EmulatedScene::R, EmulatedScene::Gr, EmulatedScene::Gb,
                          EmulatedScene::B};
-  scene_->SetReadoutPixel(0, 0);
+  context->scene->SetReadoutPixel(0, 0);
   for (unsigned int y = 0; y < chars.height; y++) {
     int* bayer_row = bayer_select + (y & 0x1) * 2;
     uint16_t* px = (uint16_t*)img + y * width;
     for (unsigned int x = 0; x < chars.width; x++) {
       uint32_t electron_count;
-      electron_count = scene_->GetPixelElectrons()[bayer_row[x & 0x1]];
+      electron_count = context->scene->GetPixelElectrons()[bayer_row[x & 0x1]];
 
       // TODO: Better pixel saturation curve?
       electron_count = (electron_count < kSaturationElectrons)
@@ -925,7 +970,9 @@ void EmulatedSensor::CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
       float photon_noise_var = electron_count * noise_var_gain;
       float noise_stddev = sqrtf_approx(read_noise_var + photon_noise_var);
       // Scaled to roughly match gaussian/uniform noise stddev
-      float noise_sample = rand_r(&rand_seed_) * (2.5 / (1.0 + RAND_MAX)) - 1.25;
+      float noise_sample =
+          NoiseRand(&context->rand_seed) * (2.5 / (1.0 + kNoiseRandMax)) -
+          1.25;
 
       raw_count += chars.black_level_pattern[bayer_row[x & 0x1]];
       raw_count += noise_stddev * noise_sample;
@@ -938,7 +985,8 @@ void EmulatedSensor::CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
   ALOGVV("Raw sensor image captured");
 }
 
-void EmulatedSensor::CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
+void EmulatedSensor::CaptureRGB(RenderContext* context, uint8_t* img,
+                                uint32_t width, uint32_t height,
                                 uint32_t stride, RGBLayout layout, uint32_t gain,
                                 const SensorCharacteristics& chars) {
   ATRACE_CALL();
@@ -949,12 +997,12 @@ void EmulatedSensor::CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
   uint32_t inc_v = ceil((float)chars.height / height);
 
   for (unsigned int y = 0, outy = 0; y < chars.height; y += inc_v, outy++) {
-    scene_->SetReadoutPixel(0, y);
+    context->scene->SetReadoutPixel(0, y);
     uint8_t* px = img + outy * stride;
     for (unsigned int x = 0; x < chars.width; x += inc_h) {
       uint32_t r_count, g_count, b_count;
       // TODO: Perfect demosaicing is a cheat
-      const uint32_t* pixel = scene_->GetPixelElectrons();
+      const uint32_t* pixel = context->scene->GetPixelElectrons();
       r_count = pixel[EmulatedScene::R] * scale64x;
       g_count = pixel[EmulatedScene::Gr] * scale64x;
       b_count = pixel[EmulatedScene::B] * scale64x;
@@ -984,13 +1032,16 @@ void EmulatedSensor::CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
           ALOGE("%s: RGB layout: %d not supported", __FUNCTION__, layout);
           return;
       }
-      for (unsigned int j = 1; j < inc_h; j++) scene_->GetPixelElectrons();
+      for (unsigned int j = 1; j < inc_h; j++) {
+        context->scene->GetPixelElectrons();
+      }
     }
   }
   ALOGVV("RGB sensor image captured");
 }
 
-void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
+void EmulatedSensor::CaptureYUV420(RenderContext* context,
+                                   YCbCrPlanes yuv_layout, uint32_t width,
                                    uint32_t height, uint32_t gain,
                                    float zoom_ratio, bool rotate,
                                    const SensorCharacteristics& chars) {
@@ -1042,12 +1093,12 @@ void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
       }
       x = std::min(std::max(x, 0), (int)chars.width - 1);
       y = std::min(std::max(y, 0), (int)chars.height - 1);
-      scene_->SetReadoutPixel(x, y);
+      context->scene->SetReadoutPixel(x, y);
 
       int32_t r_count, g_count, b_count;
       // TODO: Perfect demosaicing is a cheat
-      const uint32_t* pixel = rotate ? scene_->GetPixelElectronsColumn()
-                                     : scene_->GetPixelElectrons();
+      const uint32_t* pixel = rotate ? context->scene->GetPixelElectronsColumn()
+                                     : context->scene->GetPixelElectrons();
       r_count = pixel[EmulatedScene::R] * scale64x;
       r_count = r_count < kSaturationPoint ? r_count : kSaturationPoint;
       g_count = pixel[EmulatedScene::Gr] * scale64x;
@@ -1078,7 +1129,8 @@ void EmulatedSensor::CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width,
   ALOGVV("YUV420 sensor image captured");
 }
 
-void EmulatedSensor::CaptureDepth(uint8_t* img, uint32_t gain, uint32_t width,
+void EmulatedSensor::CaptureDepth(RenderContext* context, uint8_t* img,
+                                  uint32_t gain, uint32_t width,
                                   uint32_t height, uint32_t stride,
                                   const SensorCharacteristics& chars) {
   ATRACE_CALL();
@@ -1089,17 +1141,19 @@ void EmulatedSensor::CaptureDepth(uint8_t* img, uint32_t gain, uint32_t width,
   uint32_t inc_v = ceil((float)chars.height / height);
 
   for (unsigned int y = 0, out_y = 0; y < chars.height; y += inc_v, out_y++) {
-    scene_->SetReadoutPixel(0, y);
+    context->scene->SetReadoutPixel(0, y);
     uint16_t* px = (uint16_t*)(img + (out_y * stride));
     for (unsigned int x = 0; x < chars.width; x += inc_h) {
       uint32_t depth_count;
       // TODO: Make up real depth scene instead of using green channel
       // as depth
-      const uint32_t* pixel = scene_->GetPixelElectrons();
+      const uint32_t* pixel = context->scene->GetPixelElectrons();
       depth_count = pixel[EmulatedScene::Gr] * scale64x;
 
       *px++ = depth_count < 8191 * 64 ? depth_count / 64 : 0;
-      for (unsigned int j = 1; j < inc_h; j++) scene_->GetPixelElectrons();
+      for (unsigned int j = 1; j < inc_h; j++) {
+        context->scene->GetPixelElectrons();
+      }
     }
     // TODO: Handle this better
     // simulatedTime += mRowReadoutTime;
@@ -1107,7 +1161,8 @@ void EmulatedSensor::CaptureDepth(uint8_t* img, uint32_t gain, uint32_t width,
   ALOGVV("Depth sensor image captured");
 }
 
-status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
+status_t EmulatedSensor::ProcessYUV420(RenderContext* context,
+                                       const YUV420Frame& input,
                                        const YUV420Frame& output, uint32_t gain,
                                        ProcessType process_type, float zoom_ratio,
                                        bool rotate_and_crop,
@@ -1119,8 +1174,8 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
 
   switch (process_type) {
     case HIGH_QUALITY:
-      CaptureYUV420(output.planes, output.width, output.height, gain, zoom_ratio,
-                    rotate_and_crop, chars);
+      CaptureYUV420(context, output.planes, output.width, output.height, gain,
+                    zoom_ratio, rotate_and_crop, chars);
       return OK;
     case REPROCESS:
       input_width = input.width;
@@ -1165,8 +1220,8 @@ status_t EmulatedSensor::ProcessYUV420(const YUV420Frame& input,
           .y_stride = static_cast<uint32_t>(input_width),
           .cbcr_stride = static_cast<uint32_t>(input_width) / 2,
           .cbcr_step = 1};
-      CaptureYUV420(input_planes, input_width, input_height, gain, zoom_ratio,
-                    rotate_and_crop, chars);
+      CaptureYUV420(context, input_planes, input_width, input_height, gain,
+                    zoom_ratio, rotate_and_crop, chars);
   }
 
   output_planes = output.planes;
@@ -78,15 +78,19 @@
 #include <hwl_types.h>
 
 #include <functional>
+#include <unordered_map>
 
 #include "Base.h"
 #include "EmulatedScene.h"
 #include "HandleImporter.h"
 #include "JpegCompressor.h"
 #include "utils/Mutex.h"
+#include "utils/PhysicalSensorThread.h"
 #include "utils/StreamConfigurationMap.h"
 #include "utils/Thread.h"
 #include "utils/Timers.h"
+#include "utils/VSyncGenerator.h"
+#include "utils/WorkerPool.h"
 
 namespace android {
 
@@ -165,16 +169,17 @@ class EmulatedSensor : private Thread, public virtual RefBase {
 
   static bool AreCharacteristicsSupported(
       const SensorCharacteristics& characteristics);
-  static bool IsStreamCombinationSupported(
-      const StreamConfiguration& config, StreamConfigurationMap& map,
-      const SensorCharacteristics& sensor_chars);
 
   /*
    * Power control
    */
 
+  // When 'per_camera_threads' is set every camera in 'logical_chars' gets its
+  // own physical sensor thread. The physical sensors start every frame on a
+  // shared vsync. Otherwise the cameras are rendered by a worker pool.
   status_t StartUp(uint32_t logical_camera_id,
-                   std::unique_ptr<LogicalCharacteristics> logical_chars);
+                   std::unique_ptr<LogicalCharacteristics> logical_chars,
+                   bool per_camera_threads);
   status_t ShutDown();
 
   /*
@@ -234,6 +239,10 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   static const uint8_t kPipelineDepth;
 
  private:
+  // Renders the capture paths deterministically for benchmarks and golden
+  // image checks.
+  friend class EmulatedSensorHarness;
+
   // Scene stabilization
   static const uint32_t kRegularSceneHandshake;
   static const uint32_t kReducedSceneHandshake;
@@ -283,8 +292,6 @@ class EmulatedSensor : private Thread, public virtual RefBase {
 
   // End of control parameters
 
-  unsigned int rand_seed_ = 1;
-
   /**
    * Inherited Thread virtual overrides, and members only used by the
    * processing thread
@@ -293,19 +300,42 @@ class EmulatedSensor : private Thread, public virtual RefBase {
 
   nsecs_t next_capture_time_;
 
-  sp<EmulatedScene> scene_;
-
-  void CaptureRaw(uint8_t* img, uint32_t gain, uint32_t width,
-                  const SensorCharacteristics& chars);
+  // Per camera rendering state. Buffers of different physical cameras are
+  // rendered in parallel, so each camera needs its own scene and noise seed.
+  struct RenderContext {
+    sp<EmulatedScene> scene;
+    unsigned int rand_seed = 1;
+  };
+  // Maps a camera id to its rendering state
+  std::unordered_map<uint32_t, RenderContext> render_contexts_;
+  std::unique_ptr<WorkerPool> render_pool_;
+
+  // Only used when every camera runs its own physical sensor thread
+  std::shared_ptr<VSyncGenerator> vsync_generator_;
+  // Maps a camera id to its physical sensor thread
+  std::unordered_map<uint32_t, std::unique_ptr<PhysicalSensorThread>>
+      physical_sensor_threads_;
+
+  void RenderBuffer(RenderContext* context, std::unique_ptr<SensorBuffer>* b,
+                    const SensorSettings& settings,
+                    const SensorCharacteristics& chars,
+                    nsecs_t capture_time, bool reprocess_request,
+                    const Buffers* next_input_buffer,
+                    const HwlPipelineResult* next_result);
+
+  void CaptureRaw(RenderContext* context, uint8_t* img, uint32_t gain,
+                  uint32_t width, const SensorCharacteristics& chars);
   enum RGBLayout { RGB, RGBA, ARGB };
-  void CaptureRGB(uint8_t* img, uint32_t width, uint32_t height,
-                  uint32_t stride, RGBLayout layout, uint32_t gain,
-                  const SensorCharacteristics& chars);
-  void CaptureYUV420(YCbCrPlanes yuv_layout, uint32_t width, uint32_t height,
-                     uint32_t gain, float zoom_ratio, bool rotate,
+  void CaptureRGB(RenderContext* context, uint8_t* img, uint32_t width,
+                  uint32_t height, uint32_t stride, RGBLayout layout,
+                  uint32_t gain, const SensorCharacteristics& chars);
+  void CaptureYUV420(RenderContext* context, YCbCrPlanes yuv_layout,
+                     uint32_t width, uint32_t height, uint32_t gain,
+                     float zoom_ratio, bool rotate,
                      const SensorCharacteristics& chars);
-  void CaptureDepth(uint8_t* img, uint32_t gain, uint32_t width, uint32_t height,
-                    uint32_t stride, const SensorCharacteristics& chars);
+  void CaptureDepth(RenderContext* context, uint8_t* img, uint32_t gain,
+                    uint32_t width, uint32_t height, uint32_t stride,
+                    const SensorCharacteristics& chars);
 
   struct YUV420Frame {
     uint32_t width = 0;
@@ -314,9 +344,10 @@ class EmulatedSensor : private Thread, public virtual RefBase {
   };
 
   enum ProcessType { REPROCESS, HIGH_QUALITY, REGULAR };
-  status_t ProcessYUV420(const YUV420Frame& input, const YUV420Frame& output,
-                         uint32_t gain, ProcessType process_type,
-                         float zoom_ratio, bool rotate_and_crop,
+  status_t ProcessYUV420(RenderContext* context, const YUV420Frame& input,
+                         const YUV420Frame& output, uint32_t gain,
+                         ProcessType process_type, float zoom_ratio,
+                         bool rotate_and_crop,
                          const SensorCharacteristics& chars);
 
   inline int32_t ApplysRGBGamma(int32_t value, int32_t saturation);
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EmulatedRequestStateBenchmark"
+#include <benchmark/benchmark.h>
+#include <log/log.h>
+
+#include <vector>
+
+#include "EmulatedRequestState.h"
+
+namespace android {
+
+// EmulatedRequestStateHarness decodes the controls of a typical preview
+// request, both with the single pass used by EmulatedRequestState and with
+// one lookup per tag as a baseline.
+class EmulatedRequestStateHarness {
+ public:
+  // Number of request controls decoded for every request.
+  static const size_t kNumControls = 27;
+
+  EmulatedRequestStateHarness() {
+    settings_ = HalCameraMetadata::Create(/*entry_capacity*/ 64,
+                                          /*data_capacity*/ 1024);
+  }
+
+  // Fill the request settings. Returns false if any of the tags can't be set.
+  bool Configure() {
+    if (settings_ == nullptr) {
+      return false;
+    }
+
+    const uint8_t control_mode = ANDROID_CONTROL_MODE_AUTO;
+    const uint8_t scene_mode = ANDROID_CONTROL_SCENE_MODE_DISABLED;
+    const uint8_t extended_scene_mode =
+        ANDROID_CONTROL_EXTENDED_SCENE_MODE_DISABLED;
+    const float zoom_ratio = 1.0f;
+    const uint8_t vstab_mode = ANDROID_CONTROL_VIDEO_STABILIZATION_MODE_OFF;
+    const uint8_t capture_intent = ANDROID_CONTROL_CAPTURE_INTENT_PREVIEW;
+    const uint8_t ae_mode = ANDROID_CONTROL_AE_MODE_ON;
+    const uint8_t ae_lock = ANDROID_CONTROL_AE_LOCK_OFF;
+    const int32_t ae_exposure_compensation = 0;
+    const int32_t ae_target_fps_range[] = {15, 30};
+    const uint8_t ae_precapture_trigger =
+        ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER_IDLE;
+    const int32_t metering_region[] = {0, 0, 1920, 1440, 0};
+    const uint8_t awb_mode = ANDROID_CONTROL_AWB_MODE_AUTO;
+    const uint8_t awb_lock = ANDROID_CONTROL_AWB_LOCK_OFF;
+    const uint8_t af_mode = ANDROID_CONTROL_AF_MODE_CONTINUOUS_PICTURE;
+    const uint8_t af_trigger = ANDROID_CONTROL_AF_TRIGGER_IDLE;
+    const uint8_t edge_mode = ANDROID_EDGE_MODE_FAST;
+    const uint8_t flash_mode = ANDROID_FLASH_MODE_OFF;
+    const float focus_distance = 0.0f;
+    const int32_t crop_region[] = {0, 0, 1920, 1440};
+    const uint8_t rotate_and_crop = ANDROID_SCALER_ROTATE_AND_CROP_NONE;
+    const int64_t exposure_time = EmulatedSensor::kDefaultExposureTime;
+    const int64_t frame_duration = EmulatedSensor::kDefaultFrameDuration;
+    const int32_t sensitivity = EmulatedSensor::kDefaultSensitivity;
+    const uint8_t lens_shading_map_mode =
+        ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_OFF;
+
+    // Tags that are part of every request but aren't decoded.
+    const uint8_t noise_reduction_mode = ANDROID_NOISE_REDUCTION_MODE_FAST;
+    const uint8_t tonemap_mode = ANDROID_TONEMAP_MODE_FAST;
+    const uint8_t face_detect_mode = ANDROID_STATISTICS_FACE_DETECT_MODE_OFF;
+    const uint8_t jpeg_quality = 95;
+
+    status_t res = OK;
+    res |= settings_->Set(ANDROID_CONTROL_MODE, &control_mode, 1);
+    res |= settings_->Set(ANDROID_CONTROL_SCENE_MODE, &scene_mode, 1);
+    res |= settings_->Set(ANDROID_CONTROL_EXTENDED_SCENE_MODE,
+                          &extended_scene_mode, 1);
+    res |= settings_->Set(ANDROID_CONTROL_ZOOM_RATIO, &zoom_ratio, 1);
+    res |= settings_->Set(ANDROID_CONTROL_VIDEO_STABILIZATION_MODE,
+                          &vstab_mode, 1);
+    res |= settings_->Set(ANDROID_CONTROL_CAPTURE_INTENT, &capture_intent, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AE_MODE, &ae_mode, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AE_LOCK, &ae_lock, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
+                          &ae_exposure_compensation, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+                          ae_target_fps_range, 2);
+    res |= settings_->Set(ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER,
+                          &ae_precapture_trigger, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AE_REGIONS, metering_region, 5);
+    res |= settings_->Set(ANDROID_CONTROL_AWB_MODE, &awb_mode, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AWB_LOCK, &awb_lock, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AWB_REGIONS, metering_region, 5);
+    res |= settings_->Set(ANDROID_CONTROL_AF_MODE, &af_mode, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AF_TRIGGER, &af_trigger, 1);
+    res |= settings_->Set(ANDROID_CONTROL_AF_REGIONS, metering_region, 5);
+    res |= settings_->Set(ANDROID_EDGE_MODE, &edge_mode, 1);
+    res |= settings_->Set(ANDROID_FLASH_MODE, &flash_mode, 1);
+    res |= settings_->Set(ANDROID_LENS_FOCUS_DISTANCE, &focus_distance, 1);
+    res |= settings_->Set(ANDROID_SCALER_CROP_REGION, crop_region, 4);
+    res |= settings_->Set(ANDROID_SCALER_ROTATE_AND_CROP, &rotate_and_crop, 1);
+    res |= settings_->Set(ANDROID_SENSOR_EXPOSURE_TIME, &exposure_time, 1);
+    res |= settings_->Set(ANDROID_SENSOR_FRAME_DURATION, &frame_duration, 1);
+    res |= settings_->Set(ANDROID_SENSOR_SENSITIVITY, &sensitivity, 1);
+    res |= settings_->Set(ANDROID_STATISTICS_LENS_SHADING_MAP_MODE,
+                          &lens_shading_map_mode, 1);
+    res |= settings_->Set(ANDROID_NOISE_REDUCTION_MODE, &noise_reduction_mode,
+                          1);
+    res |= settings_->Set(ANDROID_TONEMAP_MODE, &tonemap_mode, 1);
+    res |= settings_->Set(ANDROID_STATISTICS_FACE_DETECT_MODE,
+                          &face_detect_mode, 1);
+    res |= settings_->Set(ANDROID_JPEG_QUALITY, &jpeg_quality, 1);
+
+    return res == OK;
+  }
+
+  // Decode the request controls with a single pass over the settings.
+  // Returns the number of decoded controls.
+  size_t Decode() {
+    EmulatedRequestState::DecodeRequestControls(*settings_, &controls_);
+    return CountPresentControls();
+  }
+
+  // Look up every request control separately, the way the request state
+  // read its settings before the single pass decode. Returns the number of
+  // controls found.
+  size_t GetPerTag() const {
+    size_t count = 0;
+    camera_metadata_ro_entry_t entry;
+    for (auto tag : kControlTags) {
+      if (settings_->Get(tag, &entry) == OK) {
+        benchmark::DoNotOptimize(entry.data.u8[0]);
+        count++;
+      }
+    }
+
+    return count;
+  }
+
+ private:
+  static const std::vector<uint32_t> kControlTags;
+
+  size_t CountPresentControls() const {
+    const bool present[] = {controls_.control_mode.present,
+                            controls_.scene_mode.present,
+                            controls_.extended_scene_mode.present,
+                            controls_.zoom_ratio.present,
+                            controls_.vstab_mode.present,
+                            controls_.capture_intent.present,
+                            controls_.ae_mode.present,
+                            controls_.ae_lock.present,
+                            controls_.ae_exposure_compensation.present,
+                            controls_.ae_target_fps_range.present,
+                            controls_.ae_precapture_trigger.present,
+                            controls_.ae_regions.present,
+                            controls_.awb_mode.present,
+                            controls_.awb_lock.present,
+                            controls_.awb_regions.present,
+                            controls_.af_mode.present,
+                            controls_.af_trigger.present,
+                            controls_.af_regions.present,
+                            controls_.edge_mode.present,
+                            controls_.flash_mode.present,
+                            controls_.focus_distance.present,
+                            controls_.crop_region.present,
+                            controls_.rotate_and_crop.present,
+                            controls_.exposure_time.present,
+                            controls_.frame_duration.present,
+                            controls_.sensitivity.present,
+                            controls_.lens_shading_map_mode.present};
+    size_t count = 0;
+    for (auto it : present) {
+      count += it ? 1 : 0;
+    }
+
+    return count;
+  }
+
+  std::unique_ptr<HalCameraMetadata> settings_;
+  EmulatedRequestState::RequestControls controls_;
+};
+
+const std::vector<uint32_t> EmulatedRequestStateHarness::kControlTags = {
+    ANDROID_CONTROL_MODE,
+    ANDROID_CONTROL_SCENE_MODE,
+    ANDROID_CONTROL_EXTENDED_SCENE_MODE,
+    ANDROID_CONTROL_ZOOM_RATIO,
+    ANDROID_CONTROL_VIDEO_STABILIZATION_MODE,
+    ANDROID_CONTROL_CAPTURE_INTENT,
+    ANDROID_CONTROL_AE_MODE,
+    ANDROID_CONTROL_AE_LOCK,
+    ANDROID_CONTROL_AE_EXPOSURE_COMPENSATION,
+    ANDROID_CONTROL_AE_TARGET_FPS_RANGE,
+    ANDROID_CONTROL_AE_PRECAPTURE_TRIGGER,
+    ANDROID_CONTROL_AE_REGIONS,
+    ANDROID_CONTROL_AWB_MODE,
+    ANDROID_CONTROL_AWB_LOCK,
+    ANDROID_CONTROL_AWB_REGIONS,
+    ANDROID_CONTROL_AF_MODE,
+    ANDROID_CONTROL_AF_TRIGGER,
+    ANDROID_CONTROL_AF_REGIONS,
+    ANDROID_EDGE_MODE,
+    ANDROID_FLASH_MODE,
+    ANDROID_LENS_FOCUS_DISTANCE,
+    ANDROID_SCALER_CROP_REGION,
+    ANDROID_SCALER_ROTATE_AND_CROP,
+    ANDROID_SENSOR_EXPOSURE_TIME,
+    ANDROID_SENSOR_FRAME_DURATION,
+    ANDROID_SENSOR_SENSITIVITY,
+    ANDROID_STATISTICS_LENS_SHADING_MAP_MODE};
+
+static void BM_DecodeRequestControls(benchmark::State& state) {
+  EmulatedRequestStateHarness harness;
+  if (!harness.Configure()) {
+    state.SkipWithError("Unable to create the request settings");
+    return;
+  }
+
+  for (auto _ : state) {
+    if (harness.Decode() != EmulatedRequestStateHarness::kNumControls) {
+      state.SkipWithError("Request controls are missing");
+      return;
+    }
+  }
+}
+BENCHMARK(BM_DecodeRequestControls);
+
+static void BM_GetRequestControlsPerTag(benchmark::State& state) {
+  EmulatedRequestStateHarness harness;
+  if (!harness.Configure()) {
+    state.SkipWithError("Unable to create the request settings");
+    return;
+  }
+
+  for (auto _ : state) {
+    if (harness.GetPerTag() != EmulatedRequestStateHarness::kNumControls) {
+      state.SkipWithError("Request controls are missing");
+      return;
+    }
+  }
+}
+BENCHMARK(BM_GetRequestControlsPerTag);
+
+}  // namespace android
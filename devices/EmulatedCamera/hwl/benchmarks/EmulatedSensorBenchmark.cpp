@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "EmulatedSensorBenchmark"
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <benchmark/benchmark.h>
+#include <inttypes.h>
+#include <log/log.h>
+#include <string.h>
+
+#include <fstream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "EmulatedScene.h"
+#include "EmulatedSensor.h"
+
+namespace android {
+
+using android::base::StringPrintf;
+using google_camera_hal::BufferStatus;
+
+// EmulatedSensorHarness renders single buffers through the EmulatedSensor
+// capture paths outside of the sensor thread. The scene hour, capture time and
+// noise seed are fixed, so repeated renders of the same configuration produce
+// identical output.
+class EmulatedSensorHarness {
+ public:
+  struct CaptureConfig {
+    std::string name;
+    android_pixel_format_t format = HAL_PIXEL_FORMAT_YCBCR_420_888;
+    android_dataspace_t data_space = HAL_DATASPACE_UNKNOWN;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    float zoom_ratio = 1.0f;
+    bool rotate = false;
+    bool high_quality = false;
+  };
+
+  static const uint32_t kSensorWidth = 1920;
+  static const uint32_t kSensorHeight = 1440;
+  static const int kSceneHour = 12;
+  static const unsigned int kRandSeed = 1;
+  static const nsecs_t kCaptureTime = 0;
+
+  EmulatedSensorHarness() : sensor_(new EmulatedSensor()) {
+    chars_.width = kSensorWidth;
+    chars_.height = kSensorHeight;
+    chars_.exposure_time_range[0] =
+        EmulatedSensor::kSupportedExposureTimeRange[0];
+    chars_.exposure_time_range[1] =
+        EmulatedSensor::kSupportedExposureTimeRange[1];
+    chars_.frame_duration_range[0] =
+        EmulatedSensor::kSupportedFrameDurationRange[0];
+    chars_.frame_duration_range[1] =
+        EmulatedSensor::kSupportedFrameDurationRange[1];
+    chars_.sensitivity_range[0] = EmulatedSensor::kSupportedSensitivityRange[0];
+    chars_.sensitivity_range[1] = EmulatedSensor::kSupportedSensitivityRange[1];
+    chars_.max_raw_value = EmulatedSensor::kDefaultMaxRawValue;
+    for (size_t i = 0; i < 4; i++) {
+      chars_.black_level_pattern[i] =
+          EmulatedSensor::kDefaultBlackLevelPattern[i];
+    }
+
+    context_.scene = new EmulatedScene(
+        chars_.width, chars_.height, EmulatedSensor::kElectronsPerLuxSecond,
+        chars_.orientation, chars_.is_front_facing);
+    context_.scene->SetHour(kSceneHour);
+  }
+
+  // Allocate the output buffer of 'config'. Returns false in case the
+  // configuration is not supported by the harness.
+  bool Configure(const CaptureConfig& config) {
+    uint32_t bytes_per_pixel;
+    switch (config.format) {
+      case HAL_PIXEL_FORMAT_RAW16:
+        if ((config.width != chars_.width) ||
+            (config.height != chars_.height)) {
+          return false;
+        }
+        bytes_per_pixel = 2;
+        break;
+      case HAL_PIXEL_FORMAT_Y16:
+        bytes_per_pixel = 2;
+        break;
+      case HAL_PIXEL_FORMAT_RGB_888:
+        bytes_per_pixel = 3;
+        break;
+      case HAL_PIXEL_FORMAT_RGBA_8888:
+        bytes_per_pixel = 4;
+        break;
+      case HAL_PIXEL_FORMAT_YCBCR_420_888:
+        bytes_per_pixel = 0;
+        break;
+      default:
+        return false;
+    }
+
+    buffer_ = std::make_unique<SensorBuffer>();
+    buffer_->width = config.width;
+    buffer_->height = config.height;
+    buffer_->format = config.format;
+    buffer_->dataSpace = config.data_space;
+    if (config.format == HAL_PIXEL_FORMAT_YCBCR_420_888) {
+      size_t luma_size = config.width * config.height;
+      data_.assign((luma_size * 3) / 2, 0);
+      buffer_->plane.img_y_crcb = {.img_y = data_.data(),
+                                   .img_cb = data_.data() + luma_size,
+                                   .img_cr = data_.data() + (luma_size * 5) / 4,
+                                   .y_stride = config.width,
+                                   .cbcr_stride = config.width / 2,
+                                   .cbcr_step = 1};
+    } else {
+      data_.assign(config.width * config.height * bytes_per_pixel, 0);
+      buffer_->plane.img.img = data_.data();
+      buffer_->plane.img.stride = config.width * bytes_per_pixel;
+      buffer_->plane.img.buffer_size = data_.size();
+    }
+
+    settings_.exposure_time = EmulatedSensor::kDefaultExposureTime;
+    settings_.frame_duration = EmulatedSensor::kDefaultFrameDuration;
+    settings_.gain = EmulatedSensor::kDefaultSensitivity;
+    settings_.zoom_ratio = config.zoom_ratio;
+    settings_.rotate_and_crop = config.rotate
+                                    ? ANDROID_SCALER_ROTATE_AND_CROP_90
+                                    : ANDROID_SCALER_ROTATE_AND_CROP_NONE;
+    settings_.edge_mode = config.high_quality ? ANDROID_EDGE_MODE_HIGH_QUALITY
+                                              : ANDROID_EDGE_MODE_OFF;
+
+    return true;
+  }
+
+  // Render the configured buffer. Returns false if the capture path failed.
+  bool Render() {
+    context_.rand_seed = kRandSeed;
+    sensor_->RenderBuffer(&context_, &buffer_, settings_, chars_, kCaptureTime,
+                          /*reprocess_request*/ false,
+                          /*next_input_buffer*/ nullptr,
+                          /*next_result*/ nullptr);
+    return buffer_->stream_buffer.status == BufferStatus::kOk;
+  }
+
+  // FNV-1a hash of the last rendered output.
+  uint64_t GetOutputHash() const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const auto& byte : data_) {
+      hash ^= byte;
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+ private:
+  sp<EmulatedSensor> sensor_;
+  EmulatedSensor::RenderContext context_;
+  SensorCharacteristics chars_;
+  EmulatedSensor::SensorSettings settings_;
+  std::unique_ptr<SensorBuffer> buffer_;
+  std::vector<uint8_t> data_;
+};
+
+// Output hashes of a reference run keyed by the benchmark name. Floating point
+// contraction and the math library can change the output between
+// architectures, so every architecture has its own file. The file of the
+// running architecture is installed next to the benchmark and loaded by
+// default, --golden_hashes loads a different one. A reference run writes the
+// file with --write_golden_hashes. Unless a reference run is in progress, a
+// configuration without a golden hash or with a different output hash fails.
+static std::unordered_map<std::string, uint64_t> golden_hashes;
+
+// Output hashes of this run keyed by the benchmark name.
+static std::map<std::string, uint64_t> output_hashes;
+
+// Whether output hashes are checked against golden_hashes.
+static bool check_golden_hashes = true;
+
+// Number of configurations that failed the golden hash check.
+static size_t golden_hash_failures = 0;
+
+static const char kGoldenHashesFlag[] = "--golden_hashes=";
+static const char kWriteGoldenHashesFlag[] = "--write_golden_hashes=";
+
+#if defined(__aarch64__)
+static const char kArchitecture[] = "arm64";
+#elif defined(__arm__)
+static const char kArchitecture[] = "arm";
+#elif defined(__x86_64__)
+static const char kArchitecture[] = "x86_64";
+#elif defined(__i386__)
+static const char kArchitecture[] = "x86";
+#else
+static const char kArchitecture[] = "unknown";
+#endif
+
+// Path of the golden hashes of the running architecture, installed with the
+// benchmark.
+static std::string GetDefaultGoldenHashesPath() {
+  return StringPrintf("%s/benchmarks/golden_hashes/%s.txt",
+                      android::base::GetExecutableDirectory().c_str(),
+                      kArchitecture);
+}
+
+// Read "<benchmark name> <hex hash>" lines from 'path'.
+static bool ReadGoldenHashes(const std::string& path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    ALOGE("%s: Unable to open %s", __FUNCTION__, path.c_str());
+    return false;
+  }
+
+  std::string name, hash;
+  while (file >> name >> hash) {
+    golden_hashes[name] = std::stoull(hash, nullptr, 16);
+  }
+
+  return true;
+}
+
+static bool WriteGoldenHashes(const std::string& path) {
+  std::ofstream file(path);
+  if (!file.is_open()) {
+    ALOGE("%s: Unable to open %s", __FUNCTION__, path.c_str());
+    return false;
+  }
+
+  for (const auto& hash : output_hashes) {
+    file << StringPrintf("%s %016" PRIx64 "\n", hash.first.c_str(),
+                         hash.second);
+  }
+
+  return true;
+}
+
+static void BM_Capture(benchmark::State& state,
+                       EmulatedSensorHarness::CaptureConfig config) {
+  EmulatedSensorHarness harness;
+  if (!harness.Configure(config)) {
+    state.SkipWithError("Unsupported capture configuration");
+    return;
+  }
+
+  for (auto _ : state) {
+    if (!harness.Render()) {
+      state.SkipWithError("Capture failed");
+      return;
+    }
+  }
+
+  state.counters["pixel_time"] = benchmark::Counter(
+      config.width * config.height,
+      benchmark::Counter::kIsIterationInvariantRate |
+          benchmark::Counter::kInvert);
+
+  auto hash = harness.GetOutputHash();
+  state.SetLabel(StringPrintf("hash:%016" PRIx64, hash));
+  output_hashes[config.name] = hash;
+  if (!check_golden_hashes) {
+    return;
+  }
+
+  auto golden = golden_hashes.find(config.name);
+  if (golden == golden_hashes.end()) {
+    ALOGE("%s: %s has no golden hash", __FUNCTION__, config.name.c_str());
+    golden_hash_failures++;
+    state.SkipWithError("No golden hash for this configuration");
+  } else if (golden->second != hash) {
+    ALOGE("%s: %s output hash %016" PRIx64
+          " doesn't match golden %016" PRIx64,
+          __FUNCTION__, config.name.c_str(), hash, golden->second);
+    golden_hash_failures++;
+    state.SkipWithError("Output doesn't match the golden hash");
+  }
+}
+
+static void RegisterCaptureBenchmarks() {
+  const std::vector<std::pair<uint32_t, uint32_t>> kOutputSizes = {
+      {640, 480}, {1280, 720}, {1920, 1080}};
+  std::vector<EmulatedSensorHarness::CaptureConfig> configs;
+
+  EmulatedSensorHarness::CaptureConfig raw;
+  raw.format = HAL_PIXEL_FORMAT_RAW16;
+  raw.width = EmulatedSensorHarness::kSensorWidth;
+  raw.height = EmulatedSensorHarness::kSensorHeight;
+  raw.name = StringPrintf("Raw/%ux%u", raw.width, raw.height);
+  configs.push_back(raw);
+
+  for (const auto& size : kOutputSizes) {
+    EmulatedSensorHarness::CaptureConfig config;
+    config.width = size.first;
+    config.height = size.second;
+
+    config.format = HAL_PIXEL_FORMAT_RGB_888;
+    config.name = StringPrintf("RGB/%ux%u", config.width, config.height);
+    configs.push_back(config);
+
+    config.format = HAL_PIXEL_FORMAT_RGBA_8888;
+    config.name = StringPrintf("RGBA/%ux%u", config.width, config.height);
+    configs.push_back(config);
+
+    config.format = HAL_PIXEL_FORMAT_Y16;
+    config.data_space = HAL_DATASPACE_DEPTH;
+    config.name = StringPrintf("Depth/%ux%u", config.width, config.height);
+    configs.push_back(config);
+
+    // Regular quality runs the ProcessYUV420 scaling path on top of
+    // CaptureYUV420, high quality renders the output size directly.
+    config.format = HAL_PIXEL_FORMAT_YCBCR_420_888;
+    config.data_space = HAL_DATASPACE_UNKNOWN;
+    for (auto high_quality : {false, true}) {
+      for (auto zoom_ratio : {1.0f, 2.0f}) {
+        for (auto rotate : {false, true}) {
+          config.high_quality = high_quality;
+          config.zoom_ratio = zoom_ratio;
+          config.rotate = rotate;
+          config.name = StringPrintf(
+              "YUV420%s/%ux%u/zoom:%.1f%s", high_quality ? "HQ" : "",
+              config.width, config.height, zoom_ratio,
+              rotate ? "/rotate" : "");
+          configs.push_back(config);
+        }
+      }
+    }
+  }
+
+  for (const auto& config : configs) {
+    benchmark::RegisterBenchmark(config.name.c_str(), BM_Capture, config)
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+}  // namespace android
+
+int main(int argc, char** argv) {
+  std::string golden_hashes_path, write_golden_hashes_path;
+  int benchmark_argc = 0;
+  for (int i = 0; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.rfind(android::kGoldenHashesFlag, 0) == 0) {
+      golden_hashes_path = arg.substr(strlen(android::kGoldenHashesFlag));
+    } else if (arg.rfind(android::kWriteGoldenHashesFlag, 0) == 0) {
+      write_golden_hashes_path =
+          arg.substr(strlen(android::kWriteGoldenHashesFlag));
+    } else {
+      argv[benchmark_argc++] = argv[i];
+    }
+  }
+
+  // A reference run only checks against goldens that are passed explicitly.
+  android::check_golden_hashes =
+      write_golden_hashes_path.empty() || !golden_hashes_path.empty();
+  if (android::check_golden_hashes) {
+    if (golden_hashes_path.empty()) {
+      golden_hashes_path = android::GetDefaultGoldenHashesPath();
+    }
+    if (!android::ReadGoldenHashes(golden_hashes_path)) {
+      return 1;
+    }
+  }
+
+  android::RegisterCaptureBenchmarks();
+  benchmark::Initialize(&benchmark_argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+
+  if (!write_golden_hashes_path.empty() &&
+      !android::WriteGoldenHashes(write_golden_hashes_path)) {
+    return 1;
+  }
+
+  return android::golden_hash_failures == 0 ? 0 : 1;
+}
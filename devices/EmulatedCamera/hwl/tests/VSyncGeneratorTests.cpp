@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "VSyncGeneratorTests"
+#include <gtest/gtest.h>
+#include <log/log.h>
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "utils/PhysicalSensorThread.h"
+#include "utils/VSyncGenerator.h"
+
+namespace android {
+
+static constexpr nsecs_t kVSyncPeriod = 5000000;  // 5 ms
+static constexpr size_t kNumFrames = 10;
+static const std::vector<uint32_t> kCameraIds = {0, 2, 3};
+
+// Records the vsync each camera started its frames on.
+class FrameRecorder {
+ public:
+  VSyncWork GetWork(uint32_t camera_id) {
+    return [this, camera_id](const VSync& vsync) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      vsyncs_[camera_id].push_back(vsync);
+    };
+  }
+
+  std::vector<VSync> GetVSyncs(uint32_t camera_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return vsyncs_[camera_id];
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<uint32_t, std::vector<VSync>> vsyncs_;
+};
+
+class VSyncGeneratorTests : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    vsync_generator_ = std::make_shared<VSyncGenerator>(kVSyncPeriod);
+    for (auto camera_id : kCameraIds) {
+      sensor_threads_.push_back(
+          std::make_unique<PhysicalSensorThread>(camera_id, vsync_generator_));
+    }
+  }
+
+  void TearDown() override {
+    vsync_generator_->Stop();
+    sensor_threads_.clear();
+  }
+
+  std::shared_ptr<VSyncGenerator> vsync_generator_;
+  std::vector<std::unique_ptr<PhysicalSensorThread>> sensor_threads_;
+};
+
+TEST_F(VSyncGeneratorTests, PhysicalSensorsStartFramesOnTheSameVSync) {
+  FrameRecorder recorder;
+  std::vector<VSync> queued_vsyncs;
+  for (size_t i = 0; i < kNumFrames; i++) {
+    std::unordered_map<uint32_t, VSyncWork> work;
+    for (auto camera_id : kCameraIds) {
+      work.emplace(camera_id, recorder.GetWork(camera_id));
+    }
+
+    VSync vsync;
+    ASSERT_EQ(vsync_generator_->QueueFrame(std::move(work), &vsync), OK);
+    vsync_generator_->WaitForFrameDone();
+    queued_vsyncs.push_back(vsync);
+  }
+
+  for (auto camera_id : kCameraIds) {
+    auto vsyncs = recorder.GetVSyncs(camera_id);
+    ASSERT_EQ(vsyncs.size(), kNumFrames) << "Camera " << camera_id;
+    for (size_t i = 0; i < kNumFrames; i++) {
+      EXPECT_EQ(vsyncs[i].frame, queued_vsyncs[i].frame)
+          << "Camera " << camera_id << " frame " << i;
+      EXPECT_EQ(vsyncs[i].timestamp, queued_vsyncs[i].timestamp)
+          << "Camera " << camera_id << " frame " << i;
+    }
+  }
+
+  for (size_t i = 1; i < kNumFrames; i++) {
+    EXPECT_GT(queued_vsyncs[i].frame, queued_vsyncs[i - 1].frame);
+    EXPECT_GE(queued_vsyncs[i].timestamp - queued_vsyncs[i - 1].timestamp,
+              kVSyncPeriod);
+  }
+}
+
+TEST_F(VSyncGeneratorTests, OnlyCamerasWithWorkRunTheFrame) {
+  FrameRecorder recorder;
+  uint32_t camera_id = kCameraIds[1];
+  std::unordered_map<uint32_t, VSyncWork> work;
+  work.emplace(camera_id, recorder.GetWork(camera_id));
+
+  VSync vsync;
+  ASSERT_EQ(vsync_generator_->QueueFrame(std::move(work), &vsync), OK);
+  vsync_generator_->WaitForFrameDone();
+
+  // Let a few more vsyncs pass, the work must not run again.
+  VSync next_vsync;
+  for (size_t i = 0; i < 3; i++) {
+    ASSERT_TRUE(vsync_generator_->WaitForNextVSync(&next_vsync));
+  }
+
+  for (auto id : kCameraIds) {
+    auto vsyncs = recorder.GetVSyncs(id);
+    if (id == camera_id) {
+      ASSERT_EQ(vsyncs.size(), 1u);
+      EXPECT_EQ(vsyncs[0].frame, vsync.frame);
+    } else {
+      EXPECT_TRUE(vsyncs.empty()) << "Camera " << id;
+    }
+  }
+}
+
+TEST_F(VSyncGeneratorTests, VSyncsFollowThePeriod) {
+  VSync previous;
+  ASSERT_TRUE(vsync_generator_->WaitForNextVSync(&previous));
+  for (size_t i = 0; i < kNumFrames; i++) {
+    VSync vsync;
+    ASSERT_TRUE(vsync_generator_->WaitForNextVSync(&vsync));
+    ASSERT_GT(vsync.frame, previous.frame);
+    nsecs_t num_periods = vsync.frame - previous.frame;
+    EXPECT_GE(vsync.timestamp - previous.timestamp, kVSyncPeriod * num_periods);
+    EXPECT_LE(vsync.timestamp, systemTime());
+    previous = vsync;
+  }
+}
+
+TEST_F(VSyncGeneratorTests, QueueFrameFailsWhileAFrameRuns) {
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  std::unordered_map<uint32_t, VSyncWork> work;
+  work.emplace(kCameraIds[0],
+               [released](const VSync& /*vsync*/) { released.wait(); });
+
+  VSync vsync;
+  ASSERT_EQ(vsync_generator_->QueueFrame(std::move(work), &vsync), OK);
+  EXPECT_EQ(vsync_generator_->QueueFrame({}, &vsync), INVALID_OPERATION);
+
+  release.set_value();
+  vsync_generator_->WaitForFrameDone();
+  EXPECT_EQ(vsync_generator_->QueueFrame({}, &vsync), OK);
+}
+
+TEST(VSyncGeneratorStopTests, StopReleasesWaiters) {
+  // The first vsync doesn't fire before the generator stops.
+  VSyncGenerator vsync_generator(/*period*/ 60000000000);
+  std::unordered_map<uint32_t, VSyncWork> work;
+  work.emplace(kCameraIds[0], [](const VSync& /*vsync*/) {
+    ADD_FAILURE() << "Work ran after the generator stopped";
+  });
+  VSync vsync;
+  ASSERT_EQ(vsync_generator.QueueFrame(std::move(work), &vsync), OK);
+
+  auto waiter = std::async(std::launch::async, [&vsync_generator] {
+    VSync next_vsync;
+    return vsync_generator.WaitForNextVSync(&next_vsync);
+  });
+  vsync_generator.Stop();
+  EXPECT_FALSE(waiter.get());
+
+  // Work that didn't start is dropped.
+  vsync_generator.WaitForFrameDone();
+  EXPECT_EQ(vsync_generator.QueueFrame({}, &vsync), NO_INIT);
+  VSyncWork camera_work;
+  EXPECT_FALSE(
+      vsync_generator.WaitForWork(kCameraIds[0], &vsync, &camera_work));
+}
+
+}  // namespace android
@@ -232,4 +232,14 @@ PhysicalDeviceMapPtr ClonePhysicalDeviceMap(const PhysicalDeviceMapPtr& src) {
   return ret;
 }
 
+PhysicalDeviceMapPtr ClonePhysicalDeviceMap(
+    const PhysicalDeviceSnapshotMapPtr& src) {
+  auto ret = std::make_unique<PhysicalDeviceMap>();
+  for (const auto& it : *src) {
+    ret->emplace(it.first, std::make_pair(it.second.first,
+        HalCameraMetadata::Clone(it.second.second.get())));
+  }
+  return ret;
+}
+
 }  // namespace android
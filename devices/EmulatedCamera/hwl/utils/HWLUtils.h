@@ -41,12 +41,21 @@ using std::unordered_map;
 typedef unordered_map<uint32_t, pair<CameraDeviceStatus, unique_ptr<HalCameraMetadata>>>
     PhysicalDeviceMap;
 typedef std::unique_ptr<PhysicalDeviceMap> PhysicalDeviceMapPtr;
+// Immutable physical device characteristics shared by all instances of a
+// logical camera device.
+typedef unordered_map<uint32_t, pair<CameraDeviceStatus,
+                                     std::shared_ptr<const HalCameraMetadata>>>
+    PhysicalDeviceSnapshotMap;
+typedef std::shared_ptr<const PhysicalDeviceSnapshotMap>
+    PhysicalDeviceSnapshotMapPtr;
 
 // Metadata utility functions start
 bool HasCapability(const HalCameraMetadata* metadata, uint8_t capability);
 status_t GetSensorCharacteristics(const HalCameraMetadata* metadata,
                                   SensorCharacteristics* sensor_chars /*out*/);
 PhysicalDeviceMapPtr ClonePhysicalDeviceMap(const PhysicalDeviceMapPtr& src);
+PhysicalDeviceMapPtr ClonePhysicalDeviceMap(
+    const PhysicalDeviceSnapshotMapPtr& src);
 // Metadata utility functions end
 
 }  // namespace android
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "PhysicalSensorThread"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include "PhysicalSensorThread.h"
+
+#include <inttypes.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+namespace android {
+
+PhysicalSensorThread::PhysicalSensorThread(
+    uint32_t camera_id, std::shared_ptr<VSyncGenerator> vsync_generator)
+    : camera_id_(camera_id), vsync_generator_(vsync_generator) {
+  thread_ = std::thread([this] { ThreadLoop(); });
+}
+
+PhysicalSensorThread::~PhysicalSensorThread() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void PhysicalSensorThread::ThreadLoop() {
+  if (vsync_generator_.get() == nullptr) {
+    ALOGE("%s: Camera %u has no vsync generator", __FUNCTION__, camera_id_);
+    return;
+  }
+
+  VSync vsync;
+  VSyncWork work;
+  while (vsync_generator_->WaitForWork(camera_id_, &vsync, &work)) {
+    ATRACE_NAME("PhysicalSensorFrame");
+    ALOGV("%s: Camera %u frame %" PRIu64 " vsync at %" PRId64, __FUNCTION__,
+          camera_id_, vsync.frame, vsync.timestamp);
+    work(vsync);
+    work = nullptr;
+    vsync_generator_->WorkDone();
+  }
+}
+
+}  // namespace android
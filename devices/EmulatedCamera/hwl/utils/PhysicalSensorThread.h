@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_PHYSICAL_SENSOR_THREAD_H_
+#define EMULATOR_CAMERA_HAL_HWL_PHYSICAL_SENSOR_THREAD_H_
+
+#include <memory>
+#include <thread>
+
+#include "VSyncGenerator.h"
+
+namespace android {
+
+// PhysicalSensorThread is the sensor loop of a single physical camera. It runs
+// the work latched for its camera on every vsync of a shared VSyncGenerator,
+// independently of the other physical cameras.
+class PhysicalSensorThread {
+ public:
+  PhysicalSensorThread(uint32_t camera_id,
+                       std::shared_ptr<VSyncGenerator> vsync_generator);
+  // The vsync generator must be stopped before destroying the thread.
+  virtual ~PhysicalSensorThread();
+
+ private:
+  void ThreadLoop();
+
+  const uint32_t camera_id_;
+  std::shared_ptr<VSyncGenerator> vsync_generator_;
+  std::thread thread_;
+
+  PhysicalSensorThread(const PhysicalSensorThread&) = delete;
+  PhysicalSensorThread& operator=(const PhysicalSensorThread&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_PHYSICAL_SENSOR_THREAD_H_
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//#define LOG_NDEBUG 0
+#define LOG_TAG "StreamCombinationIndex"
+#include "StreamCombinationIndex.h"
+
+#include <log/log.h>
+
+#include <algorithm>
+#include <array>
+
+namespace android {
+
+namespace {
+// Number of 'CombinationKey' entries per stream.
+const size_t kStreamKeySize = 6;
+}  // namespace
+
+StreamCombinationIndex::StreamCombinationIndex(
+    const HalCameraMetadata& chars, const SensorCharacteristics& sensor_chars)
+    : map_(chars), sensor_chars_(sensor_chars) {
+  for (const auto& format : map_.GetOutputFormats()) {
+    for (const auto& size : map_.GetOutputSizes(format)) {
+      output_configs_.emplace(format, size);
+    }
+  }
+
+  for (const auto& format : map_.GetInputFormats()) {
+    if (!map_.GetValidOutputFormatsForInput(format).empty()) {
+      input_formats_.insert(format);
+    }
+  }
+}
+
+size_t StreamCombinationIndex::CombinationKeyHash::operator()(
+    const CombinationKey& key) const {
+  size_t result = 1;
+  for (const auto& value : key) {
+    result = 31 * result + std::hash<uint32_t>{}(value);
+  }
+  return result;
+}
+
+StreamCombinationIndex::CombinationKey
+StreamCombinationIndex::GetCombinationKey(const StreamConfiguration& config) {
+  std::vector<std::array<uint32_t, kStreamKeySize>> streams;
+  streams.reserve(config.streams.size());
+  for (const auto& stream : config.streams) {
+    streams.push_back({static_cast<uint32_t>(stream.stream_type),
+                       static_cast<uint32_t>(stream.format), stream.width,
+                       stream.height, static_cast<uint32_t>(stream.data_space),
+                       static_cast<uint32_t>(stream.rotation)});
+  }
+  // The verdict does not depend on the stream order.
+  std::sort(streams.begin(), streams.end());
+
+  CombinationKey key;
+  key.reserve(streams.size() * kStreamKeySize);
+  for (const auto& stream : streams) {
+    key.insert(key.end(), stream.begin(), stream.end());
+  }
+
+  return key;
+}
+
+bool StreamCombinationIndex::IsStreamCombinationSupported(
+    const StreamConfiguration& config) {
+  auto key = GetCombinationKey(config);
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto verdict = verdicts_.find(key);
+    if (verdict != verdicts_.end()) {
+      return verdict->second;
+    }
+  }
+
+  bool supported = EvaluateStreamCombination(config);
+
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  if (verdicts_.size() >= kMaxCachedCombinations) {
+    ALOGV("%s: Verdict cache full, dropping %zu entries", __FUNCTION__,
+          verdicts_.size());
+    verdicts_.clear();
+  }
+  verdicts_.emplace(std::move(key), supported);
+
+  return supported;
+}
+
+bool StreamCombinationIndex::EvaluateStreamCombination(
+    const StreamConfiguration& config) const {
+  uint32_t raw_stream_count = 0;
+  uint32_t input_stream_count = 0;
+  uint32_t processed_stream_count = 0;
+  uint32_t stalling_stream_count = 0;
+
+  for (const auto& stream : config.streams) {
+    if (stream.rotation != google_camera_hal::StreamRotation::kRotation0) {
+      ALOGE("%s: Stream rotation: 0x%x not supported!", __FUNCTION__,
+            stream.rotation);
+      return false;
+    }
+
+    if (stream.stream_type == google_camera_hal::StreamType::kInput) {
+      if (sensor_chars_.max_input_streams == 0) {
+        ALOGE("%s: Input streams are not supported on this device!",
+              __FUNCTION__);
+        return false;
+      }
+
+      if (input_formats_.find(stream.format) == input_formats_.end()) {
+        ALOGE("%s: Input stream with format: 0x%x no supported on this device!",
+              __FUNCTION__, stream.format);
+        return false;
+      }
+
+      input_stream_count++;
+    } else {
+      switch (stream.format) {
+        case HAL_PIXEL_FORMAT_BLOB:
+          if ((stream.data_space != HAL_DATASPACE_V0_JFIF) &&
+              (stream.data_space != HAL_DATASPACE_UNKNOWN)) {
+            ALOGE("%s: Unsupported Blob dataspace 0x%x", __FUNCTION__,
+                  stream.data_space);
+            return false;
+          }
+          stalling_stream_count++;
+          break;
+        case HAL_PIXEL_FORMAT_RAW16:
+          raw_stream_count++;
+          break;
+        default:
+          processed_stream_count++;
+      }
+    }
+
+    auto stream_config = std::make_pair(
+        stream.format, std::make_pair(stream.width, stream.height));
+    if (output_configs_.find(stream_config) == output_configs_.end()) {
+      ALOGE("%s: Stream with size %dx%d and format 0x%x is not supported!",
+            __FUNCTION__, stream.width, stream.height, stream.format);
+      return false;
+    }
+  }
+
+  if (raw_stream_count > sensor_chars_.max_raw_streams) {
+    ALOGE("%s: RAW streams maximum %u exceeds supported maximum %u",
+          __FUNCTION__, raw_stream_count, sensor_chars_.max_raw_streams);
+    return false;
+  }
+
+  if (processed_stream_count > sensor_chars_.max_processed_streams) {
+    ALOGE("%s: Processed streams maximum %u exceeds supported maximum %u",
+          __FUNCTION__, processed_stream_count,
+          sensor_chars_.max_processed_streams);
+    return false;
+  }
+
+  if (stalling_stream_count > sensor_chars_.max_stalling_streams) {
+    ALOGE("%s: Stalling streams maximum %u exceeds supported maximum %u",
+          __FUNCTION__, stalling_stream_count,
+          sensor_chars_.max_stalling_streams);
+    return false;
+  }
+
+  if (input_stream_count > sensor_chars_.max_input_streams) {
+    ALOGE("%s: Input stream maximum %u exceeds supported maximum %u",
+          __FUNCTION__, input_stream_count, sensor_chars_.max_input_streams);
+    return false;
+  }
+
+  return true;
+}
+
+}  // namespace android
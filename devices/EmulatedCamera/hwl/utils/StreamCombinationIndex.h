@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_STREAM_COMBINATION_INDEX_H_
+#define EMULATOR_CAMERA_HAL_HWL_STREAM_COMBINATION_INDEX_H_
+
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "EmulatedSensor.h"
+#include "hal_types.h"
+#include "utils/StreamConfigurationMap.h"
+
+namespace android {
+
+using google_camera_hal::StreamConfiguration;
+
+// StreamCombinationIndex answers whether a stream combination is supported by
+// a camera device. The supported stream configurations are compiled once into
+// a flat index, and the verdicts of previously seen stream combinations are
+// memoized. Stream combinations that only differ in the order of their
+// streams share one verdict. Thread-safe.
+class StreamCombinationIndex {
+ public:
+  StreamCombinationIndex(const HalCameraMetadata& chars,
+                         const SensorCharacteristics& sensor_chars);
+  virtual ~StreamCombinationIndex() = default;
+
+  bool IsStreamCombinationSupported(const StreamConfiguration& config);
+
+  // The stream configurations the index was compiled from.
+  StreamConfigurationMap& GetStreamConfigurationMap() {
+    return map_;
+  }
+
+ private:
+  // Stream fields that affect the verdict, one entry per stream.
+  typedef std::vector<uint32_t> CombinationKey;
+
+  struct CombinationKeyHash {
+    size_t operator()(const CombinationKey& key) const;
+  };
+
+  static CombinationKey GetCombinationKey(const StreamConfiguration& config);
+  bool EvaluateStreamCombination(const StreamConfiguration& config) const;
+
+  // Verdicts are dropped once the cache grows past this size.
+  static const size_t kMaxCachedCombinations = 256;
+
+  StreamConfigurationMap map_;
+  const SensorCharacteristics sensor_chars_;
+  std::unordered_set<StreamConfig, StreamConfigurationHash> output_configs_;
+  std::unordered_set<android_pixel_format_t> input_formats_;
+
+  std::mutex cache_mutex_;
+  // Protected by cache_mutex_.
+  std::unordered_map<CombinationKey, bool, CombinationKeyHash> verdicts_;
+
+  StreamCombinationIndex(const StreamCombinationIndex&) = delete;
+  StreamCombinationIndex& operator=(const StreamCombinationIndex&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_STREAM_COMBINATION_INDEX_H_
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "VSyncGenerator"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include "VSyncGenerator.h"
+
+#include <inttypes.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <chrono>
+
+namespace android {
+
+VSyncGenerator::VSyncGenerator(nsecs_t period)
+    : period_(period), next_timestamp_(systemTime() + period) {
+  thread_ = std::thread([this] { ThreadLoop(); });
+}
+
+VSyncGenerator::~VSyncGenerator() {
+  Stop();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void VSyncGenerator::SetPeriod(nsecs_t period) {
+  std::lock_guard<std::mutex> lock(vsync_mutex_);
+  period_ = period;
+}
+
+status_t VSyncGenerator::QueueFrame(
+    std::unordered_map<uint32_t, VSyncWork> work, VSync* vsync) {
+  if (vsync == nullptr) {
+    ALOGE("%s: vsync is nullptr", __FUNCTION__);
+    return BAD_VALUE;
+  }
+
+  std::lock_guard<std::mutex> lock(vsync_mutex_);
+  if (stopped_) {
+    return NO_INIT;
+  }
+
+  if (num_unfinished_work_ > 0) {
+    ALOGE("%s: The previous frame is still running", __FUNCTION__);
+    return INVALID_OPERATION;
+  }
+
+  num_unfinished_work_ = work.size();
+  pending_work_ = std::move(work);
+  vsync->frame = vsync_.frame + 1;
+  vsync->timestamp = next_timestamp_;
+
+  return OK;
+}
+
+void VSyncGenerator::WaitForFrameDone() {
+  std::unique_lock<std::mutex> lock(vsync_mutex_);
+  vsync_condition_.wait(lock, [this] { return num_unfinished_work_ == 0; });
+}
+
+bool VSyncGenerator::WaitForWork(uint32_t camera_id, VSync* vsync,
+                                 VSyncWork* work) {
+  if ((vsync == nullptr) || (work == nullptr)) {
+    ALOGE("%s: vsync or work is nullptr", __FUNCTION__);
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(vsync_mutex_);
+  vsync_condition_.wait(lock, [this, camera_id] {
+    return stopped_ || (latched_work_.find(camera_id) != latched_work_.end());
+  });
+  if (stopped_) {
+    return false;
+  }
+
+  auto it = latched_work_.find(camera_id);
+  *work = std::move(it->second);
+  latched_work_.erase(it);
+  *vsync = latched_vsync_;
+
+  return true;
+}
+
+void VSyncGenerator::WorkDone() {
+  {
+    std::lock_guard<std::mutex> lock(vsync_mutex_);
+    if (num_unfinished_work_ == 0) {
+      ALOGE("%s: No work is running", __FUNCTION__);
+      return;
+    }
+    num_unfinished_work_--;
+  }
+  vsync_condition_.notify_all();
+}
+
+bool VSyncGenerator::WaitForNextVSync(VSync* vsync) {
+  if (vsync == nullptr) {
+    ALOGE("%s: vsync is nullptr", __FUNCTION__);
+    return false;
+  }
+
+  std::unique_lock<std::mutex> lock(vsync_mutex_);
+  uint64_t frame = vsync_.frame;
+  vsync_condition_.wait(
+      lock, [this, frame] { return stopped_ || (vsync_.frame > frame); });
+  if (stopped_) {
+    return false;
+  }
+
+  *vsync = vsync_;
+  return true;
+}
+
+void VSyncGenerator::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(vsync_mutex_);
+    stopped_ = true;
+    // Work that didn't start yet never runs.
+    num_unfinished_work_ -= pending_work_.size() + latched_work_.size();
+    pending_work_.clear();
+    latched_work_.clear();
+  }
+  vsync_condition_.notify_all();
+}
+
+void VSyncGenerator::ThreadLoop() {
+  std::unique_lock<std::mutex> lock(vsync_mutex_);
+  while (!stopped_) {
+    // systemTime() and steady_clock both use CLOCK_MONOTONIC.
+    auto deadline = std::chrono::steady_clock::time_point(
+        std::chrono::nanoseconds(next_timestamp_));
+    vsync_condition_.wait_until(lock, deadline);
+    nsecs_t now = systemTime();
+    if (stopped_ || (now < next_timestamp_)) {
+      continue;
+    }
+
+    ATRACE_NAME("VSync");
+    vsync_.frame++;
+    vsync_.timestamp = next_timestamp_;
+    if (!pending_work_.empty()) {
+      latched_work_ = std::move(pending_work_);
+      pending_work_.clear();
+      latched_vsync_ = vsync_;
+    }
+
+    next_timestamp_ += period_;
+    if (next_timestamp_ <= now) {
+      ALOGW("%s: VSync %" PRIu64 " fired %" PRId64 " ns late", __FUNCTION__,
+            vsync_.frame, now - vsync_.timestamp);
+      next_timestamp_ = now + period_;
+    }
+    vsync_condition_.notify_all();
+  }
+}
+
+}  // namespace android
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_VSYNC_GENERATOR_H_
+#define EMULATOR_CAMERA_HAL_HWL_VSYNC_GENERATOR_H_
+
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace android {
+
+struct VSync {
+  uint64_t frame = 0;
+  nsecs_t timestamp = 0;
+};
+
+// Work of a single camera that starts on a vsync.
+using VSyncWork = std::function<void(const VSync& vsync)>;
+
+// VSyncGenerator is the shared frame clock of the physical sensors of a
+// logical camera. It fires every period on its own thread. Work queued for a
+// frame is latched as a whole on the next vsync, so every physical sensor
+// starts the frame on the same vsync with the same timestamp.
+class VSyncGenerator {
+ public:
+  explicit VSyncGenerator(nsecs_t period);
+  virtual ~VSyncGenerator();
+
+  // Change the vsync period. The next vsync is already scheduled, the new
+  // period applies to the ones after it.
+  void SetPeriod(nsecs_t period);
+
+  // Latch the work of all cameras of a frame on the next vsync. 'vsync'
+  // returns that vsync. Fails if the previous frame is still running.
+  status_t QueueFrame(std::unordered_map<uint32_t, VSyncWork> work,
+                      VSync* vsync /*out*/);
+
+  // Wait until all work of the last queued frame has finished. Work that
+  // hasn't started when the generator stops is dropped.
+  void WaitForFrameDone();
+
+  // Wait for work latched for 'camera_id'. 'vsync' returns the vsync it was
+  // latched on. Returns false once the generator stops. WorkDone() must be
+  // called after running the work.
+  bool WaitForWork(uint32_t camera_id, VSync* vsync /*out*/,
+                   VSyncWork* work /*out*/);
+  void WorkDone();
+
+  // Wait for the next vsync. Returns false once the generator stops.
+  bool WaitForNextVSync(VSync* vsync /*out*/);
+
+  // Stop firing vsyncs and release all waiters.
+  void Stop();
+
+ private:
+  void ThreadLoop();
+
+  std::mutex vsync_mutex_;
+  std::condition_variable vsync_condition_;  // Protected by vsync_mutex_.
+  nsecs_t period_;                           // Protected by vsync_mutex_.
+  // Timestamp of the next vsync. Protected by vsync_mutex_.
+  nsecs_t next_timestamp_;
+  VSync vsync_;  // Last vsync. Protected by vsync_mutex_.
+  // Work latched on the next vsync. Protected by vsync_mutex_.
+  std::unordered_map<uint32_t, VSyncWork> pending_work_;
+  // Work latched on latched_vsync_ that hasn't started yet. Protected by
+  // vsync_mutex_.
+  std::unordered_map<uint32_t, VSyncWork> latched_work_;
+  VSync latched_vsync_;  // Protected by vsync_mutex_.
+  // Work of the last queued frame that hasn't finished. Protected by
+  // vsync_mutex_.
+  size_t num_unfinished_work_ = 0;
+  bool stopped_ = false;  // Protected by vsync_mutex_.
+  std::thread thread_;
+
+  VSyncGenerator(const VSyncGenerator&) = delete;
+  VSyncGenerator& operator=(const VSyncGenerator&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_VSYNC_GENERATOR_H_
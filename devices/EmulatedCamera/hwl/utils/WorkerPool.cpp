@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "WorkerPool"
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#include "WorkerPool.h"
+
+#include <log/log.h>
+#include <utils/Trace.h>
+
+namespace android {
+
+WorkerPool::WorkerPool(size_t num_workers) {
+  workers_.reserve(num_workers);
+  for (size_t i = 0; i < num_workers; i++) {
+    workers_.emplace_back([this] { ThreadLoop(); });
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    exiting_ = true;
+  }
+  task_condition_.notify_all();
+
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void WorkerPool::RunAndWait(std::vector<std::function<void()>> tasks) {
+  ATRACE_CALL();
+  if (tasks.empty()) {
+    return;
+  }
+
+  // Run inline when there is nothing to run in parallel.
+  if (workers_.empty() || tasks.size() == 1) {
+    for (auto& task : tasks) {
+      task();
+    }
+    return;
+  }
+
+  Batch batch;
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    batch.num_pending_tasks = tasks.size();
+    for (auto& task : tasks) {
+      tasks_.push({std::move(task), &batch});
+    }
+  }
+  task_condition_.notify_all();
+
+  // Help with the queued tasks instead of idling.
+  std::unique_lock<std::mutex> lock(pool_mutex_);
+  Task task;
+  while (PopTaskLocked(&task)) {
+    lock.unlock();
+    RunTask(std::move(task));
+    lock.lock();
+  }
+
+  batch.done_condition.wait(lock,
+                            [&batch] { return batch.num_pending_tasks == 0; });
+}
+
+bool WorkerPool::PopTaskLocked(Task* task) {
+  if (tasks_.empty()) {
+    return false;
+  }
+
+  *task = std::move(tasks_.front());
+  tasks_.pop();
+  return true;
+}
+
+void WorkerPool::RunTask(Task task) {
+  task.function();
+
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  task.batch->num_pending_tasks--;
+  if (task.batch->num_pending_tasks == 0) {
+    task.batch->done_condition.notify_all();
+  }
+}
+
+void WorkerPool::ThreadLoop() {
+  std::unique_lock<std::mutex> lock(pool_mutex_);
+  while (true) {
+    task_condition_.wait(lock, [this] { return exiting_ || !tasks_.empty(); });
+    if (exiting_) {
+      break;
+    }
+
+    Task task;
+    PopTaskLocked(&task);
+    lock.unlock();
+    RunTask(std::move(task));
+    lock.lock();
+  }
+}
+
+}  // namespace android
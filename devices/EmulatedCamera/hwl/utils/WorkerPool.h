@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef EMULATOR_CAMERA_HAL_HWL_WORKER_POOL_H_
+#define EMULATOR_CAMERA_HAL_HWL_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace android {
+
+// WorkerPool runs independent per-camera tasks in parallel. The calling thread
+// also runs tasks, so a pool with N workers runs up to N + 1 tasks at once.
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t num_workers);
+  virtual ~WorkerPool();
+
+  // Run all tasks and return after every task has finished.
+  void RunAndWait(std::vector<std::function<void()>> tasks);
+
+ private:
+  // A batch of tasks submitted by one RunAndWait call.
+  struct Batch {
+    size_t num_pending_tasks = 0;  // Protected by WorkerPool::pool_mutex_.
+    std::condition_variable done_condition;
+  };
+
+  struct Task {
+    std::function<void()> function;
+    Batch* batch = nullptr;
+  };
+
+  void ThreadLoop();
+
+  // Run task and mark it done in its batch.
+  void RunTask(Task task);
+
+  // Pop the next task. Must be called with pool_mutex_ locked.
+  bool PopTaskLocked(Task* task);
+
+  std::mutex pool_mutex_;
+  std::condition_variable task_condition_;  // Protected by pool_mutex_.
+  std::queue<Task> tasks_;                  // Protected by pool_mutex_.
+  bool exiting_ = false;                    // Protected by pool_mutex_.
+  std::vector<std::thread> workers_;
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+};
+
+}  // namespace android
+
+#endif  // EMULATOR_CAMERA_HAL_HWL_WORKER_POOL_H_